@@ -0,0 +1,176 @@
+#include "request_arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "../memory/mem_budget.h"
+
+// 每个线程的空闲块，线程退出时释放
+struct chunk_pool
+{
+    void* head;
+    int count;
+
+    chunk_pool() : head(NULL), count(0) {}
+    ~chunk_pool()
+    {
+        trim();
+    }
+
+    void trim()
+    {
+        while (head)
+        {
+            void* next = *(void**)head;
+            free(head);
+            head = next;
+        }
+        mem_budget::release(mem_budget::BUFFERS, (size_t)count * request_arena::CHUNK_SIZE);
+        count = 0;
+    }
+};
+static thread_local chunk_pool pool;
+
+static inline char* align_up(char* p, size_t align)
+{
+    return (char*)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+request_arena::request_arena(void* buf, size_t size)
+    : m_inline((char*)buf), m_inline_size(size), m_begin((char*)buf), m_cur((char*)buf), m_end((char*)buf + size),
+      m_used(0), m_chunks(NULL), m_last(NULL), m_chunk_count(0), m_large(NULL), m_large_bytes(0)
+{
+}
+
+request_arena::~request_arena()
+{
+    reset();
+}
+
+void* request_arena::alloc(size_t size, size_t align)
+{
+    char* p = align_up(m_cur, align);
+    if (p + size <= m_end && p >= m_cur)
+    {
+        m_cur = p + size;
+        return p;
+    }
+    return grow(size, align);
+}
+
+char* request_arena::dup(const char* s, size_t len)
+{
+    char* p = (char*)alloc(len + 1, 1);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+void* request_arena::grow(size_t size, size_t align)
+{
+    size_t header = (sizeof(chunk) + align - 1) & ~(align - 1);
+    if (header + size > CHUNK_SIZE / 4)
+    {
+        // 大块单独分配，不进入块缓存；header 按 align 取整，块本身也要按 align 对齐（malloc 只保证 max_align_t）
+        void* mem = NULL;
+        if (align <= alignof(std::max_align_t))
+        {
+            mem = malloc(header + size);
+        }
+        else if (posix_memalign(&mem, align, header + size) != 0)
+        {
+            mem = NULL;
+        }
+        if (!mem)
+        {
+            throw std::bad_alloc();
+        }
+        chunk* c = (chunk*)mem;
+        c->next = m_large;
+        m_large = c;
+        m_large_bytes += header + size;
+        mem_budget::charge(mem_budget::BUFFERS, header + size);
+        m_used += size;
+        return (char*)c + header;
+    }
+
+    chunk* c;
+    if (pool.head)
+    {
+        c = (chunk*)pool.head;
+        pool.head = c->next;
+        pool.count--;
+    }
+    else if (!(c = (chunk*)malloc(CHUNK_SIZE)))
+    {
+        throw std::bad_alloc();
+    }
+    else
+    {
+        mem_budget::charge(mem_budget::BUFFERS, CHUNK_SIZE); // 块缓存里的块释放时才退还
+    }
+    c->next = m_chunks;
+    m_chunks = c;
+    if (!m_last)
+    {
+        m_last = c;
+    }
+    m_chunk_count++;
+
+    m_used += m_cur - m_begin;
+    m_begin = (char*)(c + 1);
+    m_cur = m_begin;
+    m_end = (char*)c + CHUNK_SIZE;
+    return alloc(size, align);
+}
+
+void request_arena::reset()
+{
+    if (m_chunks)
+    {
+        // 内存紧张时块不再缓存，已经缓存的也一起释放
+        bool tight = mem_budget::over_soft();
+        if (pool.count + m_chunk_count <= POOL_MAX && !tight)
+        {
+            m_last->next = (chunk*)pool.head;
+            pool.head = m_chunks;
+            pool.count += m_chunk_count;
+        }
+        else
+        {
+            while (m_chunks)
+            {
+                chunk* next = m_chunks->next;
+                free(m_chunks);
+                m_chunks = next;
+            }
+            mem_budget::release(mem_budget::BUFFERS, (size_t)m_chunk_count * CHUNK_SIZE);
+            if (tight)
+            {
+                pool.trim();
+            }
+        }
+        m_chunks = NULL;
+        m_last = NULL;
+        m_chunk_count = 0;
+    }
+    while (m_large)
+    {
+        chunk* next = m_large->next;
+        free(m_large);
+        m_large = next;
+    }
+    if (m_large_bytes)
+    {
+        mem_budget::release(mem_budget::BUFFERS, m_large_bytes);
+        m_large_bytes = 0;
+    }
+    m_begin = m_inline;
+    m_cur = m_inline;
+    m_end = m_inline + m_inline_size;
+    m_used = 0;
+}
+
+void request_arena::trim()
+{
+    pool.trim();
+}
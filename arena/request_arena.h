@@ -0,0 +1,75 @@
+#ifndef REQUESTARENA_H
+#define REQUESTARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+// 按请求分配的内存：只向后移动指针，单独的对象不释放，请求结束时整体重置
+// 先用连接对象里的内联缓冲，用完后从当前线程的块缓存中取 16KB 的块（没有再 malloc），
+// 超过块大小四分之一的分配单独 malloc。重置时把块链表整体挂回当前线程的块缓存，和块的个数无关。
+//
+// 同时是一个 std::pmr::memory_resource，处理函数里的容器可以直接从这里分配：
+//     std::pmr::vector<int> v(&req.arena());
+//     arena_string s("...", &req.arena());
+// 这些容器必须在请求结束（重置）之前析构，不能保存到请求之外。
+// 一个请求同一时刻只在一个线程中处理，内存池本身不加锁。
+// 从堆上取的块（包括缓存的空闲块）记在内存预算的 BUFFERS 中，超过软限制时重置不再缓存块。
+class request_arena : public std::pmr::memory_resource
+{
+public:
+    // 块的大小，包括块头
+    static const size_t CHUNK_SIZE = 16 * 1024;
+    // 每个线程最多缓存的空闲块
+    static const int POOL_MAX = 64;
+
+public:
+    // buf 是内联缓冲，由调用者提供，生命周期不短于内存池
+    request_arena(void* buf, size_t size);
+    ~request_arena();
+
+    // 分配 size 字节，按 align 对齐，失败抛出 std::bad_alloc
+    void* alloc(size_t size, size_t align = alignof(std::max_align_t));
+    // 拷贝一个字符串，结尾加 '\0'
+    char* dup(const char* s, size_t len);
+    // 释放所有分配，调用者保证之前分配的对象都不再使用
+    void reset();
+    // 重置以来分配出去的字节数（包括对齐的空隙）
+    size_t used() const { return m_used + (m_cur - m_begin); }
+    // 释放当前线程缓存的空闲块（内存紧张时）
+    static void trim();
+
+private:
+    struct chunk
+    {
+        chunk* next;
+    };
+
+    void* grow(size_t size, size_t align);
+
+    void* do_allocate(size_t bytes, size_t align) override { return alloc(bytes, align); }
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+private:
+    char* m_inline;
+    size_t m_inline_size;
+    char* m_begin;          // 当前块的数据起点
+    char* m_cur;
+    char* m_end;
+    size_t m_used;          // 之前用完的块中分配的字节数
+    chunk* m_chunks;        // 从块缓存取的块，最新的在前
+    chunk* m_last;
+    int m_chunk_count;
+    chunk* m_large;         // 单独分配的大块
+    size_t m_large_bytes;
+};
+
+// 从请求内存池分配的字符串和数组
+typedef std::pmr::string arena_string;
+template<typename T>
+using arena_vector = std::pmr::vector<T>;
+
+#endif
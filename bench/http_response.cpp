@@ -0,0 +1,189 @@
+#include "http_response.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// chunked 长度行和 trailer 的最大长度
+static const size_t MAX_LINE = 4096;
+
+void response_parser::reset(bool keep_alive)
+{
+    m_keep_alive = keep_alive;
+    m_head = false;
+    m_state = STATE_HEADER;
+    m_header.clear();
+    m_line.clear();
+    m_remaining = 0;
+    m_chunk_state = 0;
+    m_status = 0;
+    m_close_after = !keep_alive;
+}
+
+response_parser::RESULT response_parser::finish()
+{
+    m_state = STATE_HEADER;
+    m_head = false;
+    return COMPLETE;
+}
+
+bool response_parser::parse_header()
+{
+    const char* p = m_header.c_str();
+    size_t header_len = m_header.size();
+    if (header_len < 12 || strncmp(p, "HTTP/1.", 7) != 0)
+    {
+        return false;
+    }
+    m_status = atoi(p + 9);
+    m_close_after = p[7] == '0' || !m_keep_alive;
+    long long length = -1;
+    bool chunked = false;
+
+    const char* end = p + header_len;
+    const char* line = strchr(p, '\n') + 1;
+    while (line < end)
+    {
+        const char* eol = (const char*)memchr(line, '\n', end - line);
+        if (!eol)
+        {
+            break;
+        }
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+        {
+            length = atoll(line + 15);
+        }
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+        {
+            chunked = strncasecmp(line + 18 + strspn(line + 18, " \t"), "chunked", 7) == 0;
+        }
+        else if (strncasecmp(line, "Connection:", 11) == 0)
+        {
+            const char* v = line + 11 + strspn(line + 11, " \t");
+            if (strncasecmp(v, "close", 5) == 0)
+            {
+                m_close_after = true;
+            }
+            else if (strncasecmp(v, "keep-alive", 10) == 0 && m_keep_alive)
+            {
+                m_close_after = false;
+            }
+        }
+        line = eol + 1;
+    }
+
+    if (m_head || m_status / 100 == 1 || m_status == 204 || m_status == 304)
+    {
+        m_state = STATE_LENGTH;
+        m_remaining = 0;
+    }
+    else if (chunked)
+    {
+        m_state = STATE_CHUNKED;
+        m_chunk_state = 0;
+        m_line.clear();
+    }
+    else if (length >= 0)
+    {
+        m_state = STATE_LENGTH;
+        m_remaining = length;
+    }
+    else
+    {
+        m_state = STATE_UNTIL_CLOSE;
+        m_close_after = true;
+    }
+    return true;
+}
+
+response_parser::RESULT response_parser::feed(const char* data, size_t len, size_t& consumed)
+{
+    consumed = 0;
+    while (consumed < len)
+    {
+        if (m_state == STATE_HEADER)
+        {
+            size_t old = m_header.size();
+            m_header.append(data + consumed, len - consumed);
+            size_t end = m_header.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+            if (end == std::string::npos)
+            {
+                consumed = len;
+                return m_header.size() > MAX_HEADER ? ERROR : NEED_MORE;
+            }
+            consumed += end + 4 - old;
+            m_header.resize(end + 4);
+            if (!parse_header())
+            {
+                return ERROR;
+            }
+            m_header.clear();
+            if (m_state == STATE_LENGTH && m_remaining == 0)
+            {
+                return finish();
+            }
+        }
+        else if (m_state == STATE_LENGTH)
+        {
+            size_t n = len - consumed < m_remaining ? len - consumed : m_remaining;
+            consumed += n;
+            m_remaining -= n;
+            if (m_remaining == 0)
+            {
+                return finish();
+            }
+        }
+        else if (m_state == STATE_CHUNKED)
+        {
+            if (m_chunk_state == 1)
+            {
+                size_t n = len - consumed < m_remaining ? len - consumed : m_remaining;
+                consumed += n;
+                m_remaining -= n;
+                if (m_remaining == 0)
+                {
+                    m_chunk_state = 0;
+                }
+                continue;
+            }
+            m_line.push_back(data[consumed++]);
+            size_t n = m_line.size();
+            if (n >= 2 && m_line[n - 2] == '\r' && m_line[n - 1] == '\n')
+            {
+                if (m_chunk_state == 0)
+                {
+                    m_remaining = strtoull(m_line.c_str(), NULL, 16);
+                    m_chunk_state = m_remaining ? 1 : 2;
+                    m_remaining += 2; // 数据后面的 \r\n
+                    m_line.clear();
+                }
+                else
+                {
+                    // trailer 以空行结束
+                    m_line.clear();
+                    if (n == 2)
+                    {
+                        return finish();
+                    }
+                }
+            }
+            else if (n > MAX_LINE)
+            {
+                return ERROR;
+            }
+        }
+        else
+        {
+            consumed = len; // 响应体到连接关闭为止
+        }
+    }
+    return NEED_MORE;
+}
+
+response_parser::RESULT response_parser::eof()
+{
+    if (m_state == STATE_UNTIL_CLOSE)
+    {
+        return finish();
+    }
+    return in_progress() ? ERROR : NEED_MORE;
+}
@@ -0,0 +1,57 @@
+#ifndef HTTPRESPONSE_H
+#define HTTPRESPONSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// 压测工具共用的 HTTP/1.x 响应解析，只找出响应的边界、状态码和连接是否会被关闭
+// 支持 Content-Length、chunked 和以连接关闭结束的响应体
+class response_parser
+{
+public:
+    enum RESULT { NEED_MORE = 0, COMPLETE, ERROR };
+
+    // 响应头的最大长度
+    static const size_t MAX_HEADER = 65536;
+
+public:
+    response_parser() { reset(true); }
+
+    // 新连接，keep_alive 表示请求带了 Connection: keep-alive
+    void reset(bool keep_alive);
+    // 下一个响应对应的是 HEAD 请求，没有响应体
+    void set_head(bool head) { m_head = head; }
+
+    // 解析 data 中属于当前响应的字节，consumed 返回用掉的字节数
+    // 返回 COMPLETE 时剩下的字节属于下一个响应，解析器已经准备好解析它
+    RESULT feed(const char* data, size_t len, size_t& consumed);
+    // 连接被对端关闭
+    RESULT eof();
+
+    // 上一个完成（或正在解析）的响应的状态码
+    int status() const { return m_status; }
+    // 上一个响应之后服务器会关闭连接
+    bool close_after() const { return m_close_after; }
+    // 正在解析一个响应（已经收到了部分数据）
+    bool in_progress() const { return m_state != STATE_HEADER || !m_header.empty(); }
+
+private:
+    enum STATE { STATE_HEADER = 0, STATE_LENGTH, STATE_CHUNKED, STATE_UNTIL_CLOSE };
+
+    bool parse_header();
+    RESULT finish();
+
+private:
+    bool m_keep_alive;
+    bool m_head;
+    STATE m_state;
+    std::string m_header;
+    uint64_t m_remaining;
+    int m_chunk_state;      // 0 长度行，1 数据和结尾的 \r\n，2 trailer
+    std::string m_line;
+    int m_status;
+    bool m_close_after;
+};
+
+#endif
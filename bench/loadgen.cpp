@@ -0,0 +1,791 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include "stats.h"
+#include "http_response.h"
+
+// HTTP 压测客户端
+// 多个线程，每个线程一个 epoll 和一组非阻塞连接。
+// 闭环模式：每个连接始终保持 depth 个在途请求，收到一个响应就补发一个。
+// 开环模式（-r）：按固定速率生成请求，服务器跟不上时请求在客户端排队，
+// 延迟从计划发出的时刻算起，排队时间也计入延迟，不会出现协调遗漏（coordinated omission）。
+// 闭环模式下按期望间隔对直方图做事后修正，与 HdrHistogram 的 copyCorrectedForCoordinatedOmission 相同。
+
+static const int MAX_EVENTS = 1024;
+static const int READ_CHUNK = 65536;
+static const int TICK_MS = 10;
+
+struct options
+{
+    const char* host;
+    int port;
+    int connections;
+    int threads;
+    int duration;           // 秒，不含预热
+    int warmup;             // 秒
+    bool keep_alive;
+    int depth;              // 每个连接的流水线深度
+    double rate;            // 开环模式的总请求速率，0 表示闭环
+    int timeout_ms;
+    uint64_t expected_ns;   // 闭环修正的期望间隔，0 表示使用平均延迟
+    bool json;
+    std::vector<std::string> paths;
+};
+
+static options opt;
+static sockaddr_in server_addr;
+static uint64_t warmup_end;
+static uint64_t run_end;
+
+// 一个在途请求
+struct pending
+{
+    uint64_t intended;  // 计划发出的时间（开环）或实际发出的时间（闭环）
+    uint64_t sent;      // 实际放入发送缓冲的时间
+};
+
+struct connection
+{
+    int fd;
+    uint32_t generation;    // 每次重连加一，用来丢弃旧连接上残留的事件
+    bool connected;
+    std::string out;
+    size_t out_pos;
+    std::deque<pending> inflight;
+    response_parser parser;
+    uint64_t last_active;
+};
+
+struct worker
+{
+    int id;
+    pthread_t tid;
+    int epollfd;
+    std::vector<connection> conns;
+    uint32_t seed;
+    size_t next_conn;
+
+    // 开环模式
+    std::deque<uint64_t> backlog;
+    uint64_t next_send;
+    uint64_t interval;
+
+    latency_histogram* corrected;   // 从计划时间算起
+    latency_histogram* raw;         // 从实际发送时间算起
+
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t connects;
+    uint64_t connect_errors;
+    uint64_t io_errors;
+    uint64_t timeouts;
+    uint64_t non2xx;
+    uint64_t unfinished;    // 结束时还在排队或者在途的请求
+};
+
+static uint32_t next_random(uint32_t& x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static void open_conn(worker& w, size_t idx);
+
+static void close_conn(worker& w, connection& c)
+{
+    if (c.fd >= 0)
+    {
+        epoll_ctl(w.epollfd, EPOLL_CTL_DEL, c.fd, 0);
+        close(c.fd);
+        c.fd = -1;
+    }
+    c.connected = false;
+    c.out.clear();
+    c.out_pos = 0;
+    c.parser.reset(opt.keep_alive);
+}
+
+// 连接出错：在途的请求记为错误，下一个定时周期重连
+static void fail_conn(worker& w, connection& c, bool during_connect)
+{
+    uint64_t now = server_stats::now_ns();
+    if (now >= warmup_end && now < run_end)
+    {
+        if (during_connect)
+        {
+            w.connect_errors++;
+        }
+        else
+        {
+            w.io_errors += c.inflight.size() ? c.inflight.size() : 1;
+        }
+    }
+    c.inflight.clear();
+    close_conn(w, c);
+}
+
+static void flush(worker& w, connection& c)
+{
+    while (c.connected && c.out_pos < c.out.size())
+    {
+        int n = send(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                fail_conn(w, c, false);
+            }
+            return;
+        }
+        c.out_pos += n;
+    }
+    if (c.out_pos == c.out.size())
+    {
+        c.out.clear();
+        c.out_pos = 0;
+    }
+}
+
+static void queue_request(worker& w, connection& c, uint64_t intended, uint64_t now)
+{
+    const std::string& path = opt.paths[next_random(w.seed) % opt.paths.size()];
+    c.out.append("GET ").append(path).append(" HTTP/1.1\r\nHost: ").append(opt.host);
+    c.out.append(opt.keep_alive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+    pending p = { intended, now };
+    c.inflight.push_back(p);
+    if (c.inflight.size() == 1)
+    {
+        c.last_active = now;
+    }
+    flush(w, c);
+}
+
+// 闭环模式：补满流水线
+static void fill(worker& w, connection& c, uint64_t now)
+{
+    while (c.fd >= 0 && (int)c.inflight.size() < opt.depth && now < run_end)
+    {
+        queue_request(w, c, now, now);
+    }
+}
+
+// 开环模式：把排队的请求分给有空位的连接
+static void dispatch(worker& w, uint64_t now)
+{
+    size_t n = w.conns.size();
+    size_t tried = 0;
+    while (!w.backlog.empty() && tried < n)
+    {
+        connection& c = w.conns[w.next_conn];
+        if (c.fd >= 0 && (int)c.inflight.size() < opt.depth)
+        {
+            queue_request(w, c, w.backlog.front(), now);
+            w.backlog.pop_front();
+            tried = 0;
+        }
+        else
+        {
+            tried++;
+        }
+        w.next_conn = (w.next_conn + 1) % n;
+    }
+}
+
+// 一个响应结束，返回 true 表示连接被关闭重建了
+static bool complete(worker& w, connection& c, uint64_t now)
+{
+    pending p = c.inflight.front();
+    c.inflight.pop_front();
+    if (now >= warmup_end && now < run_end)
+    {
+        w.corrected->record(now - p.intended);
+        w.raw->record(now - p.sent);
+        w.requests++;
+        if (c.parser.status() < 200 || c.parser.status() >= 300)
+        {
+            w.non2xx++;
+        }
+    }
+    c.last_active = now;
+
+    if (c.parser.close_after())
+    {
+        // 服务器会关闭连接，已经发出的流水线请求不会再有响应
+        if (!c.inflight.empty())
+        {
+            fail_conn(w, c, false);
+        }
+        size_t idx = &c - &w.conns[0];
+        close_conn(w, c);
+        open_conn(w, idx);
+        return true;
+    }
+    if (opt.rate == 0)
+    {
+        fill(w, c, now);
+    }
+    return c.fd < 0;
+}
+
+// 处理收到的数据，可能包含多个流水线响应，返回 true 表示连接被关闭或者重建了
+static bool parse(worker& w, connection& c, const char* data, size_t len, uint64_t now)
+{
+    size_t pos = 0;
+    while (pos < len)
+    {
+        if (c.inflight.empty())
+        {
+            fail_conn(w, c, false); // 没有请求却收到了数据
+            return true;
+        }
+        size_t consumed;
+        response_parser::RESULT ret = c.parser.feed(data + pos, len - pos, consumed);
+        pos += consumed;
+        if (ret == response_parser::ERROR)
+        {
+            fail_conn(w, c, false);
+            return true;
+        }
+        if (ret == response_parser::COMPLETE && complete(w, c, now))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void on_readable(worker& w, connection& c)
+{
+    char buf[READ_CHUNK];
+    while (c.fd >= 0)
+    {
+        int n = recv(c.fd, buf, sizeof(buf), 0);
+        uint64_t now = server_stats::now_ns();
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                fail_conn(w, c, false);
+            }
+            return;
+        }
+        if (n == 0)
+        {
+            size_t idx = &c - &w.conns[0];
+            if (!c.inflight.empty() && c.parser.eof() == response_parser::COMPLETE)
+            {
+                complete(w, c, now); // 以连接关闭结束的响应，会重新建立连接
+                return;
+            }
+            if (!c.inflight.empty())
+            {
+                fail_conn(w, c, false);
+            }
+            else
+            {
+                close_conn(w, c);
+            }
+            open_conn(w, idx);
+            return;
+        }
+        if (now >= warmup_end && now < run_end)
+        {
+            w.bytes += n;
+        }
+        c.last_active = now;
+        if (parse(w, c, buf, n, now))
+        {
+            return;
+        }
+    }
+}
+
+static void on_writable(worker& w, connection& c)
+{
+    if (!c.connected)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0)
+        {
+            fail_conn(w, c, true);
+            return;
+        }
+        c.connected = true;
+    }
+    flush(w, c);
+}
+
+static void open_conn(worker& w, size_t idx)
+{
+    connection& c = w.conns[idx];
+    uint64_t now = server_stats::now_ns();
+    if (now >= run_end)
+    {
+        return;
+    }
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c.fd < 0)
+    {
+        w.connect_errors++;
+        return;
+    }
+    int nodelay = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    if (connect(c.fd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS)
+    {
+        fail_conn(w, c, true);
+        return;
+    }
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    ev.data.u64 = ((uint64_t)++c.generation << 32) | idx;
+    epoll_ctl(w.epollfd, EPOLL_CTL_ADD, c.fd, &ev);
+    c.connected = false;
+    c.parser.reset(opt.keep_alive);
+    c.last_active = now;
+    if (now >= warmup_end)
+    {
+        w.connects++;
+    }
+    // 连接建立之前的请求先放在发送缓冲里
+    if (opt.rate == 0)
+    {
+        fill(w, c, now);
+    }
+    else
+    {
+        dispatch(w, now);
+    }
+}
+
+// 定时检查：超时的连接断开重连，出错关闭的连接重连
+static void tick(worker& w, uint64_t now)
+{
+    for (size_t i = 0; i < w.conns.size(); ++i)
+    {
+        connection& c = w.conns[i];
+        if (c.fd >= 0 && !c.inflight.empty() && now - c.last_active > (uint64_t)opt.timeout_ms * 1000000)
+        {
+            if (now >= warmup_end)
+            {
+                w.timeouts += c.inflight.size();
+            }
+            c.inflight.clear();
+            close_conn(w, c);
+        }
+        if (c.fd < 0)
+        {
+            open_conn(w, i);
+        }
+    }
+}
+
+static void* run(void* arg)
+{
+    worker& w = *(worker*)arg;
+    w.epollfd = epoll_create(1);
+    for (size_t i = 0; i < w.conns.size(); ++i)
+    {
+        open_conn(w, i);
+    }
+
+    epoll_event events[MAX_EVENTS];
+    uint64_t next_tick = server_stats::now_ns() + TICK_MS * 1000000ULL;
+    while (true)
+    {
+        uint64_t now = server_stats::now_ns();
+        if (now >= run_end)
+        {
+            break;
+        }
+        int timeout = TICK_MS;
+        if (opt.rate > 0)
+        {
+            while (w.next_send <= now)
+            {
+                w.backlog.push_back(w.next_send);
+                w.next_send += w.interval;
+            }
+            dispatch(w, now);
+            int wait = (w.next_send - now) / 1000000;
+            timeout = wait < timeout ? wait : timeout;
+        }
+
+        int num = epoll_wait(w.epollfd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < num; ++i)
+        {
+            connection& c = w.conns[(uint32_t)events[i].data.u64];
+            if (c.fd < 0 || c.generation != events[i].data.u64 >> 32)
+            {
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                on_writable(w, c);
+            }
+            if (c.fd >= 0 && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+            {
+                if (!c.connected && (events[i].events & (EPOLLHUP | EPOLLERR)))
+                {
+                    fail_conn(w, c, true);
+                    continue;
+                }
+                on_readable(w, c);
+            }
+        }
+
+        now = server_stats::now_ns();
+        if (now >= next_tick)
+        {
+            tick(w, now);
+            next_tick = now + TICK_MS * 1000000ULL;
+        }
+    }
+
+    w.unfinished = w.backlog.size();
+    for (size_t i = 0; i < w.conns.size(); ++i)
+    {
+        w.unfinished += w.conns[i].inflight.size();
+        close_conn(w, w.conns[i]);
+    }
+    close(w.epollfd);
+    return NULL;
+}
+
+// 把 dir 下的普通文件加入请求路径
+static void add_dir(const std::string& root, const std::string& rel)
+{
+    DIR* d = opendir((root + rel).c_str());
+    if (!d)
+    {
+        return;
+    }
+    std::vector<std::string> names;
+    while (dirent* e = readdir(d))
+    {
+        if (e->d_name[0] != '.')
+        {
+            names.push_back(e->d_name);
+        }
+    }
+    closedir(d);
+    // 按名字排序，保证每次的请求序列相同
+    std::sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        std::string path = rel + "/" + names[i];
+        struct stat st;
+        if (stat((root + path).c_str(), &st) < 0)
+        {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            add_dir(root, path);
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            opt.paths.push_back(path);
+        }
+    }
+}
+
+static uint64_t percentile(const uint64_t* counts, uint64_t total, uint64_t max, double q)
+{
+    if (total == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * total + 0.5);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < latency_histogram::BUCKETS; ++i)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+        {
+            uint64_t v = latency_histogram::bucket_max(i);
+            return v < max ? v : max;
+        }
+    }
+    return max;
+}
+
+// 合并后的直方图
+struct summary
+{
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+
+    summary() : counts(latency_histogram::BUCKETS), total(0), sum(0), max(0) {}
+
+    void finish()
+    {
+        total = 0;
+        for (int i = 0; i < latency_histogram::BUCKETS; ++i)
+        {
+            total += counts[i];
+        }
+    }
+    uint64_t at(double q) const { return percentile(&counts[0], total, max, q); }
+};
+
+// 闭环模式的事后修正：一个延迟为 v 的请求阻塞了后面本该每隔 expected 发出的请求，
+// 按 v - expected, v - 2*expected, ... 补上这些请求
+static void correct(summary& s, uint64_t expected)
+{
+    if (expected == 0)
+    {
+        return;
+    }
+    std::vector<uint64_t> extra(latency_histogram::BUCKETS);
+    for (int i = 0; i < latency_histogram::BUCKETS; ++i)
+    {
+        if (!s.counts[i])
+        {
+            continue;
+        }
+        uint64_t v = latency_histogram::bucket_max(i);
+        for (uint64_t missing = v > expected ? v - expected : 0; missing >= expected; missing -= expected)
+        {
+            extra[latency_histogram::bucket_of(missing)] += s.counts[i];
+        }
+    }
+    for (int i = 0; i < latency_histogram::BUCKETS; ++i)
+    {
+        s.counts[i] += extra[i];
+    }
+    s.finish();
+}
+
+static void print_latency_json(const char* name, const summary& s)
+{
+    printf("\"%s\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f,\"mean\":%.1f}",
+           name, s.at(0.5) / 1e3, s.at(0.9) / 1e3, s.at(0.99) / 1e3, s.at(0.999) / 1e3, s.max / 1e3,
+           s.total ? (double)s.sum / s.total / 1e3 : 0.0);
+}
+
+static void print_latency(const char* name, const summary& s)
+{
+    printf("  %-12s p50 %10.1f  p90 %10.1f  p99 %10.1f  p99.9 %10.1f  max %10.1f  (us)\n",
+           name, s.at(0.5) / 1e3, s.at(0.9) / 1e3, s.at(0.99) / 1e3, s.at(0.999) / 1e3, s.max / 1e3);
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [options]\n"
+           "  -H host        server address (127.0.0.1)\n"
+           "  -p port        server port (10000)\n"
+           "  -c conns       total connections (16)\n"
+           "  -t threads     client threads (2)\n"
+           "  -d seconds     measured duration (10)\n"
+           "  -w seconds     warmup before measuring (1)\n"
+           "  -k             keep-alive (default: one request per connection)\n"
+           "  -P depth       pipelined requests per connection, needs -k (1)\n"
+           "  -r rate        open loop at rate requests/s in total (default: closed loop)\n"
+           "  -e usec        expected interval for closed-loop correction (default: mean latency)\n"
+           "  -T msec        response timeout (5000)\n"
+           "  -u path        request path, repeatable\n"
+           "  -D dir         request every file under dir, e.g. resources\n"
+           "  -j             print one JSON object\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    opt.host = "127.0.0.1";
+    opt.port = 10000;
+    opt.connections = 16;
+    opt.threads = 2;
+    opt.duration = 10;
+    opt.warmup = 1;
+    opt.keep_alive = false;
+    opt.depth = 1;
+    opt.rate = 0;
+    opt.timeout_ms = 5000;
+    opt.expected_ns = 0;
+    opt.json = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "H:p:c:t:d:w:kP:r:e:T:u:D:jh")) != -1)
+    {
+        switch (c)
+        {
+            case 'H': opt.host = optarg; break;
+            case 'p': opt.port = atoi(optarg); break;
+            case 'c': opt.connections = atoi(optarg); break;
+            case 't': opt.threads = atoi(optarg); break;
+            case 'd': opt.duration = atoi(optarg); break;
+            case 'w': opt.warmup = atoi(optarg); break;
+            case 'k': opt.keep_alive = true; break;
+            case 'P': opt.depth = atoi(optarg); break;
+            case 'r': opt.rate = atof(optarg); break;
+            case 'e': opt.expected_ns = strtoull(optarg, NULL, 10) * 1000; break;
+            case 'T': opt.timeout_ms = atoi(optarg); break;
+            case 'u': opt.paths.push_back(optarg); break;
+            case 'D':
+            {
+                std::string root(optarg);
+                while (root.size() > 1 && root[root.size() - 1] == '/')
+                {
+                    root.erase(root.size() - 1);
+                }
+                add_dir(root, "");
+                break;
+            }
+            case 'j': opt.json = true; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (opt.threads <= 0 || opt.connections < opt.threads || opt.duration <= 0 || opt.depth <= 0 || opt.rate < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!opt.keep_alive)
+    {
+        opt.depth = 1; // 每个连接只有一个请求
+    }
+    if (opt.paths.empty())
+    {
+        opt.paths.push_back("/");
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(opt.port);
+    if (inet_pton(AF_INET, opt.host, &server_addr.sin_addr) != 1)
+    {
+        printf("invalid host %s\n", opt.host);
+        return 1;
+    }
+
+    uint64_t start = server_stats::now_ns();
+    warmup_end = start + opt.warmup * 1000000000ULL;
+    run_end = warmup_end + opt.duration * 1000000000ULL;
+
+    std::vector<worker> workers(opt.threads);
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        worker& w = workers[i];
+        w.id = i;
+        w.conns.resize(opt.connections / opt.threads + (i < opt.connections % opt.threads ? 1 : 0));
+        for (size_t j = 0; j < w.conns.size(); ++j)
+        {
+            w.conns[j].fd = -1;
+            w.conns[j].generation = 0;
+            w.conns[j].connected = false;
+            w.conns[j].out_pos = 0;
+            w.conns[j].parser.reset(opt.keep_alive);
+        }
+        w.seed = 0x9E3779B9u * (i + 1);
+        w.next_conn = 0;
+        if (opt.rate > 0)
+        {
+            w.interval = (uint64_t)(1e9 * opt.threads / opt.rate);
+            // 各线程错开发送时间
+            w.next_send = start + w.interval * i / opt.threads;
+        }
+        w.corrected = new latency_histogram();
+        w.raw = new latency_histogram();
+        w.requests = w.bytes = w.connects = w.connect_errors = w.io_errors = w.timeouts = w.non2xx = 0;
+    }
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        pthread_create(&workers[i].tid, NULL, run, &workers[i]);
+    }
+
+    summary corrected, raw;
+    uint64_t requests = 0, bytes = 0, connects = 0, connect_errors = 0, io_errors = 0, timeouts = 0, non2xx = 0, unfinished = 0;
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        worker& w = workers[i];
+        pthread_join(w.tid, NULL);
+        w.corrected->merge_into(&corrected.counts[0], corrected.sum, corrected.max);
+        w.raw->merge_into(&raw.counts[0], raw.sum, raw.max);
+        requests += w.requests;
+        bytes += w.bytes;
+        connects += w.connects;
+        connect_errors += w.connect_errors;
+        io_errors += w.io_errors;
+        timeouts += w.timeouts;
+        non2xx += w.non2xx;
+        unfinished += w.unfinished;
+        delete w.corrected;
+        delete w.raw;
+    }
+    corrected.finish();
+    raw.finish();
+
+    uint64_t expected = opt.expected_ns;
+    if (opt.rate == 0)
+    {
+        if (expected == 0 && raw.total)
+        {
+            expected = raw.sum / raw.total;
+        }
+        correct(corrected, expected);
+    }
+
+    double seconds = opt.duration;
+    const char* mode = opt.rate > 0 ? "open" : "closed";
+    if (opt.json)
+    {
+        printf("{\"mode\":\"%s\",\"threads\":%d,\"connections\":%d,\"keep_alive\":%s,\"depth\":%d,"
+               "\"target_rate\":%.1f,\"duration_s\":%.1f,\"paths\":%zu,"
+               "\"requests\":%llu,\"throughput_rps\":%.1f,\"bytes_per_s\":%.1f,\"connects\":%llu,"
+               "\"errors\":{\"connect\":%llu,\"io\":%llu,\"timeout\":%llu,\"non2xx\":%llu},\"unfinished\":%llu,"
+               "\"expected_interval_us\":%.1f,\"latency_us\":{",
+               mode, opt.threads, opt.connections, opt.keep_alive ? "true" : "false", opt.depth,
+               opt.rate, seconds, opt.paths.size(),
+               (unsigned long long)requests, requests / seconds, bytes / seconds, (unsigned long long)connects,
+               (unsigned long long)connect_errors, (unsigned long long)io_errors,
+               (unsigned long long)timeouts, (unsigned long long)non2xx, (unsigned long long)unfinished,
+               opt.rate > 0 ? 0.0 : expected / 1e3);
+        print_latency_json("corrected", corrected);
+        printf(",");
+        print_latency_json("uncorrected", raw);
+        printf("}}\n");
+    }
+    else
+    {
+        printf("%s loop, %d threads, %d connections, %s, depth %d, %zu paths, %.0f s\n",
+               mode, opt.threads, opt.connections, opt.keep_alive ? "keep-alive" : "close", opt.depth,
+               opt.paths.size(), seconds);
+        printf("  requests     %llu (%.1f req/s, %.2f MB/s), %llu connects\n",
+               (unsigned long long)requests, requests / seconds, bytes / seconds / 1048576, (unsigned long long)connects);
+        printf("  errors       connect %llu, io %llu, timeout %llu, non-2xx %llu, unfinished %llu\n",
+               (unsigned long long)connect_errors, (unsigned long long)io_errors,
+               (unsigned long long)timeouts, (unsigned long long)non2xx, (unsigned long long)unfinished);
+        print_latency("corrected", corrected);
+        print_latency("uncorrected", raw);
+        if (opt.rate == 0)
+        {
+            printf("  (closed loop, corrected with expected interval %.1f us)\n", expected / 1e3);
+        }
+    }
+    return 0;
+}
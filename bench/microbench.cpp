@@ -0,0 +1,669 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <new>
+#include <vector>
+#include "locker.h"
+#include "threadpool.h"
+#include "http_conn.h"
+#include "upstream.h"
+#include "router.h"
+#include "request_arena.h"
+#include "perf_counters.h"
+#include "stats.h"
+
+// 微基准测试：不经过 socket，直接测量请求解析、请求队列、锁和响应头生成的开销
+// 每个用例先把迭代次数调整到运行时间不少于 -t 指定的毫秒数，再正式测量一次，输出：
+//   ns/op          墙上时间
+//   allocs/op      operator new 的调用次数
+//   misses/op      调用线程的缓存未命中次数（perf_event_open 不可用时为空）
+//   insns/op       调用线程执行的指令数
+// 多线程用例的 perf 计数只包含调用线程。
+
+// 统计所有线程的内存分配次数
+// 替换全局的 operator new/delete，编译器会把 free 误判为与 new 不匹配
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+static std::atomic<uint64_t> alloc_count(0);
+
+void* operator new(size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 用例：执行 iterations 次操作
+typedef void (*bench_fn)(uint64_t iterations, int arg);
+
+struct options
+{
+    uint64_t min_ns;
+    const char* filter;
+    bool json;
+    int max_threads;
+};
+static options opt;
+static perf_counters* counters;
+// 测量结果的输出，stdout 被重定向到了 /dev/null
+static FILE* report;
+
+static void run_bench(const char* name, bench_fn fn, int arg)
+{
+    if (opt.filter && !strstr(name, opt.filter))
+    {
+        return;
+    }
+
+    // 找到足够长的迭代次数
+    uint64_t n = 1;
+    while (true)
+    {
+        uint64_t start = now_ns();
+        fn(n, arg);
+        uint64_t elapsed = now_ns() - start;
+        if (elapsed >= opt.min_ns / 10 || n >= (1ULL << 40))
+        {
+            n = elapsed ? (uint64_t)((double)n * opt.min_ns / elapsed) + 1 : n * 10;
+            break;
+        }
+        n *= 10;
+    }
+
+    uint64_t allocs = alloc_count.load();
+    uint64_t misses, insns;
+    counters->start();
+    uint64_t start = now_ns();
+    fn(n, arg);
+    uint64_t elapsed = now_ns() - start;
+    counters->stop(misses, insns);
+    allocs = alloc_count.load() - allocs;
+
+    double ns = (double)elapsed / n;
+    double ap = (double)allocs / n;
+    if (opt.json)
+    {
+        fprintf(report, "{\"name\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f", name,
+               (unsigned long long)n, ns, ap);
+        if (counters->available())
+        {
+            fprintf(report, ",\"cache_misses_per_op\":%.3f,\"instructions_per_op\":%.1f", (double)misses / n, (double)insns / n);
+        }
+        else
+        {
+            fprintf(report, ",\"cache_misses_per_op\":null,\"instructions_per_op\":null");
+        }
+        fprintf(report, "}\n");
+    }
+    else if (counters->available())
+    {
+        fprintf(report, "%-36s %12llu %12.2f %10.3f %10.3f %10.1f\n", name, (unsigned long long)n, ns, ap,
+               (double)misses / n, (double)insns / n);
+    }
+    else
+    {
+        fprintf(report, "%-36s %12llu %12.2f %10.3f %10s %10s\n", name, (unsigned long long)n, ns, ap, "-", "-");
+    }
+    fflush(report);
+}
+
+// ---------------------------------------------------------------------------
+// 请求解析和响应头生成
+
+// 固定的请求语料，路径都匹配基准测试注册的代理路由，do_request 不会访问文件系统
+static const char* corpus[] = {
+    "GET /bench/index.html HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    "GET /bench/static/js/app.js HTTP/1.1\r\n"
+    "Host: 192.168.110.129:10000\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    "POST /bench/api/login HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Content-Length: 33\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "user=admin&password=0123456789abc",
+};
+static const int CORPUS_SIZE = sizeof(corpus) / sizeof(corpus[0]);
+
+class http_conn_bench
+{
+public:
+    // 整个 process_read：逐行切分、解析请求行和头部、路由匹配
+    static void process_read(uint64_t iterations, int)
+    {
+        http_conn* conn = new http_conn();
+        int lens[CORPUS_SIZE];
+        for (int i = 0; i < CORPUS_SIZE; ++i)
+        {
+            lens[i] = strlen(corpus[i]);
+        }
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            int k = i % CORPUS_SIZE;
+            conn->init();
+            memcpy(conn->m_read_buf, corpus[k], lens[k]);
+            conn->m_read_idx = lens[k];
+            if (conn->process_read() != http_conn::PROXY_REQUEST)
+            {
+                abort();
+            }
+        }
+        delete conn;
+    }
+
+    // 只有 parse_line，不含 init() 的开销
+    static void parse_line(uint64_t iterations, int)
+    {
+        http_conn* conn = new http_conn();
+        int lens[CORPUS_SIZE];
+        for (int i = 0; i < CORPUS_SIZE; ++i)
+        {
+            lens[i] = strlen(corpus[i]);
+        }
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            int k = i % CORPUS_SIZE;
+            memcpy(conn->m_read_buf, corpus[k], lens[k]);
+            conn->m_read_idx = lens[k];
+            conn->m_checked_idx = 0;
+            while (conn->parse_line() == http_conn::LINE_OK)
+            {
+            }
+        }
+        delete conn;
+    }
+
+    // 200 响应的状态行和头部
+    static void render_headers(uint64_t iterations, int)
+    {
+        http_conn* conn = new http_conn();
+        conn->init();
+        conn->m_linger = true;
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            conn->m_write_idx = 0;
+            conn->add_status_line(200, "OK");
+            conn->add_headers(1869 + (int)(i & 1023));
+        }
+        delete conn;
+    }
+
+    // 完整的 404 响应，包括响应体
+    static void render_error(uint64_t iterations, int)
+    {
+        http_conn* conn = new http_conn();
+        conn->init();
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            conn->m_write_idx = 0;
+            conn->process_write(http_conn::NO_RESOURCE);
+        }
+        delete conn;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// 请求队列
+
+struct bench_task
+{
+    static std::atomic<uint64_t> done;
+    void process() { done.fetch_add(1, std::memory_order_relaxed); }
+};
+std::atomic<uint64_t> bench_task::done(0);
+
+// 一个生产者往 threads 个工作线程的线程池投递任务，直到全部处理完
+static void queue_append_run(uint64_t iterations, int threads)
+{
+    // 线程池的析构函数不会停止工作线程，每种线程数只创建一次，一直不释放
+    static threadpool<bench_task>* pools[64];
+    if (!pools[threads])
+    {
+        pools[threads] = new threadpool<bench_task>(threads, 10000);
+    }
+    threadpool<bench_task>* pool = pools[threads];
+    static bench_task task;
+
+    uint64_t target = bench_task::done.load() + iterations;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        while (!pool->append(&task))
+        {
+            sched_yield(); // 队列满了
+        }
+    }
+    while (bench_task::done.load() < target)
+    {
+        sched_yield();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// 锁：pthread 封装（locker/sem）和 futex 实现（futex_mutex/futex_sem）对比
+
+template<typename L>
+static void mutex_uncontended(uint64_t iterations, int)
+{
+    static L lock;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        lock.lock();
+        lock.unlock();
+    }
+}
+
+template<typename L>
+struct contended_arg
+{
+    L* lock;
+    uint64_t iterations;
+    uint64_t* shared;
+};
+
+template<typename L>
+static void* contended_worker(void* p)
+{
+    contended_arg<L>* a = (contended_arg<L>*)p;
+    for (uint64_t i = 0; i < a->iterations; ++i)
+    {
+        a->lock->lock();
+        ++*a->shared;
+        a->lock->unlock();
+    }
+    return NULL;
+}
+
+// threads 个线程争用同一把锁，iterations 是总的加锁次数
+template<typename L>
+static void mutex_contended(uint64_t iterations, int threads)
+{
+    static L lock;
+    uint64_t shared = 0;
+    std::vector<pthread_t> tids(threads);
+    contended_arg<L> arg = { &lock, iterations / threads + 1, &shared };
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_create(&tids[i], NULL, contended_worker<L>, &arg);
+    }
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+    }
+}
+
+template<typename S>
+static void sem_post_wait(uint64_t iterations, int)
+{
+    static S s;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        s.post();
+        s.wait();
+    }
+}
+
+template<typename S>
+struct pingpong_arg
+{
+    S ping;
+    S pong;
+    uint64_t iterations;
+};
+
+template<typename S>
+static void* pingpong_worker(void* p)
+{
+    pingpong_arg<S>* a = (pingpong_arg<S>*)p;
+    for (uint64_t i = 0; i < a->iterations; ++i)
+    {
+        a->ping.wait();
+        a->pong.post();
+    }
+    return NULL;
+}
+
+// 两个线程轮流唤醒对方，测量一次唤醒的往返开销
+template<typename S>
+static void sem_pingpong(uint64_t iterations, int)
+{
+    pingpong_arg<S>* arg = new pingpong_arg<S>();
+    arg->iterations = iterations;
+    pthread_t tid;
+    pthread_create(&tid, NULL, pingpong_worker<S>, arg);
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        arg->ping.post();
+        arg->pong.wait();
+    }
+    pthread_join(tid, NULL);
+    delete arg;
+}
+
+// 读多写少：每 100 次访问有 1 次写，数据是几个需要一致读出的字段
+struct read_mostly_data
+{
+    uint64_t a, b, c, d;
+};
+
+struct read_mostly_locker
+{
+    locker lock;
+    read_mostly_data data;
+    uint64_t read() { lock.lock(); uint64_t r = data.a + data.d; lock.unlock(); return r; }
+    void write(uint64_t v) { lock.lock(); data.a = v; data.b = v; data.c = v; data.d = v; lock.unlock(); }
+};
+
+struct read_mostly_rwlock
+{
+    rwlock lock;
+    read_mostly_data data;
+    uint64_t read() { lock.rdlock(); uint64_t r = data.a + data.d; lock.unlock(); return r; }
+    void write(uint64_t v) { lock.wrlock(); data.a = v; data.b = v; data.c = v; data.d = v; lock.unlock(); }
+};
+
+struct read_mostly_seqlock
+{
+    seqlock lock;
+    read_mostly_data data;
+    uint64_t read()
+    {
+        read_mostly_data copy;
+        uint32_t seq;
+        do
+        {
+            seq = lock.read_begin();
+            copy = data;
+        } while (lock.read_retry(seq));
+        return copy.a + copy.d;
+    }
+    void write(uint64_t v) { lock.write_lock(); data.a = v; data.b = v; data.c = v; data.d = v; lock.write_unlock(); }
+};
+
+template<typename D>
+struct read_mostly_arg
+{
+    D* shared;
+    uint64_t iterations;
+};
+
+template<typename D>
+static void* read_mostly_worker(void* p)
+{
+    read_mostly_arg<D>* a = (read_mostly_arg<D>*)p;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < a->iterations; ++i)
+    {
+        if (i % 100 == 0)
+        {
+            a->shared->write(i);
+        }
+        else
+        {
+            sum += a->shared->read();
+        }
+    }
+    return (void*)(uintptr_t)sum;
+}
+
+// threads 个线程访问同一份数据，iterations 是总的访问次数
+template<typename D>
+static void read_mostly(uint64_t iterations, int threads)
+{
+    static D shared;
+    std::vector<pthread_t> tids(threads);
+    read_mostly_arg<D> arg = { &shared, iterations / threads + 1 };
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_create(&tids[i], NULL, read_mostly_worker<D>, &arg);
+    }
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// 延迟直方图
+
+// 记录一个延迟样本；先检查边界上的值都落在最后一个桶里，越界时直接退出
+static void histogram_record(uint64_t iterations, int)
+{
+    const int last = latency_histogram::BUCKETS - 1;
+    if (latency_histogram::bucket_of((1ULL << latency_histogram::MAX_BITS) - 1) != last
+        || latency_histogram::bucket_of(1ULL << latency_histogram::MAX_BITS) != last
+        || latency_histogram::bucket_of((1ULL << (latency_histogram::MAX_BITS + 1)) - 1) != last
+        || latency_histogram::bucket_of(UINT64_MAX) != last)
+    {
+        abort();
+    }
+    latency_histogram* h = new latency_histogram();
+    uint64_t ns = 1;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        // 覆盖从 1 纳秒到 2^64 的所有区间
+        ns = ns * 6364136223846793005ULL + 1442695040888963407ULL;
+        h->record(ns >> (i & 63));
+    }
+    delete h;
+}
+
+// ---------------------------------------------------------------------------
+// 路由
+
+static coro_task route_handler(coro_request&)
+{
+    co_return;
+}
+
+static const char* route_paths[] = {
+    "/health",
+    "/api/v1/users/42",
+    "/api/v1/users/42/posts/7",
+    "/api/v1/orders",
+    "/static/css/site.css",
+    "/bilibili.html",
+};
+
+// 注册几十条路由后逐个查找，最后一个路径没有匹配（落到静态文件）
+static void router_match(uint64_t iterations, int)
+{
+    static bool registered = false;
+    if (!registered)
+    {
+        const char* groups[] = { "users", "orders", "items", "carts", "reviews", "tags", "search", "admin" };
+        char pattern[128];
+        for (int i = 0; i < 8; ++i)
+        {
+            snprintf(pattern, sizeof(pattern), "/api/v1/%s", groups[i]);
+            router::add("GET", pattern, route_handler);
+            snprintf(pattern, sizeof(pattern), "/api/v1/%s/:id", groups[i]);
+            router::add("GET", pattern, route_handler);
+            snprintf(pattern, sizeof(pattern), "/api/v1/%s/:id/posts/:post", groups[i]);
+            router::add("GET", pattern, route_handler);
+        }
+        router::add("GET", "/health", route_handler);
+        router::add("GET", "/static/*path", route_handler);
+        registered = true;
+    }
+    const int count = sizeof(route_paths) / sizeof(route_paths[0]);
+    coro_request::handler h;
+    router::params params;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        const char* path = route_paths[i % count];
+        params.clear();
+        router::match("GET", path, strlen(path), h, params);
+    }
+}
+
+// 一个请求的临时数据：文件路径、几个字符串和一个数组，请求结束时释放
+// heap 用普通的 std::string/std::vector，arena 用请求内存池和 pmr 容器，结束时重置
+static void scratch_heap(uint64_t iterations, int)
+{
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        char* path = (char*)malloc(http_conn::FILENAME_LEN);
+        snprintf(path, http_conn::FILENAME_LEN, "/home/acs/webserver/resources%s", route_paths[i % 4]);
+        std::vector<std::string> parts;
+        for (int k = 0; k < 8; ++k)
+        {
+            parts.push_back(std::string(path, 24 + k));
+        }
+        free(path);
+    }
+}
+
+static void scratch_arena(uint64_t iterations, int)
+{
+    alignas(16) static char buf[http_conn::ARENA_INLINE_SIZE];
+    request_arena arena(buf, sizeof(buf));
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        char* path = (char*)arena.alloc(http_conn::FILENAME_LEN, 1);
+        snprintf(path, http_conn::FILENAME_LEN, "/home/acs/webserver/resources%s", route_paths[i % 4]);
+        arena_vector<arena_string> parts(&arena);
+        for (int k = 0; k < 8; ++k)
+        {
+            parts.push_back(arena_string(path, 24 + k, &arena));
+        }
+        arena.reset();
+    }
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [-t min_ms] [-f filter] [-n max_threads] [-j]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    opt.min_ns = 200 * 1000000ULL;
+    opt.filter = NULL;
+    opt.json = false;
+    opt.max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (opt.max_threads < 4)
+    {
+        opt.max_threads = 4;
+    }
+
+    int c;
+    while ((c = getopt(argc, argv, "t:f:n:j")) != -1)
+    {
+        switch (c)
+        {
+            case 't': opt.min_ns = strtoull(optarg, NULL, 10) * 1000000ULL; break;
+            case 'f': opt.filter = optarg; break;
+            case 'n': opt.max_threads = atoi(optarg); break;
+            case 'j': opt.json = true; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (opt.max_threads <= 0 || opt.max_threads >= 64)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // 解析器每行都会 printf，把 stdout 重定向到 /dev/null，测量结果写到原来的标准输出
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!report || !freopen("/dev/null", "w", stdout))
+    {
+        return 1;
+    }
+
+    upstream::add_route("/bench=127.0.0.1:9");
+    counters = new perf_counters();
+    if (!opt.json)
+    {
+        fprintf(report, "%-36s %12s %12s %10s %10s %10s\n", "benchmark", "iterations", "ns/op", "allocs/op", "misses/op", "insns/op");
+    }
+
+    run_bench("parser/process_read", http_conn_bench::process_read, 0);
+    run_bench("parser/parse_line", http_conn_bench::parse_line, 0);
+    run_bench("writer/render_headers", http_conn_bench::render_headers, 0);
+    run_bench("writer/render_error", http_conn_bench::render_error, 0);
+    run_bench("router/match", router_match, 0);
+    run_bench("stats/histogram_record", histogram_record, 0);
+    run_bench("arena/scratch_heap", scratch_heap, 0);
+    run_bench("arena/scratch_arena", scratch_arena, 0);
+    run_bench("lock/locker_uncontended", mutex_uncontended<locker>, 0);
+    run_bench("lock/futex_mutex_uncontended", mutex_uncontended<futex_mutex>, 0);
+    run_bench("lock/sem_post_wait", sem_post_wait<sem>, 0);
+    run_bench("lock/futex_sem_post_wait", sem_post_wait<futex_sem>, 0);
+    run_bench("lock/sem_pingpong", sem_pingpong<sem>, 0);
+    run_bench("lock/futex_sem_pingpong", sem_pingpong<futex_sem>, 0);
+    char name[64];
+    for (int t = 1; t <= opt.max_threads; t *= 2)
+    {
+        snprintf(name, sizeof(name), "lock/locker_contended/%d", t);
+        run_bench(name, mutex_contended<locker>, t);
+        snprintf(name, sizeof(name), "lock/futex_mutex_contended/%d", t);
+        run_bench(name, mutex_contended<futex_mutex>, t);
+    }
+    for (int t = 1; t <= opt.max_threads; t *= 2)
+    {
+        snprintf(name, sizeof(name), "lock/read_mostly_locker/%d", t);
+        run_bench(name, read_mostly<read_mostly_locker>, t);
+        snprintf(name, sizeof(name), "lock/read_mostly_rwlock/%d", t);
+        run_bench(name, read_mostly<read_mostly_rwlock>, t);
+        snprintf(name, sizeof(name), "lock/read_mostly_seqlock/%d", t);
+        run_bench(name, read_mostly<read_mostly_seqlock>, t);
+    }
+    for (int t = 1; t <= opt.max_threads; t *= 2)
+    {
+        snprintf(name, sizeof(name), "queue/append_run/%d", t);
+        run_bench(name, queue_append_run, t);
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// 调用线程的硬件计数器，打开失败时 available 为 false
+class perf_counters
+{
+public:
+    perf_counters() : m_misses(open_counter(PERF_COUNT_HW_CACHE_MISSES, -1)),
+                      m_insns(m_misses >= 0 ? open_counter(PERF_COUNT_HW_INSTRUCTIONS, m_misses) : -1)
+    {
+    }
+
+    ~perf_counters()
+    {
+        if (m_insns >= 0)
+        {
+            close(m_insns);
+        }
+        if (m_misses >= 0)
+        {
+            close(m_misses);
+        }
+    }
+
+    bool available() const { return m_misses >= 0 && m_insns >= 0; }
+
+    void start()
+    {
+        if (available())
+        {
+            ioctl(m_misses, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(m_misses, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    // 暂停、继续计数，不清零
+    void pause()
+    {
+        if (available())
+        {
+            ioctl(m_misses, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    void resume()
+    {
+        if (available())
+        {
+            ioctl(m_misses, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    void stop(uint64_t& misses, uint64_t& insns)
+    {
+        misses = insns = 0;
+        if (available())
+        {
+            ioctl(m_misses, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            if (::read(m_misses, &misses, sizeof(misses)) != sizeof(misses)
+                || ::read(m_insns, &insns, sizeof(insns)) != sizeof(insns))
+            {
+                misses = insns = 0;
+            }
+        }
+    }
+
+private:
+    static int open_counter(uint64_t config, int group)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = group < 0 ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    }
+
+private:
+    int m_misses;
+    int m_insns;
+};
+
+#endif
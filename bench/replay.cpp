@@ -0,0 +1,880 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "stats.h"
+#include "traffic_capture.h"
+#include "http_response.h"
+
+// 录制流量回放
+// 读取服务器 -c 录制的文件，为每个录制的连接建立一个新连接，按原来的时间重新发送它收到的每个数据块。
+// -s 缩放时间：1 为原速，2 为两倍速，0 为尽快发送；-c 限制同时打开的连接数，连接要等到有空位才建立。
+// 同一个连接上请求之间的先后关系保留下来：一个数据块之前已经完整的请求，要收到它们的响应后才发送这个数据块；
+// 原来流水线发送的请求在同一个数据块里，仍然一起发送。
+// 延迟从计划发送的时间算起，服务器变慢使后面的请求推迟发送，推迟的时间也计入延迟；同时给出从实际发送算起的服务时间。
+// -C 比较两次回放（或者 loadgen -j）的 JSON 结果，用于发现性能回归。
+
+static const int MAX_EVENTS = 1024;
+static const int READ_CHUNK = 65536;
+static const int TICK_MS = 10;
+
+struct options
+{
+    const char* host;
+    int port;
+    int threads;
+    double scale;       // 时间缩放，0 表示尽快发送
+    int connections;    // 每个线程同时打开的连接数上限，0 表示不限制
+    int timeout_ms;
+    bool json;
+    const char* path;
+};
+
+static options opt;
+static sockaddr_in server_addr;
+static uint64_t replay_start;
+
+// 录制的一次 read() 收到的数据
+struct chunk
+{
+    uint64_t time;      // 距录制开始的纳秒数
+    size_t end;         // 在连接数据中的结束位置
+    size_t wait_for;    // 发送前需要收到的响应数
+};
+
+// 连接数据中的一个完整请求
+struct request
+{
+    size_t end;
+    bool head;          // HEAD 请求的响应没有响应体
+};
+
+struct session
+{
+    uint64_t open_time;
+    uint64_t close_time;
+    bool closed;            // 录制到了连接关闭
+    std::string bytes;
+    std::vector<chunk> chunks;
+    std::vector<request> requests;
+
+    // 回放状态
+    int fd;
+    bool connected;
+    bool done;
+    size_t next_chunk;      // 下一个要放行的数据块
+    size_t allowed;         // 已经放行的字节
+    size_t sent;            // 已经发出的字节
+    size_t started;         // 开始发送的请求数
+    size_t responses;       // 收到的响应数
+    std::vector<uint64_t> intended;     // 每个请求计划发送的时间
+    std::vector<uint64_t> sent_at;      // 每个请求实际发送的时间
+    response_parser parser;
+    uint64_t last_active;
+};
+
+struct worker
+{
+    pthread_t tid;
+    int epollfd;
+    std::vector<session*> sessions;     // 按连接建立的时间排序
+    size_t next_open;
+    std::vector<session*> active;
+
+    latency_histogram* latency;     // 从计划发送的时间算起
+    latency_histogram* service;     // 从实际发送的时间算起
+
+    uint64_t requests;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t connects;
+    uint64_t connect_errors;
+    uint64_t io_errors;
+    uint64_t timeouts;
+    uint64_t dropped;       // 服务器提前关闭连接，没有发出或者没有收到响应的请求
+    uint64_t non2xx;
+    uint64_t last_done;
+};
+
+// 录制时间 t 对应的回放时间，尽快发送时为 0
+static uint64_t sched(uint64_t t)
+{
+    return opt.scale > 0 ? replay_start + (uint64_t)(t / opt.scale) : 0;
+}
+
+// 从 pos 开始跳过一个 chunked 请求体，返回结束位置，不完整返回 npos
+static size_t skip_chunked(const std::string& s, size_t pos)
+{
+    while (true)
+    {
+        size_t eol = s.find("\r\n", pos);
+        if (eol == std::string::npos)
+        {
+            return std::string::npos;
+        }
+        uint64_t size = strtoull(s.c_str() + pos, NULL, 16);
+        pos = eol + 2;
+        if (size == 0)
+        {
+            // trailer 以空行结束
+            size_t end = s.find("\r\n\r\n", pos - 2);
+            return end == std::string::npos ? end : end + 4;
+        }
+        pos += size + 2;
+        if (pos > s.size())
+        {
+            return std::string::npos;
+        }
+    }
+}
+
+// 把连接数据切分成请求，返回 false 表示不是可以回放的 HTTP/1.x 连接
+static bool split_requests(session& s)
+{
+    if (s.bytes.compare(0, 4, "PRI ") == 0)
+    {
+        return false; // HTTP/2
+    }
+    size_t pos = 0;
+    while (pos < s.bytes.size())
+    {
+        size_t end = s.bytes.find("\r\n\r\n", pos);
+        if (end == std::string::npos)
+        {
+            break;
+        }
+        const char* p = s.bytes.c_str() + pos;
+        const char* eol = strstr(p, "\r\n");
+        std::string line(p, eol - p);
+        if (line.find(" HTTP/1.") == std::string::npos)
+        {
+            break;
+        }
+        request r;
+        r.head = strncmp(p, "HEAD ", 5) == 0;
+        long long length = 0;
+        bool chunked = false;
+        const char* h = eol + 2;
+        const char* header_end = s.bytes.c_str() + end + 2;
+        while (h < header_end)
+        {
+            if (strncasecmp(h, "Content-Length:", 15) == 0)
+            {
+                length = atoll(h + 15);
+            }
+            else if (strncasecmp(h, "Transfer-Encoding:", 18) == 0)
+            {
+                chunked = strncasecmp(h + 18 + strspn(h + 18, " \t"), "chunked", 7) == 0;
+            }
+            else if (strncasecmp(h, "Upgrade:", 8) == 0 && strncasecmp(h + 8 + strspn(h + 8, " \t"), "h2c", 3) == 0)
+            {
+                return false; // 升级到 HTTP/2 之后是二进制分帧
+            }
+            h = strstr(h, "\r\n") + 2;
+        }
+        r.end = chunked ? skip_chunked(s.bytes, end + 4) : end + 4 + length;
+        if (r.end == std::string::npos || r.end > s.bytes.size())
+        {
+            break; // 录制结束时请求还不完整
+        }
+        s.requests.push_back(r);
+        pos = r.end;
+    }
+
+    size_t begin = 0, done = 0;
+    for (size_t i = 0; i < s.chunks.size(); ++i)
+    {
+        while (done < s.requests.size() && s.requests[done].end <= begin)
+        {
+            done++;
+        }
+        s.chunks[i].wait_for = done;
+        begin = s.chunks[i].end;
+    }
+    return true;
+}
+
+// 读取录制文件，按连接分组
+static bool load_capture(const char* path, std::vector<session*>& sessions, size_t& skipped)
+{
+    capture_reader reader;
+    if (!reader.open(path))
+    {
+        return false;
+    }
+    std::unordered_map<uint32_t, session*> by_id;
+    std::vector<session*> all;
+    capture_reader::record r;
+    while (reader.next(r))
+    {
+        session*& s = by_id[r.id];
+        if (!s)
+        {
+            s = new session();
+            s->open_time = r.time;
+            s->close_time = 0;
+            s->closed = false;
+            all.push_back(s);
+        }
+        if (r.type == traffic_capture::DATA)
+        {
+            s->bytes.append(r.data);
+            chunk c = { r.time, s->bytes.size(), 0 };
+            s->chunks.push_back(c);
+        }
+        else if (r.type == traffic_capture::CLOSE)
+        {
+            s->closed = true;
+            s->close_time = r.time;
+            by_id.erase(r.id); // 连接编号不会重复，这里只是让表不变大
+        }
+    }
+
+    skipped = 0;
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        if (split_requests(*all[i]))
+        {
+            sessions.push_back(all[i]);
+        }
+        else
+        {
+            skipped++;
+            delete all[i];
+        }
+    }
+    return true;
+}
+
+static void finish_session(worker& w, session& s, uint64_t now)
+{
+    if (s.fd >= 0)
+    {
+        epoll_ctl(w.epollfd, EPOLL_CTL_DEL, s.fd, 0);
+        close(s.fd);
+        s.fd = -1;
+    }
+    s.done = true;
+    w.last_done = now;
+}
+
+// 连接出错：没有收到响应的请求记为错误
+static void fail_session(worker& w, session& s, uint64_t now)
+{
+    size_t lost = s.requests.size() - s.responses;
+    w.io_errors += lost ? lost : 1;
+    finish_session(w, s, now);
+}
+
+static void open_session(worker& w, session& s, uint64_t now)
+{
+    s.connected = false;
+    s.done = false;
+    s.next_chunk = s.allowed = s.sent = s.started = s.responses = 0;
+    s.intended.resize(s.requests.size());
+    s.sent_at.resize(s.requests.size());
+    s.parser.reset(true);
+    s.last_active = now;
+    s.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (s.fd < 0)
+    {
+        w.connect_errors++;
+        s.done = true;
+        return;
+    }
+    int nodelay = 1;
+    setsockopt(s.fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    if (connect(s.fd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS)
+    {
+        w.connect_errors++;
+        finish_session(w, s, now);
+        return;
+    }
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    ev.data.ptr = &s;
+    epoll_ctl(w.epollfd, EPOLL_CTL_ADD, s.fd, &ev);
+    w.connects++;
+}
+
+// 放行到时间的数据块并发送，所有请求都完成后按录制的时间关闭连接
+static void pump(worker& w, session& s, uint64_t now)
+{
+    if (s.done || !s.connected)
+    {
+        return;
+    }
+    while (s.next_chunk < s.chunks.size())
+    {
+        const chunk& c = s.chunks[s.next_chunk];
+        uint64_t at = sched(c.time);
+        if (at > now || s.responses < c.wait_for)
+        {
+            break;
+        }
+        // 从这个数据块开始的请求
+        while (s.started < s.requests.size() && (s.started ? s.requests[s.started - 1].end : 0) < c.end)
+        {
+            s.intended[s.started] = opt.scale > 0 ? at : now;
+            s.sent_at[s.started] = now;
+            s.started++;
+        }
+        s.allowed = c.end;
+        s.next_chunk++;
+    }
+    while (s.sent < s.allowed)
+    {
+        int n = send(s.fd, s.bytes.data() + s.sent, s.allowed - s.sent, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                fail_session(w, s, now);
+            }
+            return;
+        }
+        s.sent += n;
+        w.bytes_out += n;
+        s.last_active = now;
+    }
+    if (s.next_chunk == s.chunks.size() && s.responses == s.requests.size()
+        && (!s.closed || sched(s.close_time) <= now))
+    {
+        finish_session(w, s, now);
+    }
+}
+
+static void on_response(worker& w, session& s, uint64_t now)
+{
+    size_t k = s.responses++;
+    w.latency->record(now - s.intended[k]);
+    w.service->record(now - s.sent_at[k]);
+    w.requests++;
+    if (s.parser.status() < 200 || s.parser.status() >= 300)
+    {
+        w.non2xx++;
+    }
+    if (s.parser.close_after())
+    {
+        // 服务器会关闭连接，后面的请求不会再有响应
+        w.dropped += s.requests.size() - s.responses;
+        finish_session(w, s, now);
+    }
+}
+
+static void on_readable(worker& w, session& s)
+{
+    char buf[READ_CHUNK];
+    while (!s.done)
+    {
+        int n = recv(s.fd, buf, sizeof(buf), 0);
+        uint64_t now = server_stats::now_ns();
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                fail_session(w, s, now);
+            }
+            return;
+        }
+        if (n == 0)
+        {
+            if (s.responses < s.started && s.parser.eof() == response_parser::COMPLETE)
+            {
+                on_response(w, s, now);
+            }
+            if (!s.done)
+            {
+                w.dropped += s.requests.size() - s.responses;
+                finish_session(w, s, now);
+            }
+            return;
+        }
+        w.bytes_in += n;
+        s.last_active = now;
+        size_t pos = 0;
+        while (pos < (size_t)n && !s.done)
+        {
+            if (s.responses >= s.started)
+            {
+                fail_session(w, s, now); // 没有请求却收到了数据，比如服务器对格式错误的请求回复的 400
+                return;
+            }
+            if (!s.parser.in_progress())
+            {
+                s.parser.set_head(s.requests[s.responses].head);
+            }
+            size_t consumed;
+            response_parser::RESULT ret = s.parser.feed(buf + pos, n - pos, consumed);
+            pos += consumed;
+            if (ret == response_parser::ERROR)
+            {
+                fail_session(w, s, now);
+                return;
+            }
+            if (ret == response_parser::COMPLETE)
+            {
+                on_response(w, s, now);
+            }
+        }
+        pump(w, s, now);
+    }
+}
+
+static void on_writable(worker& w, session& s)
+{
+    uint64_t now = server_stats::now_ns();
+    if (!s.connected)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(s.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err)
+        {
+            w.connect_errors++;
+            finish_session(w, s, now);
+            return;
+        }
+        s.connected = true;
+    }
+    pump(w, s, now);
+}
+
+// 下一个需要处理的时间
+static uint64_t next_wake(worker& w, uint64_t now)
+{
+    uint64_t wake = now + TICK_MS * 1000000ULL;
+    if (w.next_open < w.sessions.size() && (opt.connections == 0 || (int)w.active.size() < opt.connections))
+    {
+        wake = std::min(wake, sched(w.sessions[w.next_open]->open_time));
+    }
+    for (size_t i = 0; i < w.active.size(); ++i)
+    {
+        session& s = *w.active[i];
+        if (!s.connected)
+        {
+            continue;
+        }
+        if (s.next_chunk < s.chunks.size())
+        {
+            if (s.responses >= s.chunks[s.next_chunk].wait_for)
+            {
+                wake = std::min(wake, sched(s.chunks[s.next_chunk].time));
+            }
+        }
+        else if (s.responses == s.requests.size() && s.closed)
+        {
+            wake = std::min(wake, sched(s.close_time));
+        }
+    }
+    return wake;
+}
+
+static void* run(void* arg)
+{
+    worker& w = *(worker*)arg;
+    w.epollfd = epoll_create(5);
+    epoll_event events[MAX_EVENTS];
+    while (true)
+    {
+        uint64_t now = server_stats::now_ns();
+        while (w.next_open < w.sessions.size() && sched(w.sessions[w.next_open]->open_time) <= now
+               && (opt.connections == 0 || (int)w.active.size() < opt.connections))
+        {
+            session* s = w.sessions[w.next_open++];
+            open_session(w, *s, now);
+            w.active.push_back(s);
+        }
+        for (size_t i = 0; i < w.active.size(); )
+        {
+            session& s = *w.active[i];
+            pump(w, s, now);
+            if (!s.done && s.responses < s.started && now - s.last_active > (uint64_t)opt.timeout_ms * 1000000)
+            {
+                w.timeouts += s.requests.size() - s.responses;
+                finish_session(w, s, now);
+            }
+            if (s.done)
+            {
+                w.active[i] = w.active.back();
+                w.active.pop_back();
+                continue;
+            }
+            i++;
+        }
+        if (w.next_open == w.sessions.size() && w.active.empty())
+        {
+            break;
+        }
+
+        // epoll_wait 只有毫秒精度，不足 1 毫秒时不等待，避免发送时间被推迟
+        uint64_t wake = next_wake(w, now);
+        int timeout = wake > now ? (wake - now) / 1000000 : 0;
+        int num = epoll_wait(w.epollfd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < num; ++i)
+        {
+            session& s = *(session*)events[i].data.ptr;
+            if (s.done)
+            {
+                continue;
+            }
+            if (!s.connected && (events[i].events & (EPOLLHUP | EPOLLERR)))
+            {
+                w.connect_errors++;
+                finish_session(w, s, server_stats::now_ns());
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                on_writable(w, s);
+            }
+            if (!s.done && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+            {
+                on_readable(w, s);
+            }
+        }
+    }
+    close(w.epollfd);
+    return NULL;
+}
+
+static uint64_t percentile(const uint64_t* counts, uint64_t total, uint64_t max, double q)
+{
+    if (total == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * total + 0.5);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < latency_histogram::BUCKETS; ++i)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+        {
+            uint64_t v = latency_histogram::bucket_max(i);
+            return v < max ? v : max;
+        }
+    }
+    return max;
+}
+
+// 合并后的直方图
+struct summary
+{
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+
+    summary() : counts(latency_histogram::BUCKETS), total(0), sum(0), max(0) {}
+
+    void finish()
+    {
+        total = 0;
+        for (int i = 0; i < latency_histogram::BUCKETS; ++i)
+        {
+            total += counts[i];
+        }
+    }
+    uint64_t at(double q) const { return percentile(&counts[0], total, max, q); }
+};
+
+static void print_latency_json(const char* name, const summary& s)
+{
+    printf("\"%s\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f,\"mean\":%.1f}",
+           name, s.at(0.5) / 1e3, s.at(0.9) / 1e3, s.at(0.99) / 1e3, s.at(0.999) / 1e3, s.max / 1e3,
+           s.total ? (double)s.sum / s.total / 1e3 : 0.0);
+}
+
+static void print_latency(const char* name, const summary& s)
+{
+    printf("  %-12s p50 %10.1f  p90 %10.1f  p99 %10.1f  p99.9 %10.1f  max %10.1f  (us)\n",
+           name, s.at(0.5) / 1e3, s.at(0.9) / 1e3, s.at(0.99) / 1e3, s.at(0.999) / 1e3, s.max / 1e3);
+}
+
+static bool read_file(const char* path, std::string& out)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+        return false;
+    }
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    {
+        out.append(buf, n);
+    }
+    fclose(f);
+    return true;
+}
+
+// 在 json 的 [from, to) 范围内查找 "key":数字
+static bool json_number(const std::string& json, size_t from, size_t to, const char* key, double& v)
+{
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t pos = json.find(pattern, from);
+    if (pos == std::string::npos || pos >= to)
+    {
+        return false;
+    }
+    v = atof(json.c_str() + pos + pattern.size());
+    return true;
+}
+
+// 比较两个 JSON 结果：吞吐量和 latency_us 中每一组延迟
+// threshold > 0 时，吞吐量下降或者 p99 上升超过 threshold% 返回 1
+static int compare(const char* base_path, const char* new_path, double threshold)
+{
+    std::string base, cur;
+    if (!read_file(base_path, base) || !read_file(new_path, cur))
+    {
+        printf("cannot read %s or %s\n", base_path, new_path);
+        return 2;
+    }
+    bool regressed = false;
+    printf("%-24s %12s %12s %9s\n", "", "base", "new", "change");
+
+    double b, n;
+    if (json_number(base, 0, base.size(), "throughput_rps", b) && json_number(cur, 0, cur.size(), "throughput_rps", n))
+    {
+        double change = b ? (n - b) / b * 100 : 0;
+        printf("%-24s %12.1f %12.1f %+8.1f%%\n", "throughput_rps", b, n, change);
+        regressed |= threshold > 0 && -change > threshold;
+    }
+
+    // latency_us 下的每一组，例如 replay 的 intended/service 或者 loadgen 的 corrected/uncorrected
+    static const char* fields[] = { "p50", "p90", "p99", "p999", "max" };
+    size_t pos = base.find("\"latency_us\":{");
+    if (pos != std::string::npos)
+    {
+        pos += 14;
+    }
+    while (pos < base.size() && base[pos] == '"')
+    {
+        size_t name_end = base.find('"', pos + 1);
+        std::string name = base.substr(pos + 1, name_end - pos - 1);
+        size_t base_begin = name_end;
+        size_t base_end = base.find('}', base_begin);
+        size_t cur_begin = cur.find("\"" + name + "\":{");
+        if (base_end == std::string::npos || cur_begin == std::string::npos)
+        {
+            break;
+        }
+        size_t cur_end = cur.find('}', cur_begin);
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i)
+        {
+            if (!json_number(base, base_begin, base_end, fields[i], b) || !json_number(cur, cur_begin, cur_end, fields[i], n))
+            {
+                continue;
+            }
+            std::string label = name + "." + fields[i] + "_us";
+            double change = b ? (n - b) / b * 100 : 0;
+            printf("%-24s %12.1f %12.1f %+8.1f%%\n", label.c_str(), b, n, change);
+            regressed |= threshold > 0 && strcmp(fields[i], "p99") == 0 && change > threshold;
+        }
+        pos = base_end + 1 < base.size() && base[base_end + 1] == ',' ? base_end + 2 : std::string::npos;
+    }
+    if (regressed)
+    {
+        printf("regression: more than %.1f%% worse\n", threshold);
+        return 1;
+    }
+    return 0;
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [options] capture-file\n"
+           "       %s -C base.json new.json [-x percent]\n"
+           "  -H host        server address (127.0.0.1)\n"
+           "  -p port        server port (10000)\n"
+           "  -t threads     client threads (2)\n"
+           "  -s scale       replay speed: 1 original rate, 2 twice as fast, 0 as fast as possible (1)\n"
+           "  -c conns       at most conns connections open at once, 0 for no limit (0)\n"
+           "  -T msec        response timeout (5000)\n"
+           "  -j             print one JSON object\n"
+           "  -C             compare two JSON results of replay -j or loadgen -j\n"
+           "  -x percent     with -C, exit 1 if throughput or p99 is more than percent worse\n", prog, prog);
+}
+
+int main(int argc, char* argv[])
+{
+    opt.host = "127.0.0.1";
+    opt.port = 10000;
+    opt.threads = 2;
+    opt.scale = 1;
+    opt.connections = 0;
+    opt.timeout_ms = 5000;
+    opt.json = false;
+    bool compare_mode = false;
+    double threshold = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "H:p:t:s:c:T:jCx:h")) != -1)
+    {
+        switch (c)
+        {
+            case 'H': opt.host = optarg; break;
+            case 'p': opt.port = atoi(optarg); break;
+            case 't': opt.threads = atoi(optarg); break;
+            case 's': opt.scale = atof(optarg); break;
+            case 'c': opt.connections = atoi(optarg); break;
+            case 'T': opt.timeout_ms = atoi(optarg); break;
+            case 'j': opt.json = true; break;
+            case 'C': compare_mode = true; break;
+            case 'x': threshold = atof(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (compare_mode)
+    {
+        if (argc - optind != 2)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        return compare(argv[optind], argv[optind + 1], threshold);
+    }
+    if (argc - optind != 1 || opt.threads <= 0 || opt.scale < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    opt.path = argv[optind];
+    if (opt.connections > 0)
+    {
+        opt.connections = std::max(1, opt.connections / opt.threads);
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(opt.port);
+    if (inet_pton(AF_INET, opt.host, &server_addr.sin_addr) != 1)
+    {
+        printf("invalid host %s\n", opt.host);
+        return 1;
+    }
+
+    std::vector<session*> sessions;
+    size_t skipped;
+    if (!load_capture(opt.path, sessions, skipped))
+    {
+        printf("cannot read capture %s\n", opt.path);
+        return 1;
+    }
+    std::stable_sort(sessions.begin(), sessions.end(),
+                     [](const session* a, const session* b) { return a->open_time < b->open_time; });
+    uint64_t total_requests = 0, capture_ns = 0;
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        total_requests += sessions[i]->requests.size();
+        if (!sessions[i]->chunks.empty())
+        {
+            capture_ns = std::max(capture_ns, sessions[i]->chunks.back().time);
+        }
+    }
+
+    // 连接按建立的顺序轮流分给各个线程
+    std::vector<worker> workers(opt.threads);
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        workers[i % opt.threads].sessions.push_back(sessions[i]);
+    }
+    replay_start = server_stats::now_ns();
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        worker& w = workers[i];
+        w.next_open = 0;
+        w.latency = new latency_histogram();
+        w.service = new latency_histogram();
+        w.requests = w.bytes_in = w.bytes_out = w.connects = w.connect_errors = 0;
+        w.io_errors = w.timeouts = w.dropped = w.non2xx = 0;
+        w.last_done = replay_start;
+        pthread_create(&w.tid, NULL, run, &w);
+    }
+
+    summary latency, service;
+    uint64_t requests = 0, bytes_in = 0, bytes_out = 0, connects = 0, connect_errors = 0;
+    uint64_t io_errors = 0, timeouts = 0, dropped = 0, non2xx = 0, end = replay_start;
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        worker& w = workers[i];
+        pthread_join(w.tid, NULL);
+        w.latency->merge_into(&latency.counts[0], latency.sum, latency.max);
+        w.service->merge_into(&service.counts[0], service.sum, service.max);
+        requests += w.requests;
+        bytes_in += w.bytes_in;
+        bytes_out += w.bytes_out;
+        connects += w.connects;
+        connect_errors += w.connect_errors;
+        io_errors += w.io_errors;
+        timeouts += w.timeouts;
+        dropped += w.dropped;
+        non2xx += w.non2xx;
+        end = std::max(end, w.last_done);
+        delete w.latency;
+        delete w.service;
+    }
+    latency.finish();
+    service.finish();
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        delete sessions[i];
+    }
+
+    double seconds = (end - replay_start) / 1e9;
+    double rps = seconds > 0 ? requests / seconds : 0;
+    if (opt.json)
+    {
+        printf("{\"capture\":\"%s\",\"scale\":%.2f,\"threads\":%d,\"capture_s\":%.3f,\"sessions\":%zu,\"skipped\":%zu,"
+               "\"requests\":%llu,\"completed\":%llu,\"duration_s\":%.3f,\"throughput_rps\":%.1f,"
+               "\"bytes_in\":%llu,\"bytes_out\":%llu,\"connects\":%llu,"
+               "\"errors\":{\"connect\":%llu,\"io\":%llu,\"timeout\":%llu,\"dropped\":%llu,\"non2xx\":%llu},"
+               "\"latency_us\":{",
+               opt.path, opt.scale, opt.threads, capture_ns / 1e9, sessions.size(), skipped,
+               (unsigned long long)total_requests, (unsigned long long)requests, seconds, rps,
+               (unsigned long long)bytes_in, (unsigned long long)bytes_out, (unsigned long long)connects,
+               (unsigned long long)connect_errors, (unsigned long long)io_errors, (unsigned long long)timeouts,
+               (unsigned long long)dropped, (unsigned long long)non2xx);
+        print_latency_json("intended", latency);
+        printf(",");
+        print_latency_json("service", service);
+        printf("}}\n");
+    }
+    else
+    {
+        printf("replay %s at %s, %d threads, %zu connections (%zu skipped), %.3f s captured\n",
+               opt.path, opt.scale > 0 ? "scaled rate" : "full speed", opt.threads, sessions.size(), skipped,
+               capture_ns / 1e9);
+        if (opt.scale > 0)
+        {
+            printf("  scale        %.2f\n", opt.scale);
+        }
+        printf("  requests     %llu of %llu in %.3f s (%.1f req/s), %.2f MB in, %.2f MB out\n",
+               (unsigned long long)requests, (unsigned long long)total_requests, seconds, rps,
+               bytes_in / 1048576.0, bytes_out / 1048576.0);
+        printf("  errors       connect %llu, io %llu, timeout %llu, dropped %llu, non-2xx %llu\n",
+               (unsigned long long)connect_errors, (unsigned long long)io_errors, (unsigned long long)timeouts,
+               (unsigned long long)dropped, (unsigned long long)non2xx);
+        print_latency("intended", latency);
+        print_latency("service", service);
+    }
+    return 0;
+}
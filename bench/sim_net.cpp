@@ -0,0 +1,574 @@
+#include "sim_net.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <functional>
+#include <queue>
+#include "locker.h"
+#include "sys_io.h"
+
+std::vector<sim_net::sim_fd> sim_net::m_fds;
+std::vector<sim_net::connection> sim_net::m_conns;
+std::vector<int> sim_net::m_free_conns;
+std::deque<int> sim_net::m_accept_queue;
+std::deque<int> sim_net::m_ready;
+int sim_net::m_listenfd = -1;
+uint64_t sim_net::m_calls[CALL_COUNT];
+void (*sim_net::m_pause)(bool paused) = NULL;
+
+// 保护所有状态
+static futex_mutex mutex;
+// 空闲的 fd，和内核一样总是分配最小的
+static std::priority_queue<int, std::vector<int>, std::greater<int> > free_fds;
+
+// 服务器一侧的一次调用：加锁、计数，调用期间暂停计数器
+class sim_call
+{
+public:
+    explicit sim_call(uint64_t& counter)
+    {
+        if (sim_net::m_pause)
+        {
+            sim_net::m_pause(true);
+        }
+        mutex.lock();
+        ++counter;
+    }
+
+    ~sim_call()
+    {
+        mutex.unlock();
+        if (sim_net::m_pause)
+        {
+            sim_net::m_pause(false);
+        }
+    }
+};
+
+// 客户端一侧的操作只加锁
+class sim_lock
+{
+public:
+    sim_lock() { mutex.lock(); }
+    ~sim_lock() { mutex.unlock(); }
+};
+
+int sim_net::install()
+{
+    static const sys_io::ops ops =
+    {
+        do_accept,
+        do_recv,
+        do_send,
+        do_writev,
+        do_close,
+        do_setsockopt,
+        do_fcntl,
+        do_epoll_create,
+        do_epoll_ctl,
+        do_epoll_wait,
+    };
+    sys_io::install(ops);
+    sim_lock lock;
+    m_listenfd = alloc_fd(LISTEN);
+    return m_listenfd;
+}
+
+uint64_t sim_net::calls(CALL call)
+{
+    sim_lock lock;
+    return m_calls[call];
+}
+
+uint64_t sim_net::total_calls()
+{
+    sim_lock lock;
+    uint64_t total = 0;
+    for (int i = 0; i < CALL_COUNT; ++i)
+    {
+        total += m_calls[i];
+    }
+    return total;
+}
+
+const char* sim_net::name(CALL call)
+{
+    static const char* names[CALL_COUNT] =
+    {
+        "accept", "recv", "send", "writev", "close", "setsockopt", "fcntl", "epoll_create", "epoll_ctl", "epoll_wait"
+    };
+    return names[call];
+}
+
+sim_net::sim_fd* sim_net::lookup(int fd, KIND kind)
+{
+    if (fd < FIRST_FD || fd - FIRST_FD >= (int)m_fds.size() || m_fds[fd - FIRST_FD].kind != kind)
+    {
+        errno = EBADF;
+        return NULL;
+    }
+    return &m_fds[fd - FIRST_FD];
+}
+
+int sim_net::alloc_fd(KIND kind)
+{
+    int fd;
+    if (free_fds.empty())
+    {
+        fd = FIRST_FD + (int)m_fds.size();
+        m_fds.push_back(sim_fd());
+        m_fds.back().queued = false;
+    }
+    else
+    {
+        fd = free_fds.top();
+        free_fds.pop();
+    }
+    sim_fd& f = m_fds[fd - FIRST_FD];
+    f.kind = kind;
+    f.conn = -1;
+    f.epfd = -1;
+    f.events = 0;
+    f.data.u64 = 0;
+    f.armed = false;
+    // queued 保持不变：关闭之前排进就绪队列的记录还在，由新的 fd 接着使用，每个 fd 在队列中最多一次
+    return fd;
+}
+
+void sim_net::free_fd(int fd)
+{
+    m_fds[fd - FIRST_FD].kind = FREE;
+    m_fds[fd - FIRST_FD].epfd = -1;
+    free_fds.push(fd);
+}
+
+// fd 现在的就绪状态
+uint32_t sim_net::ready(const sim_fd& f)
+{
+    if (f.kind == LISTEN)
+    {
+        return m_accept_queue.empty() ? 0 : EPOLLIN;
+    }
+    if (f.kind != CONN)
+    {
+        return 0;
+    }
+    const connection& c = m_conns[f.conn];
+    if (c.rst)
+    {
+        return EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLERR | EPOLLRDHUP;
+    }
+    uint32_t ev = 0;
+    if (c.in_pos < c.in.size() || c.fin)
+    {
+        ev |= EPOLLIN;
+    }
+    if (c.fin)
+    {
+        ev |= EPOLLRDHUP;
+    }
+    if (c.out.size() < c.window)
+    {
+        ev |= EPOLLOUT;
+    }
+    return ev;
+}
+
+// fd 的状态变化了（或者刚注册、修改），关心的事件就绪时排入就绪队列
+void sim_net::notify(int fd)
+{
+    sim_fd& f = m_fds[fd - FIRST_FD];
+    if (f.epfd < 0 || !f.armed || f.queued)
+    {
+        return;
+    }
+    if (ready(f) & (f.events | EPOLLHUP | EPOLLERR))
+    {
+        f.queued = true;
+        m_ready.push_back(fd);
+    }
+}
+
+int sim_net::connect(uint32_t addr, size_t window)
+{
+    sim_lock lock;
+    int conn;
+    if (m_free_conns.empty())
+    {
+        conn = (int)m_conns.size();
+        m_conns.push_back(connection());
+    }
+    else
+    {
+        conn = m_free_conns.back();
+        m_free_conns.pop_back();
+    }
+    connection& c = m_conns[conn];
+    c.fd = -1;
+    c.addr = addr;
+    c.in.clear();
+    c.in_pos = 0;
+    c.out.clear();
+    c.window = window;
+    c.fin = false;
+    c.rst = false;
+    c.closed = false;
+    c.used = true;
+    m_accept_queue.push_back(conn);
+    notify(m_listenfd);
+    return conn;
+}
+
+void sim_net::deliver(int conn, const char* data, size_t len)
+{
+    sim_lock lock;
+    connection& c = m_conns[conn];
+    if (c.closed || c.fin || c.rst)
+    {
+        return;
+    }
+    c.in.append(data, len);
+    if (c.fd >= 0)
+    {
+        notify(c.fd);
+    }
+}
+
+size_t sim_net::take(int conn, std::string& out, size_t max)
+{
+    sim_lock lock;
+    connection& c = m_conns[conn];
+    size_t n = c.out.size() < max ? c.out.size() : max;
+    if (n == 0)
+    {
+        return 0;
+    }
+    bool full = c.out.size() >= c.window;
+    out.append(c.out, 0, n);
+    c.out.erase(0, n);
+    if (full && c.fd >= 0)
+    {
+        notify(c.fd); // 发送缓冲腾出了空间
+    }
+    return n;
+}
+
+void sim_net::shutdown(int conn)
+{
+    sim_lock lock;
+    connection& c = m_conns[conn];
+    if (c.fin || c.rst)
+    {
+        return;
+    }
+    c.fin = true;
+    if (c.fd >= 0)
+    {
+        notify(c.fd);
+    }
+}
+
+void sim_net::reset(int conn)
+{
+    sim_lock lock;
+    connection& c = m_conns[conn];
+    if (c.rst || c.closed)
+    {
+        return;
+    }
+    c.rst = true;
+    c.out.clear();
+    if (c.fd >= 0)
+    {
+        notify(c.fd);
+    }
+}
+
+bool sim_net::closed(int conn)
+{
+    sim_lock lock;
+    return m_conns[conn].closed;
+}
+
+void sim_net::release(int conn)
+{
+    sim_lock lock;
+    connection& c = m_conns[conn];
+    c.used = false;
+    std::string().swap(c.in);
+    std::string().swap(c.out);
+    c.in_pos = 0;
+    if (!c.closed)
+    {
+        // 服务器关闭（或者 accept 时跳过）之后才能被新的连接使用
+        c.rst = true;
+        if (c.fd >= 0)
+        {
+            notify(c.fd);
+        }
+        return;
+    }
+    m_free_conns.push_back(conn);
+}
+
+int sim_net::do_accept(int fd, struct sockaddr* addr, socklen_t* len)
+{
+    sim_call call(m_calls[ACCEPT]);
+    if (!lookup(fd, LISTEN))
+    {
+        return -1;
+    }
+    while (!m_accept_queue.empty())
+    {
+        int conn = m_accept_queue.front();
+        m_accept_queue.pop_front();
+        connection& c = m_conns[conn];
+        if (c.rst)
+        {
+            // 还在队列里就被重置了，不交给服务器
+            c.closed = true;
+            if (!c.used)
+            {
+                m_free_conns.push_back(conn);
+            }
+            continue;
+        }
+        c.fd = alloc_fd(CONN);
+        m_fds[c.fd - FIRST_FD].conn = conn;
+        if (addr && len && *len >= sizeof(sockaddr_in))
+        {
+            sockaddr_in* sin = (sockaddr_in*)addr;
+            memset(sin, 0, sizeof(*sin));
+            sin->sin_family = AF_INET;
+            sin->sin_addr.s_addr = htonl(c.addr);
+            sin->sin_port = htons(10000 + conn % 50000);
+            *len = sizeof(sockaddr_in);
+        }
+        return c.fd;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+ssize_t sim_net::do_recv(int fd, void* buf, size_t len, int flags)
+{
+    sim_call call(m_calls[RECV]);
+    sim_fd* f = lookup(fd, CONN);
+    if (!f)
+    {
+        return -1;
+    }
+    connection& c = m_conns[f->conn];
+    if (c.rst)
+    {
+        errno = ECONNRESET;
+        return -1;
+    }
+    size_t avail = c.in.size() - c.in_pos;
+    if (avail == 0)
+    {
+        if (c.fin)
+        {
+            return 0;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+    size_t n = avail < len ? avail : len;
+    memcpy(buf, c.in.data() + c.in_pos, n);
+    c.in_pos += n;
+    if (c.in_pos == c.in.size())
+    {
+        c.in.clear();
+        c.in_pos = 0;
+    }
+    return n;
+}
+
+// 把 iov 中的数据写入连接的发送缓冲，最多写满 window（调用者持有锁）
+static ssize_t copy_out(std::string& out, size_t window, bool rst, const struct iovec* iov, int count)
+{
+    if (rst)
+    {
+        errno = ECONNRESET;
+        return -1;
+    }
+    size_t space = out.size() < window ? window - out.size() : 0;
+    if (space == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    size_t n = 0;
+    for (int i = 0; i < count && n < space; ++i)
+    {
+        size_t part = iov[i].iov_len < space - n ? iov[i].iov_len : space - n;
+        out.append((const char*)iov[i].iov_base, part);
+        n += part;
+    }
+    return n;
+}
+
+ssize_t sim_net::do_send(int fd, const void* buf, size_t len, int flags)
+{
+    sim_call call(m_calls[SEND]);
+    sim_fd* f = lookup(fd, CONN);
+    if (!f)
+    {
+        return -1;
+    }
+    connection& c = m_conns[f->conn];
+    struct iovec iov = { (void*)buf, len };
+    return copy_out(c.out, c.window, c.rst, &iov, 1);
+}
+
+ssize_t sim_net::do_writev(int fd, const struct iovec* iov, int count)
+{
+    sim_call call(m_calls[WRITEV]);
+    sim_fd* f = lookup(fd, CONN);
+    if (!f)
+    {
+        return -1;
+    }
+    connection& c = m_conns[f->conn];
+    return copy_out(c.out, c.window, c.rst, iov, count);
+}
+
+int sim_net::do_close(int fd)
+{
+    sim_call call(m_calls[CLOSE]);
+    if (fd < FIRST_FD || fd - FIRST_FD >= (int)m_fds.size() || m_fds[fd - FIRST_FD].kind == FREE)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    sim_fd& f = m_fds[fd - FIRST_FD];
+    if (f.kind == CONN)
+    {
+        connection& c = m_conns[f.conn];
+        c.fd = -1;
+        c.closed = true;
+        if (!c.used)
+        {
+            m_free_conns.push_back(f.conn); // 客户端已经 release 了
+        }
+    }
+    free_fd(fd);
+    return 0;
+}
+
+int sim_net::do_setsockopt(int fd, int level, int name, const void* value, socklen_t len)
+{
+    sim_call call(m_calls[SETSOCKOPT]);
+    if (!lookup(fd, CONN) && !lookup(fd, LISTEN))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int sim_net::do_fcntl(int fd, int cmd, int arg)
+{
+    sim_call call(m_calls[FCNTL]);
+    if (!lookup(fd, CONN) && !lookup(fd, LISTEN))
+    {
+        return -1;
+    }
+    return cmd == F_GETFL ? O_RDWR | O_NONBLOCK : 0; // 模拟的 socket 总是非阻塞的
+}
+
+int sim_net::do_epoll_create(int size)
+{
+    sim_call call(m_calls[EPOLL_CREATE]);
+    m_ready.clear();
+    return alloc_fd(EPOLL);
+}
+
+int sim_net::do_epoll_ctl(int epfd, int op, int fd, struct epoll_event* event)
+{
+    sim_call call(m_calls[EPOLL_CTL]);
+    if (!lookup(epfd, EPOLL))
+    {
+        return -1;
+    }
+    if (fd < FIRST_FD || fd - FIRST_FD >= (int)m_fds.size() || (m_fds[fd - FIRST_FD].kind != CONN && m_fds[fd - FIRST_FD].kind != LISTEN))
+    {
+        errno = EBADF; // 进程里真正的 fd（eventfd、上游连接等）不能注册到模拟的 epoll
+        return -1;
+    }
+    sim_fd& f = m_fds[fd - FIRST_FD];
+    switch (op)
+    {
+        case EPOLL_CTL_ADD:
+            if (f.epfd >= 0)
+            {
+                errno = EEXIST;
+                return -1;
+            }
+            f.epfd = epfd;
+            break;
+        case EPOLL_CTL_MOD:
+        case EPOLL_CTL_DEL:
+            if (f.epfd != epfd)
+            {
+                errno = ENOENT;
+                return -1;
+            }
+            if (op == EPOLL_CTL_DEL)
+            {
+                f.epfd = -1;
+                return 0;
+            }
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+    f.events = event->events;
+    f.data = event->data;
+    f.armed = true;
+    notify(fd);
+    return 0;
+}
+
+int sim_net::do_epoll_wait(int epfd, struct epoll_event* events, int max, int timeout)
+{
+    sim_call call(m_calls[EPOLL_WAIT]);
+    if (!lookup(epfd, EPOLL))
+    {
+        return -1;
+    }
+    int n = 0;
+    // 只处理这一次开始时已经在队列中的 fd，水平触发重新排队的留到下一次
+    size_t count = m_ready.size();
+    while (n < max && count-- > 0)
+    {
+        int fd = m_ready.front();
+        m_ready.pop_front();
+        sim_fd& f = m_fds[fd - FIRST_FD];
+        f.queued = false;
+        if (f.epfd != epfd || !f.armed)
+        {
+            continue;
+        }
+        uint32_t ev = ready(f) & (f.events | EPOLLHUP | EPOLLERR);
+        if (!ev)
+        {
+            continue;
+        }
+        events[n].events = ev;
+        events[n].data = f.data;
+        ++n;
+        if (f.events & EPOLLONESHOT)
+        {
+            f.armed = false;
+        }
+        else if (!(f.events & EPOLLET))
+        {
+            f.queued = true;
+            m_ready.push_back(fd);
+        }
+    }
+    return n;
+}
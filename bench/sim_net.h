@@ -0,0 +1,125 @@
+#ifndef SIMNET_H
+#define SIMNET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+// 内存中模拟的网络，通过 sys_io 替换服务器的 socket 和 epoll 调用
+// 服务器一侧看到的是普通的非阻塞 socket：监听 socket 的 accept、连接的 recv/send/writev/close，以及 epoll。
+// 客户端一侧由测试程序直接调用 connect、deliver、take、shutdown、reset，不计入系统调用：
+//   deliver 的数据在下一次 recv 时才能读到，分几次 deliver 一个请求就是分几次到达（部分读）；
+//   服务器的发送缓冲只有 window 字节，客户端 take 走之前写满了就返回 EAGAIN；
+//   shutdown 之后服务器读到 0 并收到 EPOLLRDHUP，reset 之后读写都返回 ECONNRESET 并收到 EPOLLHUP | EPOLLERR。
+// epoll 支持水平触发、边沿触发（EPOLLET）和 EPOLLONESHOT：fd 在注册、修改和状态变化（数据到达、缓冲腾出空间、对端关闭）时
+// 按先后排入就绪队列，epoll_wait 按队列的顺序报告，从不阻塞，同样的操作序列总是得到同样的结果。
+// 所有状态由一把锁保护，工作线程也可以调用；服务器一侧的 fd 从 FIRST_FD 开始分配，和进程里真正的 fd 不会混在一起。
+class sim_net
+{
+public:
+    enum CALL
+    {
+        ACCEPT = 0,
+        RECV,
+        SEND,
+        WRITEV,
+        CLOSE,
+        SETSOCKOPT,
+        FCNTL,
+        EPOLL_CREATE,
+        EPOLL_CTL,
+        EPOLL_WAIT,
+        CALL_COUNT
+    };
+
+    static const int FIRST_FD = 1000;
+
+public:
+    // 把 sys_io 换成模拟网络，返回监听 socket 的 fd
+    static int install();
+    // 服务器一侧每种调用的次数，一次 epoll_wait 不管有没有结果都算一次
+    static uint64_t calls(CALL call);
+    static uint64_t total_calls();
+    static const char* name(CALL call);
+
+    // 客户端：发起连接，addr 是客户端的 IPv4 地址（主机字节序），window 是服务器一侧的发送缓冲大小；返回连接号
+    static int connect(uint32_t addr, size_t window);
+    // 客户端发送数据
+    static void deliver(int conn, const char* data, size_t len);
+    // 客户端最多取走 max 字节服务器发来的数据，追加到 out，返回取走的字节数
+    static size_t take(int conn, std::string& out, size_t max);
+    // 客户端关闭写方向（FIN）
+    static void shutdown(int conn);
+    // 客户端异常断开（RST），之后不能再 deliver
+    static void reset(int conn);
+    // 服务器已经关闭了这个连接
+    static bool closed(int conn);
+    // 客户端用完了连接，连接号可以被新的连接使用；服务器还没有关闭时先 reset
+    static void release(int conn);
+
+public:
+    // 服务器一侧的每次调用前后调用 m_pause(true)、m_pause(false)，
+    // 测试程序用它在模拟的调用期间暂停硬件计数器，统计的指令数只包括服务器自己的代码
+    static void (*m_pause)(bool paused);
+
+private:
+    struct connection
+    {
+        int fd;                 // 服务器一侧的 fd，accept 之前和关闭之后为 -1
+        uint32_t addr;
+        std::string in;         // 客户端发来、服务器还没有读的数据，从 in_pos 开始
+        size_t in_pos;
+        std::string out;        // 服务器发出、客户端还没有取走的数据
+        size_t window;
+        bool fin;
+        bool rst;
+        bool closed;
+        bool used;
+    };
+
+    enum KIND { FREE = 0, LISTEN, CONN, EPOLL };
+
+    struct sim_fd
+    {
+        KIND kind;
+        int conn;               // CONN：连接号
+        // 在 epoll 中的注册
+        int epfd;               // -1 表示没有注册
+        uint32_t events;
+        epoll_data_t data;
+        bool armed;             // EPOLLONESHOT 报告过之后为 false，直到 EPOLL_CTL_MOD
+        bool queued;            // 已经在就绪队列中
+    };
+
+    static sim_fd* lookup(int fd, KIND kind);
+    static int alloc_fd(KIND kind);
+    static void free_fd(int fd);
+    static uint32_t ready(const sim_fd& f);
+    static void notify(int fd);
+
+    static int do_accept(int fd, struct sockaddr* addr, socklen_t* len);
+    static ssize_t do_recv(int fd, void* buf, size_t len, int flags);
+    static ssize_t do_send(int fd, const void* buf, size_t len, int flags);
+    static ssize_t do_writev(int fd, const struct iovec* iov, int count);
+    static int do_close(int fd);
+    static int do_setsockopt(int fd, int level, int name, const void* value, socklen_t len);
+    static int do_fcntl(int fd, int cmd, int arg);
+    static int do_epoll_create(int size);
+    static int do_epoll_ctl(int epfd, int op, int fd, struct epoll_event* event);
+    static int do_epoll_wait(int epfd, struct epoll_event* events, int max, int timeout);
+
+private:
+    static std::vector<sim_fd> m_fds;           // 下标是 fd - FIRST_FD
+    static std::vector<connection> m_conns;
+    static std::vector<int> m_free_conns;
+    static std::deque<int> m_accept_queue;      // 等待 accept 的连接号
+    static std::deque<int> m_ready;             // 就绪队列（fd），只有一个 epoll 实例
+    static int m_listenfd;
+    static uint64_t m_calls[CALL_COUNT];
+};
+
+#endif
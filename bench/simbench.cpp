@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "http_conn.h"
+#include "router.h"
+#include "coro_handler.h"
+#include "event_loop.h"
+#include "sim_net.h"
+#include "http_response.h"
+#include "perf_counters.h"
+
+// 在模拟网络（sim_net）上驱动服务器的事件循环，不经过内核，运行脚本化的连接，统计每个请求的开销
+// 每一轮先由客户端推进脚本：建立连接、把请求分几次发送、按速度取走响应、按计划断开；
+// 再运行一轮事件循环，工作线程数为 0 时（默认）接着在主线程中执行请求队列里的任务。
+// 整个过程是确定的，同样的参数总是得到同样的系统调用次数（和指令数），可以用来比较两个版本的热路径开销。
+// 输出：
+//   insns/req      服务器执行的用户态指令数，模拟的系统调用内部不计（perf_event_open 不可用时为空）
+//   misses/req     服务器的缓存未命中次数
+//   syscalls/req   服务器的 socket 和 epoll 调用次数，下面分别列出每种调用
+//   ns/req         服务器部分的墙上时间（包括模拟的系统调用和暂停计数器的开销），只作参考
+// 工作线程数大于 0 时结果不再确定，指令数只包括主线程。
+
+// 网站的根目录
+extern const char* doc_root;
+
+struct options
+{
+    int connections;
+    int concurrency;
+    int requests;
+    const char* url;
+    int split;
+    size_t window;
+    size_t drain;
+    int fault_every;
+    bool run_to_completion;
+    int threads;
+    bool json;
+};
+static options opt;
+static perf_counters* counters;
+// 测量结果的输出，stdout 被重定向到了 /dev/null
+static FILE* report;
+
+// 中途断开的方式
+enum FAULT
+{
+    FAULT_NONE = 0,
+    FAULT_FIN,      // 请求发到一半时关闭写方向
+    FAULT_RST       // 请求发完、响应还没收完时重置
+};
+
+// 一个同时进行的连接
+struct client
+{
+    int conn;               // sim_net 的连接号，-1 表示空闲
+    int index;              // 第几个连接
+    int sent;               // 已经发完的请求数
+    int done;               // 已经收完的响应数
+    int piece;              // 当前请求已经发送的片数
+    FAULT fault;
+    bool faulted;           // 已经断开，等服务器关闭
+    bool finished;          // 所有响应都收到了，已经关闭写方向
+    response_parser parser;
+    std::string buf;
+};
+
+struct results
+{
+    uint64_t ticks;
+    uint64_t responses;
+    uint64_t errors;        // 状态码不是 200
+    uint64_t early_closes;  // 服务器在脚本结束之前关闭了连接
+    uint64_t faults;
+    uint64_t bytes;         // 客户端取走的字节数
+    uint64_t insns;
+    uint64_t misses;
+    uint64_t server_ns;
+};
+static results res;
+static std::string request;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 模拟的系统调用期间暂停计数器
+static void pause_counters(bool paused)
+{
+    if (paused)
+    {
+        counters->pause();
+    }
+    else
+    {
+        counters->resume();
+    }
+}
+
+static void start_client(client& c, int index)
+{
+    c.index = index;
+    // 每个连接一个不同的地址，10.0.0.0/8
+    c.conn = sim_net::connect(0x0a000000u | (uint32_t)(index & 0xffffff), opt.window);
+    c.sent = 0;
+    c.done = 0;
+    c.piece = 0;
+    c.fault = FAULT_NONE;
+    if (opt.fault_every > 0 && index % opt.fault_every == opt.fault_every - 1)
+    {
+        c.fault = (index / opt.fault_every) % 2 ? FAULT_RST : FAULT_FIN;
+    }
+    c.faulted = false;
+    c.finished = false;
+    c.parser.reset(true);
+    c.buf.clear();
+}
+
+// 推进一个连接的脚本，连接结束时返回 false
+static bool step_client(client& c)
+{
+    // 在第几个请求上断开
+    int fault_at = opt.requests / 2;
+    if (!c.faulted)
+    {
+        if (c.fault == FAULT_RST && c.sent == fault_at + 1 && c.done == fault_at)
+        {
+            sim_net::reset(c.conn);
+            c.faulted = true;
+            ++res.faults;
+        }
+        else
+        {
+            // 取走响应
+            res.bytes += sim_net::take(c.conn, c.buf, opt.drain);
+            size_t pos = 0;
+            while (pos < c.buf.size())
+            {
+                size_t consumed = 0;
+                response_parser::RESULT r = c.parser.feed(c.buf.data() + pos, c.buf.size() - pos, consumed);
+                pos += consumed;
+                if (r == response_parser::NEED_MORE)
+                {
+                    break;
+                }
+                if (r == response_parser::ERROR)
+                {
+                    ++res.errors;
+                    pos = c.buf.size();
+                    break;
+                }
+                ++c.done;
+                ++res.responses;
+                if (c.parser.status() != 200)
+                {
+                    ++res.errors;
+                }
+            }
+            c.buf.erase(0, pos);
+        }
+    }
+    if (sim_net::closed(c.conn))
+    {
+        if (!c.faulted && c.done < opt.requests)
+        {
+            ++res.early_closes;
+        }
+        sim_net::release(c.conn);
+        c.conn = -1;
+        return false;
+    }
+    if (c.faulted || c.finished)
+    {
+        return true;
+    }
+    if (c.fault == FAULT_FIN && c.sent == fault_at && c.done == c.sent && c.piece == 0)
+    {
+        sim_net::deliver(c.conn, request.data(), request.size() / 2);
+        sim_net::shutdown(c.conn);
+        c.faulted = true;
+        ++res.faults;
+        return true;
+    }
+    if (c.sent == c.done && c.sent < opt.requests)
+    {
+        // 发送当前请求的下一片，一次只有一个请求在进行
+        size_t begin = request.size() * c.piece / opt.split;
+        size_t end = request.size() * (c.piece + 1) / opt.split;
+        sim_net::deliver(c.conn, request.data() + begin, end - begin);
+        if (++c.piece == opt.split)
+        {
+            c.piece = 0;
+            ++c.sent;
+        }
+    }
+    else if (c.done == opt.requests)
+    {
+        // 脚本结束，服务器读到 0 后关闭连接
+        sim_net::shutdown(c.conn);
+        c.finished = true;
+    }
+    return true;
+}
+
+// 运行所有连接，卡住时（很多轮都没有任何进展）返回 false
+static bool run()
+{
+    std::vector<client> clients(opt.concurrency);
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        clients[i].conn = -1;
+    }
+    int started = 0;
+    int active = 0;
+    uint64_t last_progress = 0;
+    uint64_t idle_ticks = 0;
+    while (started < opt.connections || active > 0)
+    {
+        for (size_t i = 0; i < clients.size(); ++i)
+        {
+            if (clients[i].conn < 0)
+            {
+                if (started < opt.connections)
+                {
+                    start_client(clients[i], started++);
+                    ++active;
+                }
+            }
+            else if (!step_client(clients[i]))
+            {
+                --active;
+            }
+        }
+
+        uint64_t misses = 0, insns = 0;
+        uint64_t start = now_ns();
+        counters->start();
+        bool ok = event_loop::run_once();
+        if (opt.threads == 0)
+        {
+            event_loop::run_pending();
+        }
+        counters->stop(misses, insns);
+        res.server_ns += now_ns() - start;
+        res.insns += insns;
+        res.misses += misses;
+        ++res.ticks;
+        if (!ok)
+        {
+            return false;
+        }
+
+        uint64_t progress = res.bytes + res.responses + res.faults + started - active;
+        idle_ticks = progress == last_progress ? idle_ticks + 1 : 0;
+        last_progress = progress;
+        if (idle_ticks >= 10000 && opt.threads == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void print_report(bool ok)
+{
+    double n = res.responses ? (double)res.responses : 1.0;
+    bool perf = counters->available() && opt.threads == 0;
+    if (opt.json)
+    {
+        fprintf(report, "{\"ok\":%s,\"ticks\":%llu,\"responses\":%llu,\"errors\":%llu,\"early_closes\":%llu,\"faults\":%llu,",
+                ok ? "true" : "false", (unsigned long long)res.ticks, (unsigned long long)res.responses,
+                (unsigned long long)res.errors, (unsigned long long)res.early_closes, (unsigned long long)res.faults);
+        if (perf)
+        {
+            fprintf(report, "\"insns_per_req\":%.1f,\"misses_per_req\":%.2f,", res.insns / n, res.misses / n);
+        }
+        fprintf(report, "\"syscalls_per_req\":%.3f,\"ns_per_req\":%.1f,\"syscalls\":{",
+                sim_net::total_calls() / n, res.server_ns / n);
+        for (int i = 0; i < sim_net::CALL_COUNT; ++i)
+        {
+            sim_net::CALL call = (sim_net::CALL)i;
+            fprintf(report, "%s\"%s\":%llu", i ? "," : "", sim_net::name(call), (unsigned long long)sim_net::calls(call));
+        }
+        fprintf(report, "}}\n");
+        return;
+    }
+    char drain[32] = "unlimited";
+    if (opt.drain != SIZE_MAX)
+    {
+        snprintf(drain, sizeof(drain), "%zu", opt.drain);
+    }
+    fprintf(report, "%d connections x %d requests %s, concurrency %d, %d pieces per request, window %zu, drain %s per tick%s%s\n",
+            opt.connections, opt.requests, opt.url, opt.concurrency, opt.split, opt.window, drain,
+            opt.run_to_completion ? ", run-to-completion" : "", opt.threads ? ", worker threads" : "");
+    fprintf(report, "  ticks        %llu%s\n", (unsigned long long)res.ticks, ok ? "" : " (stuck)");
+    fprintf(report, "  responses    %llu, non-200 %llu, closed early %llu, disconnects %llu\n",
+            (unsigned long long)res.responses, (unsigned long long)res.errors,
+            (unsigned long long)res.early_closes, (unsigned long long)res.faults);
+    if (perf)
+    {
+        fprintf(report, "  insns/req    %.1f\n", res.insns / n);
+        fprintf(report, "  misses/req   %.2f\n", res.misses / n);
+    }
+    else
+    {
+        fprintf(report, "  insns/req    -\n");
+        fprintf(report, "  misses/req   -\n");
+    }
+    fprintf(report, "  syscalls/req %.3f\n", sim_net::total_calls() / n);
+    for (int i = 0; i < sim_net::CALL_COUNT; ++i)
+    {
+        sim_net::CALL call = (sim_net::CALL)i;
+        fprintf(report, "    %-12s %12llu %10.3f\n", sim_net::name(call), (unsigned long long)sim_net::calls(call), sim_net::calls(call) / n);
+    }
+    fprintf(report, "  ns/req       %.1f\n", res.server_ns / n);
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [options]\n"
+           "  -n conns       total connections (10000)\n"
+           "  -c conns       concurrent connections (100)\n"
+           "  -r requests    requests per connection (10)\n"
+           "  -u path        request path (/bilibili.html)\n"
+           "  -s pieces      deliver each request in this many reads (1)\n"
+           "  -W bytes       server-side send buffer per connection (262144)\n"
+           "  -b bytes       bytes the client takes per tick (unlimited)\n"
+           "  -x n           every n-th connection disconnects halfway, alternating FIN and RST (0: never)\n"
+           "  -e             run-to-completion mode\n"
+           "  -T threads     worker threads, results are no longer deterministic (0)\n"
+           "  -d dir         document root (resources)\n"
+           "  -j             print one JSON object\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    opt.connections = 10000;
+    opt.concurrency = 100;
+    opt.requests = 10;
+    opt.url = "/bilibili.html";
+    opt.split = 1;
+    opt.window = 262144;
+    opt.drain = SIZE_MAX;
+    opt.fault_every = 0;
+    opt.run_to_completion = false;
+    opt.threads = 0;
+    opt.json = false;
+    const char* root = "resources";
+
+    int c;
+    while ((c = getopt(argc, argv, "n:c:r:u:s:W:b:x:eT:d:jh")) != -1)
+    {
+        switch (c)
+        {
+            case 'n': opt.connections = atoi(optarg); break;
+            case 'c': opt.concurrency = atoi(optarg); break;
+            case 'r': opt.requests = atoi(optarg); break;
+            case 'u': opt.url = optarg; break;
+            case 's': opt.split = atoi(optarg); break;
+            case 'W': opt.window = strtoull(optarg, NULL, 10); break;
+            case 'b': opt.drain = strtoull(optarg, NULL, 10); break;
+            case 'x': opt.fault_every = atoi(optarg); break;
+            case 'e': opt.run_to_completion = true; break;
+            case 'T': opt.threads = atoi(optarg); break;
+            case 'd': root = optarg; break;
+            case 'j': opt.json = true; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (opt.connections <= 0 || opt.concurrency <= 0 || opt.requests <= 0 || opt.split <= 0
+        || opt.window == 0 || opt.drain == 0 || opt.fault_every < 0 || opt.threads < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    char real_root[PATH_MAX];
+    if (!realpath(root, real_root))
+    {
+        printf("cannot open document root %s\n", root);
+        return 1;
+    }
+    doc_root = real_root;
+    request = std::string("GET ") + opt.url + " HTTP/1.1\r\nHost: sim\r\nUser-Agent: simbench\r\n\r\n";
+    if (opt.split > (int)request.size())
+    {
+        opt.split = request.size();
+    }
+
+    // 解析器每行都会 printf，把 stdout 重定向到 /dev/null，测量结果写到原来的标准输出
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!report || !freopen("/dev/null", "w", stdout))
+    {
+        return 1;
+    }
+
+    // 模拟的连接按脚本关闭，不需要空闲超时；连接数组按 fd 索引，模拟的 fd 从 FIRST_FD 开始
+    http_conn::parse_keep_alive("0");
+    http_conn::m_run_to_completion = opt.run_to_completion;
+    // 和 main 一样的动态路由
+    router::add("GET", "/health", coro_request::health);
+    router::add("GET", "/delay", coro_request::delay);
+    counters = new perf_counters();
+    if (opt.threads == 0)
+    {
+        sim_net::m_pause = pause_counters;
+    }
+    int listenfd = sim_net::install();
+    if (opt.concurrency + sim_net::FIRST_FD + 16 > event_loop::MAX_FD || !event_loop::setup(listenfd, opt.threads))
+    {
+        fprintf(report, "cannot set up the event loop\n");
+        return 1;
+    }
+
+    bool ok = run();
+    print_report(ok);
+    return ok && res.errors == 0 && res.early_closes == 0 ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+#include "traffic_capture.h"
+#include <string.h>
+#include <time.h>
+
+const char traffic_capture::MAGIC[8] = { 'W', 'S', 'C', 'A', 'P', '1', '\r', '\n' };
+
+FILE* traffic_capture::m_file = NULL;
+locker traffic_capture::m_lock;
+std::vector<char> traffic_capture::m_buf;
+uint32_t traffic_capture::m_next_id = 0;
+uint64_t traffic_capture::m_last_time = 0;
+uint64_t traffic_capture::m_last_flush = 0;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void put_varint(std::vector<char>& out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+bool traffic_capture::start(const char* path)
+{
+    m_file = fopen(path, "wb");
+    if (!m_file)
+    {
+        return false;
+    }
+    if (fwrite(MAGIC, 1, sizeof(MAGIC), m_file) != sizeof(MAGIC))
+    {
+        fclose(m_file);
+        m_file = NULL;
+        return false;
+    }
+    m_buf.reserve(FLUSH_SIZE * 2);
+    m_last_time = m_last_flush = now_ns();
+    return true;
+}
+
+// 调用者持有 m_lock
+void traffic_capture::append(RECORD type, uint32_t id, const char* buf, size_t len)
+{
+    uint64_t now = now_ns();
+    m_buf.push_back((char)type);
+    put_varint(m_buf, id);
+    put_varint(m_buf, now - m_last_time);
+    m_last_time = now;
+    if (type == DATA)
+    {
+        put_varint(m_buf, len);
+        m_buf.insert(m_buf.end(), buf, buf + len);
+    }
+    if (m_buf.size() >= FLUSH_SIZE || now - m_last_flush >= 1000000000ULL)
+    {
+        fwrite(&m_buf[0], 1, m_buf.size(), m_file);
+        fflush(m_file);
+        m_buf.clear();
+        m_last_flush = now;
+    }
+}
+
+uint32_t traffic_capture::open_conn()
+{
+    m_lock.lock();
+    uint32_t id = ++m_next_id;
+    append(OPEN, id, NULL, 0);
+    m_lock.unlock();
+    return id;
+}
+
+void traffic_capture::data(uint32_t id, const char* buf, size_t len)
+{
+    m_lock.lock();
+    append(DATA, id, buf, len);
+    m_lock.unlock();
+}
+
+void traffic_capture::close_conn(uint32_t id)
+{
+    m_lock.lock();
+    append(CLOSE, id, NULL, 0);
+    m_lock.unlock();
+}
+
+void traffic_capture::flush()
+{
+    if (!m_file)
+    {
+        return;
+    }
+    m_lock.lock();
+    if (!m_buf.empty())
+    {
+        fwrite(&m_buf[0], 1, m_buf.size(), m_file);
+        m_buf.clear();
+    }
+    fflush(m_file);
+    m_last_flush = now_ns();
+    m_lock.unlock();
+}
+
+capture_reader::~capture_reader()
+{
+    if (m_file)
+    {
+        fclose(m_file);
+    }
+}
+
+bool capture_reader::open(const char* path)
+{
+    m_file = fopen(path, "rb");
+    if (!m_file)
+    {
+        return false;
+    }
+    char magic[sizeof(traffic_capture::MAGIC)];
+    return fread(magic, 1, sizeof(magic), m_file) == sizeof(magic)
+        && memcmp(magic, traffic_capture::MAGIC, sizeof(magic)) == 0;
+}
+
+bool capture_reader::read_varint(uint64_t& v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int c = fgetc(m_file);
+        if (c == EOF)
+        {
+            return false;
+        }
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool capture_reader::next(record& r)
+{
+    int type = fgetc(m_file);
+    uint64_t id, delta;
+    if (type == EOF || type < traffic_capture::OPEN || type > traffic_capture::CLOSE
+        || !read_varint(id) || !read_varint(delta))
+    {
+        return false;
+    }
+    m_time += delta;
+    r.type = type;
+    r.id = id;
+    r.time = m_time;
+    r.data.clear();
+    if (type == traffic_capture::DATA)
+    {
+        uint64_t len;
+        if (!read_varint(len) || len > (1ULL << 30))
+        {
+            return false;
+        }
+        r.data.resize(len);
+        if (len && fread(&r.data[0], 1, len, m_file) != len)
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef TRAFFICCAPTURE_H
+#define TRAFFICCAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+// 流量录制：记录每个连接收到的原始请求字节和到达时间，供 bench/replay 回放
+// 文件格式：8 字节文件头 "WSCAP1\r\n"，之后是一条条记录：
+//   1 字节类型 | varint 连接编号 | varint 距上一条记录的纳秒数 | DATA 记录还有 varint 长度和数据
+// varint 为 LEB128 编码，时间用差值保存，小请求的记录只比数据多几个字节。
+class traffic_capture
+{
+public:
+    static const char MAGIC[8];
+
+    // 记录类型
+    enum RECORD { OPEN = 1, DATA, CLOSE };
+
+    // 缓冲超过这个大小或者距上次写文件超过 1 秒时写入文件
+    static const size_t FLUSH_SIZE = 64 * 1024;
+
+public:
+    // 开始录制到 path，失败返回 false
+    static bool start(const char* path);
+    static bool enabled() { return m_file != NULL; }
+
+    // 新连接，返回连接编号
+    static uint32_t open_conn();
+    // 连接上收到的数据
+    static void data(uint32_t id, const char* buf, size_t len);
+    static void close_conn(uint32_t id);
+    // 把缓冲写入文件
+    static void flush();
+
+private:
+    static void append(RECORD type, uint32_t id, const char* buf, size_t len);
+
+private:
+    static FILE* m_file;
+    static locker m_lock;
+    static std::vector<char> m_buf;
+    static uint32_t m_next_id;
+    static uint64_t m_last_time;    // 上一条记录的时间
+    static uint64_t m_last_flush;
+};
+
+// 读取录制文件
+class capture_reader
+{
+public:
+    struct record
+    {
+        int type;
+        uint32_t id;
+        uint64_t time;      // 距录制开始的纳秒数
+        std::string data;
+    };
+
+public:
+    capture_reader() : m_file(NULL), m_time(0) {}
+    ~capture_reader();
+
+    bool open(const char* path);
+    // 读取下一条记录，文件结束或者最后一条记录不完整时返回 false
+    bool next(record& r);
+
+private:
+    bool read_varint(uint64_t& v);
+
+private:
+    FILE* m_file;
+    uint64_t m_time;
+};
+
+#endif
@@ -0,0 +1,316 @@
+#include "coro_handler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <list>
+#include "../lock/locker.h"
+#include "../net/sys_io.h"
+
+int coro_request::m_owner[MAX_FD];
+
+// 等待 I/O 线程读文件的请求
+static std::list<coro_request*> io_queue;
+static locker io_lock;
+static sem io_sem;
+static pthread_once_t io_once = PTHREAD_ONCE_INIT;
+
+coro_task& coro_task::operator=(coro_task&& other)
+{
+    if (this != &other)
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+        }
+        m_handle = other.m_handle;
+        other.m_handle = nullptr;
+    }
+    return *this;
+}
+
+coro_task::~coro_task()
+{
+    if (m_handle)
+    {
+        m_handle.destroy();
+    }
+}
+
+void* coro_task::promise_type::operator new(size_t size, coro_request& req)
+{
+    return req.arena().alloc(size);
+}
+
+coro_request::coro_request(handler h, request_arena& arena, int client_fd, const char* method, const char* url,
+                           const char* body, size_t body_len)
+    : m_handler(h), m_arena(arena), m_client_fd(client_fd), m_method(method), m_path(&arena), m_query(&arena),
+      m_body(body, body_len, &arena), m_status(200), m_content_type("text/html"), m_headers(&arena), m_wait(WAIT_NONE), m_wait_fd(-1), m_wait_events(0),
+      m_timer_ms(0), m_revents(0), m_result(0), m_file_fd(-1), m_file_buf(NULL), m_file_len(0), m_file_offset(0)
+{
+    const char* q = strchr(url, '?');
+    if (q)
+    {
+        m_path.assign(url, q - url);
+        m_query.assign(q + 1);
+    }
+    else
+    {
+        m_path.assign(url);
+    }
+}
+
+bool coro_request::start()
+{
+    m_task = m_handler(*this);
+    return resume();
+}
+
+bool coro_request::resume()
+{
+    m_wait = WAIT_NONE;
+    m_task.resume();
+    return m_task.done();
+}
+
+void coro_request::wait_fd(int fd, uint32_t events)
+{
+    m_wait = WAIT_FD;
+    m_wait_fd = fd;
+    m_wait_events = events;
+}
+
+void coro_request::wait_timer(unsigned ms)
+{
+    m_wait = WAIT_TIMER;
+    m_timer_ms = ms;
+}
+
+void coro_request::wait_file(int fd, void* buf, size_t len, off_t offset)
+{
+    m_wait = WAIT_FILE;
+    m_file_fd = fd;
+    m_file_buf = buf;
+    m_file_len = len;
+    m_file_offset = offset;
+}
+
+bool coro_request::fail_wait(int err)
+{
+    m_wait = WAIT_NONE;
+    m_wait_fd = -1;
+    m_revents = EPOLLERR;
+    m_result = -err;
+    return false;
+}
+
+bool coro_request::arm(int epollfd)
+{
+    if (m_wait == WAIT_TIMER)
+    {
+        m_wait_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (m_wait_fd < 0)
+        {
+            return fail_wait(errno);
+        }
+        itimerspec its;
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = m_timer_ms / 1000;
+        its.it_value.tv_nsec = (m_timer_ms % 1000) * 1000000L;
+        timerfd_settime(m_wait_fd, 0, &its, NULL);
+        m_wait_events = EPOLLIN;
+    }
+    else if (m_wait == WAIT_FILE)
+    {
+        m_wait_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_wait_fd < 0)
+        {
+            return fail_wait(errno);
+        }
+        m_wait_events = EPOLLIN;
+    }
+    else if (m_wait != WAIT_FD)
+    {
+        return fail_wait(EINVAL); // 处理函数 co_await 了不属于这里的等待对象
+    }
+    if (m_wait_fd < 0 || m_wait_fd >= MAX_FD)
+    {
+        if (m_wait != WAIT_FD)
+        {
+            close(m_wait_fd);
+        }
+        return fail_wait(EBADF);
+    }
+
+    epoll_event event;
+    event.data.fd = m_wait_fd;
+    event.events = m_wait_events | EPOLLRDHUP | EPOLLONESHOT;
+    m_owner[m_wait_fd] = m_client_fd + 1;
+    if (sys_io::epoll_ctl(epollfd, EPOLL_CTL_ADD, m_wait_fd, &event) < 0)
+    {
+        int err = errno;
+        m_owner[m_wait_fd] = 0;
+        if (m_wait != WAIT_FD)
+        {
+            close(m_wait_fd);
+        }
+        return fail_wait(err);
+    }
+    if (m_wait == WAIT_FILE)
+    {
+        // 交给 I/O 线程之后不能再访问这个请求
+        pthread_once(&io_once, start_io_threads);
+        io_lock.lock();
+        io_queue.push_back(this);
+        io_lock.unlock();
+        io_sem.post();
+    }
+    return true;
+}
+
+void coro_request::wake(int epollfd, uint32_t events)
+{
+    m_owner[m_wait_fd] = 0;
+    sys_io::epoll_ctl(epollfd, EPOLL_CTL_DEL, m_wait_fd, 0);
+    if (m_wait != WAIT_FD)
+    {
+        close(m_wait_fd); // 自己创建的 timerfd/eventfd
+    }
+    m_wait_fd = -1;
+    m_revents = events;
+}
+
+int coro_request::client_of(int fd)
+{
+    if (fd < 0 || fd >= MAX_FD)
+    {
+        return -1;
+    }
+    return m_owner[fd] - 1;
+}
+
+void coro_request::start_io_threads()
+{
+    for (int i = 0; i < IO_THREADS; ++i)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, io_worker, NULL) == 0)
+        {
+            pthread_detach(tid);
+        }
+    }
+}
+
+void* coro_request::io_worker(void*)
+{
+    while (true)
+    {
+        io_sem.wait();
+        io_lock.lock();
+        if (io_queue.empty())
+        {
+            io_lock.unlock();
+            continue;
+        }
+        coro_request* req = io_queue.front();
+        io_queue.pop_front();
+        io_lock.unlock();
+
+        ssize_t n = pread(req->m_file_fd, req->m_file_buf, req->m_file_len, req->m_file_offset);
+        req->m_result = n < 0 ? -errno : n;
+        // 通知事件循环之后请求随时可能被恢复执行，不能再访问它
+        int efd = req->m_wait_fd;
+        uint64_t one = 1;
+        ssize_t ret = write(efd, &one, sizeof(one));
+        (void)ret;
+    }
+    return NULL;
+}
+
+ssize_t coro_request::io_awaiter::attempt()
+{
+    ssize_t n = m_write ? ::send(m_fd, m_buf, m_len, MSG_DONTWAIT | MSG_NOSIGNAL)
+                        : ::recv(m_fd, m_buf, m_len, MSG_DONTWAIT);
+    return n < 0 ? -errno : n;
+}
+
+bool coro_request::io_awaiter::await_ready()
+{
+    m_result = attempt();
+    return m_result != -EAGAIN && m_result != -EWOULDBLOCK;
+}
+
+ssize_t coro_request::io_awaiter::await_resume()
+{
+    if (m_result == -EAGAIN || m_result == -EWOULDBLOCK)
+    {
+        m_result = attempt();
+    }
+    return m_result;
+}
+
+const char* coro_request::status_title(int status)
+{
+    switch (status)
+    {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Error";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        default: return "Unknown";
+    }
+}
+
+const std::string* coro_request::param(const char* name) const
+{
+    for (size_t i = 0; i < m_params.size(); ++i)
+    {
+        if (m_params[i].first == name)
+        {
+            return &m_params[i].second;
+        }
+    }
+    return NULL;
+}
+
+void coro_request::add_header(const char* name, const std::string& value)
+{
+    m_headers.append(name).append(": ").append(value).append("\r\n");
+}
+
+coro_task coro_request::health(coro_request& req)
+{
+    req.set_content_type("text/plain");
+    req.response() = "ok\n";
+    co_return;
+}
+
+coro_task coro_request::delay(coro_request& req)
+{
+    const char* ms = strstr(req.query().c_str(), "ms=");
+    unsigned n = ms ? strtoul(ms + 3, NULL, 10) : 1000;
+    if (n > 60000)
+    {
+        n = 60000;
+    }
+    co_await req.sleep(n);
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "{\"delay_ms\":%u}\n", n);
+    req.set_content_type("application/json");
+    req.response() = buf;
+}
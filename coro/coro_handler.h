@@ -0,0 +1,243 @@
+#ifndef COROHANDLER_H
+#define COROHANDLER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <coroutine>
+#include <exception>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../arena/request_arena.h"
+
+class coro_request;
+
+// 协程处理函数的返回类型
+// 协程创建后先挂起，由 http_conn 在工作线程中第一次恢复它；结束时也挂起，由 coro_request 销毁协程帧
+// 协程帧从请求的内存池中分配，随请求一起释放
+class coro_task
+{
+public:
+    struct promise_type
+    {
+        coro_task get_return_object() { return coro_task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        // 处理函数不应该抛出异常，和工作线程中的其他代码一样直接终止
+        void unhandled_exception() { std::terminate(); }
+
+        // 处理函数的参数是 coro_request&，编译器把它传给这里
+        static void* operator new(size_t size, coro_request& req);
+        static void operator delete(void*, size_t) {}
+    };
+
+public:
+    coro_task() : m_handle() {}
+    explicit coro_task(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+    coro_task(coro_task&& other) : m_handle(other.m_handle) { other.m_handle = nullptr; }
+    coro_task& operator=(coro_task&& other);
+    coro_task(const coro_task&) = delete;
+    coro_task& operator=(const coro_task&) = delete;
+    ~coro_task();
+
+    bool done() const { return !m_handle || m_handle.done(); }
+    void resume() { m_handle.resume(); }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+// 一个由协程处理的请求
+// 处理函数在工作线程中运行，co_await 下面的等待对象时挂起，工作线程去处理别的请求；
+// 等待的 fd 就绪后主线程的事件循环把连接重新放入请求队列，由某个工作线程从挂起的地方继续执行。
+// 所以少量工作线程可以同时承载大量等待 I/O 的慢请求。
+//
+// 等待期间客户端连接上不注册事件（EPOLLONESHOT），连接不会被关闭，协程帧和 coro_request 始终有效；
+// 客户端在等待期间断开要等处理函数结束、写响应时才会发现。
+//
+// 挂起时只记录要等待什么，由 http_conn 在协程挂起、工作线程不再访问连接之后调用 arm 真正注册，
+// 避免事件在协程完全挂起之前到达、另一个工作线程同时恢复同一个协程。
+class coro_request
+{
+public:
+    typedef coro_task (*handler)(coro_request& req);
+
+    // 等待的 fd 到客户端 fd 的映射表大小
+    static const int MAX_FD = 65536;
+    // 读文件的 I/O 线程数
+    static const int IO_THREADS = 2;
+
+    // 当前等待的事件
+    enum WAIT { WAIT_NONE = 0, WAIT_FD, WAIT_TIMER, WAIT_FILE };
+
+    // 等待 fd 可读或可写，co_await 的结果是 epoll 返回的事件
+    class fd_awaiter
+    {
+    public:
+        fd_awaiter(coro_request& req, int fd, uint32_t events) : m_req(req), m_fd(fd), m_events(events) {}
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<>) { m_req.wait_fd(m_fd, m_events); }
+        uint32_t await_resume() const { return m_req.m_revents; }
+
+    private:
+        coro_request& m_req;
+        int m_fd;
+        uint32_t m_events;
+    };
+
+    // 非阻塞 recv/send，暂时不能完成时等待 fd 就绪后再做一次
+    // co_await 的结果是传输的字节数，出错返回 -errno
+    class io_awaiter
+    {
+    public:
+        io_awaiter(coro_request& req, int fd, void* buf, size_t len, bool write)
+            : m_req(req), m_fd(fd), m_buf(buf), m_len(len), m_write(write), m_result(0) {}
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<>) { m_req.wait_fd(m_fd, m_write ? EPOLLOUT : EPOLLIN); }
+        ssize_t await_resume();
+
+    private:
+        ssize_t attempt();
+
+    private:
+        coro_request& m_req;
+        int m_fd;
+        void* m_buf;
+        size_t m_len;
+        bool m_write;
+        ssize_t m_result;
+    };
+
+    // 定时器
+    class timer_awaiter
+    {
+    public:
+        timer_awaiter(coro_request& req, unsigned ms) : m_req(req), m_ms(ms) {}
+        bool await_ready() const { return m_ms == 0; }
+        void await_suspend(std::coroutine_handle<>) { m_req.wait_timer(m_ms); }
+        void await_resume() const {}
+
+    private:
+        coro_request& m_req;
+        unsigned m_ms;
+    };
+
+    // 在 I/O 线程中 pread 普通文件（epoll 不支持普通文件），结果是读到的字节数，出错返回 -errno
+    class file_awaiter
+    {
+    public:
+        file_awaiter(coro_request& req, int fd, void* buf, size_t len, off_t offset)
+            : m_req(req), m_fd(fd), m_buf(buf), m_len(len), m_offset(offset) {}
+        bool await_ready() const { return m_len == 0; }
+        void await_suspend(std::coroutine_handle<>) { m_req.wait_file(m_fd, m_buf, m_len, m_offset); }
+        ssize_t await_resume() const { return m_len == 0 ? 0 : m_req.m_result; }
+
+    private:
+        coro_request& m_req;
+        int m_fd;
+        void* m_buf;
+        size_t m_len;
+        off_t m_offset;
+    };
+
+public:
+    // coro_request 本身、路径和请求体都从 arena 中分配，http_conn 在请求结束时析构它并重置 arena
+    coro_request(handler h, request_arena& arena, int client_fd, const char* method, const char* url,
+                 const char* body, size_t body_len);
+
+    // 给处理函数使用的请求信息
+    const char* method() const { return m_method; }
+    const arena_string& path() const { return m_path; }
+    const arena_string& query() const { return m_query; }
+    const arena_string& body() const { return m_body; }
+    // 请求的内存池，处理函数的临时数据可以用 std::pmr 容器放在这里，请求结束时一起释放
+    request_arena& arena() { return m_arena; }
+    // 路由模式中的参数，没有返回 NULL
+    const std::string* param(const char* name) const;
+
+    // 生成响应，默认 200 text/html，content_type 必须是字符串常量
+    void set_status(int status) { m_status = status; }
+    void set_content_type(const char* type) { m_content_type = type; }
+    // 额外的响应头，例如重定向的 Location
+    void add_header(const char* name, const std::string& value);
+    std::string& response() { return m_response; }
+
+    // 等待对象
+    fd_awaiter readable(int fd) { return fd_awaiter(*this, fd, EPOLLIN); }
+    fd_awaiter writable(int fd) { return fd_awaiter(*this, fd, EPOLLOUT); }
+    io_awaiter recv(int fd, void* buf, size_t len) { return io_awaiter(*this, fd, buf, len, false); }
+    io_awaiter send(int fd, const void* buf, size_t len) { return io_awaiter(*this, fd, (void*)buf, len, true); }
+    timer_awaiter sleep(unsigned ms) { return timer_awaiter(*this, ms); }
+    file_awaiter read_file(int fd, void* buf, size_t len, off_t offset) { return file_awaiter(*this, fd, buf, len, offset); }
+
+    // 下面由 http_conn 和主线程调用
+    // 开始执行或者从挂起处继续执行处理函数，返回 true 表示处理函数已经结束
+    bool start();
+    bool resume();
+    // 协程挂起之后把等待的 fd 注册到 epoll，必须是工作线程对连接的最后一个操作
+    // 返回 false 表示无法等待（结果已经设置为错误），应该立即继续执行协程
+    bool arm(int epollfd);
+    // 等待的 fd 就绪（主线程），注销 fd，之后把连接放回请求队列
+    void wake(int epollfd, uint32_t events);
+
+    std::vector<std::pair<std::string, std::string> >& params() { return m_params; }
+    int status() const { return m_status; }
+    const char* content_type() const { return m_content_type; }
+    const arena_string& headers() const { return m_headers; }
+    static const char* status_title(int status);
+
+    // 等待的 fd 属于哪个客户端连接，不属于任何协程返回 -1
+    static int client_of(int fd);
+
+    // 内置的处理函数
+    // 健康检查，回复 ok
+    static coro_task health(coro_request& req);
+    // 演示：等待 ms 参数指定的毫秒数后回复
+    static coro_task delay(coro_request& req);
+
+private:
+    void wait_fd(int fd, uint32_t events);
+    void wait_timer(unsigned ms);
+    void wait_file(int fd, void* buf, size_t len, off_t offset);
+    bool fail_wait(int err);
+
+    static void* io_worker(void* arg);
+    static void start_io_threads();
+
+private:
+    handler m_handler;
+    request_arena& m_arena;
+    int m_client_fd;
+    const char* m_method;
+    arena_string m_path;
+    arena_string m_query;
+    arena_string m_body;
+    std::vector<std::pair<std::string, std::string> > m_params;
+
+    int m_status;
+    const char* m_content_type;
+    arena_string m_headers;
+    std::string m_response;     // 换到 http_conn::m_body 中发送，不从 arena 分配
+
+    coro_task m_task;
+
+    // 等待状态
+    WAIT m_wait;
+    int m_wait_fd;          // 注册到 epoll 的 fd，定时器和读文件是自己创建的 timerfd/eventfd
+    uint32_t m_wait_events;
+    unsigned m_timer_ms;
+    uint32_t m_revents;     // fd 就绪时 epoll 返回的事件
+    ssize_t m_result;       // 读文件的结果
+
+    // 读文件的参数
+    int m_file_fd;
+    void* m_file_buf;
+    size_t m_file_len;
+    off_t m_file_offset;
+
+    static int m_owner[MAX_FD];     // 等待的 fd -> 客户端 fd + 1
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "file_reader.h"
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <list>
+#include "../lock/locker.h"
+
+struct read_task
+{
+    const char* addr;
+    size_t len;
+    file_reader::callback done;
+    void* arg;
+};
+
+static std::list<read_task> queue;
+static locker queue_lock;
+static sem queue_sem;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static long page_size()
+{
+    static long page = sysconf(_SC_PAGESIZE);
+    return page;
+}
+
+bool file_reader::resident(const char* addr, size_t len)
+{
+    if (len == 0)
+    {
+        return true;
+    }
+    long page = page_size();
+    char* start = (char*)((uintptr_t)addr & ~(uintptr_t)(page - 1));
+    size_t pages = (addr + len - start + page - 1) / page;
+    unsigned char vec[WINDOW / 4096 + 2];
+    if (pages > sizeof(vec) || mincore(start, pages * page, vec) < 0)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < pages; ++i)
+    {
+        if (!(vec[i] & 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void file_reader::submit(const char* addr, size_t len, callback done, void* arg)
+{
+    pthread_once(&once, start_threads);
+    read_task t = { addr, len, done, arg };
+    queue_lock.lock();
+    queue.push_back(t);
+    queue_lock.unlock();
+    queue_sem.post();
+}
+
+void file_reader::start_threads()
+{
+    for (int i = 0; i < THREADS; ++i)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker, NULL) == 0)
+        {
+            pthread_detach(tid);
+        }
+    }
+}
+
+void* file_reader::worker(void*)
+{
+    long page = page_size();
+    while (true)
+    {
+        queue_sem.wait();
+        queue_lock.lock();
+        if (queue.empty())
+        {
+            queue_lock.unlock();
+            continue;
+        }
+        read_task t = queue.front();
+        queue.pop_front();
+        queue_lock.unlock();
+
+        // 整个窗口一起发起预读，逐页访问时大多只需要等待已经在进行的 I/O
+        char* start = (char*)((uintptr_t)t.addr & ~(uintptr_t)(page - 1));
+        madvise(start, t.addr + t.len - start, MADV_WILLNEED);
+        volatile char c;
+        for (const char* p = start; p < t.addr + t.len; p += page)
+        {
+            c = *p; // 映射从页边界开始，start 一定在映射内
+        }
+        (void)c;
+        t.done(t.arg);
+    }
+    return NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef FILEREADER_H
+#define FILEREADER_H
+
+#include <stddef.h>
+
+// 把文件映射中不在页缓存的部分读进来的 I/O 线程
+// 静态文件由主线程直接从映射中 writev，碰到不在页缓存中的页会缺页，整个事件循环阻塞在磁盘 I/O 上。
+// 发送前用 mincore 检查接下来的一个窗口，不在页缓存中时交给这里：先 MADV_WILLNEED 让内核一次发起整个窗口的预读，
+// 再逐页访问等待读完，然后调用 done 通知连接继续发送。
+// 提交之后、done 之前连接不能被关闭或者解除映射，调用者保证这段时间连接上没有注册事件。
+class file_reader
+{
+public:
+    // I/O 线程数
+    static const int THREADS = 2;
+    // 每次检查、读入的范围
+    static const size_t WINDOW = 256 * 1024;
+
+    typedef void (*callback)(void* arg);
+
+public:
+    // [addr, addr + len) 是否全部在页缓存中，addr 不需要按页对齐
+    static bool resident(const char* addr, size_t len);
+    // 在 I/O 线程中把 [addr, addr + len) 读入页缓存，完成后在 I/O 线程中调用 done(arg)
+    static void submit(const char* addr, size_t len, callback done, void* arg);
+
+private:
+    static void* worker(void* arg);
+    static void start_threads();
+};
+
+#endif
@@ -0,0 +1,244 @@
+#include "neg_cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/random.h>
+#include <map>
+#include <string>
+#include "../stats/stats.h"
+#include "../memory/mem_budget.h"
+
+std::atomic<neg_cache::slot*> neg_cache::m_slots(NULL);
+uint64_t neg_cache::m_seed = 0;
+std::atomic<uint32_t> neg_cache::m_generation(0);
+
+// 监视的事件：目录里出现了新的名字，或者目录本身被删除、移走
+static const uint32_t WATCH_MASK = IN_CREATE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+// 子目录最多监视到这一层，防止符号链接成环
+static const int MAX_DEPTH = 16;
+
+// 监视的状态，启动时在调用线程中初始化，之后只在监视线程中使用
+static int inotify_fd = -1;
+static std::string root_dir;
+static std::map<int, std::string> watched; // wd -> 目录
+
+// 毫秒时间，32位回绕（约49天）不影响差值计算
+static uint32_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static size_t table_size()
+{
+    return neg_cache::SETS * neg_cache::WAYS * 16;
+}
+
+// 监视 dir 和它下面所有的子目录（包括指向目录的符号链接）
+static bool watch_tree(const std::string& dir, int depth)
+{
+    int wd = inotify_add_watch(inotify_fd, dir.c_str(), WATCH_MASK);
+    if (wd < 0)
+    {
+        return errno == ENOENT || errno == ENOTDIR; // 已经被删除了，里面的路径本来就不存在
+    }
+    watched[wd] = dir;
+    if (depth >= MAX_DEPTH)
+    {
+        return true;
+    }
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+    {
+        return true;
+    }
+    bool ok = true;
+    struct dirent* e;
+    while (ok && (e = readdir(d)) != NULL)
+    {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+        {
+            continue;
+        }
+        std::string path = dir + "/" + e->d_name;
+        struct stat st;
+        if (e->d_type == DT_DIR || ((e->d_type == DT_LNK || e->d_type == DT_UNKNOWN) && stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)))
+        {
+            ok = watch_tree(path, depth + 1);
+        }
+    }
+    closedir(d);
+    return ok;
+}
+
+void neg_cache::start(const char* root)
+{
+    root_dir = root;
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0 || !watch_tree(root_dir, 0))
+    {
+        printf("cannot watch %s: %s, negative lookup cache disabled\n", root, strerror(errno));
+        return;
+    }
+    void* mem = mmap(NULL, table_size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return;
+    }
+    // 带随机种子的哈希，客户端无法构造和存在的文件冲突的路径
+    if (getrandom(&m_seed, sizeof(m_seed), 0) != sizeof(m_seed))
+    {
+        m_seed = ((uint64_t)getpid() << 32) ^ server_stats::now_ns();
+    }
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, watcher, NULL) != 0)
+    {
+        munmap(mem, table_size());
+        return;
+    }
+    pthread_detach(tid);
+    mem_budget::charge(mem_budget::FILES, table_size());
+    m_slots.store((slot*)mem, std::memory_order_release);
+}
+
+// 64 位 FNV-1a，以种子为初始值，最后再混合一次让低位也均匀
+uint64_t neg_cache::hash(const char* path, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^ m_seed;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)path[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h ? h : 1;
+}
+
+bool neg_cache::missing(const char* path, size_t len)
+{
+    slot* slots = m_slots.load(std::memory_order_acquire);
+    if (!slots)
+    {
+        return false;
+    }
+    uint64_t key = hash(path, len);
+    slot* set = slots + (key & (SETS - 1)) * WAYS;
+    uint32_t now = now_ms();
+    for (int i = 0; i < WAYS; ++i)
+    {
+        if (set[i].key.load(std::memory_order_acquire) == key)
+        {
+            return (int32_t)(set[i].expire.load(std::memory_order_relaxed) - now) > 0;
+        }
+    }
+    return false;
+}
+
+void neg_cache::add(const char* path, size_t len, uint32_t generation)
+{
+    slot* slots = m_slots.load(std::memory_order_acquire);
+    if (!slots || m_generation.load(std::memory_order_acquire) != generation)
+    {
+        return;
+    }
+    uint64_t key = hash(path, len);
+    slot* set = slots + (key & (SETS - 1)) * WAYS;
+    uint32_t now = now_ms();
+    // 已有的槽或者最早过期的槽（空槽最先）
+    slot* victim = set;
+    int32_t soonest = INT32_MAX;
+    for (int i = 0; i < WAYS; ++i)
+    {
+        uint64_t k = set[i].key.load(std::memory_order_relaxed);
+        if (k == key)
+        {
+            victim = &set[i];
+            break;
+        }
+        int32_t left = k ? (int32_t)(set[i].expire.load(std::memory_order_relaxed) - now) : INT32_MIN;
+        if (left < soonest)
+        {
+            soonest = left;
+            victim = &set[i];
+        }
+    }
+    victim->expire.store(now + TTL_MS, std::memory_order_relaxed);
+    victim->key.store(key, std::memory_order_release);
+    // 插入的同时缓存被清空了：清空可能发生在插入之前，自己把这个槽删掉
+    if (m_generation.load(std::memory_order_acquire) != generation)
+    {
+        victim->key.compare_exchange_strong(key, 0, std::memory_order_acq_rel);
+    }
+}
+
+void neg_cache::clear()
+{
+    // 先改代数再清空，stat 在清空之前开始的插入会发现代数变了
+    m_generation.fetch_add(1, std::memory_order_acq_rel);
+    slot* slots = m_slots.load(std::memory_order_acquire);
+    if (slots)
+    {
+        madvise(slots, table_size(), MADV_DONTNEED); // 匿名映射的页被释放，再访问时是全 0，也就是空槽
+        server_stats::add(server_stats::NEG_CACHE_CLEARS);
+    }
+}
+
+void* neg_cache::watcher(void* arg)
+{
+    alignas(struct inotify_event) char buf[4096];
+    while (true)
+    {
+        ssize_t n = read(inotify_fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        bool ok = true;
+        for (char* p = buf; p < buf + n; )
+        {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                // 丢失了事件，可能有没有监视到的新目录，重新扫描一遍
+                ok = ok && watch_tree(root_dir, 0);
+            }
+            else if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)) && ev->len)
+            {
+                std::map<int, std::string>::iterator it = watched.find(ev->wd);
+                if (it != watched.end())
+                {
+                    ok = ok && watch_tree(it->second + "/" + ev->name, 1);
+                }
+            }
+            else if (ev->mask & IN_IGNORED)
+            {
+                watched.erase(ev->wd);
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+        if (!ok)
+        {
+            break;
+        }
+        clear();
+    }
+    // 不能继续监视，关闭缓存
+    printf("negative lookup cache disabled: %s\n", strerror(errno));
+    m_slots.store(NULL, std::memory_order_release);
+    clear();
+    return arg;
+}
@@ -0,0 +1,54 @@
+#ifndef NEGCACHE_H
+#define NEGCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// 不存在的路径的缓存：扫描器和爬虫请求的 /wp-login.php、/.env 之类的路径每次都要拼接路径再 stat 一次，
+// 记住最近 stat 失败（ENOENT/ENOTDIR）的规范化路径，再次请求时（包括同一路径的其它写法）不访问文件系统直接回复 404。
+// 固定大小的组相联哈希表：每组 WAYS 个槽刚好占一个 cache line，槽里只存路径的 64 位带随机种子的哈希和过期时间，
+// 组满时替换最早过期的槽。槽的内容都是原子变量，多个线程同时查找、插入不需要加锁。
+//
+// 用 inotify 监视网站根目录和所有子目录，有文件或目录被创建、移入时清空整个缓存（新的子目录同时加入监视）。
+// 另外每个槽最多保留 TTL_MS，覆盖 inotify 看不到的修改（例如网络文件系统）。无法监视时不启用缓存。
+// 第一次使用时在当前进程中启动监视线程，多进程模式下每个工作进程各自监视。
+class neg_cache
+{
+public:
+    // 每组的槽数
+    static const int WAYS = 4;
+    // 组数，表的大小是 SETS * WAYS * 16 字节
+    static const size_t SETS = 4096;
+    // 槽的最长保留时间
+    static const uint32_t TTL_MS = 30000;
+
+public:
+    // 开始监视 root，失败时缓存保持关闭
+    static void start(const char* root);
+    // path 是规范化后的 url 路径（见 http_conn::map_file），是否最近确认过不存在
+    static bool missing(const char* path, size_t len);
+    // stat 之前取一次，插入时如果期间缓存被清空过就不插入（stat 的结果可能已经过时）
+    static uint32_t generation() { return m_generation.load(std::memory_order_acquire); }
+    static void add(const char* path, size_t len, uint32_t generation);
+    // 清空缓存并把表的内存还给内核（目录变化、内存紧张时）
+    static void clear();
+
+private:
+    struct slot
+    {
+        std::atomic<uint64_t> key;      // 0 表示空槽
+        std::atomic<uint32_t> expire;   // 过期的毫秒时间
+        uint32_t pad;
+    };
+
+    static uint64_t hash(const char* path, size_t len);
+    static void* watcher(void* arg);
+
+private:
+    static std::atomic<slot*> m_slots;  // 未启用时为 NULL
+    static uint64_t m_seed;
+    static std::atomic<uint32_t> m_generation;
+};
+
+#endif
@@ -0,0 +1,548 @@
+#include "hpack.h"
+
+// 静态表条目
+struct hpack_entry_view
+{
+    const char* name;
+    const char* value;
+};
+
+// RFC 7541 附录B 的哈夫曼编码表，下标为符号，256 为 EOS
+static const uint32_t huffman_codes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff
+};
+static const uint8_t huffman_code_len[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+};
+
+// RFC 7541 附录A 的静态表，索引从1开始
+static const hpack_entry_view static_table[hpack_table::STATIC_TABLE_SIZE] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" }
+};
+
+
+// 哈夫曼解码树的节点，child 为 -1 表示没有子节点，sym 为 -1 表示内部节点
+struct huffman_node
+{
+    int16_t child[2];
+    int16_t sym;
+};
+
+// 257 个叶子的满二叉树共 513 个节点
+static huffman_node huffman_tree[513];
+
+// 根据编码表构建解码树，在 main 之前由静态对象完成，避免多线程下重复构建
+static struct huffman_tree_builder
+{
+    huffman_tree_builder()
+    {
+        int count = 1;
+        huffman_tree[0].child[0] = huffman_tree[0].child[1] = -1;
+        huffman_tree[0].sym = -1;
+        for (int sym = 0; sym < 257; ++sym)
+        {
+            int node = 0;
+            for (int i = huffman_code_len[sym] - 1; i >= 0; --i)
+            {
+                int bit = (huffman_codes[sym] >> i) & 1;
+                if (huffman_tree[node].child[bit] < 0)
+                {
+                    huffman_tree[count].child[0] = huffman_tree[count].child[1] = -1;
+                    huffman_tree[count].sym = -1;
+                    huffman_tree[node].child[bit] = count++;
+                }
+                node = huffman_tree[node].child[bit];
+            }
+            huffman_tree[node].sym = sym;
+        }
+    }
+} huffman_builder;
+
+bool huffman_decode(const uint8_t* data, size_t len, std::string& out)
+{
+    int node = 0;
+    int depth = 0;          // 当前未完成符号已经读了多少位
+    bool all_ones = true;   // 未完成的位是否全为1（合法的填充）
+    out.clear();
+    for (size_t i = 0; i < len; ++i)
+    {
+        for (int shift = 7; shift >= 0; --shift)
+        {
+            int bit = (data[i] >> shift) & 1;
+            node = huffman_tree[node].child[bit];
+            if (node < 0)
+            {
+                return false;
+            }
+            ++depth;
+            all_ones = all_ones && bit;
+            if (huffman_tree[node].sym >= 0)
+            {
+                // 字符串中出现 EOS 是解码错误
+                if (huffman_tree[node].sym == 256)
+                {
+                    return false;
+                }
+                out.push_back((char)huffman_tree[node].sym);
+                node = 0;
+                depth = 0;
+                all_ones = true;
+            }
+        }
+    }
+    // 填充必须是 EOS 的前缀（全1）且不超过7位
+    return depth <= 7 && all_ones;
+}
+
+size_t huffman_encoded_len(const std::string& in)
+{
+    size_t bits = 0;
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+        bits += huffman_code_len[(uint8_t)in[i]];
+    }
+    return (bits + 7) / 8;
+}
+
+void huffman_encode(const std::string& in, std::string& out)
+{
+    uint64_t acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+        uint8_t c = (uint8_t)in[i];
+        acc = (acc << huffman_code_len[c]) | huffman_codes[c];
+        bits += huffman_code_len[c];
+        while (bits >= 8)
+        {
+            bits -= 8;
+            out.push_back((char)(acc >> bits));
+        }
+    }
+    if (bits > 0)
+    {
+        // 用 EOS 的高位（全1）填充最后一个字节
+        out.push_back((char)((acc << (8 - bits)) | (0xff >> bits)));
+    }
+}
+
+// 解码一个带 prefix 位前缀的整数 (RFC 7541 5.1)
+static bool decode_int(const uint8_t*& p, const uint8_t* end, int prefix, uint32_t& value)
+{
+    if (p >= end)
+    {
+        return false;
+    }
+    uint32_t max_prefix = (1u << prefix) - 1;
+    uint64_t v = *p++ & max_prefix;
+    if (v < max_prefix)
+    {
+        value = (uint32_t)v;
+        return true;
+    }
+    int shift = 0;
+    while (p < end)
+    {
+        // 31 位的值最多需要 5 个后续字节，更长的编码（例如重复的 0x80）直接拒绝，移位也不会超过 64
+        if (shift > 28)
+        {
+            return false;
+        }
+        uint8_t b = *p++;
+        v += (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+        if (v > 0x7fffffff)
+        {
+            return false;
+        }
+        if (!(b & 0x80))
+        {
+            value = (uint32_t)v;
+            return true;
+        }
+    }
+    return false;
+}
+
+// 编码整数，first 是第一个字节中前缀之外的标志位
+static void encode_int(std::string& out, uint8_t first, int prefix, size_t value)
+{
+    size_t max_prefix = (1u << prefix) - 1;
+    if (value < max_prefix)
+    {
+        out.push_back((char)(first | value));
+        return;
+    }
+    out.push_back((char)(first | max_prefix));
+    value -= max_prefix;
+    while (value >= 128)
+    {
+        out.push_back((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+// 解码字符串字面量 (RFC 7541 5.2)
+static bool decode_string(const uint8_t*& p, const uint8_t* end, std::string& out)
+{
+    if (p >= end)
+    {
+        return false;
+    }
+    bool huffman = (*p & 0x80) != 0;
+    uint32_t len = 0;
+    if (!decode_int(p, end, 7, len) || len > (size_t)(end - p))
+    {
+        return false;
+    }
+    if (huffman)
+    {
+        if (!huffman_decode(p, len, out))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        out.assign((const char*)p, len);
+    }
+    p += len;
+    return true;
+}
+
+// 编码字符串字面量，哈夫曼编码更短时使用哈夫曼编码
+static void encode_string(std::string& out, const std::string& s)
+{
+    size_t huff_len = huffman_encoded_len(s);
+    if (huff_len < s.size())
+    {
+        encode_int(out, 0x80, 7, huff_len);
+        huffman_encode(s, out);
+    }
+    else
+    {
+        encode_int(out, 0x00, 7, s.size());
+        out.append(s);
+    }
+}
+
+hpack_table::hpack_table() : m_size(0), m_max_size(DEFAULT_MAX_SIZE)
+{
+}
+
+bool hpack_table::get(size_t index, hpack_header& header) const
+{
+    if (index == 0)
+    {
+        return false;
+    }
+    if (index <= STATIC_TABLE_SIZE)
+    {
+        header.name = static_table[index - 1].name;
+        header.value = static_table[index - 1].value;
+        return true;
+    }
+    index -= STATIC_TABLE_SIZE + 1;
+    if (index >= m_dynamic.size())
+    {
+        return false;
+    }
+    header = m_dynamic[index];
+    return true;
+}
+
+void hpack_table::evict(size_t target)
+{
+    while (m_size > target && !m_dynamic.empty())
+    {
+        const hpack_header& old = m_dynamic.back();
+        m_size -= old.name.size() + old.value.size() + ENTRY_OVERHEAD;
+        m_dynamic.pop_back();
+    }
+}
+
+void hpack_table::add(const std::string& name, const std::string& value)
+{
+    size_t entry_size = name.size() + value.size() + ENTRY_OVERHEAD;
+    if (entry_size > m_max_size)
+    {
+        // 比整张表还大的条目会清空动态表，自身也不插入
+        evict(0);
+        return;
+    }
+    evict(m_max_size - entry_size);
+    hpack_header header;
+    header.name = name;
+    header.value = value;
+    m_dynamic.push_front(header);
+    m_size += entry_size;
+}
+
+void hpack_table::set_max_size(size_t size)
+{
+    m_max_size = size;
+    evict(m_max_size);
+}
+
+size_t hpack_table::find(const std::string& name, const std::string& value, bool& value_match) const
+{
+    size_t name_index = 0;
+    value_match = false;
+    for (size_t i = 0; i < STATIC_TABLE_SIZE; ++i)
+    {
+        if (name == static_table[i].name)
+        {
+            if (value == static_table[i].value)
+            {
+                value_match = true;
+                return i + 1;
+            }
+            if (!name_index)
+            {
+                name_index = i + 1;
+            }
+        }
+    }
+    for (size_t i = 0; i < m_dynamic.size(); ++i)
+    {
+        if (m_dynamic[i].name == name)
+        {
+            if (m_dynamic[i].value == value)
+            {
+                value_match = true;
+                return i + STATIC_TABLE_SIZE + 1;
+            }
+            if (!name_index)
+            {
+                name_index = i + STATIC_TABLE_SIZE + 1;
+            }
+        }
+    }
+    return name_index;
+}
+
+hpack_decoder::hpack_decoder()
+{
+}
+
+bool hpack_decoder::decode(const uint8_t* data, size_t len, std::vector<hpack_header>& headers)
+{
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    uint32_t index = 0;
+    while (p < end)
+    {
+        uint8_t b = *p;
+        hpack_header header;
+        if (b & 0x80)
+        {
+            // 索引头部字段
+            if (!decode_int(p, end, 7, index) || !m_table.get(index, header))
+            {
+                return false;
+            }
+            headers.push_back(header);
+        }
+        else if ((b & 0xe0) == 0x20)
+        {
+            // 动态表大小更新，不能超过我们通告的 SETTINGS_HEADER_TABLE_SIZE
+            if (!decode_int(p, end, 5, index) || index > hpack_table::DEFAULT_MAX_SIZE)
+            {
+                return false;
+            }
+            m_table.set_max_size(index);
+        }
+        else
+        {
+            // 字面量：01 增量索引，0000 不索引，0001 永不索引
+            bool indexing = (b & 0xc0) == 0x40;
+            if (!decode_int(p, end, indexing ? 6 : 4, index))
+            {
+                return false;
+            }
+            if (index)
+            {
+                if (!m_table.get(index, header))
+                {
+                    return false;
+                }
+            }
+            else if (!decode_string(p, end, header.name))
+            {
+                return false;
+            }
+            if (!decode_string(p, end, header.value))
+            {
+                return false;
+            }
+            if (indexing)
+            {
+                m_table.add(header.name, header.value);
+            }
+            headers.push_back(header);
+        }
+    }
+    return true;
+}
+
+hpack_encoder::hpack_encoder() : m_size_update(false)
+{
+}
+
+void hpack_encoder::set_max_table_size(size_t size)
+{
+    // 编码器使用的表不超过默认大小，对端允许更大时也不扩大
+    if (size > hpack_table::DEFAULT_MAX_SIZE)
+    {
+        size = hpack_table::DEFAULT_MAX_SIZE;
+    }
+    if (size != m_table.max_size())
+    {
+        m_table.set_max_size(size);
+        m_size_update = true;
+    }
+}
+
+void hpack_encoder::encode(const std::string& name, const std::string& value, bool indexing, std::string& out)
+{
+    if (m_size_update)
+    {
+        encode_int(out, 0x20, 5, m_table.max_size());
+        m_size_update = false;
+    }
+
+    bool value_match = false;
+    size_t index = m_table.find(name, value, value_match);
+    if (index && value_match)
+    {
+        encode_int(out, 0x80, 7, index);
+        return;
+    }
+
+    if (indexing)
+    {
+        encode_int(out, 0x40, 6, index);
+    }
+    else
+    {
+        encode_int(out, 0x00, 4, index);
+    }
+    if (!index)
+    {
+        encode_string(out, name);
+    }
+    encode_string(out, value);
+    if (indexing)
+    {
+        m_table.add(name, value);
+    }
+}
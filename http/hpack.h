@@ -0,0 +1,88 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <deque>
+#include <vector>
+
+// HPACK 头部压缩 (RFC 7541)，供 HTTP/2 分帧层使用
+
+// 一个头部字段
+struct hpack_header
+{
+    std::string name;
+    std::string value;
+};
+
+// 头部索引表：1 ~ 61 是静态表，62 之后是动态表（最新插入的条目索引最小）
+class hpack_table
+{
+public:
+    // 静态表条目个数
+    static const size_t STATIC_TABLE_SIZE = 61;
+    // 每个条目在计算表大小时额外占用的字节数
+    static const size_t ENTRY_OVERHEAD = 32;
+    // 动态表默认的最大字节数，等于 SETTINGS_HEADER_TABLE_SIZE 的默认值
+    static const size_t DEFAULT_MAX_SIZE = 4096;
+
+public:
+    hpack_table();
+
+    // 按索引取条目，索引非法返回 false
+    bool get(size_t index, hpack_header& header) const;
+    // 往动态表插入一个条目，空间不足时淘汰最老的条目
+    void add(const std::string& name, const std::string& value);
+    // 查找条目，返回名字和值都匹配的索引（value_match 置 true），
+    // 否则返回只有名字匹配的索引，都没有返回 0
+    size_t find(const std::string& name, const std::string& value, bool& value_match) const;
+
+    void set_max_size(size_t size);
+    size_t max_size() const { return m_max_size; }
+
+private:
+    void evict(size_t target);
+
+private:
+    std::deque<hpack_header> m_dynamic; // 动态表，front 是最新的条目
+    size_t m_size;                      // 动态表当前大小
+    size_t m_max_size;                  // 动态表最大大小
+};
+
+// 解码器，每个连接一个，动态表跨头部块保持状态
+class hpack_decoder
+{
+public:
+    hpack_decoder();
+
+    // 解码一个完整的头部块（HEADERS + CONTINUATION 拼接后的内容）
+    // 格式错误返回 false，调用者应以 COMPRESSION_ERROR 关闭连接
+    bool decode(const uint8_t* data, size_t len, std::vector<hpack_header>& headers);
+
+private:
+    hpack_table m_table;
+};
+
+// 编码器，每个连接一个
+class hpack_encoder
+{
+public:
+    hpack_encoder();
+
+    // 对端通过 SETTINGS_HEADER_TABLE_SIZE 通告了新的表大小
+    void set_max_table_size(size_t size);
+    // 编码一个头部字段追加到 out，indexing 为 true 时把它加入动态表
+    void encode(const std::string& name, const std::string& value, bool indexing, std::string& out);
+
+private:
+    hpack_table m_table;
+    bool m_size_update;     // 下一个头部块开头需要发送动态表大小更新
+};
+
+// 哈夫曼编解码，解码失败返回 false
+bool huffman_decode(const uint8_t* data, size_t len, std::string& out);
+void huffman_encode(const std::string& in, std::string& out);
+size_t huffman_encoded_len(const std::string& in);
+
+#endif
@@ -0,0 +1,688 @@
+#include "http2_conn.h"
+#include "../stats/stats.h"
+#include "../memory/mem_budget.h"
+
+// 错误页面定义在 http_conn.cpp 中，HTTP/2 响应复用同样的内容
+extern const char* error_400_form;
+extern const char* error_403_form;
+extern const char* error_404_form;
+extern const char* error_500_form;
+
+const char* const http2_conn::PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_u32(std::string& out, uint32_t v)
+{
+    out.push_back((char)(v >> 24));
+    out.push_back((char)(v >> 16));
+    out.push_back((char)(v >> 8));
+    out.push_back((char)v);
+}
+
+// 解码 HTTP2-Settings 头部使用的 base64url（无填充）
+static bool base64url_decode(const char* in, std::string& out)
+{
+    uint32_t acc = 0;
+    int bits = 0;
+    for (; *in && *in != ' ' && *in != '\t'; ++in)
+    {
+        char c = *in;
+        int v;
+        if (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '-' || c == '+') v = 62;
+        else if (c == '_' || c == '/') v = 63;
+        else if (c == '=') break;
+        else return false;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            out.push_back((char)(acc >> bits));
+        }
+    }
+    return true;
+}
+
+http2_conn::http2_conn() :
+    m_preface_received(false), m_in_pos(0), m_out_pos(0),
+    m_last_stream_id(0), m_continuation_id(0), m_rr_last(0), m_goaway(false), m_shutdown(false),
+    m_send_window(DEFAULT_WINDOW_SIZE), m_peer_initial_window(DEFAULT_WINDOW_SIZE),
+    m_peer_max_frame(DEFAULT_MAX_FRAME_SIZE)
+{
+}
+
+http2_conn::~http2_conn()
+{
+    while (!m_streams.empty())
+    {
+        close_stream(m_streams.begin()->first);
+    }
+}
+
+void http2_conn::init_prior_knowledge()
+{
+    // 服务器的连接序言就是一个 SETTINGS 帧
+    add_settings();
+}
+
+void http2_conn::init_upgrade(const char* settings, http_conn::HTTP_CODE code, char* file_address, size_t file_size)
+{
+    m_out.append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    add_settings();
+
+    // HTTP2-Settings 头部携带的是 SETTINGS 帧的负载
+    std::string payload;
+    if (settings && base64url_decode(settings, payload))
+    {
+        for (size_t i = 0; i + 6 <= payload.size(); i += 6)
+        {
+            const uint8_t* p = (const uint8_t*)payload.data() + i;
+            apply_setting((uint16_t)((p[0] << 8) | p[1]), get_u32(p + 2));
+        }
+    }
+
+    // 升级请求作为 stream 1，对客户端来说已经是半关闭状态
+    stream& s = m_streams[1];
+    s.id = 1;
+    s.remote_closed = true;
+    s.end_stream = true;
+    s.head_only = false;
+    s.send_window = m_peer_initial_window;
+    s.responding = false;
+    s.file_address = 0;
+    s.file_size = 0;
+    m_last_stream_id = 1;
+    respond(s, code, file_address, file_size);
+}
+
+void http2_conn::feed(const char* data, int len)
+{
+    m_in.append(data, len);
+}
+
+void http2_conn::consume(size_t len)
+{
+    m_out_pos += len;
+    if (m_out_pos == m_out.size())
+    {
+        m_out.clear();
+        m_out_pos = 0;
+    }
+}
+
+void http2_conn::process()
+{
+    if (!m_preface_received)
+    {
+        size_t n = m_in.size() < (size_t)PREFACE_LEN ? m_in.size() : PREFACE_LEN;
+        if (memcmp(m_in.data(), PREFACE, n) != 0)
+        {
+            add_goaway(ERR_PROTOCOL);
+            return;
+        }
+        if (n < (size_t)PREFACE_LEN)
+        {
+            return;
+        }
+        m_in_pos = PREFACE_LEN;
+        m_preface_received = true;
+    }
+
+    while (!m_goaway && m_in.size() - m_in_pos >= (size_t)FRAME_HEADER_LEN)
+    {
+        const uint8_t* p = (const uint8_t*)m_in.data() + m_in_pos;
+        uint32_t len = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        uint8_t type = p[3];
+        uint8_t flags = p[4];
+        uint32_t stream_id = get_u32(p + 5) & 0x7fffffff;
+
+        // 我们没有修改 SETTINGS_MAX_FRAME_SIZE，对端的帧不能超过默认值
+        if (len > DEFAULT_MAX_FRAME_SIZE)
+        {
+            add_goaway(ERR_FRAME_SIZE);
+            break;
+        }
+        if (m_in.size() - m_in_pos < FRAME_HEADER_LEN + len)
+        {
+            break; // 帧不完整，继续读
+        }
+        m_in_pos += FRAME_HEADER_LEN + len;
+        if (!handle_frame(type, flags, stream_id, p + FRAME_HEADER_LEN, len))
+        {
+            break;
+        }
+    }
+
+    // 丢弃已经处理的输入
+    m_in.erase(0, m_in_pos);
+    m_in_pos = 0;
+}
+
+bool http2_conn::handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len)
+{
+    // 头部块必须连续，中间不能穿插其它帧
+    if (m_continuation_id && type != CONTINUATION)
+    {
+        add_goaway(ERR_PROTOCOL);
+        return false;
+    }
+
+    switch (type)
+    {
+        case DATA:
+            return handle_data(flags, stream_id, payload, len);
+        case HEADERS:
+            return handle_headers(flags, stream_id, payload, len);
+        case CONTINUATION:
+            return handle_continuation(flags, stream_id, payload, len);
+        case SETTINGS:
+            return handle_settings(flags, payload, len);
+        case WINDOW_UPDATE:
+            return handle_window_update(stream_id, payload, len);
+        case PRIORITY:
+            // 不实现优先级，按轮转调度
+            if (stream_id == 0 || len != 5)
+            {
+                add_goaway(len != 5 ? ERR_FRAME_SIZE : ERR_PROTOCOL);
+                return false;
+            }
+            return true;
+        case RST_STREAM:
+            if (stream_id == 0 || len != 4)
+            {
+                add_goaway(len != 4 ? ERR_FRAME_SIZE : ERR_PROTOCOL);
+                return false;
+            }
+            close_stream(stream_id);
+            return true;
+        case PING:
+            if (stream_id != 0 || len != 8)
+            {
+                add_goaway(len != 8 ? ERR_FRAME_SIZE : ERR_PROTOCOL);
+                return false;
+            }
+            if (!(flags & FLAG_ACK))
+            {
+                add_frame_header(8, PING, FLAG_ACK, 0);
+                m_out.append((const char*)payload, 8);
+            }
+            return true;
+        case GOAWAY:
+            // 对端不再打开新流，发完已有的响应后关闭
+            m_goaway = true;
+            return false;
+        case PUSH_PROMISE:
+            // 客户端不能推送
+            add_goaway(ERR_PROTOCOL);
+            return false;
+        default:
+            // 未知类型的帧必须忽略
+            return true;
+    }
+}
+
+bool http2_conn::handle_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len)
+{
+    // 客户端发起的流ID必须是奇数并且递增，这里不支持请求 trailer
+    if (stream_id == 0 || !(stream_id & 1) || stream_id <= m_last_stream_id)
+    {
+        add_goaway(ERR_PROTOCOL);
+        return false;
+    }
+
+    // 去掉填充和优先级字段
+    uint32_t pad = 0;
+    if (flags & FLAG_PADDED)
+    {
+        if (len < 1)
+        {
+            add_goaway(ERR_FRAME_SIZE);
+            return false;
+        }
+        pad = payload[0];
+        ++payload;
+        --len;
+    }
+    if (flags & FLAG_PRIORITY)
+    {
+        if (len < 5)
+        {
+            add_goaway(ERR_FRAME_SIZE);
+            return false;
+        }
+        payload += 5;
+        len -= 5;
+    }
+    if (pad > len)
+    {
+        add_goaway(ERR_PROTOCOL);
+        return false;
+    }
+    len -= pad;
+
+    m_last_stream_id = stream_id;
+    stream& s = m_streams[stream_id];
+    s.id = stream_id;
+    s.remote_closed = false;
+    s.end_stream = (flags & FLAG_END_STREAM) != 0;
+    s.head_only = false;
+    s.send_window = m_peer_initial_window;
+    s.responding = false;
+    s.body = 0;
+    s.body_len = s.body_sent = 0;
+    s.file_address = 0;
+    s.file_size = 0;
+    s.header_block.assign((const char*)payload, len);
+
+    if (!(flags & FLAG_END_HEADERS))
+    {
+        m_continuation_id = stream_id;
+        return true;
+    }
+    return headers_complete(s);
+}
+
+bool http2_conn::handle_continuation(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len)
+{
+    if (stream_id == 0 || stream_id != m_continuation_id)
+    {
+        add_goaway(ERR_PROTOCOL);
+        return false;
+    }
+    stream& s = m_streams[stream_id];
+    s.header_block.append((const char*)payload, len);
+    if (s.header_block.size() > 64 * 1024)
+    {
+        add_goaway(ERR_ENHANCE_YOUR_CALM);
+        return false;
+    }
+    if (!(flags & FLAG_END_HEADERS))
+    {
+        return true;
+    }
+    m_continuation_id = 0;
+    return headers_complete(s);
+}
+
+// 头部块接收完毕：解码并在请求结束时生成响应
+bool http2_conn::headers_complete(stream& s)
+{
+    std::vector<hpack_header> headers;
+    bool ok = m_decoder.decode((const uint8_t*)s.header_block.data(), s.header_block.size(), headers);
+    s.header_block.clear();
+    if (!ok)
+    {
+        // 解码失败后两端的动态表不再一致，只能关闭连接
+        add_goaway(ERR_COMPRESSION);
+        return false;
+    }
+
+    for (size_t i = 0; i < headers.size(); ++i)
+    {
+        if (headers[i].name == ":method")
+        {
+            s.method = headers[i].value;
+        }
+        else if (headers[i].name == ":path")
+        {
+            s.path = headers[i].value;
+        }
+    }
+
+    // 解码之后才能拒绝，否则动态表会不同步
+    uint32_t id = s.id;
+    // 发送 GOAWAY 之前对端可能已经发出了新的流，同样拒绝
+    if (m_streams.size() > MAX_CONCURRENT_STREAMS || m_shutdown)
+    {
+        add_rst_stream(id, ERR_REFUSED_STREAM);
+        close_stream(id);
+        return true;
+    }
+
+    if (s.end_stream)
+    {
+        s.remote_closed = true;
+        if (s.method == "GET" || s.method == "HEAD")
+        {
+            s.head_only = s.method == "HEAD";
+            // 去掉查询字符串
+            std::string url = s.path.substr(0, s.path.find('?'));
+            char real_file[http_conn::FILENAME_LEN];
+            struct stat file_stat;
+            char* file_address = 0;
+            http_conn::HTTP_CODE code = url.empty() || url[0] != '/' ? http_conn::BAD_REQUEST
+                                      : http_conn::map_file(url.c_str(), real_file, &file_stat, &file_address);
+            respond(s, code, file_address, code == http_conn::FILE_REQUEST ? file_stat.st_size : 0);
+        }
+        else
+        {
+            respond(s, http_conn::BAD_REQUEST, 0, 0);
+        }
+    }
+    return true;
+}
+
+bool http2_conn::handle_data(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len)
+{
+    (void)payload;
+    std::map<uint32_t, stream>::iterator it = m_streams.find(stream_id);
+    if (stream_id == 0)
+    {
+        add_goaway(ERR_PROTOCOL);
+        return false;
+    }
+    // 请求体不做处理，立即归还接收窗口
+    if (len > 0)
+    {
+        add_window_update(0, len);
+    }
+    if (it == m_streams.end() || it->second.remote_closed)
+    {
+        add_rst_stream(stream_id, ERR_STREAM_CLOSED);
+        return true;
+    }
+    if (len > 0 && !(flags & FLAG_END_STREAM))
+    {
+        add_window_update(stream_id, len);
+    }
+    if (flags & FLAG_END_STREAM)
+    {
+        stream& s = it->second;
+        s.remote_closed = true;
+        respond(s, http_conn::BAD_REQUEST, 0, 0);
+    }
+    return true;
+}
+
+bool http2_conn::handle_settings(uint8_t flags, const uint8_t* payload, uint32_t len)
+{
+    if (flags & FLAG_ACK)
+    {
+        if (len != 0)
+        {
+            add_goaway(ERR_FRAME_SIZE);
+            return false;
+        }
+        return true;
+    }
+    if (len % 6 != 0)
+    {
+        add_goaway(ERR_FRAME_SIZE);
+        return false;
+    }
+    for (uint32_t i = 0; i < len; i += 6)
+    {
+        if (!apply_setting((uint16_t)((payload[i] << 8) | payload[i + 1]), get_u32(payload + i + 2)))
+        {
+            return false;
+        }
+    }
+    add_frame_header(0, SETTINGS, FLAG_ACK, 0);
+    return true;
+}
+
+bool http2_conn::apply_setting(uint16_t id, uint32_t value)
+{
+    switch (id)
+    {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            m_encoder.set_max_table_size(value);
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE:
+        {
+            if (value > 0x7fffffff)
+            {
+                add_goaway(ERR_FLOW_CONTROL);
+                return false;
+            }
+            // 新的初始窗口对所有已打开的流生效
+            int64_t delta = (int64_t)value - m_peer_initial_window;
+            for (std::map<uint32_t, stream>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+            {
+                it->second.send_window += delta;
+            }
+            m_peer_initial_window = (int32_t)value;
+            break;
+        }
+        case SETTINGS_MAX_FRAME_SIZE:
+            if (value < DEFAULT_MAX_FRAME_SIZE || value > 0xffffff)
+            {
+                add_goaway(ERR_PROTOCOL);
+                return false;
+            }
+            m_peer_max_frame = value;
+            break;
+        case SETTINGS_ENABLE_PUSH:
+            if (value > 1)
+            {
+                add_goaway(ERR_PROTOCOL);
+                return false;
+            }
+            break;
+        default:
+            // 不认识的参数必须忽略
+            break;
+    }
+    return true;
+}
+
+bool http2_conn::handle_window_update(uint32_t stream_id, const uint8_t* payload, uint32_t len)
+{
+    if (len != 4)
+    {
+        add_goaway(ERR_FRAME_SIZE);
+        return false;
+    }
+    uint32_t increment = get_u32(payload) & 0x7fffffff;
+    if (stream_id == 0)
+    {
+        if (increment == 0 || m_send_window + increment > 0x7fffffff)
+        {
+            add_goaway(increment == 0 ? ERR_PROTOCOL : ERR_FLOW_CONTROL);
+            return false;
+        }
+        m_send_window += increment;
+        return true;
+    }
+
+    std::map<uint32_t, stream>::iterator it = m_streams.find(stream_id);
+    if (it == m_streams.end())
+    {
+        return true; // 已经关闭的流，忽略
+    }
+    if (increment == 0 || it->second.send_window + increment > 0x7fffffff)
+    {
+        add_rst_stream(stream_id, increment == 0 ? ERR_PROTOCOL : ERR_FLOW_CONTROL);
+        close_stream(stream_id);
+        return true;
+    }
+    it->second.send_window += increment;
+    return true;
+}
+
+// 编码响应头部并排队 HEADERS 帧，响应体由 produce 按窗口分帧发送
+void http2_conn::respond(stream& s, http_conn::HTTP_CODE code, char* file_address, size_t file_size)
+{
+    const char* status = "200";
+    const char* body = 0;
+    size_t body_len = 0;
+    switch (code)
+    {
+        case http_conn::FILE_REQUEST:
+            body = file_address;
+            body_len = file_size;
+            s.file_address = file_address;
+            s.file_size = file_size;
+            break;
+        case http_conn::NO_RESOURCE:
+            status = "404";
+            body = error_404_form;
+            break;
+        case http_conn::FORBIDDEN_REQUEST:
+            status = "403";
+            body = error_403_form;
+            break;
+        case http_conn::BAD_REQUEST:
+            status = "400";
+            body = error_400_form;
+            break;
+        default:
+            status = "500";
+            body = error_500_form;
+            break;
+    }
+    if (code != http_conn::FILE_REQUEST)
+    {
+        body_len = strlen(body);
+    }
+
+    server_stats::status(atoi(status));
+
+    char length[32];
+    snprintf(length, sizeof(length), "%zu", body_len);
+    std::string block;
+    m_encoder.encode(":status", status, false, block);
+    m_encoder.encode("content-length", length, false, block);
+    m_encoder.encode("content-type", "text/html", true, block);
+
+    bool no_body = s.head_only || body_len == 0;
+    add_frame_header(block.size(), HEADERS, FLAG_END_HEADERS | (no_body ? FLAG_END_STREAM : 0), s.id);
+    m_out.append(block);
+
+    if (no_body)
+    {
+        close_stream(s.id);
+        return;
+    }
+    s.responding = true;
+    s.body = body;
+    s.body_len = body_len;
+    s.body_sent = 0;
+}
+
+bool http2_conn::produce()
+{
+    // 升级的连接在收到客户端连接序言（以及其中的 SETTINGS）之前只发送响应头，
+    // 不然 101 之后紧跟的大量 DATA 会超出一些客户端升级时的接收缓冲
+    // 每轮从上一次发送的流之后开始，每个流最多发一帧，保证多个流公平地交错发送
+    while (m_preface_received && out_len() < OUT_BUFFER_HIGH && m_send_window > 0 && !m_streams.empty())
+    {
+        std::map<uint32_t, stream>::iterator it = m_streams.upper_bound(m_rr_last);
+        stream* next = 0;
+        for (size_t i = 0; i < m_streams.size(); ++i, ++it)
+        {
+            if (it == m_streams.end())
+            {
+                it = m_streams.begin();
+            }
+            if (it->second.responding && it->second.send_window > 0)
+            {
+                next = &it->second;
+                break;
+            }
+        }
+        if (!next)
+        {
+            break; // 所有流都在等待 WINDOW_UPDATE
+        }
+
+        size_t n = next->body_len - next->body_sent;
+        if ((int64_t)n > next->send_window) n = next->send_window;
+        if ((int64_t)n > m_send_window) n = m_send_window;
+        if (n > m_peer_max_frame) n = m_peer_max_frame;
+
+        bool last = next->body_sent + n == next->body_len;
+        add_frame_header(n, DATA, last ? FLAG_END_STREAM : 0, next->id);
+        m_out.append(next->body + next->body_sent, n);
+        next->body_sent += n;
+        next->send_window -= n;
+        m_send_window -= n;
+        m_rr_last = next->id;
+        if (last)
+        {
+            close_stream(next->id);
+        }
+    }
+    return out_len() > 0;
+}
+
+void http2_conn::close_stream(uint32_t stream_id)
+{
+    std::map<uint32_t, stream>::iterator it = m_streams.find(stream_id);
+    if (it == m_streams.end())
+    {
+        return;
+    }
+    if (it->second.file_address)
+    {
+        munmap(it->second.file_address, it->second.file_size);
+        mem_budget::release(mem_budget::FILES, it->second.file_size);
+    }
+    if (m_continuation_id == stream_id)
+    {
+        m_continuation_id = 0;
+    }
+    m_streams.erase(it);
+}
+
+void http2_conn::add_frame_header(uint32_t len, uint8_t type, uint8_t flags, uint32_t stream_id)
+{
+    m_out.push_back((char)(len >> 16));
+    m_out.push_back((char)(len >> 8));
+    m_out.push_back((char)len);
+    m_out.push_back((char)type);
+    m_out.push_back((char)flags);
+    put_u32(m_out, stream_id & 0x7fffffff);
+}
+
+void http2_conn::add_settings()
+{
+    add_frame_header(6, SETTINGS, 0, 0);
+    m_out.push_back(0);
+    m_out.push_back((char)SETTINGS_MAX_CONCURRENT_STREAMS);
+    put_u32(m_out, MAX_CONCURRENT_STREAMS);
+}
+
+void http2_conn::add_window_update(uint32_t stream_id, uint32_t increment)
+{
+    add_frame_header(4, WINDOW_UPDATE, 0, stream_id);
+    put_u32(m_out, increment);
+}
+
+void http2_conn::add_rst_stream(uint32_t stream_id, uint32_t error_code)
+{
+    add_frame_header(4, RST_STREAM, 0, stream_id);
+    put_u32(m_out, error_code);
+}
+
+void http2_conn::shutdown()
+{
+    if (m_goaway || m_shutdown)
+    {
+        return;
+    }
+    add_frame_header(8, GOAWAY, 0, 0);
+    put_u32(m_out, m_last_stream_id);
+    put_u32(m_out, ERR_NONE);
+    m_shutdown = true;
+}
+
+// 连接错误：发送 GOAWAY，丢弃所有流，发送完毕后关闭连接
+void http2_conn::add_goaway(uint32_t error_code)
+{
+    add_frame_header(8, GOAWAY, 0, 0);
+    put_u32(m_out, m_last_stream_id);
+    put_u32(m_out, error_code);
+    while (!m_streams.empty())
+    {
+        close_stream(m_streams.begin()->first);
+    }
+    m_goaway = true;
+}
@@ -0,0 +1,130 @@
+#ifndef HTTP2CONNECTION_H
+#define HTTP2CONNECTION_H
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include "hpack.h"
+#include "http_conn.h"
+
+// HTTP/2 分帧层 (RFC 9113)
+// 挂在 http_conn 上，一个 TCP 连接上复用多个流。http_conn 负责 socket 的读写，
+// 这里只负责把读到的字节解析成帧、生成响应帧，并按流量控制窗口调度 DATA 帧。
+class http2_conn
+{
+public:
+    // 客户端连接序言
+    static const char* const PREFACE;
+    static const int PREFACE_LEN = 24;
+    // 帧头长度
+    static const int FRAME_HEADER_LEN = 9;
+    // 流量控制窗口和帧大小的默认值
+    static const int32_t DEFAULT_WINDOW_SIZE = 65535;
+    static const uint32_t DEFAULT_MAX_FRAME_SIZE = 16384;
+    // 允许对端同时打开的流的数量
+    static const uint32_t MAX_CONCURRENT_STREAMS = 100;
+    // 输出缓冲的高水位，超过后暂停生成 DATA 帧
+    static const size_t OUT_BUFFER_HIGH = 64 * 1024;
+
+    // 帧类型
+    enum FRAME_TYPE { DATA = 0, HEADERS, PRIORITY, RST_STREAM, SETTINGS, PUSH_PROMISE, PING, GOAWAY, WINDOW_UPDATE, CONTINUATION };
+    // 帧标志位
+    enum FRAME_FLAG { FLAG_END_STREAM = 0x1, FLAG_ACK = 0x1, FLAG_END_HEADERS = 0x4, FLAG_PADDED = 0x8, FLAG_PRIORITY = 0x20 };
+    // SETTINGS 参数
+    enum SETTINGS_ID { SETTINGS_HEADER_TABLE_SIZE = 1, SETTINGS_ENABLE_PUSH, SETTINGS_MAX_CONCURRENT_STREAMS,
+                       SETTINGS_INITIAL_WINDOW_SIZE, SETTINGS_MAX_FRAME_SIZE, SETTINGS_MAX_HEADER_LIST_SIZE };
+    // 错误码
+    enum ERROR_CODE { ERR_NONE = 0, ERR_PROTOCOL, ERR_INTERNAL, ERR_FLOW_CONTROL, ERR_SETTINGS_TIMEOUT, ERR_STREAM_CLOSED,
+                      ERR_FRAME_SIZE, ERR_REFUSED_STREAM, ERR_CANCEL, ERR_COMPRESSION, ERR_CONNECT, ERR_ENHANCE_YOUR_CALM };
+
+public:
+    http2_conn();
+    ~http2_conn();
+
+    // 以连接序言开头的明文连接（prior knowledge h2c）
+    void init_prior_knowledge();
+    // 通过 HTTP/1.1 Upgrade: h2c 升级的连接，升级请求成为 stream 1，
+    // file_address 的所有权转移给 stream 1
+    void init_upgrade(const char* settings, http_conn::HTTP_CODE code, char* file_address, size_t file_size);
+
+    // 追加从 socket 读到的数据
+    void feed(const char* data, int len);
+    // 解析输入缓冲中所有完整的帧，协议错误时排队 GOAWAY 并进入关闭状态
+    void process();
+    // 按流量控制窗口生成 DATA 帧，返回是否有待发送的数据
+    bool produce();
+
+    // 输出缓冲
+    const char* out_data() const { return m_out.data() + m_out_pos; }
+    size_t out_len() const { return m_out.size() - m_out_pos; }
+    void consume(size_t len);
+
+    // 平滑退出：排队一个 NO_ERROR 的 GOAWAY，之后新打开的流被拒绝，已有的流照常发送完毕
+    void shutdown();
+    // 已经发送或收到 GOAWAY 且没有剩余的流，数据发完后可以关闭连接
+    bool closing() const { return (m_goaway || m_shutdown) && m_streams.empty(); }
+    // 没有打开的流，连接在等待新的请求
+    bool idle() const { return m_streams.empty(); }
+
+private:
+    // 一个请求/响应流
+    struct stream
+    {
+        uint32_t id;
+        bool remote_closed;         // 对端已发送 END_STREAM
+        bool head_only;             // HEAD 请求只发送头部
+        int64_t send_window;        // 流级别的发送窗口
+        std::string header_block;   // HEADERS + CONTINUATION 拼接的头部块
+        bool end_stream;            // HEADERS 帧是否带有 END_STREAM
+        std::string method;
+        std::string path;
+        bool responding;            // 响应头已发送，正在发送响应体
+        const char* body;           // 响应体，指向文件映射或者静态的错误页面
+        size_t body_len;
+        size_t body_sent;
+        char* file_address;         // 文件映射，流结束时 munmap
+        size_t file_size;
+    };
+
+    bool handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    bool handle_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    bool handle_continuation(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    bool handle_data(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    bool handle_settings(uint8_t flags, const uint8_t* payload, uint32_t len);
+    bool handle_window_update(uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    bool apply_setting(uint16_t id, uint32_t value);
+    bool headers_complete(stream& s);
+
+    // 生成响应：文件请求成功时 file_address 指向文件映射
+    void respond(stream& s, http_conn::HTTP_CODE code, char* file_address, size_t file_size);
+    void close_stream(uint32_t stream_id);
+
+    void add_frame_header(uint32_t len, uint8_t type, uint8_t flags, uint32_t stream_id);
+    void add_settings();
+    void add_window_update(uint32_t stream_id, uint32_t increment);
+    void add_rst_stream(uint32_t stream_id, uint32_t error_code);
+    void add_goaway(uint32_t error_code);
+
+private:
+    bool m_preface_received;        // 是否已收到客户端连接序言
+    std::string m_in;               // 输入缓冲
+    size_t m_in_pos;
+    std::string m_out;              // 输出缓冲
+    size_t m_out_pos;
+
+    std::map<uint32_t, stream> m_streams;
+    uint32_t m_last_stream_id;      // 对端打开过的最大流ID
+    uint32_t m_continuation_id;     // 正在等待 CONTINUATION 的流，0 表示没有
+    uint32_t m_rr_last;             // 轮转调度上一次发送 DATA 的流
+    bool m_goaway;
+    bool m_shutdown;                // 已经因为平滑退出发送了 GOAWAY
+
+    int64_t m_send_window;          // 连接级别的发送窗口
+    int32_t m_peer_initial_window;  // 对端 SETTINGS_INITIAL_WINDOW_SIZE
+    uint32_t m_peer_max_frame;      // 对端 SETTINGS_MAX_FRAME_SIZE
+
+    hpack_decoder m_decoder;
+    hpack_encoder m_encoder;
+};
+
+#endif
@@ -1,4 +1,20 @@
 #include "http_conn.h"
+#include "http2_conn.h"
+#include "../proxy/proxy_conn.h"
+#include "../limit/rate_limiter.h"
+#include "../stats/stats.h"
+#include "../trace/request_trace.h"
+#include "../capture/traffic_capture.h"
+#include "../coro/coro_handler.h"
+#include "../router/router.h"
+#include "../poll/busy_poll.h"
+#include "../fileio/file_reader.h"
+#include "../fileio/neg_cache.h"
+#include "../sched/send_sched.h"
+#include "../memory/mem_budget.h"
+#include "../threadpool/threadpool.h"
+#include "../sse/sse_hub.h"
+#include "../net/sys_io.h"
 
 // 定义HTTP响应的一些状态信息
 const char* ok_200_title = "OK";
@@ -8,8 +24,27 @@ const char* error_403_title = "Forbidden";
 const char* error_403_form = "You do not have permission to get file from this server.\n";
 const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
+const char* error_405_title = "Method Not Allowed";
+const char* error_405_form = "The requested method is not supported for this resource.\n";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+// 限流时的响应，提前生成好，拒绝时只需要一次 send
+const char* error_429_response = "HTTP/1.1 429 Too Many Requests\r\nRetry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const char* error_503_response = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+// 请求方法的名字，下标与 METHOD 枚举对应
+static const char* method_names[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT" };
+
+// 保留给统计信息和请求跟踪的路径
+static const char* stats_path = "/stats";
+static const char* trace_path = "/trace";
+
+// url 是否为保留路径 path，可以带查询参数
+static bool match_path(const char* url, const char* path)
+{
+    int len = strlen(path);
+    return strncmp(url, path, len) == 0 && (url[len] == '\0' || url[len] == '?');
+}
 
 // 网站的根目录
 const char* doc_root = "/home/acs/webserver/resources";
@@ -19,9 +54,9 @@ const char* doc_root = "/home/acs/webserver/resources";
 // 这可以避免程序在等待数据或缓冲区可用时被阻塞，从而提高程序的并发性能
 int setnonblocking(int fd) 
 {
-    int old_option = fcntl(fd, F_GETFL); // 获取 fd 的旧文件描述符选项
+    int old_option = sys_io::fcntl(fd, F_GETFL, 0); // 获取 fd 的旧文件描述符选项
     int new_option = old_option | O_NONBLOCK; // 计算新的文件描述符选项
-    fcntl(fd, F_SETFL, new_option); // 使用 fcntl 函数将 fd 的选项设置为新的文件描述符选项
+    sys_io::fcntl(fd, F_SETFL, new_option); // 使用 fcntl 函数将 fd 的选项设置为新的文件描述符选项
     return old_option;
 }
 
@@ -39,7 +74,7 @@ void addfd(int epollfd, int fd, bool one_shot)
     {
         event.events |= EPOLLONESHOT; // 防止同一个通信被不同的线程处理
     }
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event); // 向 epoll 实例中添加文件描述符 fd 和对应的事件 event
+    sys_io::epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event); // 向 epoll 实例中添加文件描述符 fd 和对应的事件 event
     setnonblocking(fd); // 设置文件描述符非阻塞
 }
 
@@ -48,8 +83,8 @@ void removefd(int epollfd, int fd)
 {
     // 将操作类型设置为 EPOLL_CTL_DEL 表示删除该文件描述符
     // 第四个参数为 0，表示不需要传递事件结构体
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
-    close(fd);
+    sys_io::epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    sys_io::close(fd);
 }
 
 // 修改文件描述符，重置socket上的EPOLLONESHOT事件，以确保下一次可读时，EPOLLIN事件能被触发
@@ -58,22 +93,134 @@ void modfd(int epollfd, int fd, int ev)
     epoll_event event;
     event.data.fd = fd;
     event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
-    epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
+    // 运行到完成模式下交给工作线程的连接已经从 epoll 注销，需要重新添加
+    if (sys_io::epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event) < 0 && errno == ENOENT) 
+    {
+        sys_io::epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+// 运行到完成模式下连接只注册一次：边沿触发的读写事件，不使用 EPOLLONESHOT
+static void register_inline(int epollfd, int fd, int op) 
+{
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    sys_io::epoll_ctl(epollfd, op, fd, &event);
 }
 
 // 所有的客户数
-int http_conn::m_user_count = 0;
+std::atomic<int> http_conn::m_user_count(0);
 // 所有socket上的事件都被注册到同一个epoll内核事件中，所以设置成静态的
 int http_conn::m_epollfd = -1;
+// 限流器，由 main 根据命令行参数创建
+rate_limiter* http_conn::m_limiter = NULL;
+const char* http_conn::m_index_file = "index.html";
+bool http_conn::m_run_to_completion = false;
+std::atomic<bool> http_conn::m_draining(false);
+threadpool<http_conn>* http_conn::m_pool = NULL;
+int http_conn::m_keep_alive_timeout = 60;
+int http_conn::m_max_requests = 0;
+
+bool http_conn::parse_keep_alive(const char* arg)
+{
+    char* end;
+    long timeout = strtol(arg, &end, 10);
+    long max_requests = 0;
+    if (end == arg || timeout < 0)
+    {
+        return false;
+    }
+    if (*end == ':')
+    {
+        const char* p = end + 1;
+        max_requests = strtol(p, &end, 10);
+        if (end == p || max_requests < 0)
+        {
+            return false;
+        }
+    }
+    if (*end != '\0')
+    {
+        return false;
+    }
+    m_keep_alive_timeout = timeout;
+    m_max_requests = max_requests;
+    return true;
+}
+
+// 逗号分隔的头部值中是否有 token（不区分大小写），例如 Connection: keep-alive, Upgrade
+static bool has_token(const char* list, const char* token)
+{
+    size_t len = strlen(token);
+    while (*list)
+    {
+        list += strspn(list, " \t,");
+        size_t n = strcspn(list, ",");
+        size_t end = n;
+        while (end > 0 && (list[end - 1] == ' ' || list[end - 1] == '\t'))
+        {
+            --end;
+        }
+        if (end == len && strncasecmp(list, token, len) == 0)
+        {
+            return true;
+        }
+        list += n;
+    }
+    return false;
+}
 
 // 关闭连接
 void http_conn::close_conn() 
 {
     if(m_sockfd != -1) {
         removefd(m_epollfd, m_sockfd);
-        m_sockfd = -1;
-        m_user_count--; // 关闭一个连接，将客户总数量-1
+        server_stats::add(server_stats::CLOSED);
+        release();
+    }
+}
+
+void http_conn::release() 
+{
+    m_sockfd = -1;
+    m_user_count--; // 关闭一个连接，将客户总数量-1
+    mem_budget::release(mem_budget::CONNECTIONS, sizeof(http_conn));
+    if (m_capture_id)
+    {
+        traffic_capture::close_conn(m_capture_id);
+        m_capture_id = 0;
+    }
+    if (m_h2)
+    {
+        delete m_h2; // 释放 HTTP/2 分帧层和它所有流的文件映射
+        m_h2 = NULL;
+        mem_budget::release(mem_budget::CONNECTIONS, sizeof(http2_conn));
+    }
+    if (m_proxy)
+    {
+        delete m_proxy; // 关闭还没有完成的上游连接
+        m_proxy = NULL;
+        mem_budget::release(mem_budget::CONNECTIONS, sizeof(proxy_conn));
+    }
+    if (m_coro)
+    {
+        // 协程挂起等待时客户端连接上没有注册事件，不会走到这里，协程一定没有在等待
+        m_coro->~coro_request();
+        m_coro = NULL;
+    }
+    if (m_zc_used)
+    {
+        // 内核可能还引用着当前响应体的页
+        m_zc.hold(m_body, m_file_address, m_file_stat.st_size);
+        m_file_address = 0;
+        m_zc_used = false;
     }
+    m_zc.close();
+    unmap(); // 响应没有写完就关闭的连接
+    std::string().swap(m_body);
+    account_body();
+    m_arena.reset();
 }
 
 // 初始化连接,外部调用初始化套接字地址
@@ -85,16 +232,56 @@ void http_conn::init(int sockfd, const sockaddr_in& addr)
     // 设置套接字选项 SO_REUSEADDR，以启用端口复用。
     // 这意味着如果之前绑定到该端口的套接字处于 TIME_WAIT 状态，该端口可以立即重新使用。
     int reuse = 1;
-    setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    addfd(m_epollfd, sockfd, true); // 将套接字文件描述符 sockfd 添加到 epoll 实例中，以监听该套接字上的事件。
+    sys_io::setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (busy_poll::enabled()) 
+    {
+        busy_poll::setup_socket(sockfd);
+    }
+    if (zerocopy::enabled()) 
+    {
+        m_zc.open(sockfd);
+    }
+    m_inline = m_run_to_completion;
+    if (m_inline) 
+    {
+        register_inline(m_epollfd, sockfd, EPOLL_CTL_ADD);
+        setnonblocking(sockfd);
+    } 
+    else 
+    {
+        addfd(m_epollfd, sockfd, true); // 将套接字文件描述符 sockfd 添加到 epoll 实例中，以监听该套接字上的事件。
+    }
     m_user_count ++;
+    mem_budget::charge(mem_budget::CONNECTIONS, sizeof(http_conn));
+    m_accept_time = request_trace::sample() ? server_stats::now_ns() : 0;
+    m_capture_id = traffic_capture::enabled() ? traffic_capture::open_conn() : 0;
+    m_send_bucket.reset(server_stats::now_ns());
+    // 刚接受的连接从现在开始算空闲时间，一直不发请求的连接也受长连接超时的限制
+    m_idle_since = server_stats::now_ns();
+    // 新连接的读缓冲里没有上一个连接留下的数据
+    m_read_idx = 0;
+    m_checked_idx = 0;
+    m_check_state = CHECK_STATE_REQUESTLINE;
+    m_content_length = 0;
+    m_requests = 0;
     init();
 }
 
-// 重置 HTTP 连接对象的各个成员变量，以便在处理下一个客户端请求时可以使用一个干净的状态。
-// 通过清空缓冲区和文件名等数据，可以避免之前处理的数据对当前请求的处理产生干扰。
+// 重置 HTTP 连接对象中和一个请求相关的成员变量，以便在处理下一个客户端请求时可以使用一个干净的状态。
+// 缓冲区不用清空：读缓冲只解析 m_read_idx 之前的数据，写缓冲由 vsnprintf 写入。
+// 客户端紧跟着发来的下一个请求（pipelining）已经在读缓冲里了，把它移到开头，m_pipelined 表示还需要解析。
 void http_conn::init()
 {
+    int end = m_checked_idx + (m_check_state == CHECK_STATE_CONTENT ? m_content_length : 0);
+    int left = m_read_idx > end ? m_read_idx - end : 0;
+    if (left > 0) 
+    {
+        memmove(m_read_buf, m_read_buf + end, left);
+        m_request_start = server_stats::now_ns();
+        m_read_done = m_request_start;
+        m_idle_since = 0;
+    }
+    m_pipelined = left > 0;
 
     bytes_to_send = 0;
     bytes_have_send = 0;
@@ -105,17 +292,37 @@ void http_conn::init()
     m_method = GET; // 默认请求方式为GET
     m_url = 0;              
     m_version = 0;
+    m_http10 = false;
     m_content_length = 0;
     m_host = 0;
     m_start_line = 0;
     m_checked_idx = 0;
-    m_read_idx = 0;
+    m_read_idx = left;
     m_write_idx = 0;
+    m_h2c_upgrade = false;
+    m_h2_settings = 0;
+    m_header_idx = 0;
+    m_upstream = NULL;
+    m_trace_id = 0;
+    m_pending = NO_REQUEST;
+    m_sse = false;
+    m_zc_used = false;
+    m_content = NULL;
+    m_resident = 0;
+    if (mem_budget::over_soft()) 
+    {
+        std::string().swap(m_body); // 内存紧张时空闲的连接不保留响应体的缓冲
+    } 
+    else 
+    {
+        m_body.clear();
+    }
+    account_body();
+    m_content_type = "text/html";
 
-    // 全部设置为 0 或空字符串，以清空缓冲区和文件名。
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, READ_BUFFER_SIZE);
-    bzero(m_real_file, FILENAME_LEN);
+    // 上一个请求的临时数据都已经不再使用
+    m_arena.reset();
+    m_real_file = NULL;
 }
 
 
@@ -131,7 +338,7 @@ bool http_conn::read()
     while(true) 
     {
         // 从m_read_buf + m_read_idx索引出开始保存数据，大小是READ_BUFFER_SIZE - m_read_idx
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0 );
+        bytes_read = sys_io::recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0 );
         if (bytes_read == -1) //  -1 则表示读取出错，需要根据具体的错误码进行处理
         {
             // 如果是 EAGAIN 或 EWOULDBLOCK 错误，则表示当前没有数据可读，可以退出循环等待下一次读取。
@@ -145,7 +352,38 @@ bool http_conn::read()
         {
             return false;
         }
+        if (m_read_idx == 0 && !m_h2) 
+        {
+            m_request_start = server_stats::now_ns(); // 一个新请求的第一批数据
+            m_trace_id = request_trace::begin();
+            if (m_trace_id) 
+            {
+                if (m_accept_time) 
+                {
+                    request_trace::record(m_trace_id, request_trace::ACCEPT, m_accept_time);
+                }
+                request_trace::record(m_trace_id, request_trace::FIRST_BYTE, m_request_start);
+            }
+            m_accept_time = 0;
+        }
+        if (m_capture_id)
+        {
+            traffic_capture::data(m_capture_id, m_read_buf + m_read_idx, bytes_read);
+        }
         m_read_idx += bytes_read;
+        m_idle_since = 0;
+        server_stats::add(server_stats::BYTES_IN, bytes_read);
+        if (m_h2)
+        {
+            // HTTP/2 的帧可能比读缓冲大，直接交给分帧层的输入缓冲
+            m_h2->feed(m_read_buf, m_read_idx);
+            m_read_idx = 0;
+        }
+    }
+    m_read_done = server_stats::now_ns(); // 随后进入请求队列
+    if (m_trace_id) 
+    {
+        request_trace::record(m_trace_id, request_trace::ENQUEUE, m_read_done);
     }
     return true;
 }
@@ -202,12 +440,17 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text)
     // 将找到的URL的起始位置处置为字符串结束符
     *m_url ++ = '\0'; // 此时的请求行：GET\0/index.html HTTP/1.1
     char* method = text;
-    // 将请求方法设为GET，并检查是否合法
-    if (strcasecmp(method, "GET") == 0) // 忽略大小写比较
-    { 
-        m_method = GET;
-    } 
-    else 
+    // 识别请求方法，是否支持由 do_request 按路由决定（见 METHOD 的说明）
+    int i = 0;
+    for ( ; i < (int)(sizeof(method_names) / sizeof(method_names[0])); ++i) 
+    {
+        if (strcasecmp(method, method_names[i]) == 0) // 忽略大小写比较
+        {
+            m_method = (METHOD)i;
+            break;
+        }
+    }
+    if (i == (int)(sizeof(method_names) / sizeof(method_names[0]))) 
     {
         return BAD_REQUEST;
     }
@@ -221,10 +464,19 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text)
         return BAD_REQUEST;
     }
 
-    //将版本号的起始位置处置为字符串结束符，并检查版本号是否为HTTP/1.1。
+    // 将版本号的起始位置处置为字符串结束符，并检查版本号是否为HTTP/1.1或HTTP/1.0。
     // 如果不是则返回错误状态码BAD_REQUEST。
+    // HTTP/1.1 默认保持连接，除非 Connection: close；HTTP/1.0 默认关闭，除非 Connection: keep-alive
     *m_version ++ = '\0'; // 此时的请求行：/index.html\0HTTP/1.1
-    if (strcasecmp(m_version, "HTTP/1.1") != 0) 
+    if (strcasecmp(m_version, "HTTP/1.1") == 0) 
+    {
+        m_linger = true;
+    } 
+    else if (strcasecmp(m_version, "HTTP/1.0") == 0) 
+    {
+        m_http10 = true;
+    } 
+    else 
     {
         return BAD_REQUEST;
     }
@@ -244,6 +496,7 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text)
         return BAD_REQUEST;
     }
     m_check_state = CHECK_STATE_HEADER; // 检查状态变成检查头
+    m_header_idx = m_checked_idx; // 下一行开始就是请求头部，转发给上游时需要
     return NO_REQUEST;
 }
 
@@ -267,11 +520,14 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
     } 
     else if (strncasecmp(text, "Connection:", 11 ) == 0) 
     {
-        // 处理 Connection 头部字段
-        // 如果值为keep-alive，则设置m_linger为true，表示需要保持连接。
+        // 处理 Connection 头部字段，值是逗号分隔的列表（例如 keep-alive, Upgrade）
+        // close 关闭连接，keep-alive 保持连接，都没有时按协议版本的默认值
         text += 11;
-        text += strspn(text, " \t");
-        if ( strcasecmp(text, "keep-alive") == 0 ) 
+        if (has_token(text, "close")) 
+        {
+            m_linger = false;
+        } 
+        else if (has_token(text, "keep-alive")) 
         {
             m_linger = true;
         }
@@ -282,6 +538,10 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
         text += 15;
         text += strspn(text, " \t");
         m_content_length = atol(text); // 将其值转换成整型并存储在m_content_length中，以便后续读取消息体。
+        if (m_content_length < 0) 
+        {
+            return BAD_REQUEST;
+        }
     } 
     else if (strncasecmp(text, "Host:", 5) == 0) 
     {
@@ -290,6 +550,23 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
         text += strspn(text, " \t");
         m_host = text; // 将其值存储在m_host中，以便后续处理
     } 
+    else if (strncasecmp(text, "Upgrade:", 8) == 0) 
+    {
+        // 处理 Upgrade 头部字段，只支持从 HTTP/1.1 升级到明文 HTTP/2 (h2c)
+        text += 8;
+        text += strspn(text, " \t");
+        if (strcasecmp(text, "h2c") == 0 && !m_http10) 
+        {
+            m_h2c_upgrade = true;
+        }
+    } 
+    else if (strncasecmp(text, "HTTP2-Settings:", 15) == 0) 
+    {
+        // 升级请求携带的客户端 SETTINGS，base64url 编码
+        text += 15;
+        text += strspn(text, " \t");
+        m_h2_settings = text;
+    } 
     else 
     {
         printf("oop! unknow header %s\n", text);
@@ -300,9 +577,9 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
 // 我们没有真正解析HTTP请求的消息体，只是判断它是否被完整的读入了
 http_conn::HTTP_CODE http_conn::parse_content(char* text) 
 {
+    // 消息体按长度使用，不在结尾加 '\0'，后面可能紧跟着下一个请求
     if (m_read_idx >= (m_content_length + m_checked_idx) )
     {
-        text[m_content_length] = '\0';
         return GET_REQUEST;
     }
     return NO_REQUEST;
@@ -369,43 +646,302 @@ http_conn::HTTP_CODE http_conn::process_read()
 // 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其
 // 映射到内存地址m_file_address处，并告诉调用者获取文件成功
 http_conn::HTTP_CODE http_conn::do_request()
+{
+    // 保留路径优先于代理路由和静态文件
+    if (match_path(m_url, stats_path)) 
+    {
+        return m_method == GET ? do_stats(m_url + strlen(stats_path)) : BAD_REQUEST;
+    }
+    if (match_path(m_url, trace_path)) 
+    {
+        return m_method == GET ? do_trace(m_url + strlen(trace_path)) : BAD_REQUEST;
+    }
+    if (sse_hub::enabled() && match_path(m_url, sse_hub::path())) 
+    {
+        return do_sse(m_url + strlen(sse_hub::path()));
+    }
+
+    // 动态路由，请求体已经完整地在读缓冲中
+    coro_request::handler h;
+    router::params params;
+    router::RESULT found = router::match(method_names[m_method], m_url, strcspn(m_url, "?"), h, params);
+    if (found == router::FOUND) 
+    {
+        m_coro = new (m_arena.alloc(sizeof(coro_request), alignof(coro_request)))
+            coro_request(h, m_arena, m_sockfd, method_names[m_method], m_url, m_read_buf + m_checked_idx, m_content_length);
+        m_coro->params().swap(params);
+        return CORO_REQUEST;
+    }
+    if (found == router::METHOD_NOT_ALLOWED) 
+    {
+        return METHOD_NOT_ALLOWED;
+    }
+
+    // 匹配代理路由的请求转发给上游，其余的请求按静态文件处理
+    m_upstream = upstream::route(m_url);
+    if (m_upstream) 
+    {
+        return PROXY_REQUEST;
+    }
+    if (m_method != GET) 
+    {
+        return BAD_REQUEST;
+    }
+    m_real_file = (char*)m_arena.alloc(FILENAME_LEN, 1);
+    return map_file(m_url, m_real_file, &m_file_stat, &m_file_address);
+}
+
+// 生成统计信息，默认 JSON 格式，?format=prometheus 输出 Prometheus 文本格式
+http_conn::HTTP_CODE http_conn::do_stats(const char* query)
+{
+    if (strstr(query, "format=prometheus")) 
+    {
+        server_stats::render_prometheus(m_body);
+        m_content_type = "text/plain; version=0.0.4";
+    } 
+    else 
+    {
+        server_stats::render_json(m_body);
+        m_content_type = "application/json";
+    }
+    return STATS_REQUEST;
+}
+
+// 导出请求跟踪，?sample=N 修改采样率（每 N 个请求记录一个，0 关闭）
+http_conn::HTTP_CODE http_conn::do_trace(const char* query)
+{
+    const char* sample = strstr(query, "sample=");
+    if (sample) 
+    {
+        request_trace::set_sample(strtoul(sample + 7, NULL, 10));
+        char buf[64];
+        snprintf(buf, sizeof(buf), "{\"sample\":%u}\n", request_trace::sample());
+        m_body = buf;
+    } 
+    else 
+    {
+        request_trace::dump(m_body);
+    }
+    m_content_type = "application/json";
+    return STATS_REQUEST;
+}
+
+// GET 订阅事件；本机的客户端 POST 发布事件，请求体是数据，?event=name 指定事件类型，回复事件编号
+http_conn::HTTP_CODE http_conn::do_sse(const char* query)
+{
+    if (m_method == GET) 
+    {
+        return SSE_REQUEST;
+    }
+    if (m_method != POST) 
+    {
+        return METHOD_NOT_ALLOWED;
+    }
+    if ((ntohl(m_address.sin_addr.s_addr) >> 24) != 127) 
+    {
+        return FORBIDDEN_REQUEST;
+    }
+    char* name = NULL;
+    const char* event = strstr(query, "event=");
+    if (event) 
+    {
+        event += 6;
+        size_t len = strcspn(event, "&");
+        name = (char*)m_arena.alloc(len + 1, 1);
+        memcpy(name, event, len);
+        name[len] = '\0';
+    }
+    uint64_t id = sse_hub::publish(name, m_read_buf + m_checked_idx, m_content_length);
+    if (!id) 
+    {
+        return BAD_REQUEST;
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "{\"id\":%llu}\n", (unsigned long long)id);
+    m_body = buf;
+    m_content_type = "application/json";
+    return STATS_REQUEST;
+}
+
+// 不存在的路径的缓存在第一次访问文件时启动，这时网站根目录已经确定
+static pthread_once_t neg_once = PTHREAD_ONCE_INIT;
+static void start_neg_cache()
+{
+    neg_cache::start(doc_root);
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// out[0, n) 中最后一段是 . 时去掉，是 .. 时连同上一段一起去掉，返回新的长度，结果以 / 结尾
+static int end_segment(char* out, int n)
+{
+    if (n >= 2 && out[n - 1] == '.' && out[n - 2] == '/')
+    {
+        return n - 1;
+    }
+    if (n >= 3 && out[n - 1] == '.' && out[n - 2] == '.' && out[n - 3] == '/')
+    {
+        n -= 3;
+        while (n > 0 && out[n - 1] != '/')
+        {
+            --n;
+        }
+        return n > 0 ? n : 1;
+    }
+    return n;
+}
+
+// 规范化 url 的路径部分：解码 %XX，合并连续的 /，去掉 . 并用 .. 回退一级（不会越过根目录）
+// 同一个文件的不同写法得到同一个路径，out 的长度不超过 len + 1，以 / 开头，. 或 .. 结尾时补上 /
+// 编码不合法或者解码出 \0 时返回 -1
+static int normalize_path(const char* url, int len, char* out)
+{
+    int n = 0;
+    out[n++] = '/';
+    int i = 0;
+    while (i < len)
+    {
+        // 解码一个字符
+        char c = url[i++];
+        if (c == '%')
+        {
+            int hi = i + 1 < len ? hex_value(url[i]) : -1;
+            int lo = hi >= 0 ? hex_value(url[i + 1]) : -1;
+            if (lo < 0 || (hi == 0 && lo == 0))
+            {
+                return -1;
+            }
+            c = (char)(hi * 16 + lo);
+            i += 2;
+        }
+        if (c != '/')
+        {
+            out[n++] = c;
+            continue;
+        }
+        // 一个路径段结束，检查刚写入的段是不是 . 或 ..
+        n = end_segment(out, n);
+        if (out[n - 1] != '/')
+        {
+            out[n++] = '/';
+        }
+    }
+    n = end_segment(out, n);
+    out[n] = '\0';
+    return n;
+}
+
+// 把规范化后的 url 拼接到 doc_root 后面得到 real_file，检查文件属性后映射到内存
+http_conn::HTTP_CODE http_conn::map_file(const char* url, char* real_file, struct stat* file_stat, char** file_address)
 {
     // "/home/nowcoder/webserver/resources"
-    strcpy(m_real_file, doc_root);
     int len = strlen(doc_root);
-    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    // 获取m_real_file文件的相关的状态信息，-1失败，0成功
-    if (stat( m_real_file, &m_file_stat ) < 0) 
+    int url_len = strcspn(url, "?");
+    if (len + url_len + (int)strlen(m_index_file) >= FILENAME_LEN) 
+    {
+        return BAD_REQUEST;
+    }
+    // 不存在的路径的缓存和文件系统都使用规范化的路径，扫描器换一种写法也会命中缓存
+    char path[FILENAME_LEN];
+    int path_len = normalize_path(url, url_len, path);
+    if (path_len < 0) 
+    {
+        return BAD_REQUEST;
+    }
+    // 最近确认过不存在的路径，不再访问文件系统
+    pthread_once(&neg_once, start_neg_cache);
+    if (neg_cache::missing(path, path_len)) 
+    {
+        server_stats::add(server_stats::NEG_CACHE_HITS);
+        return NO_RESOURCE;
+    }
+    uint32_t generation = neg_cache::generation();
+    strcpy(real_file, doc_root);
+    memcpy(real_file + len, path, path_len + 1);
+    if (path[path_len - 1] == '/') 
+    {
+        strcat(real_file, m_index_file);
+    }
+    // 获取real_file文件的相关的状态信息，-1失败，0成功
+    if (stat( real_file, file_stat ) < 0) 
     {
+        if (errno == ENOENT || errno == ENOTDIR) 
+        {
+            neg_cache::add(path, path_len, generation);
+        }
         return NO_RESOURCE;
     }
 
     // 判断访问权限
-    if (!( m_file_stat.st_mode & S_IROTH)) 
+    if (!( file_stat->st_mode & S_IROTH)) 
     {
         return FORBIDDEN_REQUEST;
     }
 
     // 判断是否是目录
-    if (S_ISDIR(m_file_stat.st_mode)) 
+    if (S_ISDIR(file_stat->st_mode)) 
     {
         return BAD_REQUEST;
     }
 
+    // 空文件不能映射（mmap 长度为 0 时失败），file_address 保持为空，响应体为空
+    *file_address = 0;
+    if (file_stat->st_size == 0) 
+    {
+        return FILE_REQUEST;
+    }
+
     // 以只读方式打开文件
-    int fd = open(m_real_file, O_RDONLY);
+    int fd = open(real_file, O_RDONLY);
+    if (fd < 0) 
+    {
+        return NO_RESOURCE;
+    }
+    if (file_stat->st_size > (off_t)file_reader::WINDOW) 
+    {
+        // 大文件顺序发送，加大预读窗口；映射引用同一个打开的文件，缺页时的预读也按这个设置
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
     // 创建内存映射
-    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    char* address = (char*)mmap(0, file_stat->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
+    if (address == MAP_FAILED) 
+    {
+        return INTERNAL_ERROR;
+    }
+    *file_address = address;
+    mem_budget::charge(mem_budget::FILES, file_stat->st_size); // 由解除映射的地方退还
     return FILE_REQUEST;
 }
 
+// 响应体的缓冲容量有变化时更新内存预算
+void http_conn::account_body() 
+{
+    size_t cap = m_body.capacity();
+    if (cap > m_body_charged) 
+    {
+        mem_budget::charge(mem_budget::BUFFERS, cap - m_body_charged);
+    } 
+    else if (cap < m_body_charged) 
+    {
+        mem_budget::release(mem_budget::BUFFERS, m_body_charged - cap);
+    }
+    m_body_charged = cap;
+}
+
 // 对内存映射区执行munmap操作
 void http_conn::unmap() 
 {
     if(m_file_address)
     {
         munmap(m_file_address, m_file_stat.st_size);
+        mem_budget::release(mem_budget::FILES, m_file_stat.st_size);
         m_file_address = 0;
     }
 }
@@ -414,39 +950,102 @@ void http_conn::unmap()
 bool http_conn::write() 
 {
     int temp = 0;
+
+    if (m_h2) 
+    {
+        return write_h2();
+    }
+    if (m_proxy && m_proxy->active()) 
+    {
+        return proxy_result(m_proxy->on_client_writable());
+    }
     
     if (bytes_to_send == 0) 
     {
         // 将要发送的字节为0，这一次响应结束。
-        modfd(m_epollfd, m_sockfd, EPOLLIN); 
+        m_idle_since = server_stats::now_ns();
         init();
-        return true;
+        return rearm_read();
+    }
+
+    // 每次最多发送一个时间片，限速时还不能超过已有的令牌
+    uint64_t budget = send_sched::quantum();
+    if (send_sched::limited()) 
+    {
+        uint64_t now = server_stats::now_ns();
+        uint64_t avail = m_send_bucket.available(now);
+        uint64_t need = (uint64_t)bytes_to_send < budget ? bytes_to_send : budget;
+        if (avail < need) 
+        {
+            throttle(now + m_send_bucket.wait_ns(need));
+            return true;
+        }
+        budget = avail;
     }
+    uint64_t sent = 0;
 
     while(1) 
     {
-        // 分散写
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        // 文件映射只发送已经确认在页缓存中的部分，其余的先交给 I/O 线程读入
+        struct iovec iv[2] = { m_iv[0], m_iv[1] };
+        if (m_content == m_file_address && m_file_address && iv[1].iov_len > 0 && !file_window(iv[1])) 
+        {
+            return true;
+        }
+        if (m_iv_count == 2 && iv[1].iov_len > budget - sent) 
+        {
+            iv[1].iov_len = budget - sent;
+        }
+
+        // 分散写，剩余的响应体足够大时零拷贝发送
+        if (m_zc.worth(iv[1].iov_len)) 
+        {
+            temp = m_zc.send(m_sockfd, iv, m_iv_count);
+            m_zc_used = m_zc_used || temp > 0;
+        } 
+        else 
+        {
+            temp = sys_io::writev(m_sockfd, iv, m_iv_count);
+        }
         if (temp <= -1) 
         {
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if(errno == EAGAIN) 
             {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                if (m_trace_id) 
+                {
+                    request_trace::record(m_trace_id, request_trace::WRITE_AGAIN, server_stats::now_ns());
+                }
+                if (!m_inline) 
+                {
+                    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                }
                 return true;
             }
             unmap();
             return false;
         }
 
+        if (bytes_have_send == 0) 
+        {
+            uint64_t now = server_stats::now_ns();
+            server_stats::record(server_stats::FIRST_BYTE, now - m_request_start);
+            if (m_trace_id) 
+            {
+                request_trace::record(m_trace_id, request_trace::FIRST_WRITE, now);
+            }
+        }
+        server_stats::add(server_stats::BYTES_OUT, temp);
         bytes_have_send += temp;
         bytes_to_send -= temp;
+        sent += temp;
+        m_send_bucket.consume(temp);
 
         if (bytes_have_send >= m_iv[0].iov_len) 
         {
             m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
+            m_iv[1].iov_base = (char*)m_content + (bytes_have_send - m_write_idx);
             m_iv[1].iov_len = bytes_to_send;
         } 
         else 
@@ -458,20 +1057,40 @@ bool http_conn::write()
         if (bytes_to_send <= 0) 
         {
             // 没有数据要发送了
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-
-            if (m_linger) 
+            uint64_t now = server_stats::now_ns();
+            server_stats::record(server_stats::RESPONSE, now - m_request_start);
+            if (m_trace_id) 
             {
-                init();
-                return true;
-            } 
-            else 
+                request_trace::record(m_trace_id, request_trace::LAST_WRITE, now);
+            }
+            if (m_zc_used) 
+            {
+                // 内核发完之前不能释放或改写响应体
+                m_zc.hold(m_body, m_file_address, m_file_stat.st_size);
+                m_file_address = 0;
+                m_zc_used = false;
+            }
+            unmap();
+            if (m_sse) 
+            {
+                start_sse();
+                return true;
+            }
+            if (!m_linger) 
             {
                 return false;
             }
+            m_idle_since = server_stats::now_ns();
+            init();
+            return rearm_read();
         }
 
+        // 这一次的时间片用完了，排到其他待发送的连接后面
+        if (sent >= budget) 
+        {
+            yield_send();
+            return true;
+        }
     }
 
     
@@ -518,9 +1137,29 @@ bool http_conn::add_content_length(int content_len)
 
 bool http_conn::add_linger() 
 {
+    decide_linger();
+    if (m_linger && m_http10 && m_keep_alive_timeout) 
+    {
+        // HTTP/1.0 的长连接是扩展，告诉客户端服务器会保持多久
+        add_response("Keep-Alive: timeout=%d\r\n", m_keep_alive_timeout);
+    }
     return add_response("Connection: %s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
 
+// 一个请求的响应开始之前调用一次，决定响应之后是否保持连接
+void http_conn::decide_linger() 
+{
+    ++m_requests;
+    if (m_draining) 
+    {
+        m_linger = false; // 正在平滑退出，这是连接上的最后一个响应
+    }
+    if (m_max_requests && m_requests >= m_max_requests) 
+    {
+        m_linger = false; // 连接上的请求数到了上限，让客户端重新连接
+    }
+}
+
 bool http_conn::add_blank_line() 
 {
     return add_response("%s", "\r\n");
@@ -533,7 +1172,7 @@ bool http_conn::add_content(const char* content)
 
 bool http_conn::add_content_type() 
 {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return add_response("Content-Type:%s\r\n", m_content_type);
 }
 
 // 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
@@ -542,6 +1181,7 @@ bool http_conn::process_write(HTTP_CODE ret)
     switch (ret)
     {
         case INTERNAL_ERROR:
+            server_stats::status(500);
             add_status_line(500, error_500_title);
             add_headers(strlen(error_500_form));
             if (!add_content(error_500_form)) 
@@ -550,6 +1190,8 @@ bool http_conn::process_write(HTTP_CODE ret)
             }
             break;
         case BAD_REQUEST:
+            server_stats::status(400);
+            m_linger = false; // 请求格式错误时找不到下一个请求的开头，关闭连接
             add_status_line(400, error_400_title);
             add_headers(strlen(error_400_form));
             if (!add_content( error_400_form )) 
@@ -558,6 +1200,7 @@ bool http_conn::process_write(HTTP_CODE ret)
             }
             break;
         case NO_RESOURCE:
+            server_stats::status(404);
             add_status_line(404, error_404_title);
             add_headers(strlen(error_404_form));
             if (!add_content( error_404_form)) 
@@ -565,7 +1208,17 @@ bool http_conn::process_write(HTTP_CODE ret)
                 return false;
             }
             break;
+        case METHOD_NOT_ALLOWED:
+            server_stats::status(405);
+            add_status_line(405, error_405_title);
+            add_headers(strlen(error_405_form));
+            if (!add_content(error_405_form)) 
+            {
+                return false;
+            }
+            break;
         case FORBIDDEN_REQUEST:
+            server_stats::status(403);
             add_status_line(403, error_403_title);
             add_headers(strlen(error_403_form));
             if (!add_content(error_403_form)) 
@@ -574,8 +1227,10 @@ bool http_conn::process_write(HTTP_CODE ret)
             }
             break;
         case FILE_REQUEST:
+            server_stats::status(200);
             add_status_line(200, ok_200_title );
             add_headers(m_file_stat.st_size);
+            m_content = m_file_address;
             m_iv[0].iov_base = m_write_buf;
             m_iv[0].iov_len = m_write_idx;
             m_iv[1].iov_base = m_file_address;
@@ -585,6 +1240,49 @@ bool http_conn::process_write(HTTP_CODE ret)
             bytes_to_send = m_write_idx + m_file_stat.st_size;
 
             return true;
+        case STATS_REQUEST:
+            server_stats::status(200);
+            add_status_line(200, ok_200_title);
+            add_headers(m_body.size());
+            account_body();
+            m_content = m_body.data();
+            m_iv[0].iov_base = m_write_buf;
+            m_iv[0].iov_len = m_write_idx;
+            m_iv[1].iov_base = (char*)m_content;
+            m_iv[1].iov_len = m_body.size();
+            m_iv_count = 2;
+
+            bytes_to_send = m_write_idx + m_body.size();
+
+            return true;
+        case CORO_REQUEST:
+            server_stats::status(m_coro->status());
+            add_status_line(m_coro->status(), coro_request::status_title(m_coro->status()));
+            add_content_length(m_body.size());
+            add_content_type();
+            add_linger();
+            add_response("%s", m_coro->headers().c_str());
+            add_blank_line();
+            account_body();
+            m_content = m_body.data();
+            m_iv[0].iov_base = m_write_buf;
+            m_iv[0].iov_len = m_write_idx;
+            m_iv[1].iov_base = (char*)m_content;
+            m_iv[1].iov_len = m_method == HEAD ? 0 : m_body.size();
+            m_iv_count = 2;
+
+            bytes_to_send = m_write_idx + m_iv[1].iov_len;
+
+            return true;
+        case SSE_REQUEST:
+            // 没有 Content-Length，响应体一直到连接关闭；retry 告诉浏览器断开后多久重连
+            server_stats::status(200);
+            m_sse = true;
+            add_status_line(200, ok_200_title);
+            add_response("Content-Type: text/event-stream\r\nCache-Control: no-cache\r\n");
+            add_blank_line();
+            add_response("retry: %d\n\n", 1000);
+            break;
         default:
             return false;
     }
@@ -599,13 +1297,90 @@ bool http_conn::process_write(HTTP_CODE ret)
 // 由线程池中的工作线程调用，这是处理HTTP请求的入口函数
 void http_conn::process() 
 {
+    server_stats::add(server_stats::DEQUEUED);
+
+    // 运行到完成模式下主线程已经解析好的请求
+    if (m_pending != NO_REQUEST) 
+    {
+        HTTP_CODE read_ret = m_pending;
+        m_pending = NO_REQUEST;
+        dispatch(read_ret);
+        return;
+    }
+
+    // 协程处理函数等待的事件已经就绪，从挂起的地方继续执行
+    if (m_coro) 
+    {
+        run_coro(m_coro->resume());
+        return;
+    }
+
+    // 已经切换到HTTP/2，或者连接以HTTP/2连接序言开头（prior knowledge）
+    if (m_h2 || start_h2()) 
+    {
+        process_h2();
+        return;
+    }
+
     // 解析HTTP请求
+    uint64_t parse_start = server_stats::now_ns();
+    server_stats::record(server_stats::QUEUE_WAIT, parse_start - m_read_done);
+    if (m_trace_id) 
+    {
+        request_trace::record(m_trace_id, request_trace::DEQUEUE, parse_start);
+    }
+    m_pipelined = false;
     HTTP_CODE read_ret = process_read();
     if (read_ret == NO_REQUEST) 
     {
         modfd(m_epollfd, m_sockfd, EPOLLIN);
         return;
     }
+    uint64_t parse_done = server_stats::now_ns();
+    server_stats::record(server_stats::PARSE, parse_done - parse_start);
+    if (m_trace_id) 
+    {
+        request_trace::record(m_trace_id, request_trace::PARSE_DONE, parse_done);
+    }
+    server_stats::add(server_stats::REQUESTS);
+    dispatch(read_ret);
+}
+
+void http_conn::dispatch(HTTP_CODE read_ret) 
+{
+    // 转发给上游，之后的读写都在主线程中进行
+    if (read_ret == PROXY_REQUEST) 
+    {
+        server_stats::add(server_stats::PROXIED);
+        start_proxy();
+        return;
+    }
+
+    // 协程处理函数，等待 I/O 时挂起，不占用工作线程
+    if (read_ret == CORO_REQUEST) 
+    {
+        run_coro(m_coro->start());
+        return;
+    }
+
+    // 请求头带有 Upgrade: h2c，回复 101 后切换到HTTP/2，这个请求的响应在 stream 1 上发送
+    if (m_h2c_upgrade && m_h2_settings) 
+    {
+        m_h2 = new http2_conn();
+        mem_budget::charge(mem_budget::CONNECTIONS, sizeof(http2_conn));
+        m_h2->init_upgrade(m_h2_settings, read_ret, read_ret == FILE_REQUEST ? m_file_address : 0, m_file_stat.st_size);
+        m_file_address = 0;
+        // 客户端可能已经紧跟着请求发送了连接序言
+        if (m_read_idx > m_checked_idx) 
+        {
+            m_h2->feed(m_read_buf + m_checked_idx, m_read_idx - m_checked_idx);
+        }
+        init();
+        m_read_idx = 0; // 剩下的数据已经交给分帧层
+        m_pipelined = false;
+        process_h2();
+        return;
+    }
     
     // 生成响应
     bool write_ret = process_write(read_ret);
@@ -615,3 +1390,508 @@ void http_conn::process()
     }
     modfd(m_epollfd, m_sockfd, EPOLLOUT);
 }
+
+// 运行到完成模式：主线程收到连接上的事件后直接读、解析、生成响应并发送，
+// 省掉放入请求队列、唤醒工作线程和每个请求两次 epoll_ctl 的开销。
+// 代理、HTTP/2 和挂起等待的协程仍然交给工作线程，不在页缓存中的文件由 write 交给 I/O 线程。
+http_conn::INLINE_RESULT http_conn::process_inline(uint32_t events) 
+{
+    if (bytes_to_send > 0) 
+    {
+        // 上一个响应还没有发完，先不读新的请求
+        if (!(events & EPOLLOUT)) 
+        {
+            return INLINE_DONE;
+        }
+        if (!write()) 
+        {
+            return INLINE_CLOSE;
+        }
+        if (bytes_to_send > 0) 
+        {
+            return INLINE_DONE;
+        }
+        // 发完了，边沿触发不会再报告发送期间到达的数据，接着读
+    } 
+    else if (!(events & EPOLLIN) && !m_pipelined) 
+    {
+        return INLINE_DONE;
+    }
+
+    // 读缓冲里有上一个响应之后留下的请求时，即使没有新数据也要解析
+    int read_idx = m_read_idx;
+    if (!read()) 
+    {
+        return INLINE_CLOSE;
+    }
+    if (m_read_idx == read_idx && !m_pipelined) 
+    {
+        return INLINE_DONE;
+    }
+    m_pipelined = false;
+    if (!admit()) 
+    {
+        reject();
+        return INLINE_CLOSE;
+    }
+    if (start_h2()) 
+    {
+        return offload(NO_REQUEST);
+    }
+
+    uint64_t parse_start = server_stats::now_ns();
+    HTTP_CODE read_ret = process_read();
+    if (read_ret == NO_REQUEST) 
+    {
+        return INLINE_DONE;
+    }
+    uint64_t parse_done = server_stats::now_ns();
+    server_stats::record(server_stats::PARSE, parse_done - parse_start);
+    if (m_trace_id) 
+    {
+        request_trace::record(m_trace_id, request_trace::PARSE_DONE, parse_done);
+    }
+    server_stats::add(server_stats::REQUESTS);
+
+    if (read_ret == PROXY_REQUEST || (m_h2c_upgrade && m_h2_settings)) 
+    {
+        return offload(read_ret);
+    }
+    if (read_ret == CORO_REQUEST) 
+    {
+        // 协程处理函数先在主线程中执行，挂起时才注销连接，由等待的事件唤醒后在工作线程中继续
+        if (!m_coro->start()) 
+        {
+            offload(NO_REQUEST);
+            run_coro(false);
+            return INLINE_DONE;
+        }
+        server_stats::add(server_stats::INLINE);
+        if (!finish_coro() || !write()) 
+        {
+            return INLINE_CLOSE;
+        }
+    } 
+    else 
+    {
+        server_stats::add(server_stats::INLINE);
+        if (!process_write(read_ret) || !write()) 
+        {
+            return INLINE_CLOSE;
+        }
+    }
+    // 响应已经发完，读缓冲里还有下一个请求（pipelining）时接着处理，不会再有事件通知
+    if (m_pipelined && m_inline) 
+    {
+        return process_inline(0);
+    }
+    return INLINE_DONE;
+}
+
+// 把连接交给工作线程：先从 epoll 注销，工作线程处理期间主线程不会收到它的事件，
+// 工作线程之后用 modfd 重新注册，响应发完后再回到运行到完成模式
+http_conn::INLINE_RESULT http_conn::offload(HTTP_CODE pending) 
+{
+    sys_io::epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_sockfd, 0);
+    m_inline = false;
+    m_pending = pending;
+    return INLINE_OFFLOAD;
+}
+
+// 检查文件映射中从 iv 开始的一个窗口是否在页缓存中，主线程发送时不能因为缺页阻塞在磁盘 I/O 上。
+// 在页缓存中则把 iv 限制在确认过的范围内，返回 true；
+// 否则从 epoll 注销连接（单次触发的注册已经用掉了），交给 I/O 线程读入，读完后由 file_ready 重新注册，返回 false。
+bool http_conn::file_window(struct iovec& iv) 
+{
+    size_t off = (char*)iv.iov_base - m_file_address;
+    if (off >= m_resident) 
+    {
+        size_t len = m_file_stat.st_size - off;
+        if (len > file_reader::WINDOW) 
+        {
+            len = file_reader::WINDOW;
+        }
+        if (!file_reader::resident((char*)iv.iov_base, len)) 
+        {
+            server_stats::add(server_stats::FILE_MISSES);
+            detach();
+            file_reader::submit((char*)iv.iov_base, len, file_ready, this);
+            return false;
+        }
+        m_resident = off + len;
+    }
+    if (iv.iov_len > m_resident - off) 
+    {
+        iv.iov_len = m_resident - off;
+    }
+    return true;
+}
+
+// 用完了时间片但还有数据要发送，重新注册，连接排到 epoll 就绪队列的末尾（主线程）
+void http_conn::yield_send() 
+{
+    server_stats::add(server_stats::SEND_YIELDS);
+    if (m_inline) 
+    {
+        // 边沿触发下修改注册也会重新检查就绪状态，套接字仍然可写时再报告一次
+        register_inline(m_epollfd, m_sockfd, EPOLL_CTL_MOD);
+    } 
+    else 
+    {
+        modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    }
+}
+
+// 令牌不够，等到 when 之后由主线程继续发送
+void http_conn::throttle(uint64_t when) 
+{
+    server_stats::add(server_stats::SEND_THROTTLED);
+    detach();
+    send_sched::defer(m_sockfd, when);
+}
+
+// 运行到完成模式下的连接一直注册着事件，暂停期间先从 epoll 注销，之后用 modfd 按单次触发重新注册
+void http_conn::detach() 
+{
+    if (m_inline) 
+    {
+        sys_io::epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_sockfd, 0);
+        m_inline = false;
+    }
+}
+
+// 连接从 epoll 中的注册和套接字都交给 sse_hub，这个对象和关闭的连接一样可以被新连接使用（主线程）
+void http_conn::start_sse() 
+{
+    int fd = m_sockfd;
+    release();
+    sse_hub::subscribe(fd);
+}
+
+// 文件的下一个窗口已经读入页缓存（I/O 线程），等待可写后继续发送
+void http_conn::file_ready(void* arg) 
+{
+    http_conn* conn = (http_conn*)arg;
+    modfd(m_epollfd, conn->m_sockfd, EPOLLOUT);
+}
+
+// 平滑退出时关闭空闲的长连接：上一个响应已经写完，之后一直没有收到新请求的数据。
+// 刚写完响应的连接可能马上收到下一个请求，关闭它会让客户端在发出请求后看到连接断开，所以只关闭空闲了一段时间的连接。
+bool http_conn::close_if_idle(uint64_t idle_before) 
+{
+    if (m_sockfd == -1 || m_idle_since == 0 || m_idle_since > idle_before) 
+    {
+        return false;
+    }
+    if (m_h2) 
+    {
+        // 空闲的 HTTP/2 连接先告诉客户端不会再处理新的流，发送失败（缓冲区满）也不重试
+        m_h2->shutdown();
+        sys_io::send(m_sockfd, m_h2->out_data(), m_h2->out_len(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    close_conn();
+    return true;
+}
+
+// 零拷贝发送的完成通知放在套接字的错误队列里，epoll 报告为 EPOLLERR（主线程）
+bool http_conn::zerocopy_event(uint32_t& events) 
+{
+    if (!zerocopy::enabled() || m_sockfd < 0 || !m_zc.reap(m_sockfd)) 
+    {
+        return false;
+    }
+    events &= ~EPOLLERR;
+    if (!m_inline && !(events & (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP))) 
+    {
+        // 这个通知用掉了 EPOLLONESHOT，按连接当前在等待的事件重新注册
+        bool writing = bytes_to_send > 0 || m_h2 || (m_proxy && m_proxy->active());
+        modfd(m_epollfd, m_sockfd, writing ? EPOLLOUT : EPOLLIN);
+    }
+    return true;
+}
+
+// 响应发送完毕，等待连接上的下一个请求；返回 false 时调用者关闭连接
+bool http_conn::rearm_read() 
+{
+    if (m_inline) 
+    {
+        return true; // 一直注册着读写事件
+    }
+    if (m_run_to_completion && !m_h2) 
+    {
+        // 交给工作线程处理的请求完成了，回到运行到完成模式；套接字可写，马上会收到 EPOLLOUT，
+        // 读缓冲里留下的请求在 process_inline 中处理
+        m_inline = true;
+        register_inline(m_epollfd, m_sockfd, EPOLL_CTL_MOD);
+        return true;
+    }
+    if (m_pipelined && m_pool) 
+    {
+        // 下一个请求已经读进来了，边沿触发不会再通知，直接放回请求队列；
+        // 和主线程收到 EPOLLIN 时一样先限流，流水线中的每个请求都要经过检查
+        if (!admit()) 
+        {
+            reject();
+            return false;
+        }
+        if (m_pool->append(this)) 
+        {
+            server_stats::add(server_stats::ENQUEUED);
+            return true;
+        }
+    }
+    modfd(m_epollfd, m_sockfd, EPOLLIN);
+    return true;
+}
+
+
+// 连接的第一批数据是否为HTTP/2连接序言，是则创建分帧层接管连接
+bool http_conn::start_h2() 
+{
+    if (m_read_idx == 0 || m_start_line != 0 || m_check_state != CHECK_STATE_REQUESTLINE) 
+    {
+        return false;
+    }
+    // 至少收到 "PRI " 才能和 HTTP/1.1 的请求行区分开
+    int len = m_read_idx < http2_conn::PREFACE_LEN ? m_read_idx : http2_conn::PREFACE_LEN;
+    if (len < 4 || memcmp(m_read_buf, http2_conn::PREFACE, len) != 0) 
+    {
+        return false;
+    }
+    // 序言不完整时也交给分帧层，由它等待剩余的字节
+    m_h2 = new http2_conn();
+    mem_budget::charge(mem_budget::CONNECTIONS, sizeof(http2_conn));
+    m_h2->init_prior_knowledge();
+    m_h2->feed(m_read_buf, m_read_idx);
+    m_read_idx = 0;
+    return true;
+}
+
+// 处理HTTP/2连接上收到的帧
+void http_conn::process_h2() 
+{
+    m_h2->process();
+    if (m_draining) 
+    {
+        m_h2->shutdown();
+    }
+    if (m_h2->produce() || m_h2->closing()) 
+    {
+        modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    } 
+    else 
+    {
+        // 所有的流都在等待对端的 WINDOW_UPDATE 或者新请求
+        if (m_h2->idle()) 
+        {
+            m_idle_since = server_stats::now_ns();
+        }
+        modfd(m_epollfd, m_sockfd, EPOLLIN);
+    }
+}
+
+// 写HTTP/2连接的输出缓冲，缓冲写完后继续按窗口生成 DATA 帧
+bool http_conn::write_h2() 
+{
+    if (m_draining) 
+    {
+        m_h2->shutdown(); // 正在处理的流发完后 closing() 为真，连接随之关闭
+    }
+    // 和 HTTP/1.1 的响应一样每次最多发送一个时间片，限速时还不能超过已有的令牌；
+    // 对端的流量控制窗口可能有几十 MB，不限制的话大下载会一直占住主线程
+    uint64_t budget = send_sched::quantum();
+    if (send_sched::limited() && m_h2->produce()) 
+    {
+        uint64_t now = server_stats::now_ns();
+        uint64_t avail = m_send_bucket.available(now);
+        uint64_t need = m_h2->out_len() < budget ? m_h2->out_len() : budget;
+        if (avail < need) 
+        {
+            throttle(now + m_send_bucket.wait_ns(need));
+            return true;
+        }
+        budget = avail;
+    }
+    uint64_t sent = 0;
+    while (m_h2->produce()) 
+    {
+        if (sent >= budget) 
+        {
+            // 这一次的时间片用完了，排到其他待发送的连接后面
+            yield_send();
+            return true;
+        }
+        size_t len = m_h2->out_len();
+        if (len > budget - sent) 
+        {
+            len = budget - sent;
+        }
+        int temp = sys_io::send(m_sockfd, m_h2->out_data(), len, 0);
+        if (temp <= -1) 
+        {
+            if (errno == EAGAIN) 
+            {
+                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                return true;
+            }
+            return false;
+        }
+        server_stats::add(server_stats::BYTES_OUT, temp);
+        m_h2->consume(temp);
+        m_send_bucket.consume(temp);
+        sent += temp;
+    }
+
+    if (m_h2->closing()) 
+    {
+        return false;
+    }
+    // 输出都发完了、也没有打开的流时开始计算空闲时间，长连接超时和平滑退出对 HTTP/2 连接同样有效
+    if (m_h2->idle()) 
+    {
+        m_idle_since = server_stats::now_ns();
+    }
+    modfd(m_epollfd, m_sockfd, EPOLLIN);
+    return true;
+}
+
+// 把请求转发给匹配的上游服务器组
+void http_conn::start_proxy() 
+{
+    std::string request;
+    build_proxy_request(request);
+    if (!m_proxy) 
+    {
+        m_proxy = new proxy_conn(m_epollfd, m_sockfd);
+        mem_budget::charge(mem_budget::CONNECTIONS, sizeof(proxy_conn));
+    }
+    decide_linger();
+    int ret = m_proxy->start(m_upstream, request, m_method == HEAD, m_linger);
+    if (!proxy_result(ret)) 
+    {
+        close_conn();
+    }
+}
+
+// 根据解析好的请求重新组装发往上游的请求：
+// 去掉逐跳的头部，上游连接总是保持连接，并附加客户端地址
+void http_conn::build_proxy_request(std::string& request) 
+{
+    // HTTP/1.0 的客户端不能解析 chunked 编码，按 HTTP/1.0 转发，上游就不会使用它
+    request.append(method_names[m_method]).append(" ").append(m_url).append(m_http10 ? " HTTP/1.0\r\n" : " HTTP/1.1\r\n");
+
+    // 请求头部在 parse_line 中被切成了以 \0\0 结尾的行，逐行取出
+    char* line = m_read_buf + m_header_idx;
+    while (line < m_read_buf + m_read_idx && *line != '\0') 
+    {
+        int len = strlen(line);
+        if (strncasecmp(line, "Connection:", 11) != 0 && strncasecmp(line, "Keep-Alive:", 11) != 0
+            && strncasecmp(line, "Upgrade:", 8) != 0 && strncasecmp(line, "HTTP2-Settings:", 15) != 0
+            && strncasecmp(line, "Proxy-Connection:", 17) != 0) 
+        {
+            request.append(line, len).append("\r\n");
+        }
+        line += len + 2;
+    }
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &m_address.sin_addr, ip, sizeof(ip));
+    request.append("Connection: keep-alive\r\nX-Forwarded-For: ").append(ip).append("\r\n\r\n");
+    if (m_content_length > 0) 
+    {
+        request.append(m_read_buf + m_checked_idx, m_content_length);
+    }
+}
+
+// 上游连接上的事件，返回 false 表示需要关闭客户端连接
+bool http_conn::upstream_event(uint32_t events) 
+{
+    if (!m_proxy) 
+    {
+        return false;
+    }
+    return proxy_result(m_proxy->on_upstream(events));
+}
+
+// 处理代理会话的结果：响应转发完毕后保持连接的话重新等待下一个请求
+bool http_conn::proxy_result(int result) 
+{
+    if (result == proxy_conn::PROXY_AGAIN) 
+    {
+        return true;
+    }
+    if (m_trace_id) 
+    {
+        request_trace::record(m_trace_id, request_trace::LAST_WRITE, server_stats::now_ns());
+    }
+    if (result == proxy_conn::PROXY_DONE) 
+    {
+        m_idle_since = server_stats::now_ns();
+        init();
+        return rearm_read();
+    }
+    return false;
+}
+
+// 协程处理函数等待的 fd 就绪（主线程）
+void http_conn::coro_event(uint32_t events) 
+{
+    m_coro->wake(m_epollfd, events);
+}
+
+// 协程挂起时注册它等待的事件，结束时生成响应
+void http_conn::run_coro(bool done) 
+{
+    while (!done) 
+    {
+        if (m_coro->arm(m_epollfd)) 
+        {
+            return; // 注册之后协程随时可能在别的线程中恢复，不能再访问连接
+        }
+        // 无法等待（比如 fd 无效），带着错误结果立即继续执行
+        done = m_coro->resume();
+    }
+
+    if (!finish_coro()) 
+    {
+        close_conn();
+    }
+    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+}
+
+// 协程处理函数结束，用它生成的内容填充响应
+bool http_conn::finish_coro() 
+{
+    m_body.swap(m_coro->response());
+    m_content_type = m_coro->content_type();
+    bool write_ret = process_write(CORO_REQUEST);
+    m_coro->~coro_request(); // 内存随 m_arena 一起释放
+    m_coro = NULL;
+    return write_ret;
+}
+
+bool http_conn::admit() 
+{
+    if (mem_budget::over_hard()) 
+    {
+        return false;
+    }
+    return !m_limiter || m_limiter->admit(m_address.sin_addr);
+}
+
+void http_conn::reject() 
+{
+    // 不进入写流程，发送失败（缓冲区满）也不重试
+    const char* response = error_429_response;
+    if (mem_budget::over_hard()) 
+    {
+        server_stats::add(server_stats::MEM_SHED);
+        server_stats::status(503);
+        response = error_503_response;
+    } 
+    else 
+    {
+        server_stats::status(429);
+    }
+    sys_io::send(m_sockfd, response, strlen(response), MSG_DONTWAIT | MSG_NOSIGNAL);
+}
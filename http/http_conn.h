@@ -20,18 +20,36 @@
 #include <errno.h>
 #include "../lock/locker.h"
 #include <sys/uio.h>
+#include <string>
+#include <atomic>
+#include "../zerocopy/zerocopy.h"
+#include "../arena/request_arena.h"
+#include "../sched/send_sched.h"
+
+class http2_conn;
+class proxy_conn;
+class upstream;
+class rate_limiter;
+class coro_request;
+template<typename T> class threadpool;
 
 class http_conn
 {
+    // 微基准测试直接调用解析和生成响应的私有函数
+    friend class http_conn_bench;
+
 public:
     // 文件名的最大长度
     static const int FILENAME_LEN = 200;   
+    // 请求内存池的内联部分，普通的静态文件请求和小的协程请求不需要再分配
+    static const int ARENA_INLINE_SIZE = 1024;
     // 读缓冲区的大小
     static const int READ_BUFFER_SIZE = 2048;   
     // 写缓冲区的大小
     static const int WRITE_BUFFER_SIZE = 1024;  
     
-    // HTTP请求方法，这里只支持GET
+    // HTTP请求方法：静态文件、/stats 和 /trace 只支持 GET；动态路由按注册的方法匹配，
+    // 代理路由转发任意方法，SSE 路径 GET 订阅、POST 发布
     enum METHOD {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT};
     
     /*
@@ -52,9 +70,20 @@ public:
         FILE_REQUEST: 文件请求,获取文件成功
         INTERNAL_ERROR: 表示服务器内部错误
         CLOSED_CONNECTION: 表示客户端已经关闭连接了
+        PROXY_REQUEST: 请求匹配了代理路由，需要转发给上游服务器
+        STATS_REQUEST: 请求了保留的 /stats 或 /trace 路径，响应体在内存中生成
+        CORO_REQUEST: 请求匹配了协程处理函数的路由，响应由协程生成
+        METHOD_NOT_ALLOWED: 路径匹配了路由，但是没有为请求的方法注册处理函数
+        SSE_REQUEST: 订阅 SSE 事件，响应头发完后连接交给 sse_hub
     */
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, PROXY_REQUEST, STATS_REQUEST, CORO_REQUEST, METHOD_NOT_ALLOWED, SSE_REQUEST };
     
+    // 运行到完成模式下主线程处理连接事件的结果
+    // INLINE_DONE: 已经处理完，或者在等待更多数据、等待发送缓冲有空间
+    // INLINE_CLOSE: 需要关闭连接
+    // INLINE_OFFLOAD: 连接已经从 epoll 注销，需要放入请求队列交给工作线程
+    enum INLINE_RESULT { INLINE_DONE = 0, INLINE_CLOSE, INLINE_OFFLOAD };
+
     // 从状态机的三种可能状态，即行的读取状态，分别表示:
     // 1.读取到一个完整的行 
     // 2.行出错 
@@ -62,7 +91,9 @@ public:
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
 
 public:
-    http_conn() {}
+    http_conn() : m_sockfd(-1), m_read_idx(0), m_checked_idx(0), m_check_state(CHECK_STATE_REQUESTLINE), m_content_length(0),
+                  m_body_charged(0), m_capture_id(0), m_h2(NULL), m_proxy(NULL), m_coro(NULL), m_idle_since(0),
+                  m_arena(m_arena_buf, ARENA_INLINE_SIZE) {}
     ~http_conn() {}
 
 public:
@@ -71,9 +102,25 @@ public:
     void process(); // 处理客户端请求
     bool read(); // 非阻塞读请求
     bool write(); // 非阻塞写请求
+    bool upstream_event(uint32_t events); // 代理请求的上游连接上有事件
+    void coro_event(uint32_t events); // 协程处理函数等待的 fd 就绪，调用者随后把连接放回请求队列
+    bool admit(); // 按客户端IP限流，超过内存硬限制时拒绝所有请求，主线程读完数据、交给线程池之前调用
+    void reject(); // 拒绝请求，直接回复 429（超过内存硬限制时 503），调用者随后关闭连接
+    bool is_inline() const { return m_inline; } // 连接是否由主线程直接处理（运行到完成模式）
+    INLINE_RESULT process_inline(uint32_t events); // 主线程直接读、解析、生成并发送响应
+    bool zerocopy_event(uint32_t& events); // EPOLLERR 只是零拷贝的完成通知时去掉它并返回 true
+    bool close_if_idle(uint64_t idle_before); // 长连接超时、平滑退出或者内存超过硬限制：在 idle_before 之前就已经空闲的连接直接关闭（主线程）
+
+    // 解析 -k 的参数 timeout_s[:max_requests]
+    static bool parse_keep_alive(const char* arg);
+
+    // 解析 doc_root + url 对应的文件，成功时将其映射到 *file_address，HTTP/1.1 和 HTTP/2 共用
+    // 忽略查询字符串，以 '/' 结尾的 url 加上首页文件名
+    static HTTP_CODE map_file(const char* url, char* real_file, struct stat* file_stat, char** file_address);
 
 private:
     void init(); // 初始化连接
+    void release(); // 释放连接占用的资源，套接字已经关闭或者交给了 sse_hub
     HTTP_CODE process_read(); // 解析HTTP请求
     bool process_write(HTTP_CODE ret); // 填充HTTP应答
 
@@ -82,11 +129,15 @@ private:
     HTTP_CODE parse_headers(char* text);
     HTTP_CODE parse_content(char* text);
     HTTP_CODE do_request();
+    HTTP_CODE do_stats(const char* query);
+    HTTP_CODE do_trace(const char* query);
+    HTTP_CODE do_sse(const char* query);
     char* get_line() { return m_read_buf + m_start_line; }
     LINE_STATUS parse_line();
 
     // 这一组函数被process_write调用以填充HTTP应答。
     void unmap();
+    void account_body();
     bool add_response(const char* format, ...);
     bool add_content(const char* content);
     bool add_content_type();
@@ -94,13 +145,57 @@ private:
     bool add_headers(int content_length);
     bool add_content_length(int content_length);
     bool add_linger();
+    void decide_linger();
     bool add_blank_line();
 
+    // HTTP/2 连接的处理和写
+    bool start_h2();
+    void process_h2();
+    bool write_h2();
+
+    // 反向代理
+    void start_proxy();
+    void build_proxy_request(std::string& request);
+    bool proxy_result(int result);
+
+    // 协程处理函数
+    void run_coro(bool done);
+    bool finish_coro();
+
+    // 解析完成之后的处理：代理、协程、升级或者生成响应，在工作线程中执行
+    void dispatch(HTTP_CODE read_ret);
+    // 运行到完成模式
+    INLINE_RESULT offload(HTTP_CODE pending);
+    bool rearm_read();
+    // 文件映射中接下来要发送的部分不在页缓存时交给 I/O 线程读入
+    bool file_window(struct iovec& iv);
+    static void file_ready(void* arg);
+    // 大响应分时间片发送和限速
+    void yield_send();
+    void throttle(uint64_t when);
+    void detach();
+    // 订阅 SSE 的响应头发完了，连接交给 sse_hub
+    void start_sse();
+
 public:
     // 所有socket上的事件都被注册到同一个epoll内核事件表中，所以将epoll文件描述符设置成静态的
     static int m_epollfd;    
-    // 统计用户的数量   
-    static int m_user_count;    
+    // 统计用户的数量，主线程和工作线程都会修改
+    static std::atomic<int> m_user_count;
+    // 按客户端IP限流，为 NULL 表示不限流
+    static rate_limiter* m_limiter;
+    // 请求目录时返回的首页文件
+    static const char* m_index_file;
+    // 运行到完成模式：简单请求在主线程中处理完，不经过请求队列
+    static bool m_run_to_completion;
+    // 正在平滑退出：响应写完后关闭连接，不再保持
+    static std::atomic<bool> m_draining;
+    // 请求队列，读缓冲里已经有下一个请求（pipelining）时直接放回队列
+    static threadpool<http_conn>* m_pool;
+    // 长连接空闲超过这么多秒后关闭，0 表示不超时，由 main 每秒检查一次
+    static int m_keep_alive_timeout;
+    // 一个连接上最多处理的请求数，最后一个响应带 Connection: close，0 表示不限制
+    static int m_max_requests;
 
 private:
     int m_sockfd; // 该HTTP连接的socket和对方的socket地址
@@ -114,24 +209,29 @@ private:
     int m_checked_idx;                   
     // 当前正在解析的行的起始位置   
     int m_start_line;              
+    // 请求头部在读缓冲区中的起始位置
+    int m_header_idx;
 
     // 主状态机当前所处的状态
     CHECK_STATE m_check_state;      
     // 请求方法        
     METHOD m_method;                        
 
-    // 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录
-    char m_real_file[FILENAME_LEN];     
+    // 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录，从 m_arena 中分配
+    char* m_real_file;     
     // 客户请求的目标文件的文件名  
     char* m_url;               
-    // HTTP协议版本号，仅支持HTTP1.1             
+    // HTTP协议版本号，支持 HTTP/1.0 和 HTTP/1.1
     char* m_version;                   
+    bool m_http10;
     // 主机名     
     char* m_host;                    
     // HTTP请求的消息总长度       
     int m_content_length;              
-    // HTTP请求是否要求保持连接     
+    // HTTP请求是否要求保持连接，HTTP/1.1 默认保持，HTTP/1.0 默认不保持
     bool m_linger;                          
+    // 连接上已经响应的请求数
+    int m_requests;
 
     // 写缓冲区
     char m_write_buf[WRITE_BUFFER_SIZE];  
@@ -148,6 +248,62 @@ private:
 
     int bytes_to_send;              // 将要发送的数据的字节数
     int bytes_have_send;            // 已经发送的字节数
+    // 响应体的起始位置，指向文件映射或者 m_body
+    const char* m_content;
+    // 文件映射中已经确认在页缓存中的前缀长度
+    size_t m_resident;
+    // 发送限速的令牌桶，整个连接共用
+    send_sched::bucket m_send_bucket;
+    // 在内存中生成的响应体（/stats）
+    std::string m_body;
+    // m_body 已经记在内存预算中的容量
+    size_t m_body_charged;
+    // 响应体的类型
+    const char* m_content_type;
+
+    // 收到请求第一个字节的时间和最近一次读完数据的时间（纳秒），用于统计延迟
+    uint64_t m_request_start;
+    uint64_t m_read_done;
+    // 请求的跟踪编号，0 表示没有被采样
+    uint32_t m_trace_id;
+    // 连接建立的时间，连接上的第一个请求被采样时记录，之后为 0
+    uint64_t m_accept_time;
+    // 流量录制中的连接编号，0 表示没有录制
+    uint32_t m_capture_id;
+
+    // 请求头中带有 Upgrade: h2c，响应时升级到 HTTP/2
+    bool m_h2c_upgrade;
+    // HTTP2-Settings 头部的值
+    char* m_h2_settings;
+    // 升级到 HTTP/2 之后由分帧层接管连接，为 NULL 表示仍是 HTTP/1.1
+    http2_conn* m_h2;
+
+    // 请求匹配的代理路由
+    upstream* m_upstream;
+    // 反向代理会话，第一次代理请求时创建，连接关闭时释放
+    proxy_conn* m_proxy;
+    // 正在执行的协程处理函数，请求开始时创建，响应生成后释放
+    coro_request* m_coro;
+
+    // 连接以边沿触发一直注册着读写事件，由主线程直接处理，不使用 EPOLLONESHOT
+    bool m_inline;
+    // 主线程已经解析好、交给工作线程继续处理的请求，NO_REQUEST 表示没有
+    HTTP_CODE m_pending;
+    // init() 时读缓冲里留下了紧跟着发来的下一个请求，还没有解析
+    bool m_pipelined;
+    // 正在发送的是 SSE 订阅的响应头
+    bool m_sse;
+
+    // 零拷贝发送的状态和还没有发完的响应体
+    zerocopy m_zc;
+    // 当前响应用过零拷贝发送
+    bool m_zc_used;
+    // 上一个响应写完的时间，收到下一个请求的数据之前有效，0 表示连接上有请求在处理；只由主线程读写
+    uint64_t m_idle_since;
+
+    // 请求的临时数据（文件路径、协程请求和协程帧），init() 时整体重置
+    alignas(16) char m_arena_buf[ARENA_INLINE_SIZE];
+    request_arena m_arena;
 };
 
 #endif
@@ -0,0 +1,186 @@
+#include "rate_limiter.h"
+#include <stdlib.h>
+#include <time.h>
+#include <exception>
+#include <new>
+
+// 毫秒时间，32位回绕（约49天）不影响差值计算
+static uint32_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static uint64_t make_state(uint32_t time, uint32_t tokens)
+{
+    return ((uint64_t)time << 32) | tokens;
+}
+
+rate_limiter::rate_limiter(size_t sets, rule ip, rule prefix) :
+    m_ip(ip), m_prefix(prefix),
+    m_allowed(0), m_rejected_ip(0), m_rejected_prefix(0), m_rejected_accept(0), m_evictions(0)
+{
+    size_t n = 1;
+    while (n < sets)
+    {
+        n <<= 1;
+    }
+    m_mask = n - 1;
+
+    // 按 cache line 对齐，每组正好占一行
+    void* mem = NULL;
+    if (posix_memalign(&mem, 64, n * WAYS * sizeof(slot)) != 0)
+    {
+        throw std::exception();
+    }
+    m_slots = (slot*)mem;
+    for (size_t i = 0; i < n * WAYS; ++i)
+    {
+        new (&m_slots[i]) slot;
+        m_slots[i].key.store(0, std::memory_order_relaxed);
+        m_slots[i].state.store(0, std::memory_order_relaxed);
+    }
+}
+
+rate_limiter::~rate_limiter()
+{
+    free(m_slots);
+}
+
+// 找到 key 对应的槽，没有的话淘汰组内最久没有访问的槽，新桶是满的
+rate_limiter::slot* rate_limiter::lookup(uint64_t key, const rule& r, uint32_t now)
+{
+    slot* set = m_slots + (((key * 0x9E3779B97F4A7C15ULL) >> 32) & m_mask) * WAYS;
+    slot* victim = set;
+    uint32_t oldest = 0;
+    for (int i = 0; i < WAYS; ++i)
+    {
+        uint64_t k = set[i].key.load(std::memory_order_acquire);
+        if (k == key)
+        {
+            return &set[i];
+        }
+        uint32_t idle = k ? now - (uint32_t)(set[i].state.load(std::memory_order_relaxed) >> 32) : UINT32_MAX;
+        if (idle >= oldest)
+        {
+            oldest = idle;
+            victim = &set[i];
+        }
+    }
+
+    // 两个线程同时替换同一个槽时只有一个成功，失败的一方直接使用成功者的桶，这只是近似的
+    uint64_t old_key = victim->key.load(std::memory_order_relaxed);
+    if (victim->key.compare_exchange_strong(old_key, key, std::memory_order_acq_rel))
+    {
+        victim->state.store(make_state(now, r.burst * TOKEN_SCALE), std::memory_order_release);
+        if (old_key)
+        {
+            m_evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return victim;
+}
+
+// 补充令牌并尝试取走一个，consume 为 false 时只检查是否还有令牌
+bool rate_limiter::take(uint64_t key, const rule& r, uint32_t now, bool consume)
+{
+    slot* s = lookup(key, r, now);
+    uint64_t max_tokens = (uint64_t)r.burst * TOKEN_SCALE;
+    uint64_t old = s->state.load(std::memory_order_acquire);
+    while (true)
+    {
+        uint32_t elapsed = now - (uint32_t)(old >> 32);
+        if (elapsed > 0x7fffffff)
+        {
+            elapsed = 0; // 其它线程写入了更新的时间
+        }
+        // rate 个令牌每秒 = rate * TOKEN_SCALE / 1000 每毫秒
+        uint64_t tokens = (old & 0xffffffff) + (uint64_t)elapsed * r.rate * TOKEN_SCALE / 1000;
+        if (tokens > max_tokens)
+        {
+            tokens = max_tokens;
+        }
+        bool ok = tokens >= TOKEN_SCALE;
+        if (!consume)
+        {
+            return ok;
+        }
+        if (ok)
+        {
+            tokens -= TOKEN_SCALE;
+        }
+        if (s->state.compare_exchange_weak(old, make_state(now, (uint32_t)tokens), std::memory_order_acq_rel))
+        {
+            return ok;
+        }
+    }
+}
+
+bool rate_limiter::admit(const in_addr& addr)
+{
+    uint32_t now = now_ms();
+    uint32_t ip = ntohl(addr.s_addr);
+    // 网段和单个IP的 key 用高位区分，保证不为0
+    uint64_t ip_key = (1ULL << 32) | ip;
+    uint64_t prefix_key = (2ULL << 32) | (ip & 0xffffff00);
+    // 先只检查两个桶，都有令牌时才各取走一个，超限的IP不会耗尽同一网段其它IP的配额
+    if (m_ip.rate && !take(ip_key, m_ip, now, false))
+    {
+        m_rejected_ip.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (m_prefix.rate && !take(prefix_key, m_prefix, now, false))
+    {
+        m_rejected_prefix.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    // 检查和取走之间其它线程可能取走了最后的令牌，以取走的结果为准
+    if (m_ip.rate && !take(ip_key, m_ip, now, true))
+    {
+        m_rejected_ip.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (m_prefix.rate && !take(prefix_key, m_prefix, now, true))
+    {
+        m_rejected_prefix.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    m_allowed.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool rate_limiter::admit_accept(const in_addr& addr)
+{
+    uint32_t now = now_ms();
+    uint32_t ip = ntohl(addr.s_addr);
+    if ((m_prefix.rate && !take((2ULL << 32) | (ip & 0xffffff00), m_prefix, now, false))
+        || (m_ip.rate && !take((1ULL << 32) | ip, m_ip, now, false)))
+    {
+        m_rejected_accept.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void rate_limiter::get_stats(stats& s) const
+{
+    s.allowed = m_allowed.load(std::memory_order_relaxed);
+    s.rejected_ip = m_rejected_ip.load(std::memory_order_relaxed);
+    s.rejected_prefix = m_rejected_prefix.load(std::memory_order_relaxed);
+    s.rejected_accept = m_rejected_accept.load(std::memory_order_relaxed);
+    s.evictions = m_evictions.load(std::memory_order_relaxed);
+}
+
+bool rate_limiter::parse_rule(const char* spec, rule& r)
+{
+    char* end = NULL;
+    r.rate = strtoul(spec, &end, 10);
+    r.burst = r.rate;
+    if (*end == ':')
+    {
+        r.burst = strtoul(end + 1, &end, 10);
+    }
+    // 令牌数用32位定点数保存
+    return *end == '\0' && r.rate > 0 && r.burst > 0 && r.burst < UINT32_MAX / TOKEN_SCALE;
+}
@@ -0,0 +1,75 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <netinet/in.h>
+
+// 按客户端IP（以及它所在的 /24 网段）限流的令牌桶表
+// 固定大小的组相联哈希表：每组 WAYS 个槽刚好占一个 cache line，组内按最近访问时间近似 LRU 淘汰。
+// 槽的内容都是原子变量，用 CAS 更新，多个线程同时检查也不需要加锁。
+class rate_limiter
+{
+public:
+    // 每组的槽数
+    static const int WAYS = 4;
+    // 令牌的定点精度，1 个令牌 = 1000
+    static const uint32_t TOKEN_SCALE = 1000;
+
+    // 限流的规则：每秒补充 rate 个令牌，最多积累 burst 个，rate 为 0 表示不限制
+    struct rule
+    {
+        uint32_t rate;
+        uint32_t burst;
+    };
+
+    // 计数器
+    struct stats
+    {
+        uint64_t allowed;           // 放行的请求
+        uint64_t rejected_ip;       // 因单个IP超限拒绝的请求
+        uint64_t rejected_prefix;   // 因 /24 网段超限拒绝的请求
+        uint64_t rejected_accept;   // 令牌已经耗尽时直接关闭的新连接
+        uint64_t evictions;         // 被淘汰的桶
+    };
+
+public:
+    // sets 会向上取整为 2 的幂
+    rate_limiter(size_t sets, rule ip, rule prefix);
+    ~rate_limiter();
+
+    // 请求到达时调用，消耗一个令牌，返回 false 表示应该拒绝
+    bool admit(const in_addr& addr);
+    // 新连接建立时调用，只检查不消耗令牌，令牌耗尽的客户端直接关闭连接
+    bool admit_accept(const in_addr& addr);
+
+    void get_stats(stats& s) const;
+
+    // 解析 rate[:burst] 格式的规则，burst 缺省等于 rate
+    static bool parse_rule(const char* spec, rule& r);
+
+private:
+    struct slot
+    {
+        std::atomic<uint64_t> key;      // 0 表示空槽
+        std::atomic<uint64_t> state;    // 高32位是上次补充令牌的毫秒时间，低32位是令牌数
+    };
+
+    bool take(uint64_t key, const rule& r, uint32_t now, bool consume);
+    slot* lookup(uint64_t key, const rule& r, uint32_t now);
+
+private:
+    slot* m_slots;
+    size_t m_mask;      // 组数 - 1
+    rule m_ip;
+    rule m_prefix;
+
+    std::atomic<uint64_t> m_allowed;
+    std::atomic<uint64_t> m_rejected_ip;
+    std::atomic<uint64_t> m_rejected_prefix;
+    std::atomic<uint64_t> m_rejected_accept;
+    std::atomic<uint64_t> m_evictions;
+};
+
+#endif
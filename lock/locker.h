@@ -4,6 +4,11 @@
 #include <pthread.h>
 #include <exception>
 #include <semaphore.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
 
 // 线程同步机制封装类
 
@@ -73,9 +78,7 @@ public:
     // 等待条件变量
     bool wait(pthread_mutex_t *mutex) 
     {
-        int ret = 0;
-        ret = pthread_cond_wait(&m_cond, mutex) == 0;
-        return ret == 0;
+        return pthread_cond_wait(&m_cond, mutex) == 0;
     }
 
     // 超时时间
@@ -131,6 +134,12 @@ public:
         return sem_wait(&m_sem) == 0;
     }
 
+    // 不阻塞地尝试等待，信号量为 0 时返回 false
+    bool trywait() 
+    {
+        return sem_trywait(&m_sem) == 0;
+    }
+
     // 增加信号量
     bool post() 
     {
@@ -141,4 +150,214 @@ private:
     sem_t m_sem;
 };
 
+// 下面是直接基于 futex 的同步原语，没有竞争时只有用户态的原子操作，不进入内核
+
+// 等待 *addr 不再等于 val（或者被唤醒、被信号打断），调用者自己重新检查条件
+inline void futex_wait(std::atomic<uint32_t>* addr, uint32_t val) 
+{
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+// 唤醒最多 n 个等待 addr 的线程
+inline void futex_wake(std::atomic<uint32_t>* addr, int n) 
+{
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+// 忙等待时让出流水线，降低自旋对同一个核上另一个超线程的影响
+inline void cpu_pause() 
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// 自适应互斥锁：锁被占用时先自旋一小段时间，持有者很快释放的话不用睡眠；仍然拿不到再 futex 睡眠
+// 状态 0 空闲，1 被持有，2 被持有并且可能有线程在睡眠（解锁时需要唤醒）
+// 独占一个缓存行，放在数组或者别的热数据旁边时不会伪共享
+class alignas(64) futex_mutex 
+{
+public:
+    // 自旋的次数，大约是一次短临界区的时间
+    static const int SPIN_COUNT = 100;
+
+public:
+    futex_mutex() : m_state(0) {}
+
+    bool lock() 
+    {
+        uint32_t c = 0;
+        if (m_state.compare_exchange_strong(c, 1, std::memory_order_acquire)) 
+        {
+            return true;
+        }
+        for (int i = 0; i < SPIN_COUNT; ++i) 
+        {
+            cpu_pause();
+            c = m_state.load(std::memory_order_relaxed);
+            if (c == 0 && m_state.compare_exchange_weak(c, 1, std::memory_order_acquire)) 
+            {
+                return true;
+            }
+        }
+        // 标记为有人等待后睡眠，醒来后仍按“有人等待”加锁，保证解锁时不会漏掉别的睡眠者
+        while (m_state.exchange(2, std::memory_order_acquire) != 0) 
+        {
+            futex_wait(&m_state, 2);
+        }
+        return true;
+    }
+
+    bool trylock() 
+    {
+        uint32_t c = 0;
+        return m_state.compare_exchange_strong(c, 1, std::memory_order_acquire);
+    }
+
+    bool unlock() 
+    {
+        if (m_state.exchange(0, std::memory_order_release) == 2) 
+        {
+            futex_wake(&m_state, 1);
+        }
+        return true;
+    }
+
+private:
+    std::atomic<uint32_t> m_state;
+};
+
+// 计数信号量：post 在没有线程睡眠时不进入内核
+class alignas(64) futex_sem 
+{
+public:
+    futex_sem(uint32_t count = 0) : m_count(count), m_waiters(0) {}
+
+    bool wait() 
+    {
+        while (!trywait()) 
+        {
+            m_waiters.fetch_add(1, std::memory_order_seq_cst);
+            // 计数仍为 0 才睡眠，post 在增加计数之后检查 m_waiters，两边都是 seq_cst，不会漏掉唤醒
+            futex_wait(&m_count, 0);
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    bool trywait() 
+    {
+        uint32_t c = m_count.load(std::memory_order_relaxed);
+        while (c > 0) 
+        {
+            if (m_count.compare_exchange_weak(c, c - 1, std::memory_order_acquire)) 
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool post() 
+    {
+        m_count.fetch_add(1, std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_seq_cst) > 0) 
+        {
+            futex_wake(&m_count, 1);
+        }
+        return true;
+    }
+
+private:
+    std::atomic<uint32_t> m_count;
+    std::atomic<uint32_t> m_waiters;
+};
+
+// 读写锁，读多写少的共享数据用，写者优先，避免读者源源不断时写者饿死
+class rwlock 
+{
+public:
+    rwlock() 
+    {
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        if (pthread_rwlock_init(&m_lock, &attr) != 0) 
+        {
+            pthread_rwlockattr_destroy(&attr);
+            throw std::exception();
+        }
+        pthread_rwlockattr_destroy(&attr);
+    }
+
+    ~rwlock() 
+    {
+        pthread_rwlock_destroy(&m_lock);
+    }
+
+    bool rdlock() 
+    {
+        return pthread_rwlock_rdlock(&m_lock) == 0;
+    }
+
+    bool wrlock() 
+    {
+        return pthread_rwlock_wrlock(&m_lock) == 0;
+    }
+
+    bool unlock() 
+    {
+        return pthread_rwlock_unlock(&m_lock) == 0;
+    }
+
+private:
+    pthread_rwlock_t m_lock;
+};
+
+// 顺序锁：读者不写任何共享内存，读多写少并且数据能整体拷贝出来时比读写锁便宜得多
+// 写者之间用互斥锁排队，写期间序号为奇数；读者读到的序号为奇数或者读完后序号变了就重读：
+//     uint32_t seq;
+//     do { seq = lock.read_begin(); copy = data; } while (lock.read_retry(seq));
+// 被保护的数据在读的过程中可能被改写，读者只能拷贝，不能跟随其中的指针
+class seqlock 
+{
+public:
+    seqlock() : m_seq(0) {}
+
+    void write_lock() 
+    {
+        m_writer.lock();
+        m_seq.store(m_seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void write_unlock() 
+    {
+        m_seq.store(m_seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        m_writer.unlock();
+    }
+
+    uint32_t read_begin() const 
+    {
+        uint32_t seq;
+        while ((seq = m_seq.load(std::memory_order_acquire)) & 1) 
+        {
+            cpu_pause(); // 正在写
+        }
+        return seq;
+    }
+
+    bool read_retry(uint32_t seq) const 
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return m_seq.load(std::memory_order_relaxed) != seq;
+    }
+
+private:
+    std::atomic<uint32_t> m_seq;
+    futex_mutex m_writer;
+};
+
 #endif
\ No newline at end of file
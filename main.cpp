@@ -6,15 +6,26 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
-#include <fcntl.h>
-#include <sys/epoll.h>
 #include "locker.h"
-#include "threadpool.h"
 #include <signal.h>
 #include "http_conn.h"
-
-#define MAX_FD 65535 // 最大文件描述符个数
-#define MAX_EVENT_NUMBER 10000 // 监听最大事件数量
+#include "proxy_conn.h"
+#include "rate_limiter.h"
+#include "stats.h"
+#include "request_trace.h"
+#include "traffic_capture.h"
+#include "coro_handler.h"
+#include "router.h"
+#include "busy_poll.h"
+#include "zerocopy.h"
+#include "send_sched.h"
+#include "master.h"
+#include "mem_budget.h"
+#include "sse_hub.h"
+#include "event_loop.h"
+#include <time.h>
+
+#define LIMITER_SETS 16384 // 限流表的组数，每组4个桶
 
 // 添加信号捕捉
 void addsig(int sig, void(handler)(int)) 
@@ -26,141 +37,154 @@ void addsig(int sig, void(handler)(int))
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-// 添加文件描述符到epoll
-extern void addfd(int epollfd, int fd, bool one_shot);
-// 从epoll中删除文件描述符
-extern void removefd(int epollfd, int fd);
-// 从epoll中修改文件描述符
-// extern void modfd(int epollfd, int fd, int ev);
+// 收到 SIGUSR1 时，事件循环下一次醒来时打印统计信息
+void sig_usr1(int sig) 
+{
+    event_loop::m_dump_stats = 1;
+}
+
+// 收到 SIGUSR2 时，把请求跟踪写到 /tmp/webserver-trace-<pid>-<n>.json
+void sig_usr2(int sig) 
+{
+    event_loop::m_dump_trace = 1;
+}
+
+// 收到 SIGQUIT 时平滑退出：不再接受连接，现有的连接处理完后退出
+void sig_quit(int sig) 
+{
+    event_loop::m_drain = 1;
+}
 
 int main(int argc, char* argv[])
 {
     if(argc <= 1)
     {
-        printf("按照如下格式运行：%s port_number\n", basename(argv[0]));
+        printf("按照如下格式运行：%s port_number [-P /prefix=ip:port|unix:/path[,...][;rr|;lc]]... "
+               "[-r ip_rate[:burst]] [-R prefix_rate[:burst]] [-t trace_sample] [-c capture_file] [-i index_file] [-e] [-b spin_us[:cpu_pct]] [-z zerocopy_min_bytes] [-q quantum[:bytes_per_sec]] [-w workers [-U]] [-m soft[:hard]] [-k keepalive_s[:max_requests]] [-E /events]\n", basename(argv[0]));
         return 1;
     }
 
     // 获取端口号
     int port = atoi(argv[1]); // 字符串转换为整型
-
-    // 对sigpipe信号进行处理
-    addsig(SIGPIPE, SIG_IGN);
-
-    // 创建线程池，初始化线程池
-    threadpool<http_conn> * pool = NULL;
-    try 
+    master::save_args(argc, argv);
+
+    // 解析端口号之后的选项
+    // -P 添加一条反向代理路由，可以重复
+    // -r/-R 每个客户端IP/每个 /24 网段每秒的请求数和突发数
+    // -t 请求跟踪的采样率，每 N 个请求记录一个
+    // -c 把收到的请求字节录制到文件，用 bench/replay 回放
+    // -i 请求目录（例如 /）时返回的首页文件，默认 index.html
+    // -e 运行到完成模式，简单请求在主线程中处理完，只有慢的请求交给线程池
+    // -b 忙轮询模式，主线程和工作线程阻塞前最多自旋 spin_us 微秒，自旋占用每个线程不超过 cpu_pct% 的时间
+    // -z 剩余响应体不小于这个字节数时用 MSG_ZEROCOPY 发送
+    // -q 大响应每次最多发送 quantum 字节后让出主线程，可以同时限制每个连接每秒发送的字节数
+    // -w 主进程 fork 出这么多个工作进程共用监听 socket，-U 从正在运行的主进程接管监听 socket（升级）
+    // -m 内存预算的软限制和硬限制（字节，可以带 K/M/G），超过软限制时回收缓存并暂停 accept，超过硬限制时拒绝请求
+    // -k 长连接空闲超过这么多秒后关闭（默认 60，0 不超时），一个连接最多处理 max_requests 个请求（默认不限制）
+    // -E SSE 事件的路径，GET 订阅，本机 POST 发布
+    int opt;
+    bool valid = true;
+    rate_limiter::rule ip_rule = {0, 0}, prefix_rule = {0, 0};
+    bool take_over = false;
+    while(valid && (opt = getopt(argc - 1, argv + 1, "P:r:R:t:c:i:eb:z:q:w:Um:k:E:")) != -1) 
     {
-        pool = new threadpool<http_conn>;
-    } 
-    catch(...) 
+        switch(opt) 
+        {
+            case 'P': valid = upstream::add_route(optarg); break;
+            case 'r': valid = rate_limiter::parse_rule(optarg, ip_rule); break;
+            case 'R': valid = rate_limiter::parse_rule(optarg, prefix_rule); break;
+            case 't': request_trace::set_sample(atoi(optarg)); break;
+            case 'c': valid = traffic_capture::start(optarg); break;
+            case 'i': http_conn::m_index_file = optarg; valid = strchr(optarg, '/') == NULL; break;
+            case 'e': http_conn::m_run_to_completion = true; break;
+            case 'b': valid = busy_poll::parse(optarg); break;
+            case 'z': valid = zerocopy::parse(optarg); break;
+            case 'q': valid = send_sched::parse(optarg); break;
+            case 'w': valid = master::parse_workers(optarg); break;
+            case 'U': take_over = true; break;
+            case 'm': valid = mem_budget::parse(optarg); break;
+            case 'k': valid = http_conn::parse_keep_alive(optarg); break;
+            case 'E': valid = sse_hub::parse(optarg); break;
+            default: valid = false; break;
+        }
+    }
+    // 多个工作进程不能写同一个录制文件；接管监听 socket 之后要由主进程通知旧主进程
+    if(!valid || (master::workers() && traffic_capture::enabled()) || (take_over && !master::workers())) 
     {
+        printf("invalid option\n");
         return 1;
     }
+    if(ip_rule.rate || prefix_rule.rate) 
+    {
+        http_conn::m_limiter = new rate_limiter(LIMITER_SETS, ip_rule, prefix_rule);
+        server_stats::set_limiter(http_conn::m_limiter);
+    }
 
-    // 创建一个数组，保存客户信息
-    http_conn* users = new http_conn[MAX_FD];
-    
-    // 创建监听socke
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-
-    // 端口复用
-    int reuse = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    // 动态路由，没有匹配的请求交给代理路由和静态文件
+    router::add("GET", "/health", coro_request::health);
+    router::add("GET", "/delay", coro_request::delay);
 
-    // 绑定
+    int listenfd = -1;
     int ret = 0;
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port);
-    ret = bind(listenfd, (struct sockaddr*)&address, sizeof(address));
-
-    // 监听
-    ret = listen(listenfd, 5);
-
-    // 创建epoll对象，事件数组，添加
-    epoll_event events[MAX_EVENT_NUMBER];
-    int epollfd = epoll_create(5);
-
-    // 将监听的文件描述符添加到epoll对象中
-    addfd(epollfd, listenfd, false);
-    http_conn::m_epollfd = epollfd;
-
-    // 循环检测事件发生
-    while(1) 
+    if(take_over) 
     {
-        int num = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
-        if((num < 0) && (errno != EINTR)) 
-        {
-            printf("epoll failure\n");
-            break;
-        } 
-
-        // 循环遍历事件数组
-        for(int i = 0; i < num; i ++) 
+        // 升级：监听 socket 来自旧的主进程
+        listenfd = master::take_over(port);
+        if(listenfd < 0) 
         {
-            int sockfd = events[i].data.fd;
-            if(sockfd == listenfd) 
-            { // 有客户端连接进来
-                struct sockaddr_in client_address;
-                socklen_t client_addrlen = sizeof(client_address);
-
-                int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlen);
-
-                if(connfd < 0) 
-                {
-                    printf("errno is: %d\n", errno);
-                    continue;
-                }
-
-                // 目前连接数满了
-                if(http_conn::m_user_count >= MAX_FD) 
-                {
-                    close(connfd);
-                    continue;
-                }
-
-                // 将新的客户的数据初始化，放到数组
-                users[connfd].init(connfd, client_address);
-
-            } 
-            else if(events[i].events &(EPOLLRDHUP | EPOLLHUP | EPOLLERR)) 
-            { // 处理异常
-                // 对方异常断开或错误
-                users[sockfd].close_conn();
-            } 
-            else if(events[i].events & EPOLLIN) // 检测读行为
-            {
-                
-                if(users[sockfd].read()) 
-                {
-                    // 一次性把数据读出来
-                    pool->append(users + sockfd); // 添加到线程池队列中
-                } 
-                else 
-                {
-                    // 读失败
-                    users[sockfd].close_conn();
-                }
-            } 
-            else if(events[i].events & EPOLLOUT) // 检测写行为
-            {
-                
-                if(!users[sockfd].write()) 
-                {
-                    // 可以写的时候一次性把数据写完
-                    users[sockfd].close_conn();
-                }
-            }
+            return 1;
         }
+    } 
+    else 
+    {
+        // 创建监听socke
+        listenfd = socket(PF_INET, SOCK_STREAM, 0);
+
+        // 端口复用
+        int reuse = 1;
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        // 绑定
+        struct sockaddr_in address;
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = INADDR_ANY;
+        address.sin_port = htons(port);
+        ret = bind(listenfd, (struct sockaddr*)&address, sizeof(address));
+
+        // 监听
+        ret = listen(listenfd, 5);
+    }
+
+    // SSE 的事件环由所有工作进程共用，在 fork 之前创建
+    if(sse_hub::enabled() && !sse_hub::setup()) 
+    {
+        return 1;
+    }
 
+    // 主进程在这里管理工作进程，不会返回；工作进程从这里继续，线程池等必须在 fork 之后创建
+    if(master::workers()) 
+    {
+        master::run(listenfd, port);
     }
 
-    close(epollfd);
-    close(listenfd);
-    delete [] users;
-    delete pool;
+    // 对sigpipe信号进行处理
+    addsig(SIGPIPE, SIG_IGN);
+    addsig(SIGUSR1, sig_usr1);
+    addsig(SIGUSR2, sig_usr2);
+    addsig(SIGQUIT, sig_quit);
+    // 工作进程从 master::spawn 出来时屏蔽着 SIGQUIT，处理函数安装好之后再解除
+    sigset_t quit;
+    sigemptyset(&quit);
+    sigaddset(&quit, SIGQUIT);
+    sigprocmask(SIG_UNBLOCK, &quit, NULL);
+
+    // 工作进程（或者单进程模式下的这个进程）运行事件循环，直到平滑退出完成
+    if(!event_loop::setup(listenfd, 8)) 
+    {
+        return 1;
+    }
+    event_loop::run();
+    event_loop::shutdown();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,414 @@
+#include "master.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <string>
+#include <vector>
+
+int master::m_workers = 0;
+
+// 升级时重新执行的程序和参数
+static std::vector<std::string> saved_args;
+static char exe_path[PATH_MAX];
+
+// 工作进程的槽位，pid 为 0 表示需要重新 fork
+struct worker_slot
+{
+    pid_t pid;
+    time_t started;
+};
+static worker_slot slots[master::MAX_WORKERS];
+
+// 主进程的控制 socket：等待新主进程的监听端，以及正在进行的升级连接
+static int ctl_fd = -1;
+static int peer_fd = -1;
+// 新主进程（-U）到旧主进程的连接，工作进程启动后通知旧主进程
+static int upgrade_fd = -1;
+
+static volatile sig_atomic_t got_child = 0;
+static volatile sig_atomic_t got_hup = 0;
+static volatile sig_atomic_t got_term = 0;
+static volatile sig_atomic_t got_quit = 0;
+
+static void on_signal(int sig)
+{
+    switch (sig)
+    {
+        case SIGCHLD: got_child = 1; break;
+        case SIGHUP: got_hup = 1; break;
+        case SIGQUIT: got_quit = 1; break;
+        default: got_term = 1; break;
+    }
+}
+
+// 不设置 SA_RESTART，信号到达时 poll 立即返回
+static void set_handler(int sig, void (*handler)(int))
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler;
+    sigfillset(&sa.sa_mask);
+    sigaction(sig, &sa, NULL);
+}
+
+void master::save_args(int argc, char* argv[])
+{
+    for (int i = 0; i < argc; ++i)
+    {
+        saved_args.push_back(argv[i]);
+    }
+    // 升级时 cwd 不变，但是 /proc/self/exe 指向旧的程序文件，所以记下启动时的路径
+    if (!realpath(argv[0], exe_path))
+    {
+        snprintf(exe_path, sizeof(exe_path), "%s", argv[0]);
+    }
+}
+
+bool master::parse_workers(const char* arg)
+{
+    char* end;
+    long n = strtol(arg, &end, 10);
+    if (*end != '\0' || n <= 0 || n > MAX_WORKERS)
+    {
+        return false;
+    }
+    m_workers = n;
+    return true;
+}
+
+int master::control_socket(int port, bool listen_side)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    // 抽象命名空间：sun_path 以 '\0' 开头，不对应文件，最后一个持有者关闭后自动消失
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    int len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "webserver-master-%d", port);
+    socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + len;
+    int ret = listen_side ? bind(fd, (struct sockaddr*)&addr, addr_len) : connect(fd, (struct sockaddr*)&addr, addr_len);
+    if (ret < 0 || (listen_side && listen(fd, 1) < 0))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int master::take_over(int port)
+{
+    int fd = control_socket(port, false);
+    if (fd < 0)
+    {
+        printf("no running master on port %d\n", port);
+        return -1;
+    }
+    struct timeval tv = { 5, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char c = 0;
+    struct iovec iov = { &c, 1 };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    int listenfd = -1;
+    if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) == 1 && c == 'L')
+    {
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+        {
+            memcpy(&listenfd, CMSG_DATA(cm), sizeof(int));
+        }
+    }
+    if (listenfd < 0)
+    {
+        printf("take over from master on port %d failed\n", port);
+        close(fd);
+        return -1;
+    }
+    upgrade_fd = fd;
+    return listenfd;
+}
+
+// 把监听 socket 发给新的主进程
+static bool send_listenfd(int fd, int listenfd)
+{
+    char c = 'L';
+    struct iovec iov = { &c, 1 };
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &listenfd, sizeof(int));
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == 1;
+}
+
+pid_t master::spawn(int listenfd)
+{
+    fflush(stdout); // 否则缓冲中的输出会在子进程中再写一次
+    // 工作进程在 main 安装平滑退出的处理函数之前收到 SIGQUIT 会按默认动作退出，
+    // 所以 fork 期间屏蔽 SIGQUIT，工作进程保持屏蔽，由 main 安装好处理函数后解除，期间的信号留到那时处理
+    sigset_t quit, old;
+    sigemptyset(&quit);
+    sigaddset(&quit, SIGQUIT);
+    sigprocmask(SIG_BLOCK, &quit, &old);
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // 工作进程：恢复默认的信号处理，主进程意外退出时平滑退出
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGHUP, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        prctl(PR_SET_PDEATHSIG, SIGQUIT);
+        if (getppid() != parent)
+        {
+            raise(SIGQUIT); // 主进程在 prctl 之前就退出了
+        }
+        if (ctl_fd >= 0)
+        {
+            close(ctl_fd);
+        }
+        if (peer_fd >= 0)
+        {
+            close(peer_fd);
+        }
+        if (upgrade_fd >= 0)
+        {
+            close(upgrade_fd);
+        }
+        return 0;
+    }
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    if (pid < 0)
+    {
+        printf("fork worker failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return pid;
+}
+
+void master::upgrade()
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        if (pid < 0)
+        {
+            printf("fork for upgrade failed: %s\n", strerror(errno));
+        }
+        return;
+    }
+    std::vector<char*> args;
+    bool has_flag = false;
+    for (size_t i = 0; i < saved_args.size(); ++i)
+    {
+        has_flag = has_flag || saved_args[i] == "-U";
+        args.push_back(&saved_args[i][0]);
+    }
+    if (!has_flag)
+    {
+        args.push_back((char*)"-U");
+    }
+    args.push_back(NULL);
+    execvp(exe_path, args.data());
+    printf("exec %s failed: %s\n", exe_path, strerror(errno));
+    _exit(1);
+}
+
+// 给所有工作进程发信号
+static void signal_workers(int sig)
+{
+    for (int i = 0; i < master::workers(); ++i)
+    {
+        if (slots[i].pid > 0)
+        {
+            kill(slots[i].pid, sig);
+        }
+    }
+}
+
+void master::run(int listenfd, int port)
+{
+    // 升级时新程序通过 SCM_RIGHTS 拿到监听 socket，不需要在 exec 时继承
+    fcntl(listenfd, F_SETFD, FD_CLOEXEC);
+    set_handler(SIGCHLD, on_signal);
+    set_handler(SIGHUP, on_signal);
+    set_handler(SIGTERM, on_signal);
+    set_handler(SIGINT, on_signal);
+    set_handler(SIGQUIT, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < m_workers; ++i)
+    {
+        slots[i].started = time(NULL);
+        pid_t pid = spawn(listenfd);
+        if (pid == 0)
+        {
+            return;
+        }
+        slots[i].pid = pid < 0 ? 0 : pid;
+    }
+
+    if (upgrade_fd >= 0)
+    {
+        // 自己的工作进程已经在 accept，通知旧主进程退出，等它关闭控制 socket 后再占用这个名字
+        char c = 'R';
+        if (::write(upgrade_fd, &c, 1) != 1 || ::read(upgrade_fd, &c, 1) < 0)
+        {
+            printf("notify old master failed: %s\n", strerror(errno));
+        }
+        close(upgrade_fd);
+        upgrade_fd = -1;
+    }
+    ctl_fd = control_socket(port, true);
+    if (ctl_fd < 0)
+    {
+        printf("control socket unavailable, upgrade disabled: %s\n", strerror(errno));
+    }
+    printf("master %d started %d workers\n", (int)getpid(), m_workers);
+    fflush(stdout);
+
+    bool stopping = false;
+    while (true)
+    {
+        if (got_child)
+        {
+            got_child = 0;
+            int status;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+            {
+                for (int i = 0; i < m_workers; ++i)
+                {
+                    if (slots[i].pid == pid)
+                    {
+                        slots[i].pid = 0;
+                        if (!stopping)
+                        {
+                            printf("worker %d exited (status %d), respawning\n", (int)pid, status);
+                        }
+                    }
+                }
+            }
+        }
+        if (got_term || got_quit)
+        {
+            signal_workers(got_term ? SIGTERM : SIGQUIT);
+            got_term = 0;
+            got_quit = 0;
+            stopping = true;
+        }
+        if (got_hup)
+        {
+            got_hup = 0;
+            if (!stopping && peer_fd < 0)
+            {
+                upgrade();
+            }
+        }
+
+        int alive = 0;
+        time_t now = time(NULL);
+        for (int i = 0; i < m_workers; ++i)
+        {
+            // 启动后 1 秒内就退出的工作进程推迟到下一秒再 fork，避免不停地崩溃重启
+            if (slots[i].pid == 0 && !stopping && now > slots[i].started)
+            {
+                slots[i].started = now;
+                pid_t pid = spawn(listenfd);
+                if (pid == 0)
+                {
+                    return;
+                }
+                slots[i].pid = pid < 0 ? 0 : pid;
+            }
+            alive += slots[i].pid > 0;
+        }
+        if (stopping && alive == 0)
+        {
+            printf("master %d exiting\n", (int)getpid());
+            exit(0);
+        }
+        fflush(stdout);
+
+        struct pollfd fds[2];
+        int nfds = 0;
+        if (peer_fd >= 0)
+        {
+            fds[nfds].fd = peer_fd;
+            fds[nfds++].events = POLLIN;
+        }
+        else if (ctl_fd >= 0 && !stopping)
+        {
+            fds[nfds].fd = ctl_fd;
+            fds[nfds++].events = POLLIN;
+        }
+        if (poll(fds, nfds, 1000) <= 0)
+        {
+            continue;
+        }
+
+        if (fds[0].fd == ctl_fd)
+        {
+            // 新的主进程来接管
+            peer_fd = accept4(ctl_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (peer_fd >= 0 && !send_listenfd(peer_fd, listenfd))
+            {
+                close(peer_fd);
+                peer_fd = -1;
+            }
+            continue;
+        }
+
+        char c = 0;
+        if (::read(peer_fd, &c, 1) == 1 && c == 'R')
+        {
+            // 新主进程的工作进程已经开始 accept：让出控制 socket，自己的工作进程平滑退出
+            close(ctl_fd);
+            ctl_fd = -1;
+            c = 'K';
+            ssize_t ret = ::write(peer_fd, &c, 1);
+            (void)ret;
+            printf("upgraded, draining old workers\n");
+            signal_workers(SIGQUIT);
+            stopping = true;
+        }
+        else
+        {
+            printf("upgrade aborted\n");
+        }
+        close(peer_fd);
+        peer_fd = -1;
+    }
+}
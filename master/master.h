@@ -0,0 +1,52 @@
+#ifndef MASTER_H
+#define MASTER_H
+
+#include <sys/types.h>
+
+// 主进程/工作进程模式（-w workers），默认关闭，整个服务器在一个进程中运行
+// 主进程创建监听 socket 后 fork 出 workers 个工作进程，每个工作进程运行完整的事件循环和线程池，共用同一个监听 socket；
+// 主进程只管理工作进程：工作进程异常退出时重新 fork（1 秒内连续退出的推迟到下一秒），不处理任何连接。
+//
+// 信号（发给主进程）：
+//   SIGTERM/SIGINT  工作进程立即退出，然后主进程退出
+//   SIGQUIT         工作进程平滑退出（见下），然后主进程退出
+//   SIGHUP          升级：用启动时的路径和参数加上 -U 重新执行程序文件，新的主进程接管监听 socket
+// 工作进程收到 SIGQUIT 时平滑退出：不再 accept，关闭空闲的长连接，处理中的请求写完响应后关闭连接，
+// 所有连接都关闭或者超过 DRAIN_TIMEOUT_MS 之后退出。没有 -w 时单个进程也按同样的方式处理 SIGQUIT。
+//
+// 不停机升级：主进程在抽象命名空间的 unix socket "webserver-master-<port>" 上等待新的主进程。
+// 新程序带 -U 启动时不创建监听 socket，而是连接这个 socket，通过 SCM_RIGHTS 收到旧主进程的监听 socket，
+// fork 出自己的工作进程之后通知旧主进程；旧主进程让自己的工作进程平滑退出，之后退出。
+// 监听 socket 始终打开，新旧工作进程交替期间都在 accept，客户端不会遇到连接被拒绝。
+// 新程序在通知之前失败（例如无法启动）时旧主进程继续正常运行。
+class master
+{
+public:
+    // 平滑退出时等待连接关闭的最长时间
+    static const int DRAIN_TIMEOUT_MS = 30000;
+    // 平滑退出时关闭空闲超过这个时间的长连接，处理中的连接写完当前响应后关闭
+    static const int DRAIN_IDLE_MS = 1000;
+    // 工作进程数上限
+    static const int MAX_WORKERS = 64;
+
+public:
+    // 在解析选项之前保存启动参数，升级时用它们重新执行
+    static void save_args(int argc, char* argv[]);
+    // 解析 -w 的参数
+    static bool parse_workers(const char* arg);
+    static int workers() { return m_workers; }
+    // -U：从 port 上正在运行的主进程接管监听 socket，失败返回 -1
+    static int take_over(int port);
+    // 启动工作进程并管理它们，只在工作进程中返回，主进程在这里面退出
+    static void run(int listenfd, int port);
+
+private:
+    static pid_t spawn(int listenfd);
+    static void upgrade();
+    static int control_socket(int port, bool listen_side);
+
+private:
+    static int m_workers;
+};
+
+#endif
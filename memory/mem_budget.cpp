@@ -0,0 +1,83 @@
+#include "mem_budget.h"
+#include <stdlib.h>
+#include <vector>
+
+std::atomic<int64_t> mem_budget::m_used[mem_budget::KIND_COUNT];
+int64_t mem_budget::m_soft = 0;
+int64_t mem_budget::m_hard = 0;
+
+static const char* kind_names[mem_budget::KIND_COUNT] = {
+    "connections", "buffers", "files", "queued"
+};
+
+// 只在启动时注册，之后只读
+static std::vector<void (*)()> reclaimers;
+
+// 解析一个字节数，可以带 K/M/G 后缀
+static bool parse_bytes(const char* s, char** end, int64_t& bytes)
+{
+    unsigned long long n = strtoull(s, end, 10);
+    if (*end == s)
+    {
+        return false;
+    }
+    switch (**end)
+    {
+        case 'K': case 'k': n <<= 10; ++*end; break;
+        case 'M': case 'm': n <<= 20; ++*end; break;
+        case 'G': case 'g': n <<= 30; ++*end; break;
+        default: break;
+    }
+    bytes = n;
+    return bytes > 0;
+}
+
+bool mem_budget::parse(const char* arg)
+{
+    char* end;
+    int64_t soft, hard;
+    if (!parse_bytes(arg, &end, soft))
+    {
+        return false;
+    }
+    hard = soft + soft / 4;
+    if (*end == ':' && (!parse_bytes(end + 1, &end, hard) || hard < soft))
+    {
+        return false;
+    }
+    if (*end != '\0')
+    {
+        return false;
+    }
+    m_soft = soft;
+    m_hard = hard;
+    return true;
+}
+
+int64_t mem_budget::total()
+{
+    int64_t sum = 0;
+    for (int i = 0; i < KIND_COUNT; ++i)
+    {
+        sum += m_used[i].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+const char* mem_budget::name(KIND kind)
+{
+    return kind_names[kind];
+}
+
+void mem_budget::add_reclaimer(void (*fn)())
+{
+    reclaimers.push_back(fn);
+}
+
+void mem_budget::reclaim()
+{
+    for (size_t i = 0; i < reclaimers.size(); ++i)
+    {
+        reclaimers[i]();
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef MEMBUDGET_H
+#define MEMBUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// 进程的内存预算（-m soft[:hard]），默认不限制，但始终统计，用量在 /stats 的 memory 中
+// 各个模块在分配和释放时记账，分成几类：
+//   CONNECTIONS  打开的连接的对象（包括读写缓冲），以及 HTTP/2 分帧层、代理连接等附属对象
+//   BUFFERS      堆上的响应体，以及请求内存池从堆上取的块（包括线程缓存的空闲块）
+//   FILES        映射的文件字节数（包括零拷贝发送时还被内核引用的映射），以及不存在路径的缓存表
+//   QUEUED       请求队列中等待工作线程的任务
+// 超过软限制时：回收缓存（调用注册的回收函数，内存池的空闲块不再缓存），空闲连接的响应体缓冲在下一个请求前释放，
+// 暂停 accept 直到用量回到软限制以下；超过硬限制时：新的请求直接回复 503 后关闭连接，空闲的长连接每秒关闭一次。
+// 硬限制默认是软限制的 1.25 倍。多进程模式（-w）下每个工作进程各自计算。
+class mem_budget
+{
+public:
+    enum KIND
+    {
+        CONNECTIONS = 0,
+        BUFFERS,
+        FILES,
+        QUEUED,
+        KIND_COUNT
+    };
+
+public:
+    // 解析 -m 的参数 soft[:hard]，字节数可以带 K/M/G 后缀
+    static bool parse(const char* arg);
+    static bool enabled() { return m_soft != 0; }
+
+    static void charge(KIND kind, size_t n) { m_used[kind].fetch_add(n, std::memory_order_relaxed); }
+    static void release(KIND kind, size_t n) { m_used[kind].fetch_sub(n, std::memory_order_relaxed); }
+    static int64_t used(KIND kind) { return m_used[kind].load(std::memory_order_relaxed); }
+    static int64_t total();
+    static const char* name(KIND kind);
+
+    static bool over_soft() { return m_soft && total() >= m_soft; }
+    static bool over_hard() { return m_hard && total() >= m_hard; }
+    static int64_t soft_limit() { return m_soft; }
+    static int64_t hard_limit() { return m_hard; }
+
+    // 注册超过软限制时由主线程调用的回收函数（释放缓存），在启动时注册
+    static void add_reclaimer(void (*fn)());
+    static void reclaim();
+
+private:
+    static std::atomic<int64_t> m_used[KIND_COUNT];
+    static int64_t m_soft;
+    static int64_t m_hard;
+};
+
+#endif
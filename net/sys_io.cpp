@@ -0,0 +1,74 @@
+#include "sys_io.h"
+#include <unistd.h>
+#include <fcntl.h>
+
+static int kernel_accept(int fd, struct sockaddr* addr, socklen_t* len)
+{
+    return ::accept(fd, addr, len);
+}
+
+static ssize_t kernel_recv(int fd, void* buf, size_t len, int flags)
+{
+    return ::recv(fd, buf, len, flags);
+}
+
+static ssize_t kernel_send(int fd, const void* buf, size_t len, int flags)
+{
+    return ::send(fd, buf, len, flags);
+}
+
+static ssize_t kernel_writev(int fd, const struct iovec* iov, int count)
+{
+    return ::writev(fd, iov, count);
+}
+
+static int kernel_close(int fd)
+{
+    return ::close(fd);
+}
+
+static int kernel_setsockopt(int fd, int level, int name, const void* value, socklen_t len)
+{
+    return ::setsockopt(fd, level, name, value, len);
+}
+
+static int kernel_fcntl(int fd, int cmd, int arg)
+{
+    return ::fcntl(fd, cmd, arg);
+}
+
+static int kernel_epoll_create(int size)
+{
+    return ::epoll_create(size);
+}
+
+static int kernel_epoll_ctl(int epfd, int op, int fd, struct epoll_event* event)
+{
+    return ::epoll_ctl(epfd, op, fd, event);
+}
+
+static int kernel_epoll_wait(int epfd, struct epoll_event* events, int max, int timeout)
+{
+    return ::epoll_wait(epfd, events, max, timeout);
+}
+
+static const sys_io::ops kernel_ops =
+{
+    kernel_accept,
+    kernel_recv,
+    kernel_send,
+    kernel_writev,
+    kernel_close,
+    kernel_setsockopt,
+    kernel_fcntl,
+    kernel_epoll_create,
+    kernel_epoll_ctl,
+    kernel_epoll_wait,
+};
+
+sys_io::ops sys_io::m_ops = kernel_ops;
+
+const sys_io::ops& sys_io::kernel()
+{
+    return kernel_ops;
+}
@@ -0,0 +1,52 @@
+#ifndef SYSIO_H
+#define SYSIO_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+
+// 事件循环和客户连接用到的 socket、epoll 系统调用，默认直接进入内核
+// bench/simbench 换成内存中模拟的网络（bench/sim_net），不经过内核驱动 event_loop 和 http_conn 的读写，
+// 可以精确地控制读到的字节数、写缓冲满和断开，统计每个请求的系统调用次数和指令数。
+// 只包括监听 socket、客户连接和 epoll 本身：文件、代理的上游连接、协程等待的 fd、eventfd、
+// 忙轮询和零拷贝的套接字选项仍然直接调用内核，模拟网络下不能使用这些功能。
+class sys_io
+{
+public:
+    struct ops
+    {
+        int (*accept)(int fd, struct sockaddr* addr, socklen_t* len);
+        ssize_t (*recv)(int fd, void* buf, size_t len, int flags);
+        ssize_t (*send)(int fd, const void* buf, size_t len, int flags);
+        ssize_t (*writev)(int fd, const struct iovec* iov, int count);
+        int (*close)(int fd);
+        int (*setsockopt)(int fd, int level, int name, const void* value, socklen_t len);
+        int (*fcntl)(int fd, int cmd, int arg);
+        int (*epoll_create)(int size);
+        int (*epoll_ctl)(int epfd, int op, int fd, struct epoll_event* event);
+        int (*epoll_wait)(int epfd, struct epoll_event* events, int max, int timeout);
+    };
+
+public:
+    // 直接调用内核的实现
+    static const ops& kernel();
+    // 替换所有调用，必须在创建 epoll 之前调用，之后不能再换
+    static void install(const ops& o) { m_ops = o; }
+
+    static int accept(int fd, struct sockaddr* addr, socklen_t* len) { return m_ops.accept(fd, addr, len); }
+    static ssize_t recv(int fd, void* buf, size_t len, int flags) { return m_ops.recv(fd, buf, len, flags); }
+    static ssize_t send(int fd, const void* buf, size_t len, int flags) { return m_ops.send(fd, buf, len, flags); }
+    static ssize_t writev(int fd, const struct iovec* iov, int count) { return m_ops.writev(fd, iov, count); }
+    static int close(int fd) { return m_ops.close(fd); }
+    static int setsockopt(int fd, int level, int name, const void* value, socklen_t len) { return m_ops.setsockopt(fd, level, name, value, len); }
+    static int fcntl(int fd, int cmd, int arg) { return m_ops.fcntl(fd, cmd, arg); }
+    static int epoll_create(int size) { return m_ops.epoll_create(size); }
+    static int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) { return m_ops.epoll_ctl(epfd, op, fd, event); }
+    static int epoll_wait(int epfd, struct epoll_event* events, int max, int timeout) { return m_ops.epoll_wait(epfd, events, max, timeout); }
+
+private:
+    static ops m_ops;
+};
+
+#endif
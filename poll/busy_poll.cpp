@@ -0,0 +1,97 @@
+#include "busy_poll.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+// 旧的内核头文件里没有 epoll 的忙轮询参数（Linux 6.9）
+#ifndef EPIOCSPARAMS
+struct epoll_params
+{
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+// 内核每次忙轮询最多处理的包数
+static const int POLL_BUDGET = 64;
+
+unsigned busy_poll::m_spin_us = 0;
+uint64_t busy_poll::m_spin_ns = 0;
+uint64_t busy_poll::m_budget_ns = 0;
+int busy_poll::m_max_spinners = 1;
+std::atomic<int> busy_poll::m_spinners(0);
+
+bool busy_poll::parse(const char* arg)
+{
+    char* end;
+    unsigned long us = strtoul(arg, &end, 10);
+    unsigned long pct = 50;
+    if (*end == ':')
+    {
+        pct = strtoul(end + 1, &end, 10);
+    }
+    if (*end != '\0' || us == 0 || us > 1000000 || pct == 0 || pct > 100)
+    {
+        return false;
+    }
+    m_spin_us = us;
+    m_spin_ns = us * 1000ULL;
+    m_budget_ns = WINDOW_NS * pct / 100;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus <= 1)
+    {
+        printf("busy poll: single CPU, spinning in user space disabled\n");
+        m_spin_ns = 0;
+    }
+    // 主线程占一个 CPU，工作线程最多用剩下的一半
+    m_max_spinners = cpus / 2 > 1 ? cpus / 2 : 1;
+    return true;
+}
+
+void busy_poll::setup_socket(int fd)
+{
+    static bool warned = false;
+    int us = m_spin_us;
+    int one = 1;
+    int budget = POLL_BUDGET;
+    // 超过 net.core.busy_read 的值需要 CAP_NET_ADMIN
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) < 0)
+    {
+        if (!warned)
+        {
+            warned = true;
+            printf("busy poll: SO_BUSY_POLL failed: %s, only spinning in user space\n", strerror(errno));
+        }
+        return;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget));
+}
+
+void busy_poll::setup_epoll(int epollfd)
+{
+    epoll_params params;
+    memset(&params, 0, sizeof(params));
+    params.busy_poll_usecs = m_spin_us;
+    params.busy_poll_budget = POLL_BUDGET;
+    params.prefer_busy_poll = 1;
+    if (ioctl(epollfd, EPIOCSPARAMS, &params) < 0)
+    {
+        printf("busy poll: EPIOCSPARAMS failed: %s\n", strerror(errno));
+    }
+}
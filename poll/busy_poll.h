@@ -0,0 +1,95 @@
+#ifndef BUSYPOLL_H
+#define BUSYPOLL_H
+
+#include <stdint.h>
+#include <atomic>
+#include "../lock/locker.h"
+#include "../stats/stats.h"
+
+// 低延迟的忙轮询模式（-b spin_us[:cpu_pct]），默认关闭
+// 1. 套接字设置 SO_BUSY_POLL/SO_PREFER_BUSY_POLL，epoll 设置 EPIOCSPARAMS，由内核在收包路径上轮询网卡队列
+//    （需要网卡驱动支持 NAPI，回环接口上没有效果；提高 SO_BUSY_POLL 需要 CAP_NET_ADMIN，失败时只打印一次警告）
+// 2. 主线程在阻塞于 epoll_wait 之前、工作线程在阻塞于信号量之前，先在用户态自旋最多 spin_us 微秒，
+//    省掉睡眠和唤醒的延迟，任务投递时 sem_post 也不需要唤醒线程
+// 3. 每个线程每 100ms 的窗口内自旋的时间不超过 cpu_pct%，超出后直接阻塞，空闲时不会占满 CPU；
+//    同时自旋的工作线程不超过 CPU 数的一半，只有一个 CPU 时不在用户态自旋（自旋的线程只会抢走干活的线程的时间）
+// 自旋命中、放弃的次数和自旋时间记在 /stats 的 spin_hits、spin_misses、spin_ns 中，和进程 CPU 时间 cpu_ns 对照
+class busy_poll
+{
+public:
+    // 预算窗口（纳秒）
+    static const uint64_t WINDOW_NS = 100000000ULL;
+
+    // 一个线程的自旋状态，只能由所属线程使用
+    class spinner
+    {
+    public:
+        // shared 为 true 的线程（工作线程）共用同时自旋的名额
+        explicit spinner(bool shared = false) : m_shared(shared), m_window_start(0), m_spent(0) {}
+
+        // 自旋直到 ready() 返回 true 或者超时，返回 ready() 是否成功；没有开启或者预算用完时直接返回 false
+        template<typename F>
+        bool spin(F ready)
+        {
+            if (!m_spin_ns)
+            {
+                return false;
+            }
+            uint64_t start = server_stats::now_ns();
+            if (start - m_window_start >= WINDOW_NS)
+            {
+                m_window_start = start;
+                m_spent = 0;
+            }
+            if (m_spent >= m_budget_ns)
+            {
+                return false;
+            }
+            if (m_shared)
+            {
+                int n = m_spinners.load(std::memory_order_relaxed);
+                if (n >= m_max_spinners || !m_spinners.compare_exchange_strong(n, n + 1))
+                {
+                    return false;
+                }
+            }
+            uint64_t now = start;
+            bool hit = false;
+            while (!(hit = ready()) && now - start < m_spin_ns)
+            {
+                cpu_pause();
+                now = server_stats::now_ns();
+            }
+            if (m_shared)
+            {
+                m_spinners.fetch_sub(1, std::memory_order_relaxed);
+            }
+            m_spent += now - start;
+            server_stats::add(server_stats::SPIN_NS, now - start);
+            server_stats::add(hit ? server_stats::SPIN_HITS : server_stats::SPIN_MISSES);
+            return hit;
+        }
+
+    private:
+        bool m_shared;
+        uint64_t m_window_start;
+        uint64_t m_spent;
+    };
+
+public:
+    // 解析 -b 的参数 spin_us[:cpu_pct]，cpu_pct 默认 50
+    static bool parse(const char* arg);
+    static bool enabled() { return m_spin_us != 0; }
+    // 在新的套接字和 epoll 实例上开启内核的忙轮询
+    static void setup_socket(int fd);
+    static void setup_epoll(int epollfd);
+
+private:
+    static unsigned m_spin_us;
+    static uint64_t m_spin_ns;
+    static uint64_t m_budget_ns;
+    static int m_max_spinners;
+    static std::atomic<int> m_spinners;
+};
+
+#endif
@@ -0,0 +1,572 @@
+#include "proxy_conn.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "../stats/stats.h"
+#include "../net/sys_io.h"
+
+// 定义在 http_conn.cpp 中
+extern void modfd(int epollfd, int fd, int ev);
+
+static const char* bad_gateway_response =
+    "HTTP/1.1 502 Bad Gateway\r\n"
+    "Content-Length: 50\r\n"
+    "Content-Type:text/html\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "The upstream server did not return a valid reply.\n";
+
+// chunked 编码的解析状态
+enum CHUNK_STATE { CHUNK_SIZE = 0, CHUNK_EXT, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER, CHUNK_TRAILER_LINE, CHUNK_ERROR };
+
+int proxy_conn::m_owner[MAX_FD];
+
+int proxy_conn::client_of(int upstream_fd)
+{
+    if (upstream_fd < 0 || upstream_fd >= MAX_FD)
+    {
+        return -1;
+    }
+    return m_owner[upstream_fd] - 1;
+}
+
+proxy_conn::proxy_conn(int epollfd, int client_fd) :
+    m_epollfd(epollfd), m_client_fd(client_fd), m_state(IDLE),
+    m_group(NULL), m_server(-1), m_fd(-1), m_reused(false), m_tries(0),
+    m_request_sent(0), m_head(false), m_keep_alive(false), m_buf_len(0), m_out_pos(0),
+    m_pipe_bytes(0)
+{
+    m_pipe[0] = m_pipe[1] = -1;
+}
+
+proxy_conn::~proxy_conn()
+{
+    if (m_fd >= 0)
+    {
+        // 响应还没有转发完，连接状态未知，不能放回连接池
+        detach_upstream();
+        m_group->release(m_server, m_fd, false);
+    }
+    if (m_pipe[0] >= 0)
+    {
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+    }
+}
+
+proxy_conn::RESULT proxy_conn::start(upstream* group, const std::string& request, bool head, bool keep_alive)
+{
+    m_group = group;
+    m_request = request;
+    m_head = head;
+    m_keep_alive = keep_alive;
+    m_tries = 0;
+    m_server = -1;
+    return connect_upstream();
+}
+
+// 取得上游连接并注册到 epoll，新建的连接等待 connect 完成，复用的连接直接等待可写
+proxy_conn::RESULT proxy_conn::connect_upstream()
+{
+    m_request_sent = 0;
+    m_buf_len = 0;
+    m_out.clear();
+    m_out_pos = 0;
+    m_chunked = false;
+    m_until_close = false;
+    m_upstream_keep_alive = true;
+    m_remaining = 0;
+    m_body_done = false;
+    m_chunk_state = CHUNK_SIZE;
+    m_chunk_left = 0;
+
+    int exclude = m_server;
+    m_fd = m_group->acquire(m_server, m_reused, exclude);
+    m_tries++;
+    if (m_fd < 0)
+    {
+        return bad_gateway();
+    }
+    if (m_fd >= MAX_FD)
+    {
+        m_group->release(m_server, m_fd, false);
+        m_fd = -1;
+        return bad_gateway();
+    }
+
+    m_state = m_reused ? SENDING : CONNECTING;
+    // 先登记归属再注册事件，主线程可能立即收到这个 fd 的事件
+    m_owner[m_fd] = m_client_fd + 1;
+    epoll_event event;
+    event.data.fd = m_fd;
+    event.events = EPOLLOUT | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    sys_io::epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_fd, &event);
+    return PROXY_AGAIN;
+}
+
+// 在收到任何响应之前失败，换一个后端重试
+// 复用的空闲连接可能刚好被上游关闭，这不算后端故障
+proxy_conn::RESULT proxy_conn::retry()
+{
+    detach_upstream();
+    if (m_reused && m_buf_len == 0)
+    {
+        m_group->release(m_server, m_fd, false);
+        m_server = -1; // 同一个后端还可以用
+    }
+    else
+    {
+        m_group->fail(m_server, m_fd);
+    }
+    m_fd = -1;
+    if (m_tries > (int)m_group->size())
+    {
+        return bad_gateway();
+    }
+    return connect_upstream();
+}
+
+proxy_conn::RESULT proxy_conn::on_upstream(uint32_t events)
+{
+    switch (m_state)
+    {
+        case CONNECTING:
+        {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err || (events & EPOLLERR))
+            {
+                printf("connect upstream %s failed: %s\n", m_group->name(m_server), strerror(err));
+                return retry();
+            }
+            m_state = SENDING;
+            return send_request();
+        }
+        case SENDING:
+            return send_request();
+        case READING_HEADER:
+            return read_header();
+        case RELAYING:
+            return pump();
+        default:
+            return PROXY_CLOSE;
+    }
+}
+
+proxy_conn::RESULT proxy_conn::on_client_writable()
+{
+    return pump();
+}
+
+proxy_conn::RESULT proxy_conn::send_request()
+{
+    while (m_request_sent < m_request.size())
+    {
+        int n = send(m_fd, m_request.data() + m_request_sent, m_request.size() - m_request_sent, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                arm_upstream(EPOLLOUT);
+                return PROXY_AGAIN;
+            }
+            return retry();
+        }
+        m_request_sent += n;
+    }
+    m_state = READING_HEADER;
+    arm_upstream(EPOLLIN);
+    return PROXY_AGAIN;
+}
+
+proxy_conn::RESULT proxy_conn::read_header()
+{
+    while (true)
+    {
+        int n = recv(m_fd, m_buf + m_buf_len, BUFFER_SIZE - m_buf_len, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            arm_upstream(EPOLLIN);
+            return PROXY_AGAIN;
+        }
+        if (n <= 0)
+        {
+            if (m_buf_len == 0)
+            {
+                return retry();
+            }
+            break;
+        }
+        m_buf_len += n;
+
+        char* end = (char*)memmem(m_buf, m_buf_len, "\r\n\r\n", 4);
+        if (end)
+        {
+            if (!parse_header(end + 4 - m_buf))
+            {
+                break;
+            }
+            m_state = RELAYING;
+            return pump();
+        }
+        if (m_buf_len == BUFFER_SIZE)
+        {
+            break; // 响应头太长
+        }
+    }
+
+    // 上游返回了不完整或者无法解析的响应
+    detach_upstream();
+    m_group->fail(m_server, m_fd);
+    m_fd = -1;
+    return bad_gateway();
+}
+
+// 解析上游响应头，改写 Connection 头部后放入 m_out
+bool proxy_conn::parse_header(size_t header_len)
+{
+    if (header_len < 12 || strncmp(m_buf, "HTTP/1.", 7) != 0)
+    {
+        return false;
+    }
+    int status = atoi(m_buf + 9);
+    server_stats::status(status);
+    m_upstream_keep_alive = m_buf[7] == '1';
+    long long content_length = -1;
+
+    m_out.clear();
+    m_out_pos = 0;
+    const char* line = m_buf;
+    const char* header_end = m_buf + header_len - 2; // 空行的位置
+    bool first = true;
+    while (line < header_end)
+    {
+        const char* eol = (const char*)memmem(line, header_end - line + 2, "\r\n", 2);
+        size_t len = eol - line;
+        bool keep = true;
+        if (!first)
+        {
+            if (strncasecmp(line, "Connection:", 11) == 0)
+            {
+                std::string value(line + 11, len - 11);
+                if (strcasestr(value.c_str(), "close"))
+                {
+                    m_upstream_keep_alive = false;
+                }
+                else if (strcasestr(value.c_str(), "keep-alive"))
+                {
+                    m_upstream_keep_alive = true;
+                }
+                keep = false;
+            }
+            else if (strncasecmp(line, "Keep-Alive:", 11) == 0)
+            {
+                keep = false;
+            }
+            else if (strncasecmp(line, "Content-Length:", 15) == 0)
+            {
+                content_length = atoll(line + 15);
+            }
+            else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+            {
+                std::string value(line + 18, len - 18);
+                m_chunked = strcasestr(value.c_str(), "chunked") != NULL;
+            }
+        }
+        if (keep)
+        {
+            m_out.append(line, len + 2);
+        }
+        first = false;
+        line = eol + 2;
+    }
+
+    const char* body = m_buf + header_len;
+    size_t avail = m_buf_len - header_len;
+    if (m_head || status / 100 == 1 || status == 204 || status == 304)
+    {
+        m_body_done = true;
+        m_upstream_keep_alive = m_upstream_keep_alive && avail == 0;
+        avail = 0;
+    }
+    else if (m_chunked)
+    {
+        m_body_done = scan_chunked(body, avail);
+        if (m_chunk_state == CHUNK_ERROR)
+        {
+            return false; // 响应头还没有发出，回复 502
+        }
+    }
+    else if (content_length >= 0)
+    {
+        if ((size_t)content_length < avail)
+        {
+            // 多出来的数据不属于这个响应，连接不能再复用
+            avail = content_length;
+            m_upstream_keep_alive = false;
+        }
+        m_remaining = content_length - avail;
+        m_body_done = m_remaining == 0;
+    }
+    else
+    {
+        // 没有长度信息，以上游关闭连接为结束，客户端也只能以关闭连接来判断结束
+        m_until_close = true;
+        m_upstream_keep_alive = false;
+        m_keep_alive = false;
+    }
+
+    m_out.append(m_keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    m_out.append(body, avail);
+    return true;
+}
+
+// 跟踪 chunked 编码的边界，数据原样转发给客户端，返回响应体是否结束
+// 结束时 len 改为到结尾为止的长度，后面多出来的数据不属于这个响应，不转发，上游连接也不能再复用
+// 块大小超出 size_t 时进入 CHUNK_ERROR，调用者按上游出错处理
+bool proxy_conn::scan_chunked(const char* data, size_t& len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        char c = data[i];
+        switch (m_chunk_state)
+        {
+            case CHUNK_SIZE:
+                if (isxdigit((unsigned char)c))
+                {
+                    if (m_chunk_left > SIZE_MAX / 16)
+                    {
+                        // 块大小溢出，之后的边界都无法确定
+                        m_chunk_state = CHUNK_ERROR;
+                        return false;
+                    }
+                    m_chunk_left = m_chunk_left * 16 + (isdigit((unsigned char)c) ? c - '0' : (tolower(c) - 'a' + 10));
+                    break;
+                }
+                m_chunk_state = CHUNK_EXT;
+                // fall through
+            case CHUNK_EXT:
+                if (c == '\n')
+                {
+                    m_chunk_state = m_chunk_left ? CHUNK_DATA : CHUNK_TRAILER;
+                }
+                break;
+            case CHUNK_DATA:
+            {
+                size_t n = len - i < m_chunk_left ? len - i : m_chunk_left;
+                m_chunk_left -= n;
+                i += n - 1;
+                if (m_chunk_left == 0)
+                {
+                    m_chunk_state = CHUNK_DATA_END;
+                }
+                break;
+            }
+            case CHUNK_DATA_END:
+                if (c == '\n')
+                {
+                    m_chunk_state = CHUNK_SIZE;
+                }
+                break;
+            case CHUNK_TRAILER:
+                if (c == '\n')
+                {
+                    if (i + 1 < len)
+                    {
+                        m_upstream_keep_alive = false;
+                        len = i + 1;
+                    }
+                    return true;
+                }
+                if (c != '\r')
+                {
+                    m_chunk_state = CHUNK_TRAILER_LINE;
+                }
+                break;
+            case CHUNK_TRAILER_LINE:
+                if (c == '\n')
+                {
+                    m_chunk_state = CHUNK_TRAILER;
+                }
+                break;
+            case CHUNK_ERROR:
+                return false;
+        }
+    }
+    return false;
+}
+
+// 把响应转发给客户端，直到某一端暂时不可读写或者响应结束
+proxy_conn::RESULT proxy_conn::pump()
+{
+    while (true)
+    {
+        // 用户态的数据：改写后的响应头、随响应头读到的响应体、chunked 数据
+        if (m_out_pos < m_out.size())
+        {
+            int n = sys_io::send(m_client_fd, m_out.data() + m_out_pos, m_out.size() - m_out_pos, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    modfd(m_epollfd, m_client_fd, EPOLLOUT);
+                    return PROXY_AGAIN;
+                }
+                m_keep_alive = false;
+                return finish(false);
+            }
+            m_out_pos += n;
+            server_stats::add(server_stats::BYTES_OUT, n);
+            continue;
+        }
+
+        // 管道中已经从上游搬过来的数据
+        if (m_pipe_bytes > 0)
+        {
+            ssize_t n = splice(m_pipe[0], NULL, m_client_fd, NULL, m_pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    modfd(m_epollfd, m_client_fd, EPOLLOUT);
+                    return PROXY_AGAIN;
+                }
+                m_keep_alive = false;
+                return finish(false);
+            }
+            m_pipe_bytes -= n;
+            server_stats::add(server_stats::BYTES_OUT, n);
+            continue;
+        }
+
+        if (m_body_done)
+        {
+            return finish(true);
+        }
+
+        // 从上游读取更多的响应体：chunked 需要在用户态跟踪边界，其它情况用 splice 零拷贝
+        if (!m_chunked && m_pipe[0] < 0)
+        {
+            pipe2(m_pipe, O_NONBLOCK | O_CLOEXEC);
+        }
+        ssize_t n;
+        if (m_chunked || m_pipe[0] < 0)
+        {
+            size_t want = BUFFER_SIZE;
+            if (!m_chunked && !m_until_close && m_remaining < want)
+            {
+                want = m_remaining;
+            }
+            n = recv(m_fd, m_buf, want, 0);
+            if (n > 0)
+            {
+                m_out.assign(m_buf, n);
+                m_out_pos = 0;
+            }
+        }
+        else
+        {
+            size_t want = m_until_close || m_remaining > SPLICE_SIZE ? SPLICE_SIZE : m_remaining;
+            n = splice(m_fd, NULL, m_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0)
+            {
+                m_pipe_bytes += n;
+            }
+        }
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            arm_upstream(EPOLLIN);
+            return PROXY_AGAIN;
+        }
+        if (n == 0 && m_until_close)
+        {
+            m_body_done = true;
+            continue;
+        }
+        if (n <= 0)
+        {
+            // 上游在响应中途断开，响应头已经发出，只能关闭客户端连接
+            detach_upstream();
+            m_group->fail(m_server, m_fd);
+            m_fd = -1;
+            m_keep_alive = false;
+            return finish(false);
+        }
+        if (m_chunked)
+        {
+            size_t len = n;
+            m_body_done = scan_chunked(m_buf, len);
+            m_out.resize(len);
+            if (m_chunk_state == CHUNK_ERROR)
+            {
+                // 响应头已经发出，和上游中途断开一样只能关闭客户端连接
+                detach_upstream();
+                m_group->fail(m_server, m_fd);
+                m_fd = -1;
+                m_keep_alive = false;
+                return finish(false);
+            }
+        }
+        else if (!m_until_close)
+        {
+            m_remaining -= n;
+            m_body_done = m_remaining == 0;
+        }
+    }
+}
+
+// 响应结束，上游连接可以复用时放回连接池
+proxy_conn::RESULT proxy_conn::finish(bool reusable)
+{
+    if (m_fd >= 0)
+    {
+        detach_upstream();
+        m_group->release(m_server, m_fd, reusable && m_upstream_keep_alive);
+        m_fd = -1;
+    }
+    if (m_pipe_bytes > 0)
+    {
+        // 管道中残留的数据没法再用，换一个新的管道
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+        m_pipe[0] = m_pipe[1] = -1;
+        m_pipe_bytes = 0;
+    }
+    m_state = IDLE;
+    return m_keep_alive ? PROXY_DONE : PROXY_CLOSE;
+}
+
+// 没有可用的后端或者上游出错，且还没有向客户端发送任何数据
+proxy_conn::RESULT proxy_conn::bad_gateway()
+{
+    m_state = RELAYING;
+    server_stats::status(502);
+    m_out = bad_gateway_response;
+    m_out_pos = 0;
+    m_body_done = true;
+    m_keep_alive = false;
+    return pump();
+}
+
+void proxy_conn::arm_upstream(uint32_t ev)
+{
+    epoll_event event;
+    event.data.fd = m_fd;
+    event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    sys_io::epoll_ctl(m_epollfd, EPOLL_CTL_MOD, m_fd, &event);
+}
+
+void proxy_conn::detach_upstream()
+{
+    sys_io::epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_fd, 0);
+    m_owner[m_fd] = 0;
+}
@@ -0,0 +1,97 @@
+#ifndef PROXYCONNECTION_H
+#define PROXYCONNECTION_H
+
+#include <stdint.h>
+#include <string>
+#include "upstream.h"
+
+// 一个客户端连接上的反向代理会话，挂在 http_conn 上
+// 工作线程解析完请求后调用 start，之后上游连接和客户端连接的读写都在主线程的事件循环中完成：
+// 上游 socket 和客户端 socket 同时只有一个注册了事件（EPOLLONESHOT），所以不需要加锁。
+// 响应头在用户态改写后转发，响应体用 splice 经过管道直接从上游 socket 搬到客户端 socket。
+class proxy_conn
+{
+public:
+    // 上游 fd 到客户端 fd 的映射表大小
+    static const int MAX_FD = 65536;
+    // 读取上游响应头的缓冲区大小
+    static const int BUFFER_SIZE = 8192;
+    // 每次 splice 的最大字节数
+    static const size_t SPLICE_SIZE = 65536;
+
+    // 会话状态
+    enum STATE { IDLE = 0, CONNECTING, SENDING, READING_HEADER, RELAYING };
+    // 事件处理结果
+    // PROXY_AGAIN: 等待下一个事件
+    // PROXY_DONE: 响应转发完毕，客户端连接保持
+    // PROXY_CLOSE: 响应转发完毕或者出错，需要关闭客户端连接
+    enum RESULT { PROXY_AGAIN = 0, PROXY_DONE, PROXY_CLOSE };
+
+public:
+    proxy_conn(int epollfd, int client_fd);
+    ~proxy_conn();
+
+    // 开始转发一个请求，request 是改写好的请求报文
+    // head 表示 HEAD 请求（响应没有响应体），keep_alive 表示客户端是否要求保持连接
+    RESULT start(upstream* group, const std::string& request, bool head, bool keep_alive);
+    // 上游 socket 上的事件
+    RESULT on_upstream(uint32_t events);
+    // 客户端 socket 可写
+    RESULT on_client_writable();
+
+    bool active() const { return m_state != IDLE; }
+
+    // 上游 fd 属于哪个客户端连接，不属于任何代理会话返回 -1
+    static int client_of(int upstream_fd);
+
+private:
+    RESULT connect_upstream();
+    RESULT retry();
+    RESULT send_request();
+    RESULT read_header();
+    bool parse_header(size_t header_len);
+    bool scan_chunked(const char* data, size_t& len);
+    RESULT pump();
+    RESULT finish(bool reusable);
+    RESULT bad_gateway();
+    void arm_upstream(uint32_t ev);
+    void detach_upstream();
+
+private:
+    int m_epollfd;
+    int m_client_fd;
+    STATE m_state;
+
+    upstream* m_group;
+    int m_server;               // 当前使用的后端下标
+    int m_fd;                   // 上游连接，-1 表示没有
+    bool m_reused;              // 上游连接是否来自连接池
+    int m_tries;                // 已经尝试过的后端个数
+
+    std::string m_request;      // 发往上游的请求
+    size_t m_request_sent;
+    bool m_head;
+    bool m_keep_alive;          // 客户端连接是否保持
+
+    char m_buf[BUFFER_SIZE];    // 上游响应头
+    size_t m_buf_len;
+    std::string m_out;          // 待发给客户端的用户态数据
+    size_t m_out_pos;
+
+    int m_pipe[2];              // splice 使用的管道
+    size_t m_pipe_bytes;        // 管道中还没有发给客户端的字节数
+
+    bool m_chunked;             // 响应体是 chunked 编码
+    bool m_until_close;         // 响应体以上游关闭连接结束
+    bool m_upstream_keep_alive; // 上游连接是否可以复用
+    size_t m_remaining;         // Content-Length 方式剩余的响应体字节数
+    bool m_body_done;
+
+    // chunked 解析状态
+    int m_chunk_state;
+    size_t m_chunk_left;
+
+    static int m_owner[MAX_FD]; // 上游 fd -> 客户端 fd + 1
+};
+
+#endif
@@ -0,0 +1,294 @@
+#include "upstream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+
+// 代理路由表，启动时配置，运行时只读，所以不需要加锁
+struct proxy_route
+{
+    std::string prefix;
+    upstream* group;
+};
+static std::vector<proxy_route> routes;
+
+upstream::upstream(BALANCE balance) : m_balance(balance), m_next(0)
+{
+}
+
+upstream::~upstream()
+{
+    for (size_t i = 0; i < m_servers.size(); ++i)
+    {
+        for (size_t j = 0; j < m_servers[i].idle.size(); ++j)
+        {
+            close(m_servers[i].idle[j]);
+        }
+    }
+}
+
+bool upstream::add_server(const char* spec)
+{
+    server s;
+    memset(&s.addr, 0, sizeof(s.addr));
+    s.name = spec;
+    s.active = 0;
+    s.fails = 0;
+    s.down_until = 0;
+
+    if (strncmp(spec, "unix:", 5) == 0)
+    {
+        sockaddr_un* addr = (sockaddr_un*)&s.addr;
+        const char* path = spec + 5;
+        if (strlen(path) >= sizeof(addr->sun_path))
+        {
+            return false;
+        }
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, path);
+        s.addr_len = sizeof(sockaddr_un);
+    }
+    else
+    {
+        const char* colon = strrchr(spec, ':');
+        if (!colon)
+        {
+            return false;
+        }
+        std::string host(spec, colon - spec);
+        sockaddr_in* addr = (sockaddr_in*)&s.addr;
+        addr->sin_family = AF_INET;
+        addr->sin_port = htons(atoi(colon + 1));
+        if (inet_pton(AF_INET, host.c_str(), &addr->sin_addr) != 1)
+        {
+            return false;
+        }
+        s.addr_len = sizeof(sockaddr_in);
+    }
+    m_servers.push_back(s);
+    return true;
+}
+
+// 选择后端，调用者持有 m_lock
+int upstream::pick(int exclude)
+{
+    time_t now = time(NULL);
+    int n = m_servers.size();
+    int best = -1;
+    for (int i = 0; i < n; ++i)
+    {
+        int idx = (m_next + i) % n;
+        server& s = m_servers[idx];
+        if (idx == exclude || s.down_until > now)
+        {
+            continue;
+        }
+        if (m_balance == ROUND_ROBIN)
+        {
+            best = idx;
+            break;
+        }
+        if (best < 0 || s.active < m_servers[best].active)
+        {
+            best = idx;
+        }
+    }
+
+    if (best < 0)
+    {
+        // 所有后端都被标记为不可用时，选择最早恢复的那个，避免永远不再尝试
+        for (int i = 0; i < n; ++i)
+        {
+            if (i != exclude && (best < 0 || m_servers[i].down_until < m_servers[best].down_until))
+            {
+                best = i;
+            }
+        }
+    }
+    if (best >= 0)
+    {
+        m_next = best + 1;
+    }
+    return best;
+}
+
+// 发起非阻塞连接，连接结果由 EPOLLOUT 事件通知
+int upstream::connect_server(server& s)
+{
+    int fd = socket(s.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (s.addr.ss_family == AF_INET)
+    {
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
+    if (connect(fd, (sockaddr*)&s.addr, s.addr_len) < 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int upstream::acquire(int& server_index, bool& reused, int exclude)
+{
+    m_lock.lock();
+    for (size_t attempt = 0; attempt < m_servers.size(); ++attempt)
+    {
+        int idx = pick(exclude);
+        if (idx < 0)
+        {
+            break;
+        }
+        server& s = m_servers[idx];
+
+        // 优先复用空闲连接，对端已经关闭或者发来了意外数据的连接直接丢弃
+        while (!s.idle.empty())
+        {
+            int fd = s.idle.back();
+            s.idle.pop_back();
+            char c;
+            if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                s.active++;
+                m_lock.unlock();
+                server_index = idx;
+                reused = true;
+                return fd;
+            }
+            close(fd);
+        }
+
+        int fd = connect_server(s);
+        if (fd >= 0)
+        {
+            s.active++;
+            m_lock.unlock();
+            server_index = idx;
+            reused = false;
+            return fd;
+        }
+
+        // 立即失败（例如 Unix 套接字不存在），记一次失败后换下一个后端
+        if (++s.fails >= MAX_FAILS)
+        {
+            s.down_until = time(NULL) + FAIL_TIMEOUT;
+            s.fails = 0;
+            printf("upstream %s is down\n", s.name.c_str());
+        }
+        exclude = idx;
+    }
+    m_lock.unlock();
+    return -1;
+}
+
+void upstream::release(int server_index, int fd, bool keep_alive)
+{
+    m_lock.lock();
+    server& s = m_servers[server_index];
+    s.active--;
+    s.fails = 0;
+    if (keep_alive && s.idle.size() < MAX_IDLE)
+    {
+        s.idle.push_back(fd);
+        fd = -1;
+    }
+    m_lock.unlock();
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+void upstream::fail(int server_index, int fd)
+{
+    m_lock.lock();
+    server& s = m_servers[server_index];
+    s.active--;
+    if (++s.fails >= MAX_FAILS)
+    {
+        s.down_until = time(NULL) + FAIL_TIMEOUT;
+        s.fails = 0;
+        printf("upstream %s is down\n", s.name.c_str());
+    }
+    m_lock.unlock();
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+bool upstream::add_route(const char* spec)
+{
+    const char* eq = strchr(spec, '=');
+    if (!eq || spec[0] != '/')
+    {
+        return false;
+    }
+    std::string prefix(spec, eq - spec);
+    std::string servers(eq + 1);
+
+    BALANCE balance = ROUND_ROBIN;
+    size_t semi = servers.find(';');
+    if (semi != std::string::npos)
+    {
+        std::string mode = servers.substr(semi + 1);
+        servers.erase(semi);
+        if (mode == "lc")
+        {
+            balance = LEAST_CONN;
+        }
+        else if (mode != "rr")
+        {
+            return false;
+        }
+    }
+
+    upstream* group = new upstream(balance);
+    size_t start = 0;
+    while (start <= servers.size())
+    {
+        size_t comma = servers.find(',', start);
+        if (comma == std::string::npos)
+        {
+            comma = servers.size();
+        }
+        if (!group->add_server(servers.substr(start, comma - start).c_str()))
+        {
+            delete group;
+            return false;
+        }
+        start = comma + 1;
+    }
+
+    proxy_route r;
+    r.prefix = prefix;
+    r.group = group;
+    routes.push_back(r);
+    return true;
+}
+
+upstream* upstream::route(const char* url)
+{
+    upstream* group = NULL;
+    size_t longest = 0;
+    for (size_t i = 0; i < routes.size(); ++i)
+    {
+        const std::string& prefix = routes[i].prefix;
+        if (prefix.size() > longest && strncmp(url, prefix.c_str(), prefix.size()) == 0)
+        {
+            group = routes[i].group;
+            longest = prefix.size();
+        }
+    }
+    return group;
+}
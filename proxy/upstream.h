@@ -0,0 +1,72 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <sys/socket.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+// 反向代理的上游服务器组
+// 每个后端维护一个空闲的长连接池，按轮询或最少连接选择后端，
+// 并根据请求失败的情况被动地把后端标记为不可用（被动健康检查）
+class upstream
+{
+public:
+    // 负载均衡方式
+    enum BALANCE { ROUND_ROBIN = 0, LEAST_CONN };
+    // 连续失败多少次后把后端标记为不可用
+    static const int MAX_FAILS = 3;
+    // 标记为不可用的秒数，过后重新尝试
+    static const int FAIL_TIMEOUT = 10;
+    // 每个后端最多保留的空闲连接数
+    static const size_t MAX_IDLE = 32;
+
+    // 一个后端服务器，TCP 地址或者 Unix 域套接字
+    struct server
+    {
+        sockaddr_storage addr;
+        socklen_t addr_len;
+        std::string name;
+        int active;             // 正在处理的请求数，最少连接算法使用
+        int fails;              // 连续失败次数
+        time_t down_until;      // 在这个时间之前不再选择该后端
+        std::vector<int> idle;  // 空闲的长连接
+    };
+
+public:
+    upstream(BALANCE balance);
+    ~upstream();
+
+    // 添加后端，格式为 ip:port 或者 unix:/path/to/socket
+    bool add_server(const char* spec);
+
+    // 选择一个后端并取得一个连接，优先复用空闲连接，否则发起非阻塞 connect
+    // exclude 是重试时要跳过的后端，reused 表示连接是否来自连接池
+    // 没有可用的后端返回 -1
+    int acquire(int& server_index, bool& reused, int exclude = -1);
+    // 请求结束，keep_alive 为 true 时把连接放回连接池，否则关闭
+    void release(int server_index, int fd, bool keep_alive);
+    // 请求在该后端上失败，关闭连接并记录一次失败
+    void fail(int server_index, int fd);
+
+    size_t size() const { return m_servers.size(); }
+    const char* name(int server_index) const { return m_servers[server_index].name.c_str(); }
+
+    // 添加一条代理路由，格式为 /prefix=addr[,addr...][;rr|;lc]
+    static bool add_route(const char* spec);
+    // 查找 url 匹配的最长前缀路由，没有返回 NULL
+    static upstream* route(const char* url);
+
+private:
+    int pick(int exclude);
+    int connect_server(server& s);
+
+private:
+    std::vector<server> m_servers;
+    BALANCE m_balance;
+    unsigned m_next;    // 轮询的下一个后端
+    locker m_lock;      // 保护后端状态和连接池，工作线程和主线程都会访问
+};
+
+#endif
@@ -0,0 +1,400 @@
+#include "event_loop.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <string>
+#include "../threadpool/threadpool.h"
+#include "../http/http_conn.h"
+#include "../proxy/proxy_conn.h"
+#include "../limit/rate_limiter.h"
+#include "../stats/stats.h"
+#include "../trace/request_trace.h"
+#include "../capture/traffic_capture.h"
+#include "../coro/coro_handler.h"
+#include "../sched/send_sched.h"
+#include "../master/master.h"
+#include "../memory/mem_budget.h"
+#include "../arena/request_arena.h"
+#include "../fileio/neg_cache.h"
+#include "../sse/sse_hub.h"
+#include "../net/sys_io.h"
+
+volatile sig_atomic_t event_loop::m_dump_stats = 0;
+volatile sig_atomic_t event_loop::m_dump_trace = 0;
+volatile sig_atomic_t event_loop::m_drain = 0;
+
+int event_loop::m_listenfd = -1;
+int event_loop::m_epollfd = -1;
+threadpool<http_conn>* event_loop::m_pool = NULL;
+http_conn* event_loop::m_users = NULL;
+epoll_event event_loop::m_events[MAX_EVENT_NUMBER];
+busy_poll::spinner event_loop::m_spinner;
+bool event_loop::m_draining = false;
+time_t event_loop::m_drain_deadline = 0;
+time_t event_loop::m_drain_sweep = 0;
+bool event_loop::m_accept_paused = false;
+time_t event_loop::m_pressure_sweep = 0;
+time_t event_loop::m_keep_alive_sweep = 0;
+int event_loop::m_max_connfd = 0;
+
+// 添加文件描述符到epoll
+extern void addfd(int epollfd, int fd, bool one_shot);
+// 从epoll中删除文件描述符
+extern void removefd(int epollfd, int fd);
+
+// 导出请求跟踪到文件
+static void write_trace()
+{
+    static int seq = 0;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/webserver-trace-%d-%d.json", (int)getpid(), seq++);
+    std::string out;
+    request_trace::dump(out);
+    FILE* fp = fopen(path, "w");
+    if(fp)
+    {
+        fwrite(out.data(), 1, out.size(), fp);
+        fclose(fp);
+        printf("trace written to %s\n", path);
+    }
+    fflush(stdout);
+}
+
+bool event_loop::setup(int listenfd, int threads)
+{
+    // 创建线程池，初始化线程池
+    try
+    {
+        m_pool = new threadpool<http_conn>(threads);
+    }
+    catch(...)
+    {
+        return false;
+    }
+
+    // 创建一个数组，保存客户信息
+    m_users = new http_conn[MAX_FD];
+
+    // 创建epoll对象
+    m_listenfd = listenfd;
+    m_epollfd = sys_io::epoll_create(5);
+    add_listenfd();
+    http_conn::m_epollfd = m_epollfd;
+    http_conn::m_pool = m_pool;
+    if(sse_hub::enabled())
+    {
+        sse_hub::attach(m_epollfd);
+    }
+    if(busy_poll::enabled())
+    {
+        busy_poll::setup_socket(m_listenfd);
+        busy_poll::setup_epoll(m_epollfd);
+    }
+    // 主线程的请求内存池缓存的空闲块（运行到完成模式），工作线程的在各自重置时释放
+    mem_budget::add_reclaimer(request_arena::trim);
+    // 不存在路径的缓存表，清空后页还给内核
+    mem_budget::add_reclaimer(neg_cache::clear);
+    return true;
+}
+
+void event_loop::shutdown()
+{
+    sys_io::close(m_epollfd);
+    if(m_listenfd >= 0)
+    {
+        sys_io::close(m_listenfd);
+    }
+    delete [] m_users;
+    delete m_pool;
+}
+
+int event_loop::run_pending()
+{
+    return m_pool->run_pending();
+}
+
+// 将监听的文件描述符添加到epoll对象中，内存紧张时暂停 accept 也是把它移出 epoll
+void event_loop::add_listenfd()
+{
+    addfd(m_epollfd, m_listenfd, false);
+    if(master::workers())
+    {
+        // 多个工作进程共用监听 socket，一个新连接只唤醒其中一个
+        epoll_event event;
+        event.data.fd = m_listenfd;
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        sys_io::epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+        sys_io::epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_listenfd, &event);
+    }
+}
+
+bool event_loop::run_once()
+{
+    // 忙轮询模式下先不阻塞地反复检查，自旋超时或者预算用完才阻塞
+    int num = 0;
+    if(!m_spinner.spin([&] { return (num = sys_io::epoll_wait(m_epollfd, m_events, MAX_EVENT_NUMBER, 0)) != 0; }))
+    {
+        // 录制时每秒醒来一次，把缓冲的记录写入文件；长连接有超时的时候每秒检查一次；
+        // 暂停 accept 时每 100ms 检查一次内存用量；有限速的连接时在最早的连接到期时醒来；
+        // SSE 的广播没有完成时不阻塞，有订阅者时按时发送心跳
+        int timeout = m_accept_paused ? 100 : traffic_capture::enabled() || m_draining || http_conn::m_keep_alive_timeout ? 1000 : -1;
+        num = sys_io::epoll_wait(m_epollfd, m_events, MAX_EVENT_NUMBER, send_sched::timeout_ms(sse_hub::timeout_ms(timeout)));
+    }
+    if((num < 0) && (errno != EINTR))
+    {
+        printf("epoll failure\n");
+        return false;
+    }
+
+    if(m_dump_stats)
+    {
+        m_dump_stats = 0;
+        if(http_conn::m_limiter)
+        {
+            rate_limiter::stats s;
+            http_conn::m_limiter->get_stats(s);
+            printf("rate limiter: allowed %llu, rejected ip %llu, rejected prefix %llu, rejected accept %llu, evictions %llu\n",
+                   (unsigned long long)s.allowed, (unsigned long long)s.rejected_ip, (unsigned long long)s.rejected_prefix,
+                   (unsigned long long)s.rejected_accept, (unsigned long long)s.evictions);
+            fflush(stdout);
+        }
+    }
+    if(m_dump_trace)
+    {
+        m_dump_trace = 0;
+        write_trace();
+    }
+    if(m_drain && !m_draining)
+    {
+        // 停止 accept，监听 socket 留给其他进程；处理中的连接写完当前响应后关闭
+        m_draining = true;
+        m_drain_deadline = time(NULL) + master::DRAIN_TIMEOUT_MS / 1000;
+        http_conn::m_draining = true;
+        removefd(m_epollfd, m_listenfd);
+        m_listenfd = -1;
+        // SSE 的连接不会结束，直接断开，浏览器会重连到其他进程
+        sse_hub::close_all();
+        printf("draining %d connections\n", (int)http_conn::m_user_count);
+        fflush(stdout);
+    }
+    if(m_draining && time(NULL) != m_drain_sweep)
+    {
+        // 每秒关闭一次空闲的长连接
+        m_drain_sweep = time(NULL);
+        uint64_t idle_before = server_stats::now_ns() - master::DRAIN_IDLE_MS * 1000000ULL;
+        for(int fd = 0; fd <= m_max_connfd; ++fd)
+        {
+            m_users[fd].close_if_idle(idle_before);
+        }
+    }
+    if(m_draining && (http_conn::m_user_count == 0 || time(NULL) >= m_drain_deadline))
+    {
+        return false;
+    }
+    if(http_conn::m_keep_alive_timeout && !m_draining && time(NULL) != m_keep_alive_sweep)
+    {
+        // 每秒关闭一次空闲超时的长连接
+        m_keep_alive_sweep = time(NULL);
+        uint64_t idle_before = server_stats::now_ns() - http_conn::m_keep_alive_timeout * 1000000000ULL;
+        for(int fd = 0; fd <= m_max_connfd; ++fd)
+        {
+            m_users[fd].close_if_idle(idle_before);
+        }
+    }
+    if(mem_budget::enabled() && !m_draining)
+    {
+        // 超过软限制时暂停 accept，回到软限制以下再恢复
+        bool pressure = mem_budget::over_soft();
+        if(pressure && !m_accept_paused)
+        {
+            m_accept_paused = true;
+            sys_io::epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+            server_stats::add(server_stats::ACCEPT_PAUSES);
+        }
+        else if(!pressure && m_accept_paused)
+        {
+            m_accept_paused = false;
+            add_listenfd();
+        }
+        if(pressure && time(NULL) != m_pressure_sweep)
+        {
+            // 每秒回收一次缓存；超过硬限制时关闭所有空闲的长连接
+            m_pressure_sweep = time(NULL);
+            mem_budget::reclaim();
+            if(mem_budget::over_hard())
+            {
+                uint64_t now = server_stats::now_ns();
+                for(int fd = 0; fd <= m_max_connfd; ++fd)
+                {
+                    m_users[fd].close_if_idle(now);
+                }
+            }
+        }
+    }
+    if(num == 0)
+    {
+        traffic_capture::flush();
+    }
+
+    // 限速到期的连接继续发送
+    send_sched::run_due(server_stats::now_ns(), [&](int fd)
+    {
+        if(!m_users[fd].write())
+        {
+            m_users[fd].close_conn();
+        }
+    });
+
+    // 循环遍历事件数组
+    for(int i = 0; i < num; i ++)
+    {
+        dispatch(m_events[i]);
+    }
+
+    // 给下一批订阅者发送新的 SSE 事件
+    sse_hub::run(server_stats::now_ns());
+    return true;
+}
+
+// 有客户端连接进来
+void event_loop::accept_conn()
+{
+    struct sockaddr_in client_address;
+    socklen_t client_addrlen = sizeof(client_address);
+
+    int connfd = sys_io::accept(m_listenfd, (struct sockaddr*)&client_address, &client_addrlen);
+
+    if(connfd < 0)
+    {
+        // 共用监听 socket 的其他进程可能先接受了这个连接
+        if(errno != EAGAIN)
+        {
+            printf("errno is: %d\n", errno);
+        }
+        return;
+    }
+
+    // 目前连接数满了
+    if(http_conn::m_user_count >= MAX_FD)
+    {
+        sys_io::close(connfd);
+        server_stats::add(server_stats::ACCEPT_REJECTED);
+        return;
+    }
+
+    // 令牌已经耗尽的客户端不再分配连接，直接关闭
+    if(http_conn::m_limiter && !http_conn::m_limiter->admit_accept(client_address.sin_addr))
+    {
+        sys_io::close(connfd);
+        server_stats::add(server_stats::ACCEPT_REJECTED);
+        return;
+    }
+    server_stats::add(server_stats::ACCEPTED);
+    if(connfd > m_max_connfd)
+    {
+        m_max_connfd = connfd;
+    }
+
+    // 将新的客户的数据初始化，放到数组
+    m_users[connfd].init(connfd, client_address);
+}
+
+void event_loop::dispatch(epoll_event& event)
+{
+    int sockfd = event.data.fd;
+    // 零拷贝发送的完成通知也以 EPOLLERR 报告，取出通知后按其余的事件处理
+    if((event.events & EPOLLERR) && sockfd != m_listenfd && sockfd < MAX_FD)
+    {
+        uint32_t ev = event.events; // epoll_event 是紧凑排列的，不能直接引用成员
+        m_users[sockfd].zerocopy_event(ev);
+        event.events = ev;
+    }
+    if(sockfd == m_listenfd)
+    {
+        accept_conn();
+    }
+    else if(proxy_conn::client_of(sockfd) >= 0)
+    { // 代理请求的上游连接，交给它所属的客户连接处理
+        int clientfd = proxy_conn::client_of(sockfd);
+        if(!m_users[clientfd].upstream_event(event.events))
+        {
+            m_users[clientfd].close_conn();
+        }
+    }
+    else if(coro_request::client_of(sockfd) >= 0)
+    { // 协程处理函数等待的 fd 就绪，连接重新放入请求队列，由工作线程继续执行协程
+        int clientfd = coro_request::client_of(sockfd);
+        m_users[clientfd].coro_event(event.events);
+        if(m_pool->append(m_users + clientfd))
+        {
+            server_stats::add(server_stats::ENQUEUED);
+        }
+        else
+        {
+            m_users[clientfd].close_conn(); // 请求队列已满，放弃这个请求
+        }
+    }
+    else if(sse_hub::owns(sockfd))
+    { // SSE 的订阅者，或者有新事件发布
+        sse_hub::on_event(sockfd, event.events);
+    }
+    else if(event.events &(EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+    { // 处理异常
+        // 对方异常断开或错误
+        m_users[sockfd].close_conn();
+    }
+    else if(m_users[sockfd].is_inline())
+    { // 运行到完成模式，主线程直接处理，需要读磁盘等慢的请求交给线程池
+        http_conn::INLINE_RESULT result = m_users[sockfd].process_inline(event.events);
+        if(result == http_conn::INLINE_OFFLOAD)
+        {
+            if(m_pool->append(m_users + sockfd))
+            {
+                server_stats::add(server_stats::ENQUEUED);
+            }
+            else
+            {
+                m_users[sockfd].close_conn();
+            }
+        }
+        else if(result == http_conn::INLINE_CLOSE)
+        {
+            m_users[sockfd].close_conn();
+        }
+    }
+    else if(event.events & EPOLLIN) // 检测读行为
+    {
+
+        if(m_users[sockfd].read())
+        {
+            // 一次性把数据读出来
+            // 在解析和入队之前限流，超限的客户端回复 429 后关闭连接
+            if(!m_users[sockfd].admit())
+            {
+                m_users[sockfd].reject();
+                m_users[sockfd].close_conn();
+                return;
+            }
+            if(m_pool->append(m_users + sockfd)) // 添加到线程池队列中
+            {
+                server_stats::add(server_stats::ENQUEUED);
+            }
+        }
+        else
+        {
+            // 读失败
+            m_users[sockfd].close_conn();
+        }
+    }
+    else if(event.events & EPOLLOUT) // 检测写行为
+    {
+
+        if(!m_users[sockfd].write())
+        {
+            // 可以写的时候一次性把数据写完
+            m_users[sockfd].close_conn();
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include "../poll/busy_poll.h"
+
+class http_conn;
+template<typename T> class threadpool;
+
+// 主线程的事件循环：接受连接，把连接上的事件分给 http_conn、代理、协程和 SSE，
+// 定时关闭空闲的长连接、检查内存预算，收到信号后导出统计、跟踪或者平滑退出。
+// socket 和 epoll 都通过 sys_io 访问，bench/simbench 在模拟网络上一轮一轮地驱动它。
+class event_loop
+{
+public:
+    // 最大文件描述符个数
+    static const int MAX_FD = 65535;
+    // 监听最大事件数量
+    static const int MAX_EVENT_NUMBER = 10000;
+
+public:
+    // 创建线程池（threads 个工作线程）、连接数组和 epoll，把 listenfd 加入 epoll
+    static bool setup(int listenfd, int threads);
+    // 等待并处理一轮事件，事件循环应该结束时（epoll 失败、平滑退出完成）返回 false
+    static bool run_once();
+    static void run() { while (run_once()) {} }
+    // 关闭 epoll 和监听 socket，释放连接数组和线程池
+    static void shutdown();
+
+    // 工作线程数为 0 时，在主线程中执行请求队列里的任务
+    static int run_pending();
+
+public:
+    // 信号处理函数设置，事件循环下一次醒来时处理
+    // SIGUSR1 打印统计信息，SIGUSR2 导出请求跟踪，SIGQUIT 平滑退出
+    static volatile sig_atomic_t m_dump_stats;
+    static volatile sig_atomic_t m_dump_trace;
+    static volatile sig_atomic_t m_drain;
+
+private:
+    static void add_listenfd();
+    static void dispatch(epoll_event& event);
+    static void accept_conn();
+
+private:
+    static int m_listenfd;
+    static int m_epollfd;
+    static threadpool<http_conn>* m_pool;
+    static http_conn* m_users;
+    static epoll_event m_events[MAX_EVENT_NUMBER];
+    static busy_poll::spinner m_spinner;
+    static bool m_draining;
+    static time_t m_drain_deadline;
+    static time_t m_drain_sweep;
+    static bool m_accept_paused;
+    static time_t m_pressure_sweep;
+    static time_t m_keep_alive_sweep;
+    // 用过的最大的连接 fd，检查空闲连接时只需要遍历到这里
+    static int m_max_connfd;
+};
+
+#endif
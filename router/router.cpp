@@ -0,0 +1,313 @@
+#include "router.h"
+#include <string.h>
+
+// 与 http_conn::METHOD 的顺序相同
+static const char* method_names[router::METHOD_COUNT] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT" };
+static const int METHOD_GET = 0;
+static const int METHOD_HEAD = 2;
+
+router::build_node* router::m_root = NULL;
+std::vector<router::node> router::m_nodes;
+std::vector<char> router::m_first;
+std::string router::m_labels;
+std::vector<coro_request::handler> router::m_handlers;
+
+router::build_node::build_node() : param(NULL), wildcard(NULL)
+{
+    for (int i = 0; i < METHOD_COUNT; ++i)
+    {
+        handlers[i] = NULL;
+    }
+}
+
+router::build_node::~build_node()
+{
+    for (size_t i = 0; i < children.size(); ++i)
+    {
+        delete children[i];
+    }
+    delete param;
+    delete wildcard;
+}
+
+static int method_index(const char* method)
+{
+    for (int i = 0; i < router::METHOD_COUNT; ++i)
+    {
+        if (strcmp(method, method_names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 把静态文本 s 插入 n 的静态子树，必要时拆分已有的边，返回 s 结束处的节点
+router::build_node* router::insert_static(build_node* n, const std::string& text)
+{
+    std::string s(text);
+    while (!s.empty())
+    {
+        size_t k = 0;
+        while (k < n->children.size() && n->children[k]->label[0] != s[0])
+        {
+            k++;
+        }
+        if (k == n->children.size())
+        {
+            build_node* c = new build_node();
+            c->label = s;
+            n->children.push_back(c);
+            return c;
+        }
+        build_node* c = n->children[k];
+        size_t l = 0;
+        while (l < s.size() && l < c->label.size() && s[l] == c->label[l])
+        {
+            l++;
+        }
+        if (l < c->label.size())
+        {
+            // 从公共前缀处拆开
+            build_node* mid = new build_node();
+            mid->label = c->label.substr(0, l);
+            c->label.erase(0, l);
+            mid->children.push_back(c);
+            n->children[k] = mid;
+            c = mid;
+        }
+        n = c;
+        s.erase(0, l);
+    }
+    return n;
+}
+
+bool router::add(const char* method, const char* pattern, coro_request::handler h)
+{
+    int m = -1;
+    if (strcmp(method, "*") != 0 && (m = method_index(method)) < 0)
+    {
+        return false;
+    }
+    if (pattern[0] != '/' || !h)
+    {
+        return false;
+    }
+    if (!m_root)
+    {
+        m_root = new build_node();
+    }
+
+    build_node* n = m_root;
+    std::string text;
+    const char* p = pattern;
+    while (*p)
+    {
+        // 参数和通配符必须占据一整段
+        if ((*p == ':' || *p == '*') && p[-1] == '/')
+        {
+            n = insert_static(n, text);
+            text.clear();
+            const char* end = strchr(p, '/');
+            if (!end)
+            {
+                end = p + strlen(p);
+            }
+            std::string name(p + 1, end - p - 1);
+            if (name.empty() || (*p == '*' && *end))
+            {
+                return false;
+            }
+            build_node*& child = *p == ':' ? n->param : n->wildcard;
+            if (child && child->name != name)
+            {
+                return false; // 同一位置的参数名不同
+            }
+            if (!child)
+            {
+                child = new build_node();
+                child->name = name;
+            }
+            n = child;
+            p = end;
+            continue;
+        }
+        text.push_back(*p++);
+    }
+    n = insert_static(n, text);
+
+    for (int i = 0; i < METHOD_COUNT; ++i)
+    {
+        if ((m < 0 || m == i) && n->handlers[i])
+        {
+            return false; // 已经注册过
+        }
+    }
+    for (int i = 0; i < METHOD_COUNT; ++i)
+    {
+        if (m < 0 || m == i)
+        {
+            n->handlers[i] = h;
+        }
+    }
+    compile();
+    return true;
+}
+
+void router::clear()
+{
+    delete m_root;
+    m_root = NULL;
+    m_nodes.clear();
+    m_first.clear();
+    m_labels.clear();
+    m_handlers.clear();
+}
+
+// 按广度优先的顺序编号，同一个节点的静态子节点编号连续
+void router::compile()
+{
+    m_nodes.clear();
+    m_first.clear();
+    m_labels.clear();
+    m_handlers.clear();
+
+    std::vector<build_node*> order;
+    order.push_back(m_root);
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        build_node* b = order[i];
+        node n;
+        n.label_off = m_labels.size();
+        n.label_len = b->label.size();
+        m_labels += b->label;
+        n.name_off = m_labels.size();
+        n.name_len = b->name.size();
+        m_labels += b->name;
+
+        n.first_child = order.size();
+        n.child_count = b->children.size();
+        order.insert(order.end(), b->children.begin(), b->children.end());
+        n.param = -1;
+        if (b->param)
+        {
+            n.param = order.size();
+            order.push_back(b->param);
+        }
+        n.wildcard = -1;
+        if (b->wildcard)
+        {
+            n.wildcard = order.size();
+            order.push_back(b->wildcard);
+        }
+
+        n.handlers = -1;
+        for (int k = 0; k < METHOD_COUNT; ++k)
+        {
+            if (b->handlers[k])
+            {
+                n.handlers = m_handlers.size();
+                m_handlers.insert(m_handlers.end(), b->handlers, b->handlers + METHOD_COUNT);
+                break;
+            }
+        }
+        m_nodes.push_back(n);
+        m_first.push_back(b->label.empty() ? '\0' : b->label[0]);
+    }
+}
+
+// ni 的标签已经匹配到 pos，返回路由结束的节点，没有匹配返回 -1
+int router::find(int ni, const char* path, size_t pos, size_t len, params& p)
+{
+    const node& n = m_nodes[ni];
+    if (pos == len)
+    {
+        if (n.handlers >= 0)
+        {
+            return ni;
+        }
+        if (n.wildcard >= 0)
+        {
+            const node& w = m_nodes[n.wildcard];
+            p.push_back(std::make_pair(m_labels.substr(w.name_off, w.name_len), std::string()));
+            return n.wildcard;
+        }
+        return -1;
+    }
+
+    // 静态子节点：首字节互不相同，最多只有一个候选
+    char c = path[pos];
+    for (uint32_t k = 0; k < n.child_count; ++k)
+    {
+        if (m_first[n.first_child + k] != c)
+        {
+            continue;
+        }
+        const node& child = m_nodes[n.first_child + k];
+        if (child.label_len <= len - pos && memcmp(path + pos, m_labels.data() + child.label_off, child.label_len) == 0)
+        {
+            int r = find(n.first_child + k, path, pos + child.label_len, len, p);
+            if (r >= 0)
+            {
+                return r;
+            }
+        }
+        break;
+    }
+
+    // 参数匹配到下一个 '/' 为止
+    if (n.param >= 0)
+    {
+        size_t end = pos;
+        while (end < len && path[end] != '/')
+        {
+            end++;
+        }
+        if (end > pos)
+        {
+            const node& pn = m_nodes[n.param];
+            size_t mark = p.size();
+            p.push_back(std::make_pair(m_labels.substr(pn.name_off, pn.name_len), std::string(path + pos, end - pos)));
+            int r = find(n.param, path, end, len, p);
+            if (r >= 0)
+            {
+                return r;
+            }
+            p.resize(mark);
+        }
+    }
+
+    if (n.wildcard >= 0)
+    {
+        const node& w = m_nodes[n.wildcard];
+        p.push_back(std::make_pair(m_labels.substr(w.name_off, w.name_len), std::string(path + pos, len - pos)));
+        return n.wildcard;
+    }
+    return -1;
+}
+
+router::RESULT router::match(const char* method, const char* path, size_t len, coro_request::handler& h, params& p)
+{
+    h = NULL;
+    if (m_nodes.empty())
+    {
+        return NOT_FOUND;
+    }
+    int ni = find(0, path, 0, len, p);
+    if (ni < 0)
+    {
+        p.clear();
+        return NOT_FOUND;
+    }
+    const coro_request::handler* handlers = &m_handlers[m_nodes[ni].handlers];
+    int m = method_index(method);
+    if (m >= 0)
+    {
+        h = handlers[m];
+        if (!h && m == METHOD_HEAD)
+        {
+            h = handlers[METHOD_GET];
+        }
+    }
+    return h ? FOUND : METHOD_NOT_ALLOWED;
+}
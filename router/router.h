@@ -0,0 +1,81 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../coro/coro_handler.h"
+
+// 动态路由：按方法和路径模式注册协程处理函数，没有匹配的请求再交给代理路由和静态文件
+// 模式由 '/' 分隔的段组成，整段可以是参数 :name（匹配一个非空的段）或者通配符 *name（匹配剩余的路径，只能在最后）
+// 例如 /health、/users/:id/posts、/files/*path
+//
+// 注册时先构造以指针相连的压缩前缀树，再编译成连续数组：
+// 同一个节点的静态子节点在数组中相邻，它们的首字节单独放在一个数组里，按首字节查找子节点只扫描几个连续的字节；
+// 所有节点的标签拼接在一个字符串中。查找时逐段比较，时间与路径长度成正比，与路由数量无关。
+// 静态段优先于参数，参数优先于通配符，匹配失败时回溯。
+class router
+{
+public:
+    // 方法个数，与 http_conn::METHOD 的顺序相同
+    static const int METHOD_COUNT = 8;
+
+    // 查找结果
+    enum RESULT { FOUND = 0, NOT_FOUND, METHOD_NOT_ALLOWED };
+
+    // 路径参数，按在模式中出现的顺序
+    typedef std::vector<std::pair<std::string, std::string> > params;
+
+public:
+    // 注册处理函数，method 为 "GET" 等方法名或者 "*" 表示所有方法
+    // 只能在启动、工作线程开始处理请求之前调用；模式不合法或者与已有的路由冲突返回 false
+    static bool add(const char* method, const char* pattern, coro_request::handler h);
+    // 按方法和路径查找，path 不含查询字符串；HEAD 请求没有单独注册时使用 GET 的处理函数
+    static RESULT match(const char* method, const char* path, size_t len, coro_request::handler& h, params& p);
+    // 删除所有路由
+    static void clear();
+
+private:
+    // 构造阶段的节点
+    struct build_node
+    {
+        std::string label;                  // 静态边的标签
+        std::vector<build_node*> children;  // 静态子节点，首字节互不相同
+        build_node* param;
+        build_node* wildcard;
+        std::string name;                   // 参数和通配符节点的参数名
+        coro_request::handler handlers[METHOD_COUNT];
+
+        build_node();
+        ~build_node();
+    };
+
+    // 编译后的节点
+    struct node
+    {
+        uint32_t label_off;     // 在 m_labels 中的位置
+        uint32_t label_len;
+        uint32_t name_off;      // 参数名在 m_labels 中的位置
+        uint32_t name_len;
+        uint32_t first_child;   // 静态子节点在 m_nodes 中的起始下标
+        uint32_t child_count;
+        int32_t param;          // 参数子节点，-1 表示没有
+        int32_t wildcard;       // 通配符子节点，-1 表示没有
+        int32_t handlers;       // 在 m_handlers 中的起始下标，-1 表示这里没有路由结束
+    };
+
+    static build_node* insert_static(build_node* n, const std::string& s);
+    static void compile();
+    static int find(int ni, const char* path, size_t pos, size_t len, params& p);
+
+private:
+    static build_node* m_root;
+    static std::vector<node> m_nodes;
+    static std::vector<char> m_first;           // 每个节点标签的首字节
+    static std::string m_labels;
+    static std::vector<coro_request::handler> m_handlers;
+};
+
+#endif
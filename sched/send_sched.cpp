@@ -0,0 +1,71 @@
+#include "send_sched.h"
+#include <stdlib.h>
+#include "../stats/stats.h"
+
+size_t send_sched::m_quantum = send_sched::DEFAULT_QUANTUM;
+uint64_t send_sched::m_rate = 0;
+std::multimap<uint64_t, int> send_sched::m_deferred;
+
+bool send_sched::parse(const char* arg)
+{
+    char* end;
+    unsigned long long quantum = strtoull(arg, &end, 10);
+    if (quantum < 4096)
+    {
+        return false; // 太小的时间片只会增加系统调用
+    }
+    unsigned long long rate = 0;
+    if (*end == ':')
+    {
+        rate = strtoull(end + 1, &end, 10);
+        if (rate == 0)
+        {
+            return false;
+        }
+    }
+    if (*end != '\0')
+    {
+        return false;
+    }
+    m_quantum = quantum;
+    m_rate = rate;
+    return true;
+}
+
+uint64_t send_sched::bucket::available(uint64_t now)
+{
+    if (m_tokens < m_quantum)
+    {
+        double add = (double)(now - m_last) * m_rate / 1e9; // 长时间空闲时整数乘法会溢出
+        m_tokens = m_tokens + add > m_quantum ? m_quantum : m_tokens + (uint64_t)add;
+        if (add < 1)
+        {
+            return m_tokens; // 不到一个字节的时间不计，否则频繁调用时永远补充不了
+        }
+    }
+    m_last = now;
+    return m_tokens;
+}
+
+uint64_t send_sched::bucket::wait_ns(uint64_t n) const
+{
+    uint64_t ns = n > m_tokens ? (n - m_tokens) * 1000000000ULL / m_rate : 0;
+    return ns < MIN_WAIT_NS ? MIN_WAIT_NS : ns;
+}
+
+void send_sched::defer(int fd, uint64_t when)
+{
+    m_deferred.insert(std::make_pair(when, fd));
+}
+
+int send_sched::timeout_ms(int timeout)
+{
+    if (m_deferred.empty())
+    {
+        return timeout;
+    }
+    uint64_t now = server_stats::now_ns();
+    uint64_t when = m_deferred.begin()->first;
+    int ms = when <= now ? 0 : (int)((when - now + 999999) / 1000000);
+    return timeout < 0 || ms < timeout ? ms : timeout;
+}
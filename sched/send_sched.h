@@ -0,0 +1,68 @@
+#ifndef SENDSCHED_H
+#define SENDSCHED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+
+// 大响应的公平发送（-q quantum[:bytes_per_sec]）
+// 主线程的 write 原来一直 writev 到 EAGAIN，快速链路上下载大文件的连接会长时间占住事件循环。
+// 现在每次 write 最多发送 quantum 字节（默认 256KB），还有剩余时重新注册 EPOLLOUT 让出主线程：
+// 连接排到 epoll 就绪队列的末尾，所有待发送的连接轮流发送。不超过 quantum 的响应仍然一次写完。
+// 指定 bytes_per_sec 时每个连接按令牌桶限速（桶的容量是 quantum），令牌不够时连接从 epoll 注销，
+// 放到这里的定时队列中，到时间后由主线程继续发送。
+// HTTP/2 连接按同样的规则发送（时间片和令牌按连接计算，不区分流）。
+class send_sched
+{
+public:
+    static const size_t DEFAULT_QUANTUM = 256 * 1024;
+    // 限速时两次发送之间的最短间隔，和 epoll_wait 的精度一致
+    static const uint64_t MIN_WAIT_NS = 1000000ULL;
+
+    // 一个连接的令牌桶，只在主线程中使用
+    class bucket
+    {
+    public:
+        bucket() : m_tokens(0), m_last(0) {}
+
+        void reset(uint64_t now) { m_tokens = m_quantum; m_last = now; }
+        // 补充令牌，返回现在可以发送的字节数
+        uint64_t available(uint64_t now);
+        void consume(uint64_t n) { m_tokens = n >= m_tokens ? 0 : m_tokens - n; }
+        // 令牌积累到 n 还要等待的时间
+        uint64_t wait_ns(uint64_t n) const;
+
+    private:
+        uint64_t m_tokens;
+        uint64_t m_last;
+    };
+
+public:
+    // 解析 -q 的参数
+    static bool parse(const char* arg);
+    static size_t quantum() { return m_quantum; }
+    static bool limited() { return m_rate != 0; }
+
+    // 限速的连接在 when（server_stats::now_ns 的时间）之后继续发送（主线程）
+    static void defer(int fd, uint64_t when);
+    // epoll_wait 的超时：timeout 和最早到期的连接中较早的一个，-1 表示没有超时
+    static int timeout_ms(int timeout);
+    // 对所有到期的连接调用 resume(fd)（主线程）
+    template<typename F>
+    static void run_due(uint64_t now, F resume)
+    {
+        while (!m_deferred.empty() && m_deferred.begin()->first <= now)
+        {
+            int fd = m_deferred.begin()->second;
+            m_deferred.erase(m_deferred.begin());
+            resume(fd);
+        }
+    }
+
+private:
+    static size_t m_quantum;
+    static uint64_t m_rate;
+    static std::multimap<uint64_t, int> m_deferred;     // 到期时间 -> fd
+};
+
+#endif
@@ -0,0 +1,475 @@
+#include "sse_hub.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <atomic>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "../stats/stats.h"
+#include "../memory/mem_budget.h"
+#include "../net/sys_io.h"
+
+// 共享环的一个槽，按顺序锁的方式读写：写之前 seq 置 0，写完后置为事件编号；读完后 seq 没有变化才有效
+struct ring_slot
+{
+    std::atomic<uint64_t> seq;
+    uint32_t len;
+    uint32_t pad;
+    char data[sse_hub::SLOT_DATA];
+};
+
+// 所有工作进程共用的事件环，head 单独占一页
+struct shared_ring
+{
+    std::atomic<uint64_t> head;     // 已经分配的最大事件编号，编号从 1 开始
+    char pad[sse_hub::SLOT_SIZE - sizeof(std::atomic<uint64_t>)];
+    ring_slot slots[sse_hub::RING];
+};
+
+const char* sse_hub::m_path = NULL;
+int sse_hub::m_doorbell = -1;
+shared_ring* sse_hub::m_ring = NULL;
+uint64_t sse_hub::m_next_shared = 0;
+sse_hub::event* sse_hub::m_events[sse_hub::LOCAL_RING];
+uint64_t sse_hub::m_head = 0;
+sse_hub::subscriber* sse_hub::m_subs = NULL;
+std::vector<int> sse_hub::m_fds;
+size_t sse_hub::m_cursor = 0;
+uint64_t sse_hub::m_round_head = 0;
+int sse_hub::m_blocked = 0;
+uint32_t sse_hub::m_last_event = 0;
+uint32_t sse_hub::m_last_sweep = 0;
+
+static int epollfd = -1;
+
+// 毫秒时间，32位回绕不影响差值计算；0 留给“没有时间”
+static uint32_t to_ms(uint64_t ns)
+{
+    uint32_t ms = (uint32_t)(ns / 1000000);
+    return ms ? ms : 1;
+}
+
+bool sse_hub::parse(const char* path)
+{
+    if (path[0] != '/' || strchr(path, '?'))
+    {
+        return false;
+    }
+    m_path = path;
+    return true;
+}
+
+bool sse_hub::setup()
+{
+    void* mem = mmap(NULL, sizeof(shared_ring), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        printf("sse: cannot map the event ring: %s\n", strerror(errno));
+        return false;
+    }
+    m_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_doorbell < 0)
+    {
+        printf("sse: cannot create the doorbell: %s\n", strerror(errno));
+        munmap(mem, sizeof(shared_ring));
+        return false;
+    }
+    m_ring = (shared_ring*)mem;
+    mem_budget::charge(mem_budget::BUFFERS, sizeof(shared_ring));
+    return true;
+}
+
+void sse_hub::attach(int fd)
+{
+    epollfd = fd;
+    epoll_event event;
+    event.data.fd = m_doorbell;
+    event.events = EPOLLIN | EPOLLET;
+    sys_io::epoll_ctl(epollfd, EPOLL_CTL_ADD, m_doorbell, &event);
+    // 只发送之后发布的事件；calloc 的大块内存是按需分配的零页，只有用到的 fd 才占内存
+    m_next_shared = m_ring->head.load(std::memory_order_acquire) + 1;
+    m_subs = (subscriber*)calloc(MAX_FD, sizeof(subscriber));
+    m_last_event = to_ms(server_stats::now_ns());
+    m_last_sweep = m_last_event;
+}
+
+uint64_t sse_hub::publish(const char* name, const char* data, size_t len)
+{
+    // 先在栈上格式化好，分配编号之后不能再失败，否则读的一方会一直等这个槽
+    char buf[SLOT_DATA];
+    size_t n = 0;
+    if (name)
+    {
+        size_t name_len = strlen(name);
+        if (name_len == 0 || name_len > 64 || strpbrk(name, "\r\n") || name_len + 8 > SLOT_DATA)
+        {
+            return 0;
+        }
+        memcpy(buf, "event: ", 7);
+        memcpy(buf + 7, name, name_len);
+        buf[7 + name_len] = '\n';
+        n = 8 + name_len;
+    }
+    // 每一行数据一个 data: 字段，忽略结尾的换行
+    if (len > 0 && data[len - 1] == '\n')
+    {
+        --len;
+    }
+    size_t pos = 0;
+    while (true)
+    {
+        const char* eol = (const char*)memchr(data + pos, '\n', len - pos);
+        size_t line = eol ? eol - (data + pos) : len - pos;
+        size_t copy = line > 0 && data[pos + line - 1] == '\r' ? line - 1 : line;
+        if (n + 7 + copy > SLOT_DATA)
+        {
+            return 0;
+        }
+        memcpy(buf + n, "data: ", 6);
+        memcpy(buf + n + 6, data + pos, copy);
+        buf[n + 6 + copy] = '\n';
+        n += 7 + copy;
+        if (!eol)
+        {
+            break;
+        }
+        pos += line + 1;
+    }
+
+    uint64_t seq = m_ring->head.fetch_add(1, std::memory_order_acq_rel) + 1;
+    ring_slot& slot = m_ring->slots[seq % RING];
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(slot.data, buf, n);
+    slot.len = n;
+    slot.seq.store(seq, std::memory_order_release);
+    server_stats::add(server_stats::SSE_PUBLISHED);
+
+    // 门铃以边沿触发注册，没有人读，每次写入都会唤醒所有工作进程
+    uint64_t one = 1;
+    if (::write(m_doorbell, &one, sizeof(one)) < 0)
+    {
+        printf("sse: doorbell: %s\n", strerror(errno));
+    }
+    return seq;
+}
+
+sse_hub::event* sse_hub::make_event(const char* head, size_t head_len, const char* body, size_t body_len)
+{
+    size_t len = head_len + body_len + 1;
+    event* ev = (event*)malloc(sizeof(event) + len);
+    ev->refs = 1;
+    ev->len = len;
+    memcpy(ev->data, head, head_len);
+    memcpy(ev->data + head_len, body, body_len);
+    ev->data[len - 1] = '\n'; // 空行结束一个事件
+    mem_budget::charge(mem_budget::BUFFERS, sizeof(event) + len);
+    return ev;
+}
+
+void sse_hub::unref(event* ev)
+{
+    if (--ev->refs == 0)
+    {
+        mem_budget::release(mem_budget::BUFFERS, sizeof(event) + ev->len);
+        free(ev);
+    }
+}
+
+// 事件放入本地环，挤出的事件由还在发送它的订阅者继续持有
+void sse_hub::append(event* ev)
+{
+    event*& slot = m_events[m_head % LOCAL_RING];
+    if (slot)
+    {
+        unref(slot);
+    }
+    slot = ev;
+    ++m_head;
+    m_last_event = to_ms(server_stats::now_ns());
+}
+
+// 把共享环中的新事件取到本地环（门铃响了）
+void sse_hub::pull()
+{
+    uint64_t head = m_ring->head.load(std::memory_order_acquire);
+    if (head >= m_next_shared + RING)
+    {
+        m_next_shared = head - RING + 1; // 落后了一整圈，中间的事件已经被覆盖
+    }
+    char data[SLOT_DATA];
+    while (m_next_shared <= head)
+    {
+        ring_slot& slot = m_ring->slots[m_next_shared % RING];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq < m_next_shared)
+        {
+            break; // 发布者还在写，写完后会再按门铃
+        }
+        if (seq == m_next_shared)
+        {
+            uint32_t len = slot.len;
+            memcpy(data, slot.data, len < SLOT_DATA ? len : SLOT_DATA);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == seq && len <= SLOT_DATA)
+            {
+                char head_buf[32];
+                int head_len = snprintf(head_buf, sizeof(head_buf), "id: %llu\n", (unsigned long long)seq);
+                append(make_event(head_buf, head_len, data, len));
+            }
+        }
+        ++m_next_shared; // 被覆盖（seq 更大）或者读的时候被改写的事件跳过
+    }
+}
+
+void sse_hub::subscribe(int fd)
+{
+    subscriber& s = m_subs[fd];
+    s.partial = NULL;
+    s.next = m_head;
+    s.offset = 0;
+    s.blocked = 0;
+    s.index = m_fds.size() + 1;
+    m_fds.push_back(fd);
+    mem_budget::charge(mem_budget::CONNECTIONS, sizeof(subscriber));
+    server_stats::add(server_stats::SSE_SUBSCRIBED);
+
+    // 死掉的客户端不回 ACK，发出去的数据这么久没有确认时内核断开连接；只是读得慢的订阅者先由 run 断开
+    unsigned int timeout = 2 * SLOW_MS;
+    sys_io::setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout));
+    // 一直注册着边沿触发的读写事件；连接原来按单次触发注册，或者已经从 epoll 注销
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    if (sys_io::epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event) < 0 && errno == ENOENT)
+    {
+        sys_io::epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+// 发送订阅者积压的所有事件，直到发完或者发送缓冲满；返回 false 表示连接已经关闭
+bool sse_hub::flush(int fd, uint32_t now)
+{
+    subscriber& s = m_subs[fd];
+    uint64_t first = s.next + (s.offset ? 1 : 0);
+    if (m_head > first && m_head - first > (uint64_t)LOCAL_RING)
+    {
+        server_stats::add(server_stats::SSE_DROPPED); // 落后太多，要发的事件已经不在本地环中
+        drop(fd);
+        return false;
+    }
+    while (true)
+    {
+        struct iovec iov[MAX_IOV];
+        event* evs[MAX_IOV];
+        int n = 0;
+        uint64_t seq = s.next;
+        if (s.offset)
+        {
+            evs[n] = s.partial;
+            iov[n].iov_base = s.partial->data + s.offset;
+            iov[n].iov_len = s.partial->len - s.offset;
+            ++n;
+            ++seq;
+        }
+        for (; seq < m_head && n < MAX_IOV; ++seq, ++n)
+        {
+            evs[n] = m_events[seq % LOCAL_RING];
+            iov[n].iov_base = evs[n]->data;
+            iov[n].iov_len = evs[n]->len;
+        }
+        if (n == 0)
+        {
+            return true;
+        }
+        ssize_t sent = sys_io::writev(fd, iov, n);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN)
+            {
+                // 等 EPOLLOUT，在这之前不参加广播
+                s.blocked = now;
+                ++m_blocked;
+                return true;
+            }
+            drop(fd);
+            return false;
+        }
+        server_stats::add(server_stats::BYTES_OUT, sent);
+
+        // 按发出去的字节数前进，停在一个事件中间时持有它的引用
+        seq = s.next;
+        for (int i = 0; i < n; ++i, ++seq)
+        {
+            if ((size_t)sent < iov[i].iov_len)
+            {
+                if (sent > 0)
+                {
+                    if (s.partial != evs[i])
+                    {
+                        s.partial = evs[i];
+                        ++s.partial->refs;
+                    }
+                    s.offset += sent;
+                }
+                break;
+            }
+            sent -= iov[i].iov_len;
+            if (s.partial)
+            {
+                unref(s.partial);
+                s.partial = NULL;
+                s.offset = 0;
+            }
+        }
+        s.next = seq;
+    }
+}
+
+// 关闭订阅者的连接
+void sse_hub::drop(int fd)
+{
+    subscriber& s = m_subs[fd];
+    if (s.partial)
+    {
+        unref(s.partial);
+        s.partial = NULL;
+    }
+    if (s.blocked)
+    {
+        --m_blocked;
+    }
+    // 最后一个订阅者移到空出来的位置；广播从后往前进行，移过去的订阅者已经发送过，再发一次也不会重复
+    size_t i = s.index - 1;
+    int last = m_fds.back();
+    m_fds[i] = last;
+    m_subs[last].index = i + 1;
+    m_fds.pop_back();
+    s.index = 0;
+    if (m_cursor > m_fds.size())
+    {
+        m_cursor = m_fds.size();
+    }
+    sys_io::epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    sys_io::close(fd);
+    mem_budget::release(mem_budget::CONNECTIONS, sizeof(subscriber));
+    server_stats::add(server_stats::SSE_CLOSED);
+    server_stats::add(server_stats::CLOSED);
+}
+
+void sse_hub::on_event(int fd, uint32_t events)
+{
+    if (fd == m_doorbell)
+    {
+        pull();
+        return;
+    }
+    if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+    {
+        drop(fd);
+        return;
+    }
+    if (events & EPOLLIN)
+    {
+        // 订阅者不应该再发送数据，读出来丢掉，读到 0 表示客户端关闭了连接
+        char buf[512];
+        ssize_t n;
+        while ((n = sys_io::recv(fd, buf, sizeof(buf), 0)) > 0)
+        {
+            server_stats::add(server_stats::BYTES_IN, n);
+        }
+        if (n == 0 || errno != EAGAIN)
+        {
+            drop(fd);
+            return;
+        }
+    }
+    if (events & EPOLLOUT)
+    {
+        subscriber& s = m_subs[fd];
+        if (s.blocked)
+        {
+            s.blocked = 0;
+            --m_blocked;
+        }
+        flush(fd, to_ms(server_stats::now_ns()));
+    }
+}
+
+void sse_hub::run(uint64_t now_ns)
+{
+    if (!m_subs || m_fds.empty())
+    {
+        return;
+    }
+    uint32_t now = to_ms(now_ns);
+    if ((int32_t)(now - m_last_event) >= HEARTBEAT_MS)
+    {
+        append(make_event(":", 1, "\n", 1));
+    }
+    // 有新的事件时开始一轮广播，本轮开始之后到达的事件在访问到时一起发送，没有访问到的留给下一轮
+    if (m_cursor == 0 && m_round_head < m_head)
+    {
+        m_round_head = m_head;
+        m_cursor = m_fds.size();
+    }
+    for (int n = 0; m_cursor > 0 && n < BATCH; ++n)
+    {
+        int fd = m_fds[--m_cursor];
+        if (!m_subs[fd].blocked)
+        {
+            flush(fd, now);
+        }
+    }
+    // 每秒检查一次发送缓冲一直满的订阅者
+    if (m_blocked && (int32_t)(now - m_last_sweep) >= 1000)
+    {
+        m_last_sweep = now;
+        for (size_t i = m_fds.size(); i > 0; --i)
+        {
+            int fd = m_fds[i - 1];
+            if (m_subs[fd].blocked && (int32_t)(now - m_subs[fd].blocked) >= SLOW_MS)
+            {
+                server_stats::add(server_stats::SSE_DROPPED);
+                drop(fd);
+            }
+        }
+    }
+}
+
+int sse_hub::timeout_ms(int timeout)
+{
+    if (!m_subs || m_fds.empty())
+    {
+        return timeout;
+    }
+    if (m_cursor > 0 || m_round_head < m_head)
+    {
+        return 0;
+    }
+    int32_t ms = HEARTBEAT_MS - (int32_t)(to_ms(server_stats::now_ns()) - m_last_event);
+    if (ms < 0)
+    {
+        ms = 0;
+    }
+    if (m_blocked && ms > 1000)
+    {
+        ms = 1000;
+    }
+    return timeout < 0 || ms < timeout ? ms : timeout;
+}
+
+void sse_hub::close_all()
+{
+    while (!m_fds.empty())
+    {
+        drop(m_fds.back());
+    }
+}
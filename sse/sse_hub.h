@@ -0,0 +1,114 @@
+#ifndef SSEHUB_H
+#define SSEHUB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+struct shared_ring;
+
+// Server-Sent Events 的广播（-E path），默认关闭
+// GET path 订阅：回复 text/event-stream 的响应头之后，连接从 http_conn 交给这里，http_conn 的响应体、请求内存池
+// 和内存预算中的连接对象都释放掉，每个订阅者只剩一个 32 字节的 subscriber（发送进度），连接一直注册着边沿触发的读写事件。
+// POST path 发布（只接受本机的客户端）：请求体是事件的数据，可以有多行，?event=name 指定事件类型。
+//
+// 发布的事件先写入 fork 之前创建的共享内存环（多进程模式下所有工作进程共用），再写一次门铃 eventfd。
+// 门铃以边沿触发注册在每个工作进程的 epoll 中，从来不读，每次写入都会唤醒所有进程；
+// 每个进程的主线程把新的事件从共享环取出，格式化成一个带引用计数的缓冲，所有订阅者共用，保存在本进程的事件环中。
+// 订阅者只记录下一个要发送的事件和已经发送的字节数，每轮事件循环最多给 BATCH 个订阅者发送（积压的事件合并成一次 writev），
+// 其余的留到下一轮，广播给大量订阅者时不会长时间占住事件循环。
+// 发送缓冲满的订阅者等待 EPOLLOUT，不参加广播；持续 SLOW_MS 还发不出去，或者落后超过本地事件环（LOCAL_RING 个事件）的订阅者被断开，
+// 浏览器的 EventSource 会自动重连。没有事件时每 HEARTBEAT_MS 发送一行注释，防止中间的代理断开空闲连接。
+// 升级（SIGHUP）时新旧两组工作进程的环是分开的，交替期间的事件只发给发布请求所在的那一组。
+class sse_hub
+{
+public:
+    // 共享环中的事件数
+    static const int RING = 256;
+    // 共享环中一个事件占用的字节数，事件数据（包括 event: 和 data: 前缀）不能超过 SLOT_DATA
+    static const size_t SLOT_SIZE = 4096;
+    static const size_t SLOT_DATA = SLOT_SIZE - 16;
+    // 本进程的事件环，订阅者最多落后这么多个事件
+    static const int LOCAL_RING = 1024;
+    // 每轮事件循环最多发送的订阅者数
+    static const int BATCH = 256;
+    // 没有事件时发送心跳的间隔
+    static const int HEARTBEAT_MS = 15000;
+    // 订阅者的发送缓冲持续满这么久之后断开
+    static const int SLOW_MS = 30000;
+
+public:
+    // 解析 -E 的参数，订阅和发布的路径
+    static bool parse(const char* path);
+    static bool enabled() { return m_path != NULL; }
+    static const char* path() { return m_path; }
+    // 创建共享环和门铃，在 fork 工作进程之前调用
+    static bool setup();
+    // 把门铃注册到本进程的 epoll（主线程）
+    static void attach(int epollfd);
+
+    // 发布一个事件，任何进程的任何线程都可以调用；name 为 NULL 表示默认的 message 类型。
+    // 返回事件编号，事件太大或者名字不合法时返回 0
+    static uint64_t publish(const char* name, const char* data, size_t len);
+
+    // 响应头已经发完的连接成为订阅者（主线程）
+    static void subscribe(int fd);
+    // fd 是订阅者或者门铃
+    static bool owns(int fd) { return fd == m_doorbell || (fd >= 0 && fd < MAX_FD && m_subs && m_subs[fd].index); }
+    // 订阅者或者门铃上的事件（主线程）
+    static void on_event(int fd, uint32_t events);
+    // 每轮事件循环调用一次：继续广播、发送心跳、断开慢的订阅者（主线程）
+    static void run(uint64_t now);
+    // epoll_wait 的超时：广播没有完成时为 0，有订阅者时不超过下一次心跳
+    static int timeout_ms(int timeout);
+    // 平滑退出时断开所有订阅者
+    static void close_all();
+
+private:
+    static const int MAX_FD = 65536;
+    static const int MAX_IOV = 64;
+
+    // 格式化好的事件，本进程的事件环和正在发送它的订阅者各持有一个引用（只在主线程中使用）
+    struct event
+    {
+        int refs;
+        uint32_t len;
+        char data[];
+    };
+
+    // 订阅者的发送进度：下一个要发送的事件（本地编号）和其中已经发送的字节数
+    struct subscriber
+    {
+        event* partial;     // offset > 0 时持有事件 next 的引用，事件离开本地环之后也能发完
+        uint64_t next;
+        uint32_t offset;
+        uint32_t blocked;   // 发送缓冲满的时间（毫秒），0 表示可写
+        uint32_t index;     // 在 m_fds 中的位置 + 1，0 表示不是订阅者
+        uint32_t pad;
+    };
+
+    static event* make_event(const char* head, size_t head_len, const char* body, size_t body_len);
+    static void unref(event* ev);
+    static void append(event* ev);
+    static void pull();
+    static bool flush(int fd, uint32_t now_ms);
+    static void drop(int fd);
+
+private:
+    static const char* m_path;
+    static int m_doorbell;
+    static shared_ring* m_ring;
+    static uint64_t m_next_shared;          // 下一个要从共享环取出的事件编号
+
+    static event* m_events[LOCAL_RING];
+    static uint64_t m_head;                 // 本地事件的下一个编号
+    static subscriber* m_subs;              // 按 fd 索引
+    static std::vector<int> m_fds;          // 所有订阅者
+    static size_t m_cursor;                 // 广播进行到 m_fds 的这个位置（从后往前），0 表示没有在广播
+    static uint64_t m_round_head;           // 正在进行的广播发送到这个本地编号之前的事件
+    static int m_blocked;                   // 发送缓冲满的订阅者数
+    static uint32_t m_last_event;           // 最近一次有事件（包括心跳）的时间（毫秒）
+    static uint32_t m_last_sweep;
+};
+
+#endif
@@ -0,0 +1,381 @@
+#include "stats.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "../lock/locker.h"
+#include "../memory/mem_budget.h"
+#include "../limit/rate_limiter.h"
+
+// 一个线程的全部统计数据
+struct stats_shard
+{
+    std::atomic<uint64_t> counters[server_stats::COUNTER_COUNT];
+    std::atomic<uint64_t> status[server_stats::MAX_STATUS];
+    latency_histogram histograms[server_stats::HISTOGRAM_COUNT];
+
+    stats_shard()
+    {
+        for (int i = 0; i < server_stats::COUNTER_COUNT; ++i)
+        {
+            counters[i].store(0, std::memory_order_relaxed);
+        }
+        for (int i = 0; i < server_stats::MAX_STATUS; ++i)
+        {
+            status[i].store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+// 所有线程的数据，线程都不会退出，所以只增不减
+static std::vector<stats_shard*> shards;
+static locker shards_lock;
+static thread_local stats_shard* local_shard = NULL;
+
+static const char* counter_names[server_stats::COUNTER_COUNT] = {
+    "accepted", "accept_rejected", "closed", "bytes_in", "bytes_out",
+    "enqueued", "dequeued", "requests", "proxied", "inline",
+    "spin_hits", "spin_misses", "spin_ns", "zerocopy_bytes", "zerocopy_copied",
+    "file_misses", "send_yields", "send_throttled", "mem_shed", "accept_pauses",
+    "neg_cache_hits", "neg_cache_clears", "sse_subscribed", "sse_closed", "sse_dropped", "sse_published"
+};
+// 没有启用限流时为 NULL
+static const rate_limiter* limiter = NULL;
+
+static const char* histogram_names[server_stats::HISTOGRAM_COUNT] = {
+    "queue_wait", "parse", "first_byte", "response"
+};
+
+// 只有本线程写，用 load + store 代替原子加法
+static inline void bump(std::atomic<uint64_t>& a, uint64_t n)
+{
+    a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static stats_shard* shard()
+{
+    if (!local_shard)
+    {
+        local_shard = new stats_shard();
+        shards_lock.lock();
+        shards.push_back(local_shard);
+        shards_lock.unlock();
+    }
+    return local_shard;
+}
+
+latency_histogram::latency_histogram()
+{
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        m_counts[i].store(0, std::memory_order_relaxed);
+    }
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+int latency_histogram::bucket_of(uint64_t ns)
+{
+    if (ns < (uint64_t)SUB_COUNT)
+    {
+        return (int)ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    // 2^MAX_BITS 及以上都记在最后一个桶，否则下标会超出 BUCKETS
+    if (msb >= MAX_BITS)
+    {
+        return BUCKETS - 1;
+    }
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_COUNT + (int)((ns >> shift) & (SUB_COUNT - 1));
+}
+
+uint64_t latency_histogram::bucket_max(int index)
+{
+    if (index < SUB_COUNT)
+    {
+        return index;
+    }
+    int shift = index / SUB_COUNT - 1;
+    uint64_t sub = index % SUB_COUNT;
+    return ((SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void latency_histogram::record(uint64_t ns)
+{
+    bump(m_counts[bucket_of(ns)], 1);
+    bump(m_sum, ns);
+    if (ns > m_max.load(std::memory_order_relaxed))
+    {
+        m_max.store(ns, std::memory_order_relaxed);
+    }
+}
+
+void latency_histogram::merge_into(uint64_t* counts, uint64_t& sum, uint64_t& max) const
+{
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        counts[i] += m_counts[i].load(std::memory_order_relaxed);
+    }
+    sum += m_sum.load(std::memory_order_relaxed);
+    uint64_t m = m_max.load(std::memory_order_relaxed);
+    if (m > max)
+    {
+        max = m;
+    }
+}
+
+void server_stats::add(COUNTER c, uint64_t n)
+{
+    bump(shard()->counters[c], n);
+}
+
+void server_stats::status(int code)
+{
+    if (code >= 0 && code < MAX_STATUS)
+    {
+        bump(shard()->status[code], 1);
+    }
+}
+
+void server_stats::record(HISTOGRAM h, uint64_t ns)
+{
+    shard()->histograms[h].record(ns);
+}
+
+void server_stats::set_limiter(const rate_limiter* l)
+{
+    limiter = l;
+}
+
+uint64_t server_stats::now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t server_stats::cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 合并后的数据
+struct stats_snapshot
+{
+    int threads;
+    uint64_t counters[server_stats::COUNTER_COUNT];
+    uint64_t status[server_stats::MAX_STATUS];
+    uint64_t counts[server_stats::HISTOGRAM_COUNT][latency_histogram::BUCKETS];
+    uint64_t total[server_stats::HISTOGRAM_COUNT];
+    uint64_t sum[server_stats::HISTOGRAM_COUNT];
+    uint64_t max[server_stats::HISTOGRAM_COUNT];
+};
+
+static void collect(stats_snapshot& s)
+{
+    memset(&s, 0, sizeof(s));
+    shards_lock.lock();
+    s.threads = shards.size();
+    for (size_t i = 0; i < shards.size(); ++i)
+    {
+        stats_shard* t = shards[i];
+        for (int c = 0; c < server_stats::COUNTER_COUNT; ++c)
+        {
+            s.counters[c] += t->counters[c].load(std::memory_order_relaxed);
+        }
+        for (int c = 0; c < server_stats::MAX_STATUS; ++c)
+        {
+            s.status[c] += t->status[c].load(std::memory_order_relaxed);
+        }
+        for (int h = 0; h < server_stats::HISTOGRAM_COUNT; ++h)
+        {
+            t->histograms[h].merge_into(s.counts[h], s.sum[h], s.max[h]);
+        }
+    }
+    shards_lock.unlock();
+
+    for (int h = 0; h < server_stats::HISTOGRAM_COUNT; ++h)
+    {
+        for (int i = 0; i < latency_histogram::BUCKETS; ++i)
+        {
+            s.total[h] += s.counts[h][i];
+        }
+    }
+}
+
+// 第 q 分位数所在桶的最大值，不超过记录到的最大值
+static uint64_t percentile(const stats_snapshot& s, int h, double q)
+{
+    if (s.total[h] == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * s.total[h] + 0.5);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < latency_histogram::BUCKETS; ++i)
+    {
+        seen += s.counts[h][i];
+        if (seen >= rank)
+        {
+            uint64_t v = latency_histogram::bucket_max(i);
+            return v < s.max[h] ? v : s.max[h];
+        }
+    }
+    return s.max[h];
+}
+
+static void append_format(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append_format(std::string& out, const char* format, ...)
+{
+    char buf[256];
+    va_list arg_list;
+    va_start(arg_list, format);
+    int len = vsnprintf(buf, sizeof(buf), format, arg_list);
+    va_end(arg_list);
+    if (len > 0)
+    {
+        out.append(buf, len < (int)sizeof(buf) ? len : (int)sizeof(buf) - 1);
+    }
+}
+
+void server_stats::render_json(std::string& out)
+{
+    stats_snapshot* s = new stats_snapshot;
+    collect(*s);
+    uint64_t* c = s->counters;
+
+    append_format(out, "{\"threads\":%d", s->threads);
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+    {
+        append_format(out, ",\"%s\":%llu", counter_names[i], (unsigned long long)c[i]);
+    }
+    // 两个线程各自计数，相减得到当前值
+    append_format(out, ",\"connections\":%lld,\"queue_depth\":%lld,\"sse_subscribers\":%lld",
+                  (long long)(c[ACCEPTED] - c[CLOSED]), (long long)(c[ENQUEUED] - c[DEQUEUED]),
+                  (long long)(c[SSE_SUBSCRIBED] - c[SSE_CLOSED]));
+    // 进程消耗的 CPU 时间，和 spin_ns 对照可以看出忙轮询的代价
+    append_format(out, ",\"cpu_ns\":%llu", (unsigned long long)cpu_ns());
+    // 内存预算的各项用量和限制（字节，0 表示不限制）
+    out.append(",\"memory\":{");
+    for (int i = 0; i < mem_budget::KIND_COUNT; ++i)
+    {
+        append_format(out, "\"%s\":%lld,", mem_budget::name((mem_budget::KIND)i), (long long)mem_budget::used((mem_budget::KIND)i));
+    }
+    append_format(out, "\"total\":%lld,\"soft_limit\":%lld,\"hard_limit\":%lld}",
+                  (long long)mem_budget::total(), (long long)mem_budget::soft_limit(), (long long)mem_budget::hard_limit());
+    if (limiter)
+    {
+        rate_limiter::stats r;
+        limiter->get_stats(r);
+        append_format(out, ",\"rate_limiter\":{\"allowed\":%llu,\"rejected_ip\":%llu,\"rejected_prefix\":%llu,"
+                      "\"rejected_accept\":%llu,\"evictions\":%llu}",
+                      (unsigned long long)r.allowed, (unsigned long long)r.rejected_ip, (unsigned long long)r.rejected_prefix,
+                      (unsigned long long)r.rejected_accept, (unsigned long long)r.evictions);
+    }
+
+    out.append(",\"status\":{");
+    bool first = true;
+    for (int i = 0; i < MAX_STATUS; ++i)
+    {
+        if (s->status[i])
+        {
+            append_format(out, "%s\"%d\":%llu", first ? "" : ",", i, (unsigned long long)s->status[i]);
+            first = false;
+        }
+    }
+    out.append("},\"latency_ns\":{");
+    for (int h = 0; h < HISTOGRAM_COUNT; ++h)
+    {
+        append_format(out, "%s\"%s\":{\"count\":%llu,\"sum\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+                      h ? "," : "", histogram_names[h],
+                      (unsigned long long)s->total[h], (unsigned long long)s->sum[h],
+                      (unsigned long long)percentile(*s, h, 0.5), (unsigned long long)percentile(*s, h, 0.9),
+                      (unsigned long long)percentile(*s, h, 0.99), (unsigned long long)percentile(*s, h, 0.999),
+                      (unsigned long long)s->max[h]);
+    }
+    out.append("}}\n");
+    delete s;
+}
+
+void server_stats::render_prometheus(std::string& out)
+{
+    stats_snapshot* s = new stats_snapshot;
+    collect(*s);
+    uint64_t* c = s->counters;
+
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+    {
+        append_format(out, "# TYPE webserver_%s_total counter\nwebserver_%s_total %llu\n",
+                      counter_names[i], counter_names[i], (unsigned long long)c[i]);
+    }
+    append_format(out, "# TYPE webserver_connections gauge\nwebserver_connections %lld\n",
+                  (long long)(c[ACCEPTED] - c[CLOSED]));
+    append_format(out, "# TYPE webserver_queue_depth gauge\nwebserver_queue_depth %lld\n",
+                  (long long)(c[ENQUEUED] - c[DEQUEUED]));
+    append_format(out, "# TYPE webserver_sse_subscribers gauge\nwebserver_sse_subscribers %lld\n",
+                  (long long)(c[SSE_SUBSCRIBED] - c[SSE_CLOSED]));
+    append_format(out, "# TYPE webserver_cpu_seconds_total counter\nwebserver_cpu_seconds_total %.6f\n",
+                  cpu_ns() / 1e9);
+    out.append("# TYPE webserver_memory_bytes gauge\n");
+    for (int i = 0; i < mem_budget::KIND_COUNT; ++i)
+    {
+        append_format(out, "webserver_memory_bytes{kind=\"%s\"} %lld\n",
+                      mem_budget::name((mem_budget::KIND)i), (long long)mem_budget::used((mem_budget::KIND)i));
+    }
+    append_format(out, "# TYPE webserver_memory_limit_bytes gauge\nwebserver_memory_limit_bytes{limit=\"soft\"} %lld\n"
+                  "webserver_memory_limit_bytes{limit=\"hard\"} %lld\n",
+                  (long long)mem_budget::soft_limit(), (long long)mem_budget::hard_limit());
+    if (limiter)
+    {
+        rate_limiter::stats r;
+        limiter->get_stats(r);
+        append_format(out, "# TYPE webserver_rate_limit_requests_total counter\n"
+                      "webserver_rate_limit_requests_total{result=\"allowed\"} %llu\n"
+                      "webserver_rate_limit_requests_total{result=\"rejected_ip\"} %llu\n"
+                      "webserver_rate_limit_requests_total{result=\"rejected_prefix\"} %llu\n",
+                      (unsigned long long)r.allowed, (unsigned long long)r.rejected_ip, (unsigned long long)r.rejected_prefix);
+        append_format(out, "# TYPE webserver_rate_limit_accept_rejected_total counter\nwebserver_rate_limit_accept_rejected_total %llu\n"
+                      "# TYPE webserver_rate_limit_evictions_total counter\nwebserver_rate_limit_evictions_total %llu\n",
+                      (unsigned long long)r.rejected_accept, (unsigned long long)r.evictions);
+    }
+
+    out.append("# TYPE webserver_responses_total counter\n");
+    for (int i = 0; i < MAX_STATUS; ++i)
+    {
+        if (s->status[i])
+        {
+            append_format(out, "webserver_responses_total{code=\"%d\"} %llu\n", i, (unsigned long long)s->status[i]);
+        }
+    }
+
+    // 直方图的桶边界在 2 的幂上，和细分的桶边界对齐，按 1us 到 16s 输出
+    for (int h = 0; h < HISTOGRAM_COUNT; ++h)
+    {
+        const char* name = histogram_names[h];
+        append_format(out, "# TYPE webserver_%s_seconds histogram\n", name);
+        uint64_t cumulative = 0;
+        int i = 0;
+        for (int bits = 10; bits <= 34; ++bits)
+        {
+            for (; i < latency_histogram::BUCKETS && latency_histogram::bucket_max(i) < (1ULL << bits); ++i)
+            {
+                cumulative += s->counts[h][i];
+            }
+            append_format(out, "webserver_%s_seconds_bucket{le=\"%g\"} %llu\n",
+                          name, (double)(1ULL << bits) / 1e9, (unsigned long long)cumulative);
+        }
+        append_format(out, "webserver_%s_seconds_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)s->total[h]);
+        append_format(out, "webserver_%s_seconds_sum %.9f\n", name, (double)s->sum[h] / 1e9);
+        append_format(out, "webserver_%s_seconds_count %llu\n", name, (unsigned long long)s->total[h]);
+    }
+    delete s;
+}
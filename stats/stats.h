@@ -0,0 +1,107 @@
+#ifndef SERVERSTATS_H
+#define SERVERSTATS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+class rate_limiter;
+
+// HDR 风格的延迟直方图（纳秒）
+// 每个 2 的幂区间再线性分成 16 个桶，相对误差不超过 1/16，覆盖 0 到 2^40 纳秒（约 18 分钟），超出的记在最后一个桶。
+// 只允许一个线程写，读的线程直接读取各个桶，读到的是近似一致的快照。
+class latency_histogram
+{
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_BITS = 40;
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+public:
+    latency_histogram();
+
+    void record(uint64_t ns);
+    // 累加到 counts（BUCKETS 个元素）中，用于合并多个线程的直方图
+    void merge_into(uint64_t* counts, uint64_t& sum, uint64_t& max) const;
+
+    static int bucket_of(uint64_t ns);
+    // 桶内的最大值
+    static uint64_t bucket_max(int index);
+
+private:
+    std::atomic<uint64_t> m_counts[BUCKETS];
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+};
+
+// 服务器的统计信息
+// 每个线程第一次记录时分配自己的一份计数器和直方图，之后只有它自己写，不需要加锁也没有缓存行争用；
+// 读取 /stats 时把所有线程的数据合并起来。
+class server_stats
+{
+public:
+    // 计数器
+    enum COUNTER
+    {
+        ACCEPTED = 0,       // 接受的连接
+        ACCEPT_REJECTED,    // accept 之后因为连接数满或者限流直接关闭的连接
+        CLOSED,             // 关闭的连接
+        BYTES_IN,           // 从客户端读到的字节数
+        BYTES_OUT,          // 发给客户端的字节数
+        ENQUEUED,           // 放入请求队列的次数
+        DEQUEUED,           // 工作线程从请求队列取出的次数
+        REQUESTS,           // 解析完成的 HTTP/1.1 请求
+        PROXIED,            // 转发给上游的请求
+        INLINE,             // 运行到完成模式下由主线程直接处理完的请求
+        SPIN_HITS,          // 忙轮询模式下自旋期间等到了事件或任务
+        SPIN_MISSES,        // 自旋超时后阻塞
+        SPIN_NS,            // 自旋的时间（纳秒）
+        ZEROCOPY_BYTES,     // 用 MSG_ZEROCOPY 发送的字节数
+        ZEROCOPY_COPIED,    // 内核报告零拷贝退化成拷贝、连接改回 writev 的次数
+        FILE_MISSES,        // 发送文件时下一个窗口不在页缓存中、交给 I/O 线程读入的次数
+        SEND_YIELDS,        // 大响应用完一个发送时间片、让出主线程的次数
+        SEND_THROTTLED,     // 连接的发送令牌不够、延迟发送的次数
+        MEM_SHED,           // 超过内存硬限制、回复 503 的请求
+        ACCEPT_PAUSES,      // 超过内存软限制、暂停 accept 的次数
+        NEG_CACHE_HITS,     // 请求的路径在不存在路径的缓存中、没有访问文件系统的次数
+        NEG_CACHE_CLEARS,   // 网站目录有变化（或内存紧张）、清空不存在路径的缓存的次数
+        SSE_SUBSCRIBED,     // 成为 SSE 订阅者的连接
+        SSE_CLOSED,         // 关闭的 SSE 订阅者（包括被断开的）
+        SSE_DROPPED,        // 发送太慢被断开的 SSE 订阅者
+        SSE_PUBLISHED,      // 从这个进程发布的 SSE 事件
+        COUNTER_COUNT
+    };
+
+    // 延迟直方图
+    enum HISTOGRAM
+    {
+        QUEUE_WAIT = 0,     // 读完数据到工作线程开始处理
+        PARSE,              // 解析请求
+        FIRST_BYTE,         // 收到请求的第一个字节到发出响应的第一个字节
+        RESPONSE,           // 收到请求的第一个字节到响应全部写完
+        HISTOGRAM_COUNT
+    };
+
+    // 记录的状态码范围
+    static const int MAX_STATUS = 600;
+
+public:
+    static void add(COUNTER c, uint64_t n = 1);
+    static void status(int code);
+    static void record(HISTOGRAM h, uint64_t ns);
+
+    // CLOCK_MONOTONIC 纳秒时间
+    static uint64_t now_ns();
+    // 进程所有线程消耗的 CPU 时间（纳秒）
+    static uint64_t cpu_ns();
+
+    // 启用限流时设置，/stats 同时输出限流器的计数器
+    static void set_limiter(const rate_limiter* limiter);
+
+    // 合并所有线程的数据后输出，JSON 或者 Prometheus 文本格式
+    static void render_json(std::string& out);
+    static void render_prometheus(std::string& out);
+};
+
+#endif
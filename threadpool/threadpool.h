@@ -7,13 +7,15 @@
 #include <cstdio>
 
 #include "../lock/locker.h"
+#include "../poll/busy_poll.h"
+#include "../memory/mem_budget.h"
 
 // 线程池类，定义成模板类是为了代码复用
 template<typename T>
 class threadpool 
 {
 public:
-    // thread_number是线程池中的线程数量
+    // thread_number是线程池中的线程数量，为 0 时不创建线程，由调用者用 run_pending 执行任务
     // max_requests是请求队列中最多允许的、等待处理的请求的数量
     threadpool(int thread_number = 8, int max_requests = 10000);
     ~threadpool();
@@ -21,6 +23,9 @@ public:
     // 往请求队列添加任务
     bool append(T* request);
 
+    // 没有工作线程时在调用线程中按顺序执行队列中的所有任务（包括执行期间加入的），返回执行的任务数
+    int run_pending();
+
 private:
     // 工作线程运行的函数，它不断从工作队列中取出任务并执行
     static void* worker(void* arg);
@@ -39,11 +44,14 @@ private:
     // 请求队列
     std::list<T*> m_workqueue;
 
-    // 保护请求队列的互斥锁
-    locker m_queuelocker;
+    // 队列中一个任务占用的内存（链表节点）记在内存预算中，请求本身在连接对象里，已经算在连接中
+    static const size_t QUEUE_NODE_SIZE = sizeof(T*) + 2 * sizeof(void*);
+
+    // 保护请求队列的互斥锁，临界区很短，自适应锁通常自旋就能拿到
+    futex_mutex m_queuelocker;
 
-    // 信号量用来判断是否有任务要处理
-    sem m_queuestat;
+    // 信号量用来判断是否有任务要处理，没有线程睡眠时投递任务不进入内核
+    futex_sem m_queuestat;
 
     // 是否结束线程
     bool m_stop;
@@ -54,7 +62,7 @@ threadpool<T>::threadpool(int thread_number, int max_requests) :
             m_thread_number(thread_number), m_max_requests(max_requests),
             m_stop(false), m_threads(NULL) 
     {
-        if ((thread_number <= 0) || (max_requests <= 0)) 
+        if ((thread_number < 0) || (max_requests <= 0)) 
         {
             throw std::exception();
         }
@@ -104,11 +112,32 @@ bool threadpool<T>::append(T* request)
     }
 
     m_workqueue.push_back(request); // 把任务入队
+    mem_budget::charge(mem_budget::QUEUED, QUEUE_NODE_SIZE);
     m_queuelocker.unlock(); // 操作完工作队列后解锁
     m_queuestat.post(); 
     return true;
 }
 
+template<typename T>
+int threadpool<T>::run_pending() 
+{
+    int n = 0;
+    while (m_queuestat.trywait()) 
+    {
+        m_queuelocker.lock();
+        T* request = m_workqueue.front();
+        m_workqueue.pop_front();
+        m_queuelocker.unlock();
+        mem_budget::release(mem_budget::QUEUED, QUEUE_NODE_SIZE);
+        if (request) 
+        {
+            request -> process();
+            ++n;
+        }
+    }
+    return n;
+}
+
 template<typename T>
 void* threadpool<T>::worker(void* arg) // 接受一个 void 指针类型的参数 arg，这个参数实际上是一个指向 threadpool 类的指针
 {
@@ -120,9 +149,13 @@ void* threadpool<T>::worker(void* arg) // 接受一个 void 指针类型的参
 template<typename T>
 void threadpool<T>::run() // run 函数是在 worker 函数内被调用的，它是线程池的核心函数，负责从请求队列中取出任务并执行
 {
+    busy_poll::spinner spinner(true); // 忙轮询模式下先自旋等待任务，超时再阻塞
     while (!m_stop) 
     {
-        m_queuestat.wait(); // 通过信号量 m_queuestat 等待任务的到来
+        if (!spinner.spin([this] { return m_queuestat.trywait(); })) 
+        {
+            m_queuestat.wait(); // 通过信号量 m_queuestat 等待任务的到来
+        }
         m_queuelocker.lock(); // 操作队列要加锁
         if (m_workqueue.empty()) 
         {
@@ -133,6 +166,7 @@ void threadpool<T>::run() // run 函数是在 worker 函数内被调用的，它
         T* request = m_workqueue.front(); // 取出队头元素
         m_workqueue.pop_front();
         m_queuelocker.unlock(); // 解锁
+        mem_budget::release(mem_budget::QUEUED, QUEUE_NODE_SIZE);
 
         if (!request) 
         {
@@ -0,0 +1,163 @@
+#include "request_trace.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <vector>
+#include <algorithm>
+#include "../lock/locker.h"
+
+std::atomic<uint32_t> request_trace::m_sample(0);
+
+// 一个事件占两个 64 位字：时间戳，以及 请求编号 << 32 | 阶段 << 16
+// 都是原子变量，导出线程读的时候写线程可能正在覆盖，读完后根据写指针丢弃可能被覆盖的部分
+struct trace_ring
+{
+    std::atomic<uint64_t> ts[request_trace::RING_SIZE];
+    std::atomic<uint64_t> info[request_trace::RING_SIZE];
+    std::atomic<uint64_t> head;     // 已经写入的事件总数
+    int tid;                        // 内核线程号
+};
+
+// 线程不会退出，缓冲只增不减
+static std::vector<trace_ring*> rings;
+static locker rings_lock;
+static thread_local trace_ring* local_ring = NULL;
+
+static std::atomic<uint32_t> request_count(0);
+static std::atomic<uint32_t> next_id(0);
+
+static const char* stage_names[request_trace::STAGE_COUNT] = {
+    "accept", "first_byte", "enqueue", "dequeue", "parse_done", "first_write", "write_again", "last_write"
+};
+
+// 从某个阶段开始到下一个阶段之间的时间段的名字
+static const char* span_names[request_trace::STAGE_COUNT] = {
+    "idle", "read", "queue", "parse", "handle", "write", "write", ""
+};
+
+uint32_t request_trace::begin()
+{
+    uint32_t n = m_sample.load(std::memory_order_relaxed);
+    if (n == 0 || request_count.fetch_add(1, std::memory_order_relaxed) % n != 0)
+    {
+        return 0;
+    }
+    uint32_t id = next_id.fetch_add(1, std::memory_order_relaxed) + 1;
+    return id ? id : next_id.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void request_trace::record(uint32_t id, STAGE stage, uint64_t ns)
+{
+    trace_ring* r = local_ring;
+    if (!r)
+    {
+        r = new trace_ring();
+        r->head.store(0, std::memory_order_relaxed);
+        r->tid = syscall(SYS_gettid);
+        rings_lock.lock();
+        rings.push_back(r);
+        rings_lock.unlock();
+        local_ring = r;
+    }
+    uint64_t h = r->head.load(std::memory_order_relaxed);
+    uint32_t slot = h & (RING_SIZE - 1);
+    r->ts[slot].store(ns, std::memory_order_relaxed);
+    r->info[slot].store(((uint64_t)id << 32) | ((uint64_t)stage << 16), std::memory_order_relaxed);
+    r->head.store(h + 1, std::memory_order_release);
+}
+
+struct trace_event
+{
+    uint32_t id;
+    uint16_t stage;
+    int tid;
+    uint64_t ts;
+
+    bool operator<(const trace_event& o) const
+    {
+        return id != o.id ? id < o.id : ts < o.ts;
+    }
+};
+
+// 复制一个线程的缓冲
+static void copy_ring(trace_ring* r, std::vector<trace_event>& events)
+{
+    uint64_t head = r->head.load(std::memory_order_acquire);
+    uint64_t begin = head > request_trace::RING_SIZE ? head - request_trace::RING_SIZE : 0;
+    size_t first = events.size();
+    for (uint64_t i = begin; i < head; ++i)
+    {
+        uint32_t slot = i & (request_trace::RING_SIZE - 1);
+        trace_event e;
+        e.ts = r->ts[slot].load(std::memory_order_relaxed);
+        uint64_t info = r->info[slot].load(std::memory_order_relaxed);
+        e.id = info >> 32;
+        e.stage = (info >> 16) & 0xffff;
+        e.tid = r->tid;
+        events.push_back(e);
+    }
+
+    // 复制期间被覆盖的事件丢掉
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t now = r->head.load(std::memory_order_relaxed);
+    if (now > begin + request_trace::RING_SIZE)
+    {
+        size_t lost = now - (begin + request_trace::RING_SIZE);
+        lost = std::min(lost, events.size() - first);
+        events.erase(events.begin() + first, events.begin() + first + lost);
+    }
+}
+
+void request_trace::dump(std::string& out)
+{
+    std::vector<trace_event> events;
+    rings_lock.lock();
+    for (size_t i = 0; i < rings.size(); ++i)
+    {
+        copy_ring(rings[i], events);
+    }
+    rings_lock.unlock();
+    std::sort(events.begin(), events.end());
+
+    uint64_t base = UINT64_MAX;
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        base = std::min(base, events[i].ts);
+    }
+
+    // 每个请求一行（tid 为请求编号），相邻阶段之间画一段 "X" 事件，EAGAIN 画成瞬时事件
+    char buf[256];
+    out.append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    bool first = true;
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        const trace_event& e = events[i];
+        int len;
+        if (i == 0 || events[i - 1].id != e.id)
+        {
+            len = snprintf(buf, sizeof(buf),
+                           "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"request %u\"}}",
+                           first ? "" : ",", e.id, e.id);
+            out.append(buf, len);
+            first = false;
+        }
+        if (e.stage == WRITE_AGAIN)
+        {
+            len = snprintf(buf, sizeof(buf),
+                           ",{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"thread\":%d}}",
+                           stage_names[e.stage], e.id, (e.ts - base) / 1e3, e.tid);
+            out.append(buf, len);
+        }
+        if (i + 1 < events.size() && events[i + 1].id == e.id && e.stage < STAGE_COUNT && e.stage != LAST_WRITE)
+        {
+            const trace_event& next = events[i + 1];
+            len = snprintf(buf, sizeof(buf),
+                           ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                           "\"args\":{\"from\":\"%s\",\"to\":\"%s\",\"thread\":%d}}",
+                           span_names[e.stage], e.id, (e.ts - base) / 1e3, (next.ts - e.ts) / 1e3,
+                           stage_names[e.stage], next.stage < STAGE_COUNT ? stage_names[next.stage] : "?", e.tid);
+            out.append(buf, len);
+        }
+    }
+    out.append("]}\n");
+}
@@ -0,0 +1,49 @@
+#ifndef REQUESTTRACE_H
+#define REQUESTTRACE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+// 按请求记录生命周期各阶段的时间戳，导出为 Chrome trace JSON（chrome://tracing、Perfetto 都能打开）
+// 每个线程写自己的环形缓冲，满了覆盖最旧的事件；导出时合并所有线程的缓冲，
+// 按请求分组，每个请求一行，相邻两个阶段之间画成一段。
+// 采样率为 0 时不记录，每个阶段只多一次判断。
+class request_trace
+{
+public:
+    // 每个线程的环形缓冲能放的事件数
+    static const uint32_t RING_SIZE = 1 << 16;
+
+    // 请求的阶段
+    enum STAGE
+    {
+        ACCEPT = 0,     // 连接建立（只有连接上的第一个请求有）
+        FIRST_BYTE,     // 读到请求的第一个字节
+        ENQUEUE,        // 读完一批数据，放入请求队列
+        DEQUEUE,        // 工作线程取出
+        PARSE_DONE,     // 请求解析完成
+        FIRST_WRITE,    // 响应的第一次写成功
+        WRITE_AGAIN,    // 写的时候遇到 EAGAIN，等待下一次 EPOLLOUT
+        LAST_WRITE,     // 响应写完（代理请求为转发结束）
+        STAGE_COUNT
+    };
+
+public:
+    // 设置采样率：每 n 个请求记录一个，0 表示关闭
+    static void set_sample(uint32_t n) { m_sample.store(n, std::memory_order_relaxed); }
+    static uint32_t sample() { return m_sample.load(std::memory_order_relaxed); }
+
+    // 新请求开始时调用，返回请求的跟踪编号，0 表示这个请求不记录
+    static uint32_t begin();
+    // 记录一个阶段，ns 为 CLOCK_MONOTONIC 纳秒时间
+    static void record(uint32_t id, STAGE stage, uint64_t ns);
+
+    // 导出所有线程缓冲中的事件
+    static void dump(std::string& out);
+
+private:
+    static std::atomic<uint32_t> m_sample;
+};
+
+#endif
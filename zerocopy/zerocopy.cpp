@@ -0,0 +1,167 @@
+#include "zerocopy.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include "../lock/locker.h"
+#include "../stats/stats.h"
+#include "../memory/mem_budget.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+size_t zerocopy::m_threshold = 0;
+
+// 连接关闭时还没有发完的响应体，过了 RETIRE_NS 之后释放
+struct retired_body
+{
+    uint64_t expire;
+    std::string body;
+};
+static std::list<retired_body> retired;
+static locker retired_lock;
+
+bool zerocopy::parse(const char* arg)
+{
+    char* end;
+    unsigned long n = strtoul(arg, &end, 10);
+    if (*end != '\0' || n == 0)
+    {
+        return false;
+    }
+    m_threshold = n;
+    return true;
+}
+
+void zerocopy::open(int fd)
+{
+    int one = 1;
+    m_active = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+    m_next = 0;
+    m_done = 0;
+}
+
+void zerocopy::close()
+{
+    uint64_t now = server_stats::now_ns();
+    retired_lock.lock();
+    while (!retired.empty() && retired.front().expire <= now)
+    {
+        retired.pop_front();
+    }
+    for (std::list<held_buffer>::iterator it = m_held.begin(); it != m_held.end(); ++it)
+    {
+        // 文件映射的页在页缓存里，解除映射不会改变内容，可以立即释放；内存中的响应体可能被重新分配后改写
+        if (it->map)
+        {
+            munmap(it->map, it->map_len);
+            mem_budget::release(mem_budget::FILES, it->map_len);
+        }
+        if (!it->body.empty())
+        {
+            retired.push_back(retired_body());
+            retired.back().expire = now + RETIRE_NS;
+            retired.back().body.swap(it->body);
+        }
+    }
+    retired_lock.unlock();
+    m_held.clear();
+    m_active = false;
+}
+
+ssize_t zerocopy::send(int fd, const struct iovec* iov, int count)
+{
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*)iov;
+    msg.msg_iovlen = count;
+    ssize_t n = sendmsg(fd, &msg, MSG_ZEROCOPY);
+    if (n < 0 && errno == ENOBUFS)
+    {
+        return writev(fd, iov, count); // 锁定的页超过了 optmem 限制，这一次拷贝
+    }
+    if (n > 0)
+    {
+        m_next++;
+        server_stats::add(server_stats::ZEROCOPY_BYTES, n);
+    }
+    return n;
+}
+
+void zerocopy::hold(std::string& body, char* map, size_t map_len)
+{
+    m_held.push_back(held_buffer());
+    held_buffer& h = m_held.back();
+    h.last = m_next - 1;
+    h.body.swap(body);
+    h.map = map;
+    h.map_len = map_len;
+    release();
+}
+
+// 释放最后一次发送已经完成的缓冲
+void zerocopy::release()
+{
+    while (!m_held.empty() && (int32_t)(m_held.front().last - m_done) < 0)
+    {
+        if (m_held.front().map)
+        {
+            munmap(m_held.front().map, m_held.front().map_len);
+            mem_budget::release(mem_budget::FILES, m_held.front().map_len);
+        }
+        m_held.pop_front();
+    }
+}
+
+bool zerocopy::reap(int fd)
+{
+    while (true)
+    {
+        char control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return false;
+            }
+            break;
+        }
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                  || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+            sock_extended_err* err = (sock_extended_err*)CMSG_DATA(cm);
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                return false; // 不是完成通知，真正的错误
+            }
+            // [ee_info, ee_data] 范围内的发送已经完成，TCP 的通知按顺序到达
+            m_done = err->ee_data + 1;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                // 内核还是拷贝了数据，零拷贝只剩下额外的通知开销
+                m_active = false;
+                server_stats::add(server_stats::ZEROCOPY_COPIED);
+            }
+        }
+    }
+    release();
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    return getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0;
+}
@@ -0,0 +1,64 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <sys/types.h>
+#include <list>
+#include <string>
+
+// MSG_ZEROCOPY 发送（-z min_bytes），默认关闭
+// 剩余响应体不小于 min_bytes 时用 sendmsg(MSG_ZEROCOPY) 代替 writev，内核直接引用用户态的页，不再拷贝到套接字缓冲。
+// 内核发完（收到 ACK）之前这些页不能被修改，所以响应写完后响应体（m_body 或文件映射）交给这里保管，
+// 直到错误队列里的完成通知覆盖了这个响应的最后一次发送才释放。
+// 完成通知以 EPOLLERR 的形式报告，由主线程调用 reap 取出。
+// 内核报告数据实际上还是被拷贝了（比如回环接口），这个连接之后改回普通的 writev。
+class zerocopy
+{
+public:
+    // 连接关闭时还没有完成的 m_body 保留的时间
+    static const uint64_t RETIRE_NS = 30000000000ULL;
+
+public:
+    zerocopy() : m_active(false), m_next(0), m_done(0) {}
+
+    // 解析 -z 的参数
+    static bool parse(const char* arg);
+    static bool enabled() { return m_threshold != 0; }
+
+    // 新连接开启 SO_ZEROCOPY
+    void open(int fd);
+    // 连接关闭：释放已经完成的缓冲，没有完成的 m_body 延迟释放
+    void close();
+    // 剩余 len 字节是否值得零拷贝发送
+    bool worth(size_t len) const { return m_active && len >= m_threshold; }
+    // 和 writev 相同的语义；optmem 不够（ENOBUFS）时退回 writev
+    ssize_t send(int fd, const struct iovec* iov, int count);
+    // 一个用过零拷贝发送的响应写完了，接管它的响应体，body 被清空，map 由这里 munmap
+    void hold(std::string& body, char* map, size_t map_len);
+    // 取出错误队列中的完成通知并释放完成的缓冲；返回 false 表示套接字真的出错了
+    bool reap(int fd);
+    bool active() const { return m_active; }
+    bool pending() const { return !m_held.empty(); }
+
+private:
+    struct held_buffer
+    {
+        uint32_t last;      // 最后一次零拷贝发送的编号
+        std::string body;
+        char* map;
+        size_t map_len;
+    };
+    void release();
+
+private:
+    bool m_active;          // 套接字开启了 SO_ZEROCOPY，并且还没有退回拷贝
+    uint32_t m_next;        // 下一次零拷贝发送的编号，内核从 0 开始按调用次数编号
+    uint32_t m_done;        // 编号小于它的发送都已经完成
+    std::list<held_buffer> m_held;
+
+    static size_t m_threshold;
+};
+
+#endif